@@ -0,0 +1,459 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Microbenchmark of the minimal solvers
+ *
+ * usage: mfg-bench [num of samples]
+ *
+ * Times the fixed-size 5-point solver, its cv::Mat interface and the former
+ * cv::Mat/single precision solver on random minimal samples of synthetic
+ * two-view scenes, and checks that the true essential matrix is among the
+ * solutions. Then times point to line distances
+ * of random image lines through the cv::Mat and the fixed-size line equations.
+ * Then times the F-guided line matching of a synthetic image pair describing
+ * every line, as before, and only the lines the cheap checks keep. Last, runs
+ * the bundle adjustment of a synthetic sequence with each linear solver of the
+ * reduced system.
+ ********************************************************************************/
+
+// Standard library
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// g2o
+#include "g2o/core/optimization_algorithm_levenberg.h"
+#include "g2o/core/sparse_optimizer.h"
+#include "g2o/types/sba/types_sba.h"
+
+// MFG
+#include "edge_vnpt_cam.h"
+#include "mfg.h"
+#include "mfgutils.h"
+#include "settings.h"
+#include "utils.h"
+#include "vertex_vnpt.h"
+
+using namespace std;
+
+// globals of the MFG libraries
+int IDEAL_IMAGE_WIDTH = 640;
+double THRESH_POINT_MATCH_RATIO = 0.50;
+double SIFT_THRESH_HIGH = 0.05;
+double SIFT_THRESH_LOW  = 0.03;
+double SIFT_THRESH = SIFT_THRESH_HIGH;
+bool mfg_writing = false;
+MfgSettings *mfgSettings;
+
+struct Sample
+{
+    Eigen::Matrix<double, 3, 5> P1, P2;  // normalized points
+    Eigen::Matrix3d E;                   // ground truth, unit norm
+};
+
+static Sample randomSample(xrand_state *rng)
+{
+    Sample s;
+    Eigen::Vector3d axis = Eigen::Vector3d::Random().normalized();
+    double angle = 0.3 * (xrand_r(rng) % 1000) / 1000.0;
+    Eigen::Matrix3d R = Eigen::AngleAxisd(angle, axis).toRotationMatrix();
+    Eigen::Vector3d t = Eigen::Vector3d::Random().normalized();
+
+    for (int i = 0; i < 5; ++i)
+    {
+        Eigen::Vector3d X = 2 * Eigen::Vector3d::Random() + Eigen::Vector3d(0, 0, 6);
+        Eigen::Vector3d Y = R * X + t;
+        s.P1.col(i) = X / X(2);
+        s.P2.col(i) = Y / Y(2);
+    }
+
+    Eigen::Matrix3d tx;
+    tx << 0, -t(2), t(1),
+          t(2), 0, -t(0),
+          -t(1), t(0), 0;
+    s.E = tx * R;
+    s.E /= s.E.norm();
+    return s;
+}
+
+static bool hasTrueE(const Sample &s, const Eigen::Matrix3d *Es, int numSols, double tol = 1e-6)
+{
+    for (int k = 0; k < numSols; ++k)
+    {
+        Eigen::Matrix3d E = Es[k] / Es[k].norm();
+
+        if ((E - s.E).norm() < tol || (E + s.E).norm() < tol)
+            return true;
+    }
+
+    return false;
+}
+
+// synthetic sequence: a camera moving sideways along a wall of points, with
+// three vanishing directions seen from every camera
+struct BaScene
+{
+    vector<g2o::SBACam> cams, camsInit;
+    vector<Eigen::Vector3d> pts, ptsInit, vps;
+    vector<int> obsCam, obsPt;
+    vector<Eigen::Vector2d> obs;
+};
+
+static double urand(xrand_state *rng, double a, double b)
+{
+    return a + (b - a) * (xrand_r(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static BaScene baScene(xrand_state *rng, int numCams, int numPts)
+{
+    BaScene sc;
+
+    for (int i = 0; i < numCams; ++i)
+    {
+        Eigen::Vector3d axis(urand(rng, -1, 1), urand(rng, -1, 1), urand(rng, -1, 1));
+        Eigen::Quaterniond q(Eigen::AngleAxisd(urand(rng, 0, 0.05), axis.normalized()));
+        Eigen::Vector3d c(0.2 * i, urand(rng, -0.05, 0.05), urand(rng, -0.05, 0.05));
+        g2o::SBACam cam(q, c), init(q, c + Eigen::Vector3d(urand(rng, -0.05, 0.05),
+                                    urand(rng, -0.05, 0.05), urand(rng, -0.05, 0.05)));
+        cam.setKcam(500, 500, 320, 240, 0);
+        init.setKcam(500, 500, 320, 240, 0);
+        sc.cams.push_back(cam);
+        sc.camsInit.push_back(i < 2 ? cam : init);
+    }
+
+    for (int j = 0; j < numPts; ++j)
+    {
+        Eigen::Vector3d X(urand(rng, -1, 0.2 * numCams + 1), urand(rng, -2, 2), urand(rng, 4, 10));
+        sc.pts.push_back(X);
+        sc.ptsInit.push_back(X + Eigen::Vector3d(urand(rng, -0.1, 0.1), urand(rng, -0.1, 0.1),
+                             urand(rng, -0.1, 0.1)));
+
+        for (int i = 0; i < numCams; ++i)
+        {
+            Eigen::Vector3d x = sc.cams[i].w2i * Eigen::Vector4d(X(0), X(1), X(2), 1);
+            Eigen::Vector2d u(x(0) / x(2) + urand(rng, -0.5, 0.5), x(1) / x(2) + urand(rng, -0.5, 0.5));
+
+            if (x(2) > 0 && u(0) >= 0 && u(0) < 640 && u(1) >= 0 && u(1) < 480)
+            {
+                sc.obsCam.push_back(i);
+                sc.obsPt.push_back(j);
+                sc.obs.push_back(u);
+            }
+        }
+    }
+
+    sc.vps.push_back(Eigen::Vector3d(1, 0, 0));
+    sc.vps.push_back(Eigen::Vector3d(0, 1, 0));
+    sc.vps.push_back(Eigen::Vector3d(0, 0, 1));
+    return sc;
+}
+
+static void benchBaSolver(const BaScene &sc, BaLinearSolver solver, const char *name)
+{
+    g2o::SparseOptimizer optimizer;
+    optimizer.setVerbose(false);
+    optimizer.setAlgorithm(newBaAlgorithm(solver));
+    int id = 0;
+    vector<g2o::VertexCam *> vcams;
+    vector<g2o::VertexVanishPoint *> vvps;
+
+    for (int i = 0; i < sc.camsInit.size(); ++i)
+    {
+        g2o::VertexCam *v = new g2o::VertexCam();
+        v->setId(id++);
+        v->setEstimate(sc.camsInit[i]);
+        v->setFixed(i < 2);
+        optimizer.addVertex(v);
+        vcams.push_back(v);
+    }
+
+    for (int k = 0; k < sc.vps.size(); ++k)
+    {
+        g2o::VertexVanishPoint *v = new g2o::VertexVanishPoint();
+        v->setId(id++);
+        v->setEstimate(sc.vps[k] + Eigen::Vector3d(0.02, -0.02, 0.02));
+        optimizer.addVertex(v);
+        vvps.push_back(v);
+
+        for (int i = 0; i < sc.cams.size(); ++i)
+        {
+            Eigen::Vector3d w = sc.cams[i].w2n.block<3, 3>(0, 0) * sc.vps[k];
+            double a, b;
+            unitVec2angle((cv::Mat_<double>(3, 1) << w(0), w(1), w(2)), &a, &b);
+            g2o::EdgeVnptCam *e = new g2o::EdgeVnptCam();
+            e->setVertex(0, v);
+            e->setVertex(1, vcams[i]);
+            e->setMeasurement(Eigen::Vector2d(a, b));
+            e->information() = Eigen::Matrix2d::Identity() * 1e4;
+            optimizer.addEdge(e);
+        }
+    }
+
+    vector<g2o::VertexSBAPointXYZ *> vpts;
+
+    for (int j = 0; j < sc.ptsInit.size(); ++j)
+    {
+        g2o::VertexSBAPointXYZ *v = new g2o::VertexSBAPointXYZ();
+        v->setId(id++);
+        v->setMarginalized(true);
+        v->setEstimate(sc.ptsInit[j]);
+        optimizer.addVertex(v);
+        vpts.push_back(v);
+    }
+
+    for (int k = 0; k < sc.obs.size(); ++k)
+    {
+        g2o::EdgeProjectP2MC *e = new g2o::EdgeProjectP2MC();
+        e->setVertex(0, vpts[sc.obsPt[k]]);
+        e->setVertex(1, vcams[sc.obsCam[k]]);
+        e->setMeasurement(sc.obs[k]);
+        e->information() = Eigen::Matrix2d::Identity();
+        optimizer.addEdge(e);
+    }
+
+    optimizer.initializeOptimization();
+    optimizer.computeActiveErrors();
+    double chi2Init = optimizer.chi2();
+
+    MyTimer tm;
+    tm.start();
+    int iters = optimizer.optimize(10);
+    tm.end();
+
+    double camErr = 0;
+
+    for (int i = 0; i < sc.cams.size(); ++i)
+        camErr += (vcams[i]->estimate().translation() - sc.cams[i].translation()).norm();
+
+    cout << "BA " << name << ": " << tm.time_ms << " ms for " << iters << " iterations, chi2 "
+         << chi2Init << " -> " << optimizer.chi2() << ", mean camera error "
+         << camErr / sc.cams.size() << endl;
+}
+
+static IdealLine2d benchLine(cv::Point2d a, cv::Point2d b, int lid, cv::Mat *xGrad, cv::Mat *yGrad)
+{
+    LineSegmt2d s(a, b, lid);
+    computeMSLD(s, xGrad, yGrad);
+    IdealLine2d l(s);
+    l.lid = lid;
+    return l;
+}
+
+static void benchLineMatch(xrand_state *rng, int numLines)
+// img2 is img1 moved 4 pixels to the right, so the epipolar lines are the rows
+{
+    const int W = 640, H = 480, shift = 4;
+    cv::Mat img1(H, W, CV_8U), img2;
+    cv::randu(img1, 0, 256);
+    cv::GaussianBlur(img1, img1, cv::Size(0, 0), 2);
+
+    vector<cv::Point2d> a(numLines), b(numLines);
+
+    for (int i = 0; i < numLines; ++i)
+    {
+        a[i] = cv::Point2d(20 + xrand_r(rng) % (W - 40), 20 + xrand_r(rng) % (H - 40));
+        b[i] = cv::Point2d(20 + xrand_r(rng) % (W - 40), 20 + xrand_r(rng) % (H - 40));
+        cv::line(img1, a[i], b[i], cv::Scalar(xrand_r(rng) % 256), 2);
+    }
+
+    img2 = cv::Mat::zeros(H, W, CV_8U);
+    img1.colRange(0, W - shift).copyTo(img2.colRange(shift, W));
+
+    cv::Mat gx1, gy1, gx2, gy2;
+    cv::Sobel(img1, gx1, CV_64F, 1, 0, 5);
+    cv::Sobel(img1, gy1, CV_64F, 0, 1, 5);
+    cv::Sobel(img2, gx2, CV_64F, 1, 0, 5);
+    cv::Sobel(img2, gy2, CV_64F, 0, 1, 5);
+
+    vector<IdealLine2d> lines1, lines2;
+    cv::Point2d d(shift, 0);
+
+    for (int i = 0; i < numLines; ++i)
+    {
+        if (cv::norm(b[i] - a[i]) < 20) continue;
+
+        lines1.push_back(benchLine(a[i], b[i], i, &gx1, &gy1));
+        lines2.push_back(benchLine(a[i] + d, b[i] + d, i, &gx2, &gy2));
+    }
+
+    cv::Mat F = (cv::Mat_<double>(3, 3) << 0, 0, 0, 0, 0, -1, 0, 1, 0);
+    MyTimer tm;
+    tm.start();
+    vector<vector<int>> all = F_guidedLinematch(F, lines1, lines2, img1, img2, true);
+    tm.end();
+    double tAll = tm.time_s;
+    tm.start();
+    vector<vector<int>> cand = F_guidedLinematch(F, lines1, lines2, img1, img2);
+    tm.end();
+
+    int numCorrect = 0;
+
+    for (int i = 0; i < cand.size(); ++i)
+        numCorrect += cand[i][0] == cand[i][1];
+
+    cout << "line matching, " << lines1.size() << " lines: describe all "
+         << tAll * 1000 << " ms, candidates only " << tm.time_s * 1000 << " ms, "
+         << cand.size() << " matches, " << numCorrect << " correct, "
+         << (all == cand ? "same" : "DIFFERENT") << " matches" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int numSamples = argc > 1 ? atoi(argv[1]) : 100000;
+
+    xrand_state rng;
+    seed_xrand_r(&rng, 1);
+    srand(1); // Eigen::Random
+
+    vector<Sample> samples;
+
+    for (int i = 0; i < numSamples; ++i)
+        samples.push_back(randomSample(&rng));
+
+    // fixed-size solver
+    MyTimer tm;
+    int numSols = 0, numFound = 0;
+    tm.start();
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        Eigen::Matrix3d Es[10];
+        int n = fivepoint_stewnister(samples[i].P1, samples[i].P2, Es);
+        numSols += n;
+        numFound += hasTrueE(samples[i], Es, n);
+    }
+
+    tm.end();
+    cout << "fivepoint fixed-size: " << numSamples / max(tm.time_s, 1e-3) << " samples/s, "
+         << double(numSols) / numSamples << " solutions/sample, true E found in "
+         << 100.0 * numFound / numSamples << "%" << endl;
+
+    // cv::Mat interface, as used before
+    vector<cv::Mat> P1s(numSamples), P2s(numSamples);
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        P1s[i].create(3, 5, CV_64F);
+        P2s[i].create(3, 5, CV_64F);
+
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 5; ++c)
+            {
+                P1s[i].at<double>(r, c) = samples[i].P1(r, c);
+                P2s[i].at<double>(r, c) = samples[i].P2(r, c);
+            }
+    }
+
+    numSols = 0;
+    tm.start();
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        vector<cv::Mat> Es;
+        fivepoint_stewnister(P1s[i], P2s[i], Es);
+        numSols += Es.size();
+    }
+
+    tm.end();
+    cout << "fivepoint cv::Mat:    " << numSamples / max(tm.time_s, 1e-3) << " samples/s, "
+         << double(numSols) / numSamples << " solutions/sample" << endl;
+
+    // the solver before the fixed-size one, as the baseline
+    numSols = numFound = 0;
+    tm.start();
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        vector<cv::Mat> Es;
+        fivepoint_stewnister_ref(P1s[i], P2s[i], Es);
+        numSols += Es.size();
+
+        Eigen::Matrix3d Ex[10];
+
+        for (int k = 0; k < Es.size() && k < 10; ++k)
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 3; ++c)
+                    Ex[k](r, c) = Es[k].at<double>(r, c);
+
+        numFound += hasTrueE(samples[i], Ex, min((int)Es.size(), 10), 1e-3); // single precision
+    }
+
+    tm.end();
+    cout << "fivepoint reference:  " << numSamples / max(tm.time_s, 1e-3) << " samples/s, "
+         << double(numSols) / numSamples << " solutions/sample, true E found in "
+         << 100.0 * numFound / numSamples << "%" << endl;
+
+    // point to line distances, all lines against all points as in line matching
+    int numLines = 300, numPts = max(1, numSamples / 100);
+    vector<IdealLine2d> lines;
+    vector<cv::Point2d> pts;
+
+    for (int i = 0; i < numLines; ++i)
+    {
+        cv::Point2d a(xrand_r(&rng) % 640, xrand_r(&rng) % 480);
+        cv::Point2d b(xrand_r(&rng) % 640, xrand_r(&rng) % 480);
+        lines.push_back(IdealLine2d(LineSegmt2d(a, b + cv::Point2d(1, 1))));
+    }
+
+    for (int i = 0; i < numPts; ++i)
+        pts.push_back(cv::Point2d(xrand_r(&rng) % 640, xrand_r(&rng) % 480));
+
+    double sumMat = 0, sumVec = 0;
+    tm.start();
+
+    for (int i = 0; i < numLines; ++i)
+        for (int j = 0; j < numPts; ++j)
+            sumMat += point2LineDist(lines[i].lineEq(), pts[j]);
+
+    tm.end();
+    double tMat = tm.time_s;
+    tm.start();
+
+    for (int i = 0; i < numLines; ++i)
+        for (int j = 0; j < numPts; ++j)
+            sumVec += point2LineDist(lines[i].lineVec(), pts[j]);
+
+    tm.end();
+    double numDists = double(numLines) * numPts;
+    cout << "point2LineDist cv::Mat:    " << numDists / max(tMat, 1e-3) << " dists/s" << endl;
+    cout << "point2LineDist fixed-size: " << numDists / max(tm.time_s, 1e-3) << " dists/s, "
+         << "rel. difference " << fabs(sumMat - sumVec) / max(sumMat, 1e-12) << endl;
+
+    benchLineMatch(&rng, 200);
+
+    // bundle adjustment, same scene and initial estimates for each linear solver
+    BaScene sc = baScene(&rng, 40, max(100, numSamples / 30));
+    cout << "BA scene: " << sc.cams.size() << " cameras, " << sc.pts.size() << " points, "
+         << sc.obs.size() << " observations" << endl;
+    benchBaSolver(sc, BA_SOLVER_CSPARSE, "CSparse");
+    benchBaSolver(sc, BA_SOLVER_CHOLMOD, "CHOLMOD");
+    benchBaSolver(sc, BA_SOLVER_DENSE, "dense  ");
+    benchBaSolver(sc, BA_SOLVER_PCG, "PCG    ");
+
+    return 0;
+}
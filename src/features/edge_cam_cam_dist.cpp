@@ -92,5 +92,25 @@ void EdgeCamCamDist::computeError()
     _error(0) = (pos1 - pos0).norm() - _measurement;
 }
 
+void EdgeCamCamDist::linearizeOplus()
+// error only depends on the camera positions, the rotation part is zero
+{
+    const VertexCam *cam0 = static_cast<const VertexCam *>(_vertices[0]);
+    const VertexCam *cam1 = static_cast<const VertexCam *>(_vertices[1]);
+
+    Eigen::Vector3d pos0 = - cam0->estimate().w2n.block<3, 3>(0, 0).transpose() * cam0->estimate().w2n.block<3, 1>(0, 3),
+                    pos1 = - cam1->estimate().w2n.block<3, 3>(0, 0).transpose() * cam1->estimate().w2n.block<3, 1>(0, 3);
+    Eigen::Vector3d dp = pos1 - pos0;
+    double dist = dp.norm();
+
+    _jacobianOplusXi.setZero();
+    _jacobianOplusXj.setZero();
+
+    if (dist < 1e-12) return;
+
+    _jacobianOplusXi.block<1, 3>(0, 0) = -dp.transpose() / dist;
+    _jacobianOplusXj.block<1, 3>(0, 0) = dp.transpose() / dist;
+}
+
 }
 
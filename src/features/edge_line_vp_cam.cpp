@@ -79,4 +79,55 @@ void EdgeLineVpCam::computeError()
     _error(0) = sqrt(_error(0));
 
 }
+void EdgeLineVpCam::linearizeOplus()
+// with S = sum of q*q' over the homogeneous segment points q, the squared
+// error is l'*S*l/(l0^2+l1^2), so the segment points are visited only once
+{
+    VertexSBAPointXYZ *v_lnpt = static_cast<VertexSBAPointXYZ *>(_vertices[0]);
+    VertexVanishPoint *v_vp = static_cast<VertexVanishPoint *>(_vertices[1]);
+    const VertexCam *cam = static_cast<const VertexCam *>(_vertices[2]);
+
+    const Eigen::Vector3d &vp = v_vp->estimate();
+    const Eigen::Vector3d &lnpt = v_lnpt->estimate();
+    const Eigen::Matrix3d &K = cam->estimate().Kcam;
+    Eigen::Matrix3d Rt = cam->estimate().w2n.block<3, 3>(0, 0);
+    Eigen::Matrix3d KRt = cam->estimate().w2i.block<3, 3>(0, 0);
+
+    Eigen::Vector3d w_vp = Rt * vp;                                                // vp in camera coords
+    Eigen::Vector3d p_ln = Rt * lnpt + cam->estimate().w2n.block<3, 1>(0, 3);     // line point in camera coords
+    Eigen::Vector3d hvp_im = K * w_vp;
+    Eigen::Vector3d h_lnpt_im = K * p_ln;
+    Eigen::Vector3d l = hvp_im.cross(h_lnpt_im);
+
+    Eigen::Matrix3d S = Eigen::Matrix3d::Zero();
+
+    for (int i = 0; i < segpts.size(); ++i)
+    {
+        Eigen::Vector3d q(segpts[i].x, segpts[i].y, 1);
+        S += q * q.transpose();
+    }
+
+    double N = l(0) * l(0) + l(1) * l(1);
+    double E2 = l.dot(S * l) / N;
+    double e = sqrt(E2);
+
+    _jacobianOplus[0].setZero();
+    _jacobianOplus[1].setZero();
+    _jacobianOplus[2].setZero();
+
+    if (e < 1e-12 || N < 1e-24) return;
+
+    // d(error)/dl
+    Eigen::Vector3d dl = S * l - E2 * Eigen::Vector3d(l(0), l(1), 0);
+    Eigen::Matrix<double, 1, 3> g = dl.transpose() / (N * e);
+    // l = hvp_im x h_lnpt_im
+    Eigen::Matrix<double, 1, 3> g_vp = -g * skew(h_lnpt_im);
+    Eigen::Matrix<double, 1, 3> g_ln = g * skew(hvp_im);
+
+    _jacobianOplus[0] = g_ln * KRt;
+    _jacobianOplus[1] = g_vp * KRt;
+    _jacobianOplus[2].block<1, 3>(0, 0) = -g_ln * KRt;
+    _jacobianOplus[2].block<1, 3>(0, 3) = 2 * (g_vp * K * skew(w_vp) + g_ln * K * skew(p_ln));
+}
+
 }
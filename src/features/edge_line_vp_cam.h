@@ -50,6 +50,8 @@ public:
     virtual bool read(std::istream &is);
     virtual bool write(std::ostream &os) const;
     void computeError();
+    // analytic jacobian
+    virtual void linearizeOplus();
 
     void setMeasurement(const double &m)
     {
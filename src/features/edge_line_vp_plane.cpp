@@ -76,4 +76,51 @@ void EdgeLineVpPlane::computeError()
     Eigen::Vector3d n = v_plane->estimate() * d; // plane unit normal
     _error(0) = sqrt(pow(vA.dot(n) + d, 2) + pow(vB.dot(n) + d, 2));
 }
+void EdgeLineVpPlane::linearizeOplus()
+{
+    VertexSBAPointXYZ *v_lnpt = static_cast<VertexSBAPointXYZ *>(_vertices[0]);
+    VertexVanishPoint *v_vp = static_cast<VertexVanishPoint *>(_vertices[1]);
+    const VertexPlane3d *v_plane = static_cast<const VertexPlane3d *>(_vertices[2]);
+
+    const Eigen::Vector3d &X = v_lnpt->estimate();
+    const Eigen::Vector3d &v = v_vp->estimate();
+    const Eigen::Vector3d &pl = v_plane->estimate();
+    double vv = v.dot(v);
+    double r = pl.norm();
+    Eigen::Vector3d n = pl / r;
+    double nv = n.dot(v);
+
+    Eigen::Vector3d endpts[2] = {Eigen::Vector3d(endptA.x, endptA.y, endptA.z),
+                                 Eigen::Vector3d(endptB.x, endptB.y, endptB.z)
+                                };
+    double s[2];
+    Eigen::Matrix<double, 1, 3> ds_dX[2], ds_dv[2], ds_dpl[2];
+
+    for (int i = 0; i < 2; ++i)
+    {
+        // endpoint projected onto the line, P = X + k*v
+        Eigen::Vector3d w = endpts[i] - X;
+        double k = v.dot(w) / vv;
+        Eigen::Vector3d P = X + k * v;
+        s[i] = (P.dot(pl) + 1) / r; // signed distance to the plane
+        ds_dX[i] = n.transpose() - nv * v.transpose() / vv;
+        ds_dv[i] = k * n.transpose() + nv * (w - 2 * k * v).transpose() / vv;
+        ds_dpl[i] = (P - s[i] * n).transpose() / r;
+    }
+
+    double e = sqrt(s[0] * s[0] + s[1] * s[1]);
+
+    if (e < 1e-12)
+    {
+        _jacobianOplus[0].setZero();
+        _jacobianOplus[1].setZero();
+        _jacobianOplus[2].setZero();
+        return;
+    }
+
+    _jacobianOplus[0] = (s[0] * ds_dX[0] + s[1] * ds_dX[1]) / e;
+    _jacobianOplus[1] = (s[0] * ds_dv[0] + s[1] * ds_dv[1]) / e;
+    _jacobianOplus[2] = (s[0] * ds_dpl[0] + s[1] * ds_dpl[1]) / e;
+}
+
 }
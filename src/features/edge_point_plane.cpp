@@ -110,5 +110,21 @@ void EdgePointPlane3d::computeError()
     _error(0) = abs(pt.dot(n) + d);
 }
 
+void EdgePointPlane3d::linearizeOplus()
+{
+    VertexSBAPointXYZ *v_pt = static_cast<VertexSBAPointXYZ *>(_vertices[0]);
+    const VertexPlane3d *v_plane = static_cast<const VertexPlane3d *>(_vertices[1]);
+
+    const Eigen::Vector3d pt = v_pt->estimate();
+    const Eigen::Vector3d &pl = v_plane->estimate();
+    double r = pl.norm();
+    Eigen::Vector3d n = pl / r;           // plane unit normal
+    double s = (pt.dot(pl) + 1) / r;      // signed distance, error = |s|
+    double sgn = s < 0 ? -1 : 1;
+
+    _jacobianOplusXi = sgn * n.transpose();
+    _jacobianOplusXj = sgn * (pt - s * n).transpose() / r;
+}
+
 
 } // end namespace
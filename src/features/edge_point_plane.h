@@ -45,8 +45,8 @@ public:
 
     // return the error estimate as a
     void computeError();
-    // jacobian
-//   virtual void linearizeOplus();
+    // analytic jacobian
+    virtual void linearizeOplus();
 
     virtual void setMeasurement(const double &m)
     {
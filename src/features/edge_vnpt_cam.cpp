@@ -123,5 +123,40 @@ void EdgeVnptCam::computeError()
 
 }
 
+void EdgeVnptCam::linearizeOplus()
+// VertexCam updates are [dt, dq] with R <- R*q(dq), so the vp direction in
+// camera coordinates w = R'*vp changes by 2*[w]x*dq; both error rows are equal
+{
+    VertexVanishPoint *v_vp = static_cast<VertexVanishPoint *>(_vertices[0]);
+    const VertexCam *cam = static_cast<const VertexCam *>(_vertices[1]);
+
+    const Eigen::Vector3d &vp = v_vp->estimate();
+    Eigen::Matrix3d Rt = cam->estimate().w2n.block<3, 3>(0, 0);
+    Eigen::Vector3d w = Rt * vp;
+    double wnorm = w.norm();
+    Eigen::Vector3d c = w / wnorm;
+    cv::Mat meas_univec = angle2unitVec(_measurement(0), _measurement(1));
+    Eigen::Vector3d m(meas_univec.at<double>(0), meas_univec.at<double>(1), meas_univec.at<double>(2));
+    double mc = m.dot(c);
+    double a = abs(mc);
+
+    _jacobianOplusXi.setZero();
+    _jacobianOplusXj.setZero();
+
+    if (a >= 1 || wnorm < 1e-12) return; // error clamped at zero angle
+
+    // d(angle)/dw
+    Eigen::Matrix<double, 1, 3> g = -(mc < 0 ? -1 : 1) / (sqrt(1 - a * a) * wnorm)
+                                    * (m - mc * c).transpose();
+    Eigen::Matrix<double, 1, 3> Jvp = g * Rt;
+    Eigen::Matrix<double, 1, 3> Jrot = 2 * g * skew(w);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        _jacobianOplusXi.row(i) = Jvp;
+        _jacobianOplusXj.block<1, 3>(i, 3) = Jrot;
+    }
+}
+
 
 } // end namespace
@@ -27,6 +27,8 @@
 //#include "mfg.h"
 #include "utils.h"
 #include "epnp.h"
+#include "geokernels.h"
+#include "ransac.h"
 #include <vector>
 
 using namespace std;
@@ -59,70 +61,84 @@ int computePnP(vector<cv::Point3d> X, vector<cv::Point2d> x, cv::Mat K,
 }
 
 
-int computePnP_ransac(vector<cv::Point3d> X, vector<cv::Point2d> x, cv::Mat K,
-                      cv::Mat &R, cv::Mat &t, int maxIter)
+// PnP from 7 correspondences for ransac(), the model is P = K*[R|t] and the
+// error of a correspondence is its reprojection distance
+struct PnPProblem : public RansacProblem
 {
-    int N = X.size();
-    int n = 7; // min set
+    typedef cv::Matx34d Model;
+    enum { SAMPLE_SIZE = 7, MAX_MODELS = 1 };
 
-    if (N < n)
+    const vector<cv::Point3d> &X;
+    const vector<cv::Point2d> &x;
+    const cv::Mat &K;
+    SoaPoints3d soaX;
+    SoaPoints2d soax;
+
+    PnPProblem(const vector<cv::Point3d> &_X, const vector<cv::Point2d> &_x, const cv::Mat &_K)
+        : X(_X), x(_x), K(_K)
     {
-        computePnP(X, x, K, R, t);
-        return -1;
+        for (int i = 0; i < X.size(); ++i)
+        {
+            soaX.push_back(X[i].x, X[i].y, X[i].z);
+            soax.push_back(x[i].x, x[i].y);
+        }
     }
 
-    double imptDistThresh = 3;
-    vector<int> maxInlierSet;
-    cv::Mat Rmax, tmax;
-    vector<int> rnd;
-
-    for (int i = 0; i < N; ++i)		rnd.push_back(i);
+    int numData() const { return X.size(); }
 
-    int	iter = 0;
-
-    while (iter < maxIter)
+    int fit(const int *sample, Model *models) const
     {
-        ++iter;
-        vector<int> inlier;
-        // --- choose minimal solution set: mss1<->mss2
-        random_unique(rnd.begin(), rnd.end(), n);
-        vector<cv::Point3d> Xmin(n);
-        vector<cv::Point2d> xmin(n);
-
-        for (int i = 0; i < n; ++i)
+        vector<cv::Point3d> Xmin(SAMPLE_SIZE);
+        vector<cv::Point2d> xmin(SAMPLE_SIZE);
+
+        for (int i = 0; i < SAMPLE_SIZE; ++i)
         {
-            Xmin[i] = X[rnd[i]];
-            xmin[i] = x[rnd[i]];
+            Xmin[i] = X[sample[i]];
+            xmin[i] = x[sample[i]];
         }
 
-        cv::Mat Rm, tm;
-        computePnP(X, x, K, Rm, tm);
+        cv::Mat Rm, tm, Rt;
+        computePnP(Xmin, xmin, K, Rm, tm);
+        cv::hconcat(Rm, tm, Rt);
+        models[0] = cv::Mat(K * Rt);
+        return 1;
+    }
 
-        for (int i = 0; i < N; ++i)
-        {
-            double d = cv::norm(mat2cvpt(K * (Rm * cvpt2mat(X[i], 0) + tm)) - x[i]);
+    void errors(const Model &P, int begin, int end, double *err) const
+    {
+        reprojErrors(P.val, &soaX.x[begin], &soaX.y[begin], &soaX.z[begin],
+                     &soax.x[begin], &soax.y[begin], end - begin, err);
+    }
+};
 
-            if (d < imptDistThresh)
-                inlier.push_back(i);
-        }
+int computePnP_ransac(vector<cv::Point3d> X, vector<cv::Point2d> x, cv::Mat K,
+                      cv::Mat &R, cv::Mat &t, xrand_state *rng, int maxIter)
+{
+    int N = X.size();
+    int n = PnPProblem::SAMPLE_SIZE; // min set
 
-        if (inlier.size() > maxInlierSet.size())
-        {
-            maxInlierSet = inlier;
-            Rmax = Rm;
-            tmax = tm;
-        }
+    if (N < n)
+    {
+        computePnP(X, x, K, R, t);
+        return 0;
     }
 
+    PnPProblem prob(X, x, K);
+    RansacOptions opts;
+    opts.maxIter = maxIter;
+    opts.threshold = 3;
+
+    cv::Matx34d Pmax;
+    vector<int> maxInlierSet;
+    ransac(prob, opts, rng, Pmax, maxInlierSet);
+
     if (maxInlierSet.size() < n)
     {
         computePnP(X, x, K, R, t);
-        return n;
+        return maxInlierSet.size();
     }
     else
     {
-        //R = Rmax;
-        //t = tmax;
         vector<cv::Point3d> Xin;
         vector<cv::Point2d> xin;
 
@@ -33,6 +33,16 @@
 
 #include <opencv2/core/core.hpp>
 
+// Line through two image points, (a,b,c) with a*a+b*b = 1. The geometry of the
+// classes below is returned by value in fixed-size types (vec(), lineVec()),
+// the cv::Mat accessors (mat(), lineEq()) are kept for the code that needs a
+// cv::Mat and copy from them.
+inline cv::Vec3d lineThrough(const cv::Point2d &p1, const cv::Point2d &p2)
+{
+    cv::Vec3d l(p1.y - p2.y, p2.x - p1.x, p1.x * p2.y - p1.y * p2.x); // p1 x p2
+    return l * (1 / sqrt(l[0] * l[0] + l[1] * l[1]));
+}
+
 // This class stores a feature point information in 2d image
 class FeatPoint2d
 {
@@ -80,9 +90,13 @@ public:
         gid = g;
     }
 
+    cv::Vec3d vec() const
+    {
+        return cv::Vec3d(x, y, 1);
+    }
     cv::Mat mat()
     {
-        return (cv::Mat_<double>(3, 1) << x, y, 1);
+        return cv::Mat(vec());
     }
     cv::Point2d cvpt()
     {
@@ -117,7 +131,14 @@ public:
     {
         return sqrt(pow(endpt1.x - endpt2.x, 2) + pow(endpt1.y - endpt2.y, 2));
     }
-    cv::Mat lineEq();
+    cv::Vec3d lineVec() const
+    {
+        return lineThrough(endpt1, endpt2);
+    }
+    cv::Mat lineEq()
+    {
+        return cv::Mat(lineVec());
+    }
 };
 
 
@@ -142,10 +163,14 @@ public:
         gid = g;
     }
 
+    cv::Vec3d vec() const
+    {
+        return cv::Vec3d(x, y, w);
+    }
     cv::Mat mat(bool homo = true)
     {
         if (homo)
-            return (cv::Mat_<double>(3, 1) << x, y, w);
+            return cv::Mat(vec());
         else
             return (cv::Mat_<double>(2, 1) << x / w, y / w);
     }
@@ -199,16 +224,15 @@ public:
         lsLids.push_back(s.lid);
     }
 
+    cv::Vec3d lineVec() const
+    {
+        return lineThrough(extremity1, extremity2);
+    }
     cv::Mat lineEq()
     {
-        cv::Mat pt1 = (cv::Mat_<double>(3, 1) << extremity1.x, extremity1.y, 1);
-        cv::Mat pt2 = (cv::Mat_<double>(3, 1) << extremity2.x, extremity2.y, 1);
-        cv::Mat lnEq = pt1.cross(pt2); // lnEq = pt1 x pt2
-        lnEq = lnEq / sqrt(lnEq.at<double>(0) * lnEq.at<double>(0)
-                           + lnEq.at<double>(1) * lnEq.at<double>(1)); // normalize, optional
-        return lnEq;
+        return cv::Mat(lineVec());
     }
-    double length()
+    double length() const
     {
         return sqrt(pow(extremity1.x - extremity2.x, 2)
                     + pow(extremity1.y - extremity2.y, 2));
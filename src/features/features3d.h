@@ -71,12 +71,16 @@ public:
         estViewId = -1;
     }
 
+    cv::Vec3d vec() const
+    {
+        return cv::Vec3d(x, y, z);
+    }
     cv::Mat mat(bool homo = true) const
     {
         if (homo)
-            return (cv::Mat_<double>(4, 1) << x, y, z, 1);
+            return cv::Mat(cv::Vec4d(x, y, z, 1));
         else
-            return (cv::Mat_<double>(3, 1) << x, y, z);
+            return cv::Mat(vec());
     }
     cv::Point3d cvpt() const
     {
@@ -88,7 +92,7 @@ public:
 class PrimPlane3d
 {
 public:
-    cv::Mat			n;
+    cv::Vec3d		n;		// normal, n'*X + d = 0
     double			d;
     int				gid;
     std::vector <int>	ilnGids;  // global ids of coplanar ideal lines
@@ -105,30 +109,21 @@ public:
     PrimPlane3d(cv::Mat nd, int _gid)
     {
         gid = _gid;
-
-        if (nd.cols * nd.rows == 3) // nd = n/d, is a 3-std::vector
-        {
-            n = nd / cv::norm(nd);
-            d = 1 / cv::norm(nd);
-        }
-        else     // nd=[n d] is 4-std::vector
-        {
-            n = (cv::Mat_<double>(3, 1) << nd.at<double>(0), nd.at<double>(1), nd.at<double>(2));
-            d = nd.at<double>(3);
-        }
-
+        setPlane(nd);
         estViewId = -1;
     }
     void setPlane(cv::Mat nd)
     {
+        cv::Vec3d v(nd.at<double>(0), nd.at<double>(1), nd.at<double>(2));
+
         if (nd.cols * nd.rows == 3) // nd = n/d, is a 3-std::vector
         {
-            n = nd / cv::norm(nd);
-            d = 1 / cv::norm(nd);
+            n = v * (1 / cv::norm(v));
+            d = 1 / cv::norm(v);
         }
         else     // nd=[n d] is 4-std::vector
         {
-            n = (cv::Mat_<double>(3, 1) << nd.at<double>(0), nd.at<double>(1), nd.at<double>(2));
+            n = v;
             d = nd.at<double>(3);
         }
     }
@@ -168,6 +163,10 @@ public:
         return v / cv::norm(v);
     }
 
+    cv::Vec3d vec() const
+    {
+        return cv::Vec3d(x, y, z);
+    }
 };
 
 
@@ -175,7 +174,7 @@ class IdealLine3d
 {
 public:
     cv::Point3d				midpt;
-    cv::Mat					direct;  // line direction std::vector
+    cv::Vec3d				direct;  // line direction std::vector
     double					length;	 // length between endpoints
     int						gid;	// global id of line
     int						pGid;	// global id of the associated plane
@@ -186,26 +185,31 @@ public:
 
     IdealLine3d() {}
 
-    IdealLine3d(cv::Point3d mpt, cv::Mat d)
+    IdealLine3d(cv::Point3d mpt, const cv::Vec3d &d)
     {
         midpt = mpt;
-        direct = d.clone();
+        direct = d;
         vpGid = -1;
         pGid = -1;
         gid = -1;
         estViewId = -1;
     }
 
+    cv::Vec3d directVec() const // unit direction
+    {
+        return direct * (1 / cv::norm(direct));
+    }
+
     cv::Point3d extremity1() const
     {
-        cv::Mat d = direct / cv::norm(direct);
-        return midpt + 0.5 * length * cv::Point3d(d.at<double>(0), d.at<double>(1), d.at<double>(2));
+        cv::Vec3d d = directVec();
+        return midpt + 0.5 * length * cv::Point3d(d[0], d[1], d[2]);
     }
 
     cv::Point3d extremity2() const
     {
-        cv::Mat d = direct / cv::norm(direct);
-        return midpt - 0.5 * length * cv::Point3d(d.at<double>(0), d.at<double>(1), d.at<double>(2));
+        cv::Vec3d d = directVec();
+        return midpt - 0.5 * length * cv::Point3d(d[0], d[1], d[2]);
     }
 };
 
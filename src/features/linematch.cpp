@@ -26,11 +26,14 @@
 
 #include "utils.h"
 #include "consts.h"
+#include "pointgrid.h"
 #include "random.h"
 #include "view.h"
 #include "features2d.h"
 #include "features3d.h"
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
 #include <iostream>
 
@@ -131,8 +134,16 @@ int computeMSLD(LineSegmt2d &l, cv::Mat *xGradient, cv::Mat *yGradient)
 
     if (GDM.size() == 0)
     {
+        // if not computable, assign random num from a stream keyed by the
+        // segment itself, so the result does not depend on the thread or call
+        // order
+        xrand_state rng;
+        int64_t seed = int64_t(l.endpt1.x * 1000) * 73856093 ^ int64_t(l.endpt1.y * 1000) * 19349663
+                       ^ int64_t(l.endpt2.x * 1000) * 83492791 ^ int64_t(l.endpt2.y * 1000) * 50331653;
+        seed_xrand_task(&rng, XRAND_MSLD, uint64_t(seed));
+
         for (int i = 0; i < MS.rows; ++i)
-            MS.at<double>(i, 0) = rand(); // if not computable, assign random num
+            MS.at<double>(i, 0) = xrand_r(&rng) % RAND_MAX;
 
         l.msldDesc = MS;
         return 0;
@@ -176,225 +187,219 @@ int computeMSLD(LineSegmt2d &l, cv::Mat *xGradient, cv::Mat *yGradient)
     return 1;
 }
 
-int isPtInLineNeighbor(IdealLine2d line, cv::Point2d pt, double imageWidth);
+int isPtInLineNeighbor(const IdealLine2d &line, cv::Point2d pt, double imageWidth);
+
+static double lineNeighborWidth(double imageWidth)
+{
+    return min(imageWidth / 12.0, 100.0); //THRESH_LINE_NEIGHBOR_WIDTH
+}
+
+static void findLineNeighbors(const IdealLine2d &line, const PointGrid &grid, double imWidth,
+                              vector<int> &lhsIdx, vector<int> &rhsIdx)
+// points of grid in the left/right neighborhood of line, ascending
+{
+    vector<int> cand;
+    grid.queryBand(line.extremity1, line.extremity2, lineNeighborWidth(imWidth), cand);
+
+    for (int k = 0; k < cand.size(); ++k)
+    {
+        int neigh = isPtInLineNeighbor(line, grid.pt(cand[k]), imWidth);
+
+        if (neigh == 1)
+            lhsIdx.push_back(cand[k]);
+
+        if (neigh == 2)
+            rhsIdx.push_back(cand[k]);
+    }
+}
+
+static double maxMedianSim(const cv::Vec3d &eq1, const cv::Vec3d &eq2, const vector<int> &bothIdx,
+                           const vector<vector<cv::Point2d>> &pointPairs, double distThresh)
+// max over the reference points of the median similarity of the relative
+// point to line distances of the other points, in both images
+{
+    double maxMedian = 0;
+
+    if (bothIdx.size() < 2)
+        return maxMedian;
+
+    for (int b = 0; b < bothIdx.size(); ++b)
+    {
+        vector<double> sims;
+        // choose a reference point
+        cv::Point2d basisPt1 = pointPairs[bothIdx[b]][0],
+                    basisPt2 = pointPairs[bothIdx[b]][1];
+        double basisDist1 = point2LineDist(eq1, basisPt1),
+               basisDist2 = point2LineDist(eq2, basisPt2);
+
+        if (basisDist1 < distThresh || basisDist2 < distThresh)
+            continue; // if dist between basispt to line is too
+
+        // small, it cannot be used.
+        for (int ii = 0; ii < bothIdx.size(); ++ii)
+        {
+            if (ii == b)
+                continue;
+
+            cv::Point2d Pt1 = pointPairs[bothIdx[ii]][0],
+                        Pt2 = pointPairs[bothIdx[ii]][1];
+
+            if (abs(Pt1.x - basisPt1.x) + abs(Pt1.y - basisPt1.y) < 1e-6)
+                sims.push_back(0);
+            else
+            {
+                double d1 = point2LineDist(eq1, Pt1) / basisDist1,
+                       d2 = point2LineDist(eq2, Pt2) / basisDist2;
+                sims.push_back(exp(-abs(d1 - d2)));
+            }
+        }
+
+        // find median of sims
+        double median;
+
+        if (sims.size() < 35) //for short vector, sort faster
+            sort(sims.begin(), sims.end());
+        else      // for long vector, nth_ is faster
+            nth_element(sims.begin(),
+                        sims.begin() + sims.size() / 2, sims.end());
+
+        if (sims.size() % 2 == 0)
+            median = sims[sims.size() / 2 - 1];
+        else
+            median = sims[sims.size() / 2];
+
+        maxMedian = max(maxMedian, median);
+    }
+
+    return maxMedian;
+}
+
+void matchLinesByPointPairs(double imWidth,
+                            vector<IdealLine2d> &lines1, vector<IdealLine2d> &lines2,
+                            vector<vector<cv::Point2d>> &pointPairs,
+                            vector<vector<int>> &linePairIdx)
+{
+    vector<cv::Point2d> pts1(pointPairs.size()), pts2(pointPairs.size());
+
+    for (int k = 0; k < pointPairs.size(); ++k)
+    {
+        pts1[k] = pointPairs[k][0];
+        pts2[k] = pointPairs[k][1];
+    }
+
+    double cellSize = lineNeighborWidth(imWidth) / 2;
+    matchLinesByPointPairs(imWidth, lines1, lines2, pointPairs,
+                           PointGrid(pts1, cellSize), PointGrid(pts2, cellSize), linePairIdx);
+}
 
 void matchLinesByPointPairs(double imWidth,
                             vector<IdealLine2d> &lines1, vector<IdealLine2d> &lines2,
                             vector<vector<cv::Point2d>> &pointPairs,
+                            const PointGrid &grid1, const PointGrid &grid2,
                             vector<vector<int>> &linePairIdx)
 // algorithm: Line Matching leveraged by Point Correspondences (CVPR2010)
-// img1 and img2 need be gray images
+// grid1 and grid2 index the points of pointPairs in image 1 and 2
 {
     double lsLenThresh = 0;//imWidth/100.0;
 
-    // ======= Find neighborhood points for lines in img1 =========
-    vector<vector<int>> lhsPairIdx1, rhsPairIdx1;
+    // ======= Find neighborhood points for lines in both images =========
+    vector<vector<int>> lhsPairIdx1(lines1.size()), rhsPairIdx1(lines1.size()),
+           lhsPairIdx2(lines2.size()), rhsPairIdx2(lines2.size());
+    vector<cv::Vec3d> eqs1(lines1.size()), eqs2(lines2.size());
 
     for (int i = 0; i < lines1.size(); ++i)
     {
-        //		lines1[i].getGradient(&xGradImg1,&yGradImg1);
-        cv::Point2d nDirect = cv::Point2d(
-                                  lines1[i].lineEq().at<double>(0),
-                                  lines1[i].lineEq().at<double>(1));
-        cv::Point2d lineDirect =
-            cv::Point2d(nDirect.y, -nDirect.x) * (1 / cv::norm(nDirect));
-        cv::Point2d midPt = (lines1[i].extremity1 + lines1[i].extremity2) * 0.5;
-        double len = lines1[i].length(); //line length
-        vector<int> lhsIdx, rhsIdx;
-
-        if (len >= lsLenThresh)
-        {
-            for (int j = 0; j < pointPairs.size(); ++j)
-            {
-                // check if in neighborhood, left or right
-                int neigh = isPtInLineNeighbor
-                            (lines1[i], pointPairs[j][0], imWidth);
+        eqs1[i] = lines1[i].lineVec();
 
-                if (neigh == 1)
-                    lhsIdx.push_back(j);
+        if (lines1[i].length() >= lsLenThresh)
+            findLineNeighbors(lines1[i], grid1, imWidth, lhsPairIdx1[i], rhsPairIdx1[i]);
+    }
 
-                if (neigh == 2)
-                    rhsIdx.push_back(j);
-            }
-        }
+    for (int j = 0; j < lines2.size(); ++j)
+    {
+        eqs2[j] = lines2[j].lineVec();
 
-        lhsPairIdx1.push_back(lhsIdx);
-        rhsPairIdx1.push_back(rhsIdx);
+        if (lines2[j].length() >= lsLenThresh)
+            findLineNeighbors(lines2[j], grid2, imWidth, lhsPairIdx2[j], rhsPairIdx2[j]);
     }
 
-    // =============== compute similarity matrix ===================
-    cv::Mat simMat = cv::Mat::zeros(lines1.size(), lines2.size(), CV_64F);
-    cv::Mat neighborhood = cv::Mat::zeros
-                           (pointPairs.size(), lines2.size(), CV_64F) - 1; // initialize to -1
+    // =============== compute similarity, sparse ===================
+    // (j, similarity) of the lines2 with a nonzero similarity to each line
+    vector<vector<pair<int, double> > > simRows(lines1.size());
 
     double distThresh = 0.05;// threshold for pt to line distance when computing
     // similarity, pt too close to line is discarded
 
     for (int i = 0; i < lines1.size(); ++i)
     {
-        vector<int> lIdx = lhsPairIdx1[i], rIdx = rhsPairIdx1[i];
+        const vector<int> &lIdx = lhsPairIdx1[i], &rIdx = rhsPairIdx1[i];
+
+        if (lIdx.size() < 2 && rIdx.size() < 2)
+            continue;
+
+        for (int j = 0; j < lines2.size(); ++j)
+        {
+            // if two gradients are opposite, then set similarity to 0.
+            if (lines1[i].gradient.dot(lines2[j].gradient) <= 0)
+                continue;
+
+            // point pairs in the same side neighborhood of both lines
+            vector<int> bothLhsIdx, bothRhsIdx;
+            set_intersection(lIdx.begin(), lIdx.end(),
+                             lhsPairIdx2[j].begin(), lhsPairIdx2[j].end(),
+                             back_inserter(bothLhsIdx));
+            set_intersection(rIdx.begin(), rIdx.end(),
+                             rhsPairIdx2[j].begin(), rhsPairIdx2[j].end(),
+                             back_inserter(bothRhsIdx));
+
+            double sim = max(maxMedianSim(eqs1[i], eqs2[j], bothRhsIdx, pointPairs, distThresh),
+                             maxMedianSim(eqs1[i], eqs2[j], bothLhsIdx, pointPairs, distThresh));
+
+            if (sim > 0)
+                simRows[i].push_back(make_pair(j, sim));
+        }
+    }
+
+    // ============  Identify matches based on simlarity matrix ==========
+    // the first max of each column, as the first max of each row below
+    vector<double> colMax(lines2.size(), 0);
+    vector<int> colMaxRow(lines2.size(), -1);
 
-        if (lIdx.size() >= 2 || rIdx.size() >= 2)
+    for (int i = 0; i < simRows.size(); ++i)
+    {
+        for (int k = 0; k < simRows[i].size(); ++k)
         {
-            for (int j = 0; j < lines2.size(); ++j)
+            int j = simRows[i][k].first;
+
+            if (simRows[i][k].second > colMax[j])
             {
-                // if two gradients are opposite, then set similarity to 0.
-                if (lines1[i].gradient.dot(lines2[j].gradient) > 0
-                        && lines2[j].length() >= lsLenThresh)
-                {
-                    vector<int> bothLhsIdx;
-
-                    for (int k = 0; k < lIdx.size(); ++k)
-                    {
-                        if (neighborhood.at<double>(lIdx[k], j) < 0)
-                            neighborhood.at<double>(lIdx[k], j) =
-                                isPtInLineNeighbor(lines2[j], pointPairs[lIdx[k]][1], imWidth);
-
-                        if (neighborhood.at<double>(lIdx[k], j) == 1)
-                            bothLhsIdx.push_back(lIdx[k]);
-                    }
-
-                    double maxLeftMedian = 0;
-
-                    if (bothLhsIdx.size() >= 2) // compute similarity - left
-                    {
-                        for (int b = 0; b < bothLhsIdx.size(); ++b)
-                        {
-                            vector<double> sims;
-                            // choose a reference point
-                            cv::Point2d basisPt1 = pointPairs[bothLhsIdx[b]][0],
-                                        basisPt2 = pointPairs[bothLhsIdx[b]][1];
-                            double basisDist1 = point2LineDist(lines1[i].lineEq(), basisPt1),
-                                   basisDist2 = point2LineDist(lines2[j].lineEq(), basisPt2);
-
-                            if (basisDist1 < distThresh || basisDist2 < distThresh)
-                                continue; // if dist between basispt to line is too
-
-                            // small, it cannot be used.
-                            for (int ii = 0; ii < bothLhsIdx.size(); ++ii)
-                            {
-                                if (ii == b)
-                                    continue;
-
-                                cv::Point2d Pt1 = pointPairs[bothLhsIdx[ii]][0],
-                                            Pt2 = pointPairs[bothLhsIdx[ii]][1];
-
-                                if (abs(Pt1.x - basisPt1.x) + abs(Pt1.y - basisPt1.y) < 1e-6)
-                                    sims.push_back(0);
-                                else
-                                {
-                                    double d1 = point2LineDist(lines1[i].lineEq(), Pt1) / basisDist1,
-                                           d2 = point2LineDist(lines2[j].lineEq(), Pt2) / basisDist2;
-                                    sims.push_back(exp(-abs(d1 - d2)));
-                                }
-                            }
-
-                            // find median of sims
-                            double median;
-
-                            if (sims.size() < 35) //for short vector, sort faster
-                                sort(sims.begin(), sims.end());
-                            else      // for long vector, nth_ is faster
-                                nth_element(sims.begin(),
-                                            sims.begin() + sims.size() / 2, sims.end());
-
-                            if (sims.size() % 2 == 0)
-                                median = sims[sims.size() / 2 - 1];
-                            else
-                                median = sims[sims.size() / 2];
-
-                            maxLeftMedian = max(maxLeftMedian, median);
-                        }
-                    }
-
-                    vector<int> bothRhsIdx;
-
-                    for (int k = 0; k < rIdx.size(); ++k)
-                    {
-                        if (neighborhood.at<double>(rIdx[k], j) < 0)
-                            neighborhood.at<double>(rIdx[k], j) =
-                                isPtInLineNeighbor(lines2[j], pointPairs[rIdx[k]][1], imWidth);
-
-                        if (neighborhood.at<double>(rIdx[k], j) == 2)
-                            bothRhsIdx.push_back(rIdx[k]);
-                    }
-
-                    double maxRightMedian = 0;
-
-                    if (bothRhsIdx.size() >= 2) // compute similarity - right
-                    {
-                        for (int b = 0; b < bothRhsIdx.size(); ++b)
-                        {
-                            vector<double> sims;
-                            cv::Point2d basisPt1 = pointPairs[bothRhsIdx[b]][0],
-                                        basisPt2 = pointPairs[bothRhsIdx[b]][1];
-                            double basisDist1 = point2LineDist(lines1[i].lineEq(), basisPt1),
-                                   basisDist2 = point2LineDist(lines2[j].lineEq(), basisPt2);
-
-                            if (basisDist1 < distThresh || basisDist2 < distThresh)
-                                continue; // if dist between basispt to line is too
-
-                            // small, it cannot be used.
-                            for (int ii = 0; ii < bothRhsIdx.size(); ++ii)
-                            {
-                                if (ii == b)
-                                    continue;
-
-                                cv::Point2d Pt1 = pointPairs[bothRhsIdx[ii]][0],
-                                            Pt2 = pointPairs[bothRhsIdx[ii]][1];
-
-                                if (abs(Pt1.x - basisPt1.x) + abs(Pt1.y - basisPt1.y) < 1e-6)
-                                    sims.push_back(0);
-                                else
-                                {
-                                    double  d1 = point2LineDist(lines1[i].lineEq(), Pt1) / basisDist1,
-                                            d2 = point2LineDist(lines2[j].lineEq(), Pt2) / basisDist2;
-                                    sims.push_back(exp(-abs(d1 - d2)));
-                                }
-                            }
-
-                            // find median of sims
-                            if (sims.size() < 35) //for short vector, sort faster
-                                sort(sims.begin(), sims.end());
-                            else      // for long vector, nth_ is faster
-                                nth_element(sims.begin(),
-                                            sims.begin() + sims.size() / 2, sims.end());
-
-                            double median = 0;
-
-                            if (sims.size() % 2 == 0)
-                                median = (sims[sims.size() / 2 - 1]);
-                            else
-                                median = (sims[sims.size() / 2]);
-
-                            maxRightMedian = max(maxRightMedian, median);
-                        }
-                    }
-
-                    simMat.at<double>(i, j) = max(maxRightMedian, maxLeftMedian);
-                }
+                colMax[j] = simRows[i][k].second;
+                colMaxRow[j] = i;
             }
         }
     }
 
-    // ============  Identify matches based on simlarity matrix ==========
-    for (int i = 0; i < simMat.rows; ++i)
+    for (int i = 0; i < simRows.size(); ++i)
     {
-        vector<int> onePairIdx;
-        double maxVal;
-        cv::Point maxPos;
-        cv::minMaxLoc(simMat.row(i), NULL, &maxVal, NULL, &maxPos);
+        double maxVal = 0;
+        int maxPos = -1;
 
-        if (maxVal > 0.95)
+        for (int k = 0; k < simRows[i].size(); ++k)
         {
-            double maxV;
-            cv::Point maxP;
-            cv::minMaxLoc(simMat.col(maxPos.x), NULL, &maxV, NULL, &maxP);
+            if (simRows[i][k].second > maxVal)
+            {
+                maxVal = simRows[i][k].second;
+                maxPos = simRows[i][k].first;
+            }
+        }
 
-            if (i == maxP.y)    // commnent this for more potential matches
+        if (maxVal > 0.95)
+        {
+            if (i == colMaxRow[maxPos])    // commnent this for more potential matches
             {
+                vector<int> onePairIdx;
                 onePairIdx.push_back(lines1[i].lid);
-                onePairIdx.push_back(lines2[maxPos.x].lid);
+                onePairIdx.push_back(lines2[maxPos].lid);
                 linePairIdx.push_back(onePairIdx);
             }
         }
@@ -402,7 +407,7 @@ void matchLinesByPointPairs(double imWidth,
 }
 
 
-int isPtInLineNeighbor(IdealLine2d line, cv::Point2d pt, double imageWidth)
+int isPtInLineNeighbor(const IdealLine2d &line, cv::Point2d pt, double imageWidth)
 // check if point is in the neighborhood of line,
 // input:  a line, a point
 // output: 0, if pt not in neiborhood of line
@@ -410,12 +415,11 @@ int isPtInLineNeighbor(IdealLine2d line, cv::Point2d pt, double imageWidth)
 //		   2, if pt in rightneighbor -
 // Note, before calling, line.gradient must have been computed !!
 {
-    double threshDistToLine
-    = min(imageWidth / 12.0, 100.0), //THRESH_LINE_NEIGHBOR_WIDTH,
-    threshDistAlongLine;
+    double threshDistToLine = lineNeighborWidth(imageWidth),
+           threshDistAlongLine;
 
-    cv::Point2d nDirect = cv::Point2d(line.lineEq().at<double>(0),
-                                      line.lineEq().at<double>(1));
+    cv::Vec3d eq = line.lineVec();
+    cv::Point2d nDirect = cv::Point2d(eq[0], eq[1]);
     cv::Point2d lineDirect =
         cv::Point2d(nDirect.y, -nDirect.x) * (1 / cv::norm(nDirect));
     cv::Point2d midPt = (line.extremity1 + line.extremity2) * 0.5;
@@ -424,14 +428,14 @@ int isPtInLineNeighbor(IdealLine2d line, cv::Point2d pt, double imageWidth)
     cv::Point2d diffVect = pt - midPt;
     double distAlongLine = abs(diffVect.dot(lineDirect))
                            / sqrt(double(lineDirect.x * lineDirect.x + lineDirect.y * lineDirect.y)),
-                           distToLine = point2LineDist(line.lineEq(), pt);
+                           distToLine = point2LineDist(eq, pt);
     threshDistAlongLine		= len / 2;
 
     if (distAlongLine <= threshDistAlongLine && distToLine <= threshDistToLine)
     {
         cv::Point2d gradPt = line.gradient * 100 + cv::Point2d(midPt);
-        double gradSign = cvpt2mat(gradPt).dot(line.lineEq()),
-               ptSign = cvpt2mat(pt).dot(line.lineEq());
+        double gradSign = eq[0] * gradPt.x + eq[1] * gradPt.y + eq[2],
+               ptSign = eq[0] * pt.x + eq[1] * pt.y + eq[2];
 
         if ((gradSign > 0) ^ (ptSign > 0)) //XOR
             return 1;
@@ -459,75 +463,124 @@ vector<cv::Point2d> sampleFromLine(IdealLine2d l, double stepSize)
 }
 
 
-vector<vector<int>> F_guidedLinematch(cv::Mat F, vector<IdealLine2d> lines1,
-                                      vector<IdealLine2d> lines2, cv::Mat img1, cv::Mat img2)
+// Samples of a line described by SURF for F-guided matching; desc has one row
+// per sample, idx maps a sample to its row, -1 if it cannot be described.
+struct LineSampleDescs
+{
+    cv::Point2d      direct;  // unit normal, on the side of the gradient
+    double           angle;   // keypoint orientation in degrees
+    vector<int>      idx;
+    cv::Mat          desc;
+};
+
+static void lineSampleOrientation(const IdealLine2d &l, LineSampleDescs &ld)
+// normal and keypoint orientation of line l, no image access
+{
+    cv::Vec3d eq = l.lineVec();
+    ld.direct = cv::Point2d(eq[0], eq[1]);
+    ld.direct = ld.direct * (1 / cv::norm(ld.direct));
+
+    if (l.gradient.dot(ld.direct) < 0)
+        ld.direct = ld.direct * (-1);
+
+    if (ld.direct.y > 0)
+        ld.angle = acos(ld.direct.x) * 180 / PI;
+    else
+        ld.angle = (2 * PI - acos(ld.direct.x)) * 180 / PI;
+}
+
+static void describeLineSamples(const cv::Mat &gImg, const vector<cv::Point2d> &pts,
+                                double patchDiameter, LineSampleDescs &ld)
+// describe the patches at pts, all with the orientation in ld, in one pass
+{
+    vector<cv::KeyPoint> kpts;
+
+    for (int k = 0; k < pts.size(); ++k)
+    {
+        // ensure descriptor can be computed
+        if (pts[k].x + patchDiameter / 2 > gImg.cols ||
+                pts[k].x - patchDiameter / 2 < 1 ||
+                pts[k].y + patchDiameter / 2 > gImg.rows ||
+                pts[k].y - patchDiameter / 2 < 1)
+            continue;
+
+        kpts.push_back(cv::KeyPoint(pts[k], patchDiameter, ld.angle, 0, 0, k));
+    }
+
+    ld.idx.assign(pts.size(), -1);
+
+    if (kpts.empty()) return;
+
+    cv::SurfDescriptorExtractor featExtractor;
+    featExtractor.compute(gImg, kpts, ld.desc); // may drop keypoints, keeps class_id
+
+    for (int r = 0; r < kpts.size(); ++r)
+        ld.idx[kpts[r].class_id] = r;
+}
+
+static double descDist(const cv::Mat &d1, int r1, const cv::Mat &d2, int r2)
+{
+    const float *a = d1.ptr<float>(r1), *b = d2.ptr<float>(r2);
+    double s = 0;
+
+    for (int c = 0; c < d1.cols; ++c)
+        s += (a[c] - b[c]) * (a[c] - b[c]);
+
+    return sqrt(s);
+}
+
+vector<vector<int>> F_guidedLinematch(cv::Mat F, const vector<IdealLine2d> &lines1,
+                                      const vector<IdealLine2d> &lines2, cv::Mat img1, cv::Mat img2,
+                                      bool describeAll)
+// Three phases: the cheap orientation, MSLD and distance checks select the
+// candidate pairs first. Only the lines of some candidate pair are described,
+// once, at the points sampleFromLine gives with the usual sample number; with
+// describeAll every line is, as before the checks were moved first (for the
+// bench, the matches are the same). A candidate pair is then scored from the
+// cached descriptors only: the epipolar transfer of a sample of lines1 onto
+// lines2 uses the nearest described sample of lines2, if it is within
+// sampleTol pixels, and is skipped otherwise.
 {
     if (F.empty())
         return vector<vector <int> >();
 
     double patchDiameter = 20; // point area diameter for featextractor
-    cv::SurfDescriptorExtractor featExtractor;
-    int	sampleNum = 10; // smaple points per line
+    double sampleTol = 3;      // max distance of a transferred sample to a described one
     cv::Mat scores =
         cv::Mat::zeros(lines1.size(), lines2.size(), CV_64F) + 1e6;
     vector<vector<int>> linePairIdx;
-
+    cv::Matx33d Fx = F;
 
     cv::Mat gImg1, gImg2;
 
-    if (img1.dims > 2)
-    {
+    if (img1.channels() > 1)
         cv::cvtColor(img1, gImg1, CV_RGB2GRAY);
-        cv::cvtColor(img2, gImg2, CV_RGB2GRAY);
-    }
     else
-    {
         gImg1 = img1;
-        gImg2 = img2;
-    }
 
-    for (int i = 0; i < lines1.size(); ++i)
-    {
-
-        double angle_i = -1;
-        double minScore = 1e6;
-        int minj;
-        cv::Point2d direct1 = cv::Point2d(lines1[i].lineEq().at<double>(0),
-                                          lines1[i].lineEq().at<double>(1));
-        direct1 = direct1 * (1 / cv::norm(direct1));
+    if (img2.channels() > 1)
+        cv::cvtColor(img2, gImg2, CV_RGB2GRAY);
+    else
+        gImg2 = img2;
 
-        if (lines1[i].gradient.dot(direct1) < 0)
-            direct1 = direct1 * (-1);
+    // ======= phase 1: candidate pairs =======
+    vector<LineSampleDescs> descs1(lines1.size()), descs2(lines2.size());
+    vector<vector<int>> cands(lines1.size());
+    vector<uchar> used2(lines2.size(), describeAll);
 
-        if (direct1.y > 0)
-            angle_i = acos(direct1.x) * 180 / PI;
-        else
-            angle_i = (2 * PI - acos(direct1.x)) * 180 / PI;
+    for (int i = 0; i < lines1.size(); ++i)
+        lineSampleOrientation(lines1[i], descs1[i]);
 
-        sampleNum = max(10, (int)ceil(2 * lines1[i].length() / patchDiameter));
-        vector<cv::Point2d> pts1 = sampleFromLine(lines1[i], sampleNum);
+    for (int j = 0; j < lines2.size(); ++j)
+        lineSampleOrientation(lines2[j], descs2[j]);
 
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < lines1.size(); ++i)
+    {
         for (int j = 0; j < lines2.size(); ++j)
         {
-            // compute matching score for each pair
-            double angle_j = -1;
-            vector<cv::KeyPoint> kpts1(0), kpts2(0);
-            cv::Mat desc1, desc2;
-
-            cv::Point2d direct2 = cv::Point2d(
-                                      lines2[j].lineEq().at<double>(0), lines2[j].lineEq().at<double>(1));
-            direct2 = direct2 * (1 / cv::norm(direct2));
-
-            if (lines2[j].gradient.dot(direct2) < 0)
-                direct2 = direct2 * (-1);
-
-            if (direct2.y > 0)
-                angle_j = acos(direct2.x) * 180 / PI;
-            else
-                angle_j = (2 * PI - acos(direct2.x)) * 180 / PI;
-
             // == gradient orientation check
-            if (direct1.dot(direct2) < 0)
+            if (descs1[i].direct.dot(descs2[j].direct) < 0)
                 continue;
 
             // == MSLD similarity check
@@ -538,51 +591,81 @@ vector<vector<int>> F_guidedLinematch(cv::Mat F, vector<IdealLine2d> lines1,
             if (aveLine2LineDist(lines1[i], lines2[j]) > img1.cols / 5.0)
                 continue;
 
-            for (int k = 0; k < pts1.size(); ++k)
-            {
-                // ensure sift-descriptor can be computed
-                if (pts1[k].x + patchDiameter / 2 > img1.cols ||
-                        pts1[k].x - patchDiameter / 2 < 1 ||
-                        pts1[k].y + patchDiameter / 2 > img1.rows ||
-                        pts1[k].y - patchDiameter / 2 < 1)
-                    continue;
+            cands[i].push_back(j);
+        }
+    }
+
+    for (int i = 0; i < lines1.size(); ++i)
+        for (int k = 0; k < cands[i].size(); ++k)
+            used2[cands[i][k]] = 1;
+
+    // ======= phase 2: describe line samples =======
+    vector<vector<cv::Point2d>> pts1(lines1.size()), pts2(lines2.size());
+    vector<cv::Vec3d> eqs2(lines2.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < lines1.size(); ++i)
+    {
+        if (cands[i].empty() && !describeAll)
+            continue;
+
+        int sampleNum = max(10, (int)ceil(2 * lines1[i].length() / patchDiameter));
+        pts1[i] = sampleFromLine(lines1[i], sampleNum);
+        describeLineSamples(gImg1, pts1[i], patchDiameter, descs1[i]);
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < lines2.size(); ++j)
+    {
+        if (!used2[j])
+            continue;
 
-                cv::KeyPoint kp1(pts1[k], patchDiameter, angle_i);
+        eqs2[j] = lines2[j].lineVec();
+        int sampleNum = max(10, (int)ceil(2 * lines2[j].length() / patchDiameter));
+        pts2[j] = sampleFromLine(lines2[j], sampleNum);
+        describeLineSamples(gImg2, pts2[j], patchDiameter, descs2[j]);
+    }
 
-                cv::Point2d p2 = mat2cvpt(
-                                     lines2[j].lineEq().cross(F * cvpt2mat(pts1[k], 1)));
+    // ======= phase 3: score candidate pairs =======
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < lines1.size(); ++i)
+    {
+        const LineSampleDescs &ld1 = descs1[i];
 
-                // ensure sift-descriptor can be computed
-                if (p2.x + patchDiameter / 2 > img1.cols ||
-                        p2.x - patchDiameter / 2 < 1 ||
-                        p2.y + patchDiameter / 2 > img1.rows ||
-                        p2.y - patchDiameter / 2 < 1)
+        for (int c = 0; c < cands[i].size(); ++c)
+        {
+            int j = cands[i][c];
+            const LineSampleDescs &ld2 = descs2[j];
+            cv::Point2d u2 = (lines2[j].extremity2 - lines2[j].extremity1)
+                             * (1 / lines2[j].length());
+            double step2 = lines2[j].length() / (pts2[j].size() - 1);
+            double sum = 0;
+            int num = 0;
+
+            for (int k = 0; k < pts1[i].size(); ++k)
+            {
+                if (ld1.idx[k] < 0)
                     continue;
 
+                cv::Vec3d h2 = eqs2[j].cross(Fx * cv::Vec3d(pts1[i][k].x, pts1[i][k].y, 1));
+                cv::Point2d p2(h2[0] / h2[2], h2[1] / h2[2]);
+
                 if (!isPtOnLineSegment(p2, lines2[j]))
                     continue;
 
-                cv::KeyPoint kp2(p2, patchDiameter, angle_j);
-                kpts1.push_back(kp1);
-                kpts2.push_back(kp2);
-            }
-
-            if (kpts1.size() == 0)
-            {
-                scores.at<double>(i, j) = 1e6;
-                continue;
-            }
+                int k2 = cvRound((p2 - lines2[j].extremity1).dot(u2) / step2);
 
-            featExtractor.compute(gImg1, kpts1, desc1);
-            featExtractor.compute(gImg2, kpts2, desc2);
-            double sum = 0;
+                if (k2 < 0 || k2 >= ld2.idx.size() || ld2.idx[k2] < 0
+                        || cv::norm(p2 - pts2[j][k2]) > sampleTol)
+                    continue;
 
-            for (int k = 0; k < kpts1.size(); ++k)
-                sum = sum + cv::norm(desc1.row(k) - desc2.row(k));
+                sum += descDist(ld1.desc, ld1.idx[k], ld2.desc, ld2.idx[k2]);
+                ++num;
+            }
 
-            scores.at<double>(i, j) = sum / kpts1.size();
+            if (num > 0)
+                scores.at<double>(i, j) = sum / num;
         }
-
     }
 
     // ============  Identify matches based on simlarity matrix ==========
@@ -651,11 +734,23 @@ void  matchIdealLines(View &view1, View &view2, vector<vector<int>> vpPairIdx,
     //==  point based line matching ==
     if (usePtMatch)
     {
+        // index the matched points once for all vp groups
+        vector<cv::Point2d> pts1(featPtMatches.size()), pts2(featPtMatches.size());
+
+        for (int i = 0; i < featPtMatches.size(); ++i)
+        {
+            pts1[i] = featPtMatches[i][0];
+            pts2[i] = featPtMatches[i][1];
+        }
+
+        double cellSize = lineNeighborWidth(view1.img.cols) / 2;
+        PointGrid grid1(pts1, cellSize), grid2(pts2, cellSize);
+
         for (int i = 0; i < vpPairIdx.size(); ++i)
         {
             int vpIdx1 = vpPairIdx[i][0], vpIdx2 = vpPairIdx[i][1];
             matchLinesByPointPairs(view1.img.cols,	grpLines1[vpIdx1],
-                                   grpLines2[vpIdx2],	featPtMatches, ilinePairIdx);
+                                   grpLines2[vpIdx2],	featPtMatches, grid1, grid2, ilinePairIdx);
         }
 
         // check gradient consistency and msld similarity
@@ -717,7 +812,7 @@ void  matchIdealLines(View &view1, View &view2, vector<vector<int>> vpPairIdx,
 
         vector<vector<int>> tmpPairs;
         tmpPairs = F_guidedLinematch(F, grpLines1[vpIdx1], grpLines2[vpIdx2],
-                                     view1.img, view2.img);
+                                     view1.grayImg, view2.grayImg);
         ilinePairIdx_F.insert(ilinePairIdx_F.end(), tmpPairs.begin(), tmpPairs.end());
     }
 
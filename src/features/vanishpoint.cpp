@@ -51,8 +51,10 @@ void refineVanishPt(const vector<LineSegmt2d> &allLs, vector<int> &lsIdx,
 
         for (int i = 0; i < ls.size(); ++i)
         {
-            cv::Mat eq = ls[i].lineEq();
-            eq.copyTo(A.col(i));
+            cv::Vec3d eq = ls[i].lineVec();
+
+            for (int k = 0; k < 3; ++k)
+                A.at<double>(k, i) = eq[k];
         }
 
         if (A.cols == 2)
@@ -101,8 +103,10 @@ void refineVanishPt(const vector<LineSegmt2d> &allLs, vector<int> &lsIdx,
 
         for (int i = 0; i < ls.size(); ++i)
         {
-            cv::Mat eq = ls[i].lineEq();
-            eq.copyTo(A.col(i));
+            cv::Vec3d eq = ls[i].lineVec();
+
+            for (int k = 0; k < 3; ++k)
+                A.at<double>(k, i) = eq[k];
         }
 
         if (A.cols == 2)
@@ -0,0 +1,308 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Vocabulary tree of visual words for bag-of-words place recognition
+ ********************************************************************************/
+
+#include "vocabulary.h"
+
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+static const char VOC_MAGIC[8] = {'M', 'F', 'G', 'V', 'O', 'C', '0', '1'};
+
+void Vocabulary::create(const vector<cv::Mat> &imageDescs)
+{
+    nodes.clear();
+    words.clear();
+    idf.clear();
+
+    cv::Mat all;
+
+    for (int i = 0; i < imageDescs.size(); ++i)
+    {
+        if (!imageDescs[i].empty())
+            all.push_back(imageDescs[i]);
+    }
+
+    if (all.empty()) return;
+
+    all.convertTo(all, CV_32F);
+
+    nodes.push_back(Node());
+    nodes[0].center = cv::Mat::zeros(1, all.cols, CV_32F);
+    nodes[0].wordId = -1;
+    split(0, all, 1);
+
+    // idf = log(N / N_i), N_i = num of training images containing word i
+    vector<int> numImages(words.size(), 0);
+
+    for (int i = 0; i < imageDescs.size(); ++i)
+    {
+        cv::Mat descs;
+        imageDescs[i].convertTo(descs, CV_32F);
+        set<int> seen;
+
+        for (int j = 0; j < descs.rows; ++j)
+            seen.insert(word(descs.ptr<float>(j)));
+
+        for (set<int>::iterator it = seen.begin(); it != seen.end(); ++it)
+            ++numImages[*it];
+    }
+
+    idf.resize(words.size());
+
+    for (int i = 0; i < words.size(); ++i)
+        idf[i] = log((double)imageDescs.size() / max(1, numImages[i]));
+}
+
+void Vocabulary::split(int node, const cv::Mat &descs, int level)
+// cluster descs, which all belong to node, into its children
+{
+    if (level > levels || descs.rows <= k)
+    {
+        nodes[node].wordId = words.size();
+        words.push_back(node);
+        return;
+    }
+
+    cv::Mat labels, centers;
+    cv::kmeans(descs, k, labels,
+               cv::TermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 10, 1e-4),
+               1, cv::KMEANS_PP_CENTERS, centers);
+
+    vector<cv::Mat> clusters(k);
+
+    for (int i = 0; i < descs.rows; ++i)
+        clusters[labels.at<int>(i)].push_back(descs.row(i));
+
+    for (int c = 0; c < k; ++c)
+    {
+        if (clusters[c].empty()) continue;
+
+        int child = nodes.size();
+        nodes.push_back(Node());
+        nodes[child].center = centers.row(c).clone();
+        nodes[child].wordId = -1;
+        nodes[node].children.push_back(child);
+    }
+
+    // children are split after all of them exist, nodes may be reallocated
+    for (int i = 0, c = 0; c < k; ++c)
+    {
+        if (clusters[c].empty()) continue;
+
+        split(nodes[node].children[i++], clusters[c], level + 1);
+    }
+}
+
+int Vocabulary::word(const float *desc) const
+{
+    int node = 0;
+    int dim = descriptorSize();
+
+    while (!nodes[node].children.empty())
+    {
+        const vector<int> &children = nodes[node].children;
+        int best = children[0];
+        float bestDist = -1;
+
+        for (int i = 0; i < children.size(); ++i)
+        {
+            const float *c = nodes[children[i]].center.ptr<float>(0);
+            float d = 0;
+
+            for (int j = 0; j < dim; ++j)
+                d += (desc[j] - c[j]) * (desc[j] - c[j]);
+
+            if (bestDist < 0 || d < bestDist)
+            {
+                bestDist = d;
+                best = children[i];
+            }
+        }
+
+        node = best;
+    }
+
+    return nodes[node].wordId;
+}
+
+void Vocabulary::transform(const cv::Mat &descs, BowVector &bow, vector<int> *rowWords) const
+{
+    bow.clear();
+
+    if (rowWords) rowWords->clear();
+
+    if (empty() || descs.empty() || descs.cols != descriptorSize()) return;
+
+    cv::Mat d;
+    descs.convertTo(d, CV_32F);
+
+    for (int i = 0; i < d.rows; ++i)
+    {
+        int w = word(d.ptr<float>(i));
+        bow[w] += idf[w];
+
+        if (rowWords) rowWords->push_back(w);
+    }
+
+    double sum = 0;
+
+    for (BowVector::iterator it = bow.begin(); it != bow.end(); ++it)
+        sum += it->second;
+
+    if (sum <= 0) return;
+
+    for (BowVector::iterator it = bow.begin(); it != bow.end(); ++it)
+        it->second /= sum;
+}
+
+double Vocabulary::score(const BowVector &a, const BowVector &b)
+// for L1 normalized vectors |a - b|_1 = 2 - sum over common words of
+// (a_i + b_i - |a_i - b_i|), so only common words are visited
+{
+    double s = 0;
+    BowVector::const_iterator ia = a.begin(), ib = b.begin();
+
+    while (ia != a.end() && ib != b.end())
+    {
+        if (ia->first < ib->first)
+            ++ia;
+        else if (ib->first < ia->first)
+            ++ib;
+        else
+        {
+            s += ia->second + ib->second - fabs(ia->second - ib->second);
+            ++ia;
+            ++ib;
+        }
+    }
+
+    return s / 2;
+}
+
+// File layout: magic, k, levels, dim, num of nodes, then per node its parent
+// (-1 for the root), word id and center, then the idf of each word. Children
+// are stored after their parent in the order they were created.
+bool Vocabulary::save(const string &fname) const
+{
+    ofstream os(fname.c_str(), ios::binary);
+
+    if (!os.is_open())
+    {
+        cerr << "Vocabulary: cannot write " << fname << endl;
+        return false;
+    }
+
+    int dim = descriptorSize();
+    int numNodes = nodes.size();
+    vector<int> parent(numNodes, -1);
+
+    for (int i = 0; i < numNodes; ++i)
+        for (int j = 0; j < nodes[i].children.size(); ++j)
+            parent[nodes[i].children[j]] = i;
+
+    os.write(VOC_MAGIC, sizeof(VOC_MAGIC));
+    os.write((const char *)&k, sizeof(int));
+    os.write((const char *)&levels, sizeof(int));
+    os.write((const char *)&dim, sizeof(int));
+    os.write((const char *)&numNodes, sizeof(int));
+
+    for (int i = 0; i < numNodes; ++i)
+    {
+        os.write((const char *)&parent[i], sizeof(int));
+        os.write((const char *)&nodes[i].wordId, sizeof(int));
+        os.write((const char *)nodes[i].center.ptr<float>(0), dim * sizeof(float));
+    }
+
+    if (!idf.empty())
+        os.write((const char *)&idf[0], idf.size() * sizeof(double));
+
+    return os.good();
+}
+
+bool Vocabulary::load(const string &fname)
+{
+    nodes.clear();
+    words.clear();
+    idf.clear();
+
+    ifstream is(fname.c_str(), ios::binary);
+    char magic[sizeof(VOC_MAGIC)];
+    int dim = 0, numNodes = 0;
+
+    if (!is.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), VOC_MAGIC))
+    {
+        cerr << "Vocabulary: " << fname << " is not a vocabulary file" << endl;
+        return false;
+    }
+
+    is.read((char *)&k, sizeof(int));
+    is.read((char *)&levels, sizeof(int));
+    is.read((char *)&dim, sizeof(int));
+    is.read((char *)&numNodes, sizeof(int));
+
+    nodes.resize(numNodes);
+
+    for (int i = 0; i < numNodes && is; ++i)
+    {
+        int parent;
+        is.read((char *)&parent, sizeof(int));
+        is.read((char *)&nodes[i].wordId, sizeof(int));
+        nodes[i].center.create(1, dim, CV_32F);
+        is.read((char *)nodes[i].center.ptr<float>(0), dim * sizeof(float));
+
+        if (parent >= 0)
+            nodes[parent].children.push_back(i);
+
+        if (nodes[i].wordId >= 0)
+        {
+            if (words.size() <= nodes[i].wordId)
+                words.resize(nodes[i].wordId + 1);
+
+            words[nodes[i].wordId] = i;
+        }
+    }
+
+    idf.resize(words.size());
+
+    if (!idf.empty())
+        is.read((char *)&idf[0], idf.size() * sizeof(double));
+
+    if (!is || words.empty())
+    {
+        cerr << "Vocabulary: " << fname << " is truncated" << endl;
+        nodes.clear();
+        words.clear();
+        idf.clear();
+        return false;
+    }
+
+    return true;
+}
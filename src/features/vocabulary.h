@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Vocabulary tree of visual words for bag-of-words place recognition
+ ********************************************************************************/
+
+#ifndef VOCABULARY_H_
+#define VOCABULARY_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// Bag of words: word id -> tf-idf weight, L1 normalized
+typedef std::map<int, double> BowVector;
+
+// Vocabulary is a hierarchical k-means tree over float descriptors (SURF/SIFT):
+// every node has up to k children, the leaves are the words. A descriptor is
+// quantized by descending to the closest child at each level, so lookup costs
+// k*levels distances. Words are weighted by their inverse document frequency
+// in the training images.
+class Vocabulary
+{
+public:
+    Vocabulary(int _k = 10, int _levels = 5) : k(_k), levels(_levels) {}
+
+    // build from the descriptors of a set of training images, one CV_32F
+    // descriptor per row
+    void create(const std::vector<cv::Mat> &imageDescs);
+
+    bool save(const std::string &fname) const;
+    bool load(const std::string &fname);
+
+    bool empty() const { return words.empty(); }
+    int  size() const { return words.size(); }
+    int  descriptorSize() const { return nodes.empty() ? 0 : nodes[0].center.cols; }
+
+    // word of a descriptor of descriptorSize() floats
+    int  word(const float *desc) const;
+    // bag of words of a set of descriptors, one per row, and optionally the word
+    // of each row
+    void transform(const cv::Mat &descs, BowVector &bow, std::vector<int> *rowWords = 0) const;
+
+    // similarity of two bags of words in [0, 1], 1 - |a - b|_1 / 2
+    static double score(const BowVector &a, const BowVector &b);
+
+private:
+    struct Node
+    {
+        cv::Mat          center;   // 1 x dim, CV_32F
+        std::vector<int> children;
+        int              wordId;   // -1 for inner nodes
+    };
+
+    int k, levels;
+    std::vector<Node>   nodes;    // nodes[0] is the root
+    std::vector<int>    words;    // node of each word
+    std::vector<double> idf;      // weight of each word
+
+    void split(int node, const cv::Mat &descs, int level);
+};
+
+#endif
@@ -0,0 +1,792 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * MFG archive: append-only binary file of retired keyframes and landmarks
+ ********************************************************************************/
+
+#include "archive.h"
+
+#include <iostream>
+#include <stdint.h>
+
+using namespace std;
+
+// ----- plain binary (de)serialization, native byte order -----
+
+template <typename T>
+static void put(ostream &os, const T &val)
+{
+    os.write(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+template <typename T>
+static void get(istream &is, T &val)
+{
+    is.read(reinterpret_cast<char *>(&val), sizeof(T));
+}
+
+static void putStr(ostream &os, const string &s)
+{
+    put(os, (int32_t)s.size());
+    os.write(s.data(), s.size());
+}
+
+static void getStr(istream &is, string &s)
+{
+    int32_t n = 0;
+    get(is, n);
+    s.resize(max(0, n));
+    if (n > 0) is.read(&s[0], n);
+}
+
+static void putMat(ostream &os, const cv::Mat &m)
+{
+    cv::Mat c = m.isContinuous() ? m : m.clone();
+    put(os, (int32_t)c.rows);
+    put(os, (int32_t)c.cols);
+    put(os, (int32_t)c.type());
+    if (!c.empty()) os.write(reinterpret_cast<const char *>(c.data), c.total() * c.elemSize());
+}
+
+static void getMat(istream &is, cv::Mat &m)
+{
+    int32_t rows = 0, cols = 0, type = 0;
+    get(is, rows);
+    get(is, cols);
+    get(is, type);
+
+    if (rows <= 0 || cols <= 0)
+    {
+        m = cv::Mat();
+        return;
+    }
+
+    m.create(rows, cols, type);
+    is.read(reinterpret_cast<char *>(m.data), m.total() * m.elemSize());
+}
+
+static void putPt(ostream &os, const cv::Point2d &p)
+{
+    put(os, p.x);
+    put(os, p.y);
+}
+
+static void getPt(istream &is, cv::Point2d &p)
+{
+    get(is, p.x);
+    get(is, p.y);
+}
+
+static void putIdList(ostream &os, const vector<int> &ids)
+{
+    put(os, (int32_t)ids.size());
+    for (int i = 0; i < ids.size(); ++i) put(os, (int32_t)ids[i]);
+}
+
+static void getIdList(istream &is, vector<int> &ids)
+{
+    int32_t n = 0, id;
+    get(is, n);
+    ids.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        get(is, id);
+        ids.push_back(id);
+    }
+}
+
+static void putObs(ostream &os, const vector<vector<int> > &obs) // (viewId, lid) pairs
+{
+    put(os, (int32_t)obs.size());
+    for (int i = 0; i < obs.size(); ++i)
+    {
+        put(os, (int32_t)obs[i][0]);
+        put(os, (int32_t)obs[i][1]);
+    }
+}
+
+static void getObs(istream &is, vector<vector<int> > &obs)
+{
+    int32_t n = 0, vid, lid;
+    get(is, n);
+    obs.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        get(is, vid);
+        get(is, lid);
+        vector<int> o(2);
+        o[0] = vid;
+        o[1] = lid;
+        obs.push_back(o);
+    }
+}
+
+static void putView(ostream &os, const View &v, const cv::Mat &R, const cv::Mat &t) // pose as stored
+{
+    put(os, (int32_t)v.frameId);
+    putStr(os, v.filename);
+    putMat(os, v.K);
+    putMat(os, R);
+    putMat(os, t);
+    put(os, v.angVel);
+    put(os, v.lsLenThresh);
+
+    put(os, (int32_t)v.featurePoints.size());
+    for (int i = 0; i < v.featurePoints.size(); ++i)
+    {
+        const FeatPoint2d &p = v.featurePoints[i];
+        put(os, p.x);
+        put(os, p.y);
+        put(os, (int32_t)p.lid);
+        put(os, (int32_t)p.gid);
+        putMat(os, p.siftDesc); // empty once released, see appendDescriptors
+    }
+
+    put(os, (int32_t)v.idealLines.size());
+    for (int i = 0; i < v.idealLines.size(); ++i)
+    {
+        const IdealLine2d &l = v.idealLines[i];
+        put(os, (int32_t)l.lid);
+        put(os, (int32_t)l.gid);
+        put(os, (int32_t)l.vpLid);
+        put(os, (int32_t)l.pGid);
+        putPt(os, l.extremity1);
+        putPt(os, l.extremity2);
+        putPt(os, l.gradient);
+        putIdList(os, l.lsLids);
+        put(os, (int32_t)l.lsEndpoints.size());
+        for (int j = 0; j < l.lsEndpoints.size(); ++j) putPt(os, l.lsEndpoints[j]);
+    }
+
+    put(os, (int32_t)v.vanishPoints.size());
+    for (int i = 0; i < v.vanishPoints.size(); ++i)
+    {
+        const VanishPnt2d &p = v.vanishPoints[i];
+        put(os, p.x);
+        put(os, p.y);
+        put(os, p.w);
+        put(os, (int32_t)p.lid);
+        put(os, (int32_t)p.gid);
+        putIdList(os, p.idlnLids);
+        putMat(os, p.cov);
+        putMat(os, p.cov_ab);
+        putMat(os, p.cov_homo);
+    }
+}
+
+static void getView(istream &is, int id, View &v)
+{
+    int32_t n = 0, ival;
+
+    v.id = id;
+    get(is, ival);
+    v.frameId = ival;
+    getStr(is, v.filename);
+    getMat(is, v.K);
+    getMat(is, v.R);
+    getMat(is, v.t);
+    get(is, v.angVel);
+    get(is, v.lsLenThresh);
+    v.matchable = false; // no images and descriptors
+
+    get(is, n);
+    v.featurePoints.resize(max(0, n));
+    for (int i = 0; i < n; ++i)
+    {
+        FeatPoint2d &p = v.featurePoints[i];
+        get(is, p.x);
+        get(is, p.y);
+        get(is, ival);
+        p.lid = ival;
+        get(is, ival);
+        p.gid = ival;
+        getMat(is, p.siftDesc);
+    }
+
+    get(is, n);
+    v.idealLines.resize(max(0, n));
+    for (int i = 0; i < n; ++i)
+    {
+        IdealLine2d &l = v.idealLines[i];
+        get(is, ival);
+        l.lid = ival;
+        get(is, ival);
+        l.gid = ival;
+        get(is, ival);
+        l.vpLid = ival;
+        get(is, ival);
+        l.pGid = ival;
+        getPt(is, l.extremity1);
+        getPt(is, l.extremity2);
+        getPt(is, l.gradient);
+        getIdList(is, l.lsLids);
+        int32_t m = 0;
+        get(is, m);
+        l.lsEndpoints.resize(max(0, m));
+        for (int j = 0; j < m; ++j) getPt(is, l.lsEndpoints[j]);
+    }
+
+    get(is, n);
+    v.vanishPoints.resize(max(0, n));
+    for (int i = 0; i < n; ++i)
+    {
+        VanishPnt2d &p = v.vanishPoints[i];
+        get(is, p.x);
+        get(is, p.y);
+        get(is, p.w);
+        get(is, ival);
+        p.lid = ival;
+        get(is, ival);
+        p.gid = ival;
+        getIdList(is, p.idlnLids);
+        getMat(is, p.cov);
+        getMat(is, p.cov_ab);
+        getMat(is, p.cov_homo);
+    }
+}
+
+static void putKeyPoint(ostream &os, const KeyPoint3d &p)
+{
+    put(os, p.x);
+    put(os, p.y);
+    put(os, p.z);
+    put(os, (int32_t)p.pGid);
+    put(os, (int32_t)p.is3D);
+    put(os, (int32_t)p.estViewId);
+    putObs(os, p.viewId_ptLid);
+}
+
+static void getKeyPoint(istream &is, int gid, KeyPoint3d &p)
+{
+    int32_t ival;
+
+    p.gid = gid;
+    get(is, p.x);
+    get(is, p.y);
+    get(is, p.z);
+    get(is, ival);
+    p.pGid = ival;
+    get(is, ival);
+    p.is3D = ival != 0;
+    get(is, ival);
+    p.estViewId = ival;
+    getObs(is, p.viewId_ptLid);
+}
+
+static void putIdealLine(ostream &os, const IdealLine3d &l)
+{
+    put(os, l.midpt.x);
+    put(os, l.midpt.y);
+    put(os, l.midpt.z);
+    putMat(os, cv::Mat(l.direct));
+    put(os, l.length);
+    put(os, (int32_t)l.pGid);
+    put(os, (int32_t)l.vpGid);
+    put(os, (int32_t)l.is3D);
+    put(os, (int32_t)l.estViewId);
+    putObs(os, l.viewId_lnLid);
+}
+
+static void getIdealLine(istream &is, int gid, IdealLine3d &l)
+{
+    int32_t ival;
+
+    l.gid = gid;
+    get(is, l.midpt.x);
+    get(is, l.midpt.y);
+    get(is, l.midpt.z);
+    cv::Mat d;
+    getMat(is, d);
+    l.direct = d.total() == 3 ? cv::Vec3d(d) : cv::Vec3d();
+    get(is, l.length);
+    get(is, ival);
+    l.pGid = ival;
+    get(is, ival);
+    l.vpGid = ival;
+    get(is, ival);
+    l.is3D = ival != 0;
+    get(is, ival);
+    l.estViewId = ival;
+    getObs(is, l.viewId_lnLid);
+}
+
+// ----- keyframe corrections, X' = A*X = AR*X + At -----
+
+static bool isPose(const cv::Mat &R, const cv::Mat &t)
+{
+    return R.rows == 3 && R.cols == 3 && R.type() == CV_64FC1
+           && t.total() == 3 && t.type() == CV_64FC1;
+}
+
+static int firstView(const vector<vector<int> > &obs)
+{
+    return obs.empty() ? -1 : obs[0][0];
+}
+
+static void undoPose(const cv::Matx33d &AR, const cv::Vec3d &At, cv::Mat &R, cv::Mat &t)
+// pose before the correction: R0 = R*AR, t0 = t + R*At
+{
+    cv::Matx33d Rm = R;
+    cv::Vec3d tm(t.at<double>(0), t.at<double>(1), t.at<double>(2));
+    R = cv::Mat(Rm * AR);
+    t = cv::Mat(tm + Rm * At);
+}
+
+static void redoPose(const cv::Matx33d &AR, const cv::Vec3d &At, cv::Mat &R, cv::Mat &t)
+// R = R0*AR', t = t0 - R*At
+{
+    cv::Matx33d Rm = R;
+    cv::Vec3d tm(t.at<double>(0), t.at<double>(1), t.at<double>(2));
+    Rm = Rm * AR.t();
+    R = cv::Mat(Rm);
+    t = cv::Mat(tm - Rm * At);
+}
+
+static cv::Point3d undoPoint(const cv::Matx33d &AR, const cv::Vec3d &At, const cv::Point3d &X)
+{
+    cv::Vec3d X0 = AR.t() * (cv::Vec3d(X.x, X.y, X.z) - At);
+    return cv::Point3d(X0[0], X0[1], X0[2]);
+}
+
+static cv::Point3d redoPoint(const cv::Matx33d &AR, const cv::Vec3d &At, const cv::Point3d &X0)
+{
+    cv::Vec3d X = AR * cv::Vec3d(X0.x, X0.y, X0.z) + At;
+    return cv::Point3d(X[0], X[1], X[2]);
+}
+
+// ----- MfgArchive -----
+
+MfgArchive::~MfgArchive()
+// the correction table goes last, load() applies it to all records
+{
+    if (!file.is_open()) return;
+
+    if (!corrR.empty())
+    {
+        file.clear();
+        file.seekp(0, ios::end);
+        put(file, (int32_t)REC_CORRECTION);
+        put(file, (int32_t)corrR.size());
+
+        for (int i = 0; i < corrR.size(); ++i)
+        {
+            for (int k = 0; k < 9; ++k) put(file, corrR[i].val[k]);
+            for (int k = 0; k < 3; ++k) put(file, corrT[i][k]);
+        }
+    }
+
+    file.close();
+}
+
+void MfgArchive::correction(int id, cv::Matx33d &R, cv::Vec3d &t) const
+// cumulative correction of keyframe id, mtx must be held
+{
+    if (id >= 0 && id < corrR.size())
+    {
+        R = corrR[id];
+        t = corrT[id];
+    }
+    else
+    {
+        R = cv::Matx33d::eye();
+        t = cv::Vec3d(0, 0, 0);
+    }
+}
+
+void MfgArchive::correct(const vector<cv::Matx33d> &Rc, const vector<cv::Vec3d> &tc, int numViews)
+// C*A: R = Rc*AR, t = Rc*At + tc
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (Rc.empty()) return;
+
+    int n = Rc.size();
+
+    if (corrR.size() < numViews)
+    {
+        corrR.resize(numViews, cv::Matx33d::eye());
+        corrT.resize(numViews, cv::Vec3d(0, 0, 0));
+    }
+
+    for (int i = 0; i < numViews; ++i)
+    {
+        int c = min(i, n - 1);
+        corrR[i] = Rc[c] * corrR[i];
+        corrT[i] = Rc[c] * corrT[i] + tc[c];
+    }
+}
+
+bool MfgArchive::open(const string &fname)
+{
+    lock_guard<mutex> lock(mtx);
+
+    filename = fname;
+    file.open(fname.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
+
+    if (!file.is_open())
+    {
+        cerr << "MfgArchive: cannot open " << fname << endl;
+        return false;
+    }
+
+    viewIdx.clear();
+    kptIdx.clear();
+    ilnIdx.clear();
+    descIdx.clear();
+    corrR.clear();
+    corrT.clear();
+    return true;
+}
+
+void MfgArchive::appendView(const View &v)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!file.is_open() || viewIdx.count(v.id)) return;
+
+    file.clear();
+    file.seekp(0, ios::end);
+    viewIdx[v.id] = file.tellp();
+    put(file, (int32_t)REC_VIEW);
+    put(file, (int32_t)v.id);
+
+    cv::Mat R = v.R, t = v.t;
+
+    if (isPose(R, t))
+    {
+        cv::Matx33d AR;
+        cv::Vec3d At;
+        correction(v.id, AR, At);
+        undoPose(AR, At, R, t);
+    }
+
+    putView(file, v, R, t);
+    file.flush();
+}
+
+void MfgArchive::appendKeyPoint(const KeyPoint3d &kpt)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!file.is_open() || kptIdx.count(kpt.gid)) return;
+
+    file.clear();
+    file.seekp(0, ios::end);
+    kptIdx[kpt.gid] = file.tellp();
+    put(file, (int32_t)REC_KEYPOINT);
+    put(file, (int32_t)kpt.gid);
+
+    cv::Matx33d AR;
+    cv::Vec3d At;
+    correction(firstView(kpt.viewId_ptLid), AR, At);
+    KeyPoint3d p = kpt;
+    cv::Point3d X0 = undoPoint(AR, At, cv::Point3d(kpt.x, kpt.y, kpt.z));
+    p.x = X0.x;
+    p.y = X0.y;
+    p.z = X0.z;
+    putKeyPoint(file, p);
+}
+
+void MfgArchive::appendIdealLine(const IdealLine3d &iln)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!file.is_open() || ilnIdx.count(iln.gid)) return;
+
+    file.clear();
+    file.seekp(0, ios::end);
+    ilnIdx[iln.gid] = file.tellp();
+    put(file, (int32_t)REC_IDEALLINE);
+    put(file, (int32_t)iln.gid);
+
+    cv::Matx33d AR;
+    cv::Vec3d At;
+    correction(firstView(iln.viewId_lnLid), AR, At);
+    IdealLine3d l = iln;
+    l.midpt = undoPoint(AR, At, iln.midpt);
+    l.direct = AR.t() * iln.direct;
+
+    putIdealLine(file, l);
+}
+
+void MfgArchive::appendDescriptors(const View &v)
+{
+    vector<int> lids;
+    cv::Mat descs;
+
+    for (int i = 0; i < v.featurePoints.size(); ++i)
+    {
+        if (v.featurePoints[i].gid < 0 || v.featurePoints[i].siftDesc.empty()) continue;
+
+        lids.push_back(i);
+        descs.push_back(cv::Mat(v.featurePoints[i].siftDesc.reshape(1, 1)));
+    }
+
+    lock_guard<mutex> lock(mtx);
+
+    if (!file.is_open() || descIdx.count(v.id)) return;
+
+    file.clear();
+    file.seekp(0, ios::end);
+    descIdx[v.id] = file.tellp();
+    put(file, (int32_t)REC_DESCRIPTORS);
+    put(file, (int32_t)v.id);
+    putIdList(file, lids);
+    putMat(file, descs);
+}
+
+bool MfgArchive::hasView(int id) const
+{
+    lock_guard<mutex> lock(mtx);
+    return viewIdx.count(id) > 0;
+}
+
+bool MfgArchive::hasKeyPoint(int gid) const
+{
+    lock_guard<mutex> lock(mtx);
+    return kptIdx.count(gid) > 0;
+}
+
+bool MfgArchive::hasIdealLine(int gid) const
+{
+    lock_guard<mutex> lock(mtx);
+    return ilnIdx.count(gid) > 0;
+}
+
+int MfgArchive::numKeyPoints() const
+{
+    lock_guard<mutex> lock(mtx);
+    return kptIdx.size();
+}
+
+int MfgArchive::numIdealLines() const
+{
+    lock_guard<mutex> lock(mtx);
+    return ilnIdx.size();
+}
+
+vector<int> MfgArchive::keyPointIds() const
+{
+    lock_guard<mutex> lock(mtx);
+    vector<int> ids;
+
+    for (map<int, streamoff>::const_iterator it = kptIdx.begin(); it != kptIdx.end(); ++it)
+        ids.push_back(it->first);
+
+    return ids;
+}
+
+vector<int> MfgArchive::idealLineIds() const
+{
+    lock_guard<mutex> lock(mtx);
+    vector<int> ids;
+
+    for (map<int, streamoff>::const_iterator it = ilnIdx.begin(); it != ilnIdx.end(); ++it)
+        ids.push_back(it->first);
+
+    return ids;
+}
+
+bool MfgArchive::seekRecord(const map<int, streamoff> &idx, int id)
+// position the read pointer at the payload of record id, mtx must be held
+{
+    map<int, streamoff>::const_iterator it = idx.find(id);
+
+    if (!file.is_open() || it == idx.end()) return false;
+
+    file.clear();
+    file.flush();
+    file.seekg(it->second + 2 * sizeof(int32_t)); // skip type and id
+    return file.good();
+}
+
+bool MfgArchive::readView(int id, View &v)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!seekRecord(viewIdx, id)) return false;
+
+    getView(file, id, v);
+
+    if (!file.good()) return false;
+
+    if (isPose(v.R, v.t))
+    {
+        cv::Matx33d AR;
+        cv::Vec3d At;
+        correction(id, AR, At);
+        redoPose(AR, At, v.R, v.t);
+    }
+
+    return true;
+}
+
+bool MfgArchive::readKeyPoint(int gid, KeyPoint3d &kpt)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!seekRecord(kptIdx, gid)) return false;
+
+    getKeyPoint(file, gid, kpt);
+
+    if (!file.good()) return false;
+
+    cv::Matx33d AR;
+    cv::Vec3d At;
+    correction(firstView(kpt.viewId_ptLid), AR, At);
+    cv::Point3d X = redoPoint(AR, At, cv::Point3d(kpt.x, kpt.y, kpt.z));
+    kpt.x = X.x;
+    kpt.y = X.y;
+    kpt.z = X.z;
+    return true;
+}
+
+bool MfgArchive::readIdealLine(int gid, IdealLine3d &iln)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!seekRecord(ilnIdx, gid)) return false;
+
+    getIdealLine(file, gid, iln);
+
+    if (!file.good()) return false;
+
+    cv::Matx33d AR;
+    cv::Vec3d At;
+    correction(firstView(iln.viewId_lnLid), AR, At);
+    iln.midpt = redoPoint(AR, At, iln.midpt);
+    iln.direct = AR * iln.direct;
+
+    return true;
+}
+
+bool MfgArchive::readDescriptors(int id, vector<int> &lids, cv::Mat &descs)
+{
+    lock_guard<mutex> lock(mtx);
+
+    if (!seekRecord(descIdx, id)) return false;
+
+    getIdList(file, lids);
+    getMat(file, descs);
+    return file.good();
+}
+
+bool MfgArchive::load(const string &fname, vector<View> &views,
+                      vector<KeyPoint3d> &keyPoints, vector<IdealLine3d> &idealLines)
+{
+    ifstream is(fname.c_str(), ios::binary);
+
+    if (!is.is_open())
+    {
+        cerr << "MfgArchive: cannot open " << fname << endl;
+        return false;
+    }
+
+    int32_t type, id;
+    vector<cv::Matx33d> AR; // correction table, see MfgArchive::correct
+    vector<cv::Vec3d> At;
+
+    while (is.peek() != EOF)
+    {
+        get(is, type);
+        get(is, id);
+
+        if (type == REC_VIEW)
+        {
+            views.push_back(View());
+            getView(is, id, views.back());
+        }
+        else if (type == REC_KEYPOINT)
+        {
+            keyPoints.push_back(KeyPoint3d());
+            getKeyPoint(is, id, keyPoints.back());
+        }
+        else if (type == REC_IDEALLINE)
+        {
+            idealLines.push_back(IdealLine3d());
+            getIdealLine(is, id, idealLines.back());
+        }
+        else if (type == REC_DESCRIPTORS) // only used for loop closure
+        {
+            vector<int> lids;
+            cv::Mat descs;
+            getIdList(is, lids);
+            getMat(is, descs);
+        }
+        else if (type == REC_CORRECTION) // id is the number of keyframes
+        {
+            AR.resize(max(0, id));
+            At.resize(max(0, id));
+
+            for (int i = 0; i < id; ++i)
+            {
+                for (int k = 0; k < 9; ++k) get(is, AR[i].val[k]);
+                for (int k = 0; k < 3; ++k) get(is, At[i][k]);
+            }
+        }
+        else
+        {
+            cerr << "MfgArchive: bad record in " << fname << endl;
+            return false;
+        }
+
+        if (!is.good())
+        {
+            cerr << "MfgArchive: truncated record in " << fname << endl;
+            return false;
+        }
+    }
+
+    // records are stored before the correction of their keyframe
+    for (int i = 0; i < views.size(); ++i)
+    {
+        int v = views[i].id;
+
+        if (v < AR.size() && isPose(views[i].R, views[i].t))
+            redoPose(AR[v], At[v], views[i].R, views[i].t);
+    }
+
+    for (int i = 0; i < keyPoints.size(); ++i)
+    {
+        int v = firstView(keyPoints[i].viewId_ptLid);
+
+        if (v < 0 || v >= AR.size()) continue;
+
+        cv::Point3d X = redoPoint(AR[v], At[v], cv::Point3d(keyPoints[i].x, keyPoints[i].y, keyPoints[i].z));
+        keyPoints[i].x = X.x;
+        keyPoints[i].y = X.y;
+        keyPoints[i].z = X.z;
+    }
+
+    for (int i = 0; i < idealLines.size(); ++i)
+    {
+        int v = firstView(idealLines[i].viewId_lnLid);
+
+        if (v < 0 || v >= AR.size()) continue;
+
+        idealLines[i].midpt = redoPoint(AR[v], At[v], idealLines[i].midpt);
+        idealLines[i].direct = AR[v] * idealLines[i].direct;
+    }
+
+    return true;
+}
@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * MFG archive: append-only binary file of retired keyframes and landmarks
+ ********************************************************************************/
+
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "view.h"
+#include "features3d.h"
+
+// MfgArchive writes keyframes that left the active map, and landmarks only
+// observed by such keyframes, to a binary file as a sequence of records
+//   [record type (int32)][record id (int32)][payload]
+// Records are appended once and never rewritten. When the map is corrected,
+// only the cumulative rigid correction of each keyframe is updated (correct());
+// records are stored as they were before the correction of the keyframe they
+// belong to (a landmark: its first observation), and the correction is applied
+// when they are read back. The table is written as the last record when the
+// archive is closed. The file offset of each record is indexed in memory by
+// id, so single records can be read back on demand while writing. The descriptors of a keyframe are
+// written as a record of their own when the keyframe releases them (see
+// Mfg::releaseOldViews), long before the keyframe itself is archived.
+class MfgArchive
+{
+public:
+    enum RecordType { REC_VIEW = 1, REC_KEYPOINT = 2, REC_IDEALLINE = 3, REC_DESCRIPTORS = 4,
+                      REC_CORRECTION = 5 };
+
+    MfgArchive() {}
+    ~MfgArchive();
+
+    bool open(const std::string &fname); // create (truncate) the archive file
+    bool isOpen() const { return file.is_open(); }
+    const std::string &name() const { return filename; }
+
+    void appendView(const View &v);
+    void appendKeyPoint(const KeyPoint3d &kpt);
+    void appendIdealLine(const IdealLine3d &iln);
+    // descriptors of the feature points of v that have a landmark
+    void appendDescriptors(const View &v);
+
+    bool hasView(int id) const;
+    bool hasKeyPoint(int gid) const;
+    bool hasIdealLine(int gid) const;
+    int  numKeyPoints() const;
+    int  numIdealLines() const;
+
+    // ids of the archived records, ascending
+    std::vector<int> keyPointIds() const;
+    std::vector<int> idealLineIds() const;
+
+    // compose the correction X' = Rc[c]*X + tc[c], c = min(id, Rc.size() - 1),
+    // with the one of each keyframe id < numViews (see GlobalMapper)
+    void correct(const std::vector<cv::Matx33d> &Rc, const std::vector<cv::Vec3d> &tc, int numViews);
+
+    // read a record back, corrected, false if it is not archived
+    bool readView(int id, View &v);
+    bool readKeyPoint(int gid, KeyPoint3d &kpt);
+    bool readIdealLine(int gid, IdealLine3d &iln);
+    // feature point ids and their descriptors, one per row
+    bool readDescriptors(int id, std::vector<int> &lids, cv::Mat &descs);
+
+    // read a whole archive file, e.g. for offline processing
+    static bool load(const std::string &fname, std::vector<View> &views,
+                     std::vector<KeyPoint3d> &keyPoints, std::vector<IdealLine3d> &idealLines);
+
+private:
+    std::string  filename;
+    std::fstream file;
+    mutable std::mutex mtx;
+
+    std::map<int, std::streamoff> viewIdx, kptIdx, ilnIdx, descIdx; // record offsets by id
+    std::vector<cv::Matx33d> corrR; // cumulative correction by keyframe id,
+    std::vector<cv::Vec3d>   corrT; // identity past the end
+
+    void correction(int id, cv::Matx33d &R, cv::Vec3d &t) const;
+    bool seekRecord(const std::map<int, std::streamoff> &idx, int id);
+};
+
+#endif
@@ -0,0 +1,283 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Block solver of the MFG bundle adjustment
+ ********************************************************************************/
+
+#ifndef BABLOCKSOLVER_H_
+#define BABLOCKSOLVER_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "g2o/core/block_solver.h"
+#include "g2o/core/jacobian_workspace.h"
+#include "g2o/core/robust_kernel.h"
+#include "g2o/core/sparse_optimizer.h"
+
+// Keypoints and line points are the marginalized vertices, so the landmark
+// blocks are fixed 3x3 and eliminated by the Schur complement. The reduced
+// system holds cameras (6) together with vanishing points and planes (3): they
+// are connected to landmarks of both kinds and cannot be marginalized, so the
+// pose blocks cannot have a fixed size.
+typedef g2o::BlockSolver< g2o::BlockSolverTraits<Eigen::Dynamic, 3> >  BaBlockSolver;
+
+// BaBlockSolver that builds the system on all cores. Each edge gets its own
+// jacobian workspace and its own storage for its robustly weighted quadratic
+// form, so the edges are linearized and weighted in parallel; the forms are
+// then added into the hessian blocks and the gradient on one thread in edge
+// order: the system is the same for any number of threads. It relies on g2o's
+// internals of BlockSolver (_Hpp, _Hpl, _Hll, _b), test-ba-block-solver
+// compares its system with the stock solvers; it is used only with the [ba]
+// parallel_build setting.
+class BaParallelBlockSolver : public BaBlockSolver
+{
+public:
+    BaParallelBlockSolver(BaBlockSolver::LinearSolverType *linearSolver)
+        : BaBlockSolver(linearSolver) {}
+
+    virtual bool buildStructure(bool zeroBlocks = false)
+    {
+        if (!BaBlockSolver::buildStructure(zeroBlocks))
+            return false;
+
+        // workspaces and forms of the active edges, kept until the structure
+        // changes. The form of an edge holds, for each vertex that is not
+        // fixed, its diagonal block and gradient, then the off-diagonal block
+        // of each pair of such vertices, found as g2o's buildStructure maps it
+        const g2o::SparseOptimizer::EdgeContainer &edges = _optimizer->activeEdges();
+        edgeWorkspaces.clear();
+        edgeWorkspaces.resize(edges.size());
+        formOffset.assign(1, 0);
+        pairBlocks.clear();
+        pairOffset.assign(1, 0);
+
+        for (int k = 0; k < edges.size(); ++k)
+        {
+            edgeWorkspaces[k].updateSize(edges[k]);
+            edgeWorkspaces[k].allocate();
+
+            int size = 0;
+
+            for (int a = 0; a < edges[k]->vertices().size(); ++a)
+            {
+                g2o::OptimizableGraph::Vertex *va = vertexOf(edges[k], a);
+
+                if (va->hessianIndex() < 0) continue;
+
+                size += va->dimension() * (va->dimension() + 1);
+
+                for (int b = a + 1; b < edges[k]->vertices().size(); ++b)
+                {
+                    g2o::OptimizableGraph::Vertex *vb = vertexOf(edges[k], b);
+
+                    if (vb->hessianIndex() < 0) continue;
+
+                    size += va->dimension() * vb->dimension();
+                    pairBlocks.push_back(hessianBlock(va, vb));
+                }
+            }
+
+            formOffset.push_back(formOffset.back() + size);
+            pairOffset.push_back(pairBlocks.size());
+        }
+
+        edgeForms.resize(formOffset.back());
+        return true;
+    }
+
+    virtual bool buildSystem()
+    {
+        const g2o::SparseOptimizer::EdgeContainer &edges = _optimizer->activeEdges();
+        const g2o::SparseOptimizer::VertexContainer &vertices = _optimizer->indexMapping();
+
+        if (edgeWorkspaces.size() != edges.size())
+            return BaBlockSolver::buildSystem();
+
+        for (int i = 0; i < vertices.size(); ++i)
+            vertices[i]->clearQuadraticForm();
+
+        _Hpp->clear();
+
+        if (_doSchur)
+        {
+            _Hll->clear();
+            _Hpl->clear();
+        }
+
+        #pragma omp parallel for schedule(dynamic, 64) if (edges.size() > 100)
+        for (int k = 0; k < edges.size(); ++k)
+        {
+            edges[k]->linearizeOplus(edgeWorkspaces[k]);
+            computeForm(edges[k], edgeWorkspaces[k], &edgeForms[formOffset[k]]);
+        }
+
+        for (int k = 0; k < edges.size(); ++k)
+            addForm(edges[k], &edgeForms[formOffset[k]], &pairBlocks[pairOffset[k]]);
+
+        for (int i = 0; i < vertices.size(); ++i)
+        {
+            int iBase = vertices[i]->colInHessian();
+
+            if (vertices[i]->marginalized())
+                iBase += _sizePoses;
+
+            vertices[i]->copyB(_b + iBase);
+        }
+
+        return true;
+    }
+
+private:
+    // block of the hessian shared by two vertices of an edge, stored transposed
+    // when the block of the pair in edge order is below the diagonal
+    struct PairBlock
+    {
+        double *data;
+        bool    transposed;
+    };
+
+    std::vector<g2o::JacobianWorkspace> edgeWorkspaces;
+    std::vector<double>    edgeForms;
+    std::vector<int>       formOffset;  // per edge, into edgeForms
+    std::vector<PairBlock> pairBlocks;
+    std::vector<int>       pairOffset;  // per edge, into pairBlocks
+
+    static g2o::OptimizableGraph::Vertex *vertexOf(g2o::OptimizableGraph::Edge *e, int i)
+    {
+        return static_cast<g2o::OptimizableGraph::Vertex *>(e->vertex(i));
+    }
+
+    PairBlock hessianBlock(g2o::OptimizableGraph::Vertex *va, g2o::OptimizableGraph::Vertex *vb)
+    {
+        PairBlock pb;
+        int ia = va->hessianIndex(), ib = vb->hessianIndex();
+
+        if (!va->marginalized() && !vb->marginalized())
+        {
+            pb.data = _Hpp->block(std::min(ia, ib), std::max(ia, ib))->data();
+            pb.transposed = ia > ib;
+        }
+        else if (va->marginalized() && vb->marginalized())
+        {
+            pb.data = _Hll->block(ia - _numPoses, ib - _numPoses)->data();
+            pb.transposed = false;
+        }
+        else if (va->marginalized())
+        {
+            pb.data = _Hpl->block(ib, ia - _numPoses)->data();
+            pb.transposed = true;
+        }
+        else
+        {
+            pb.data = _Hpl->block(ia, ib - _numPoses)->data();
+            pb.transposed = false;
+        }
+
+        return pb;
+    }
+
+    static void computeForm(g2o::OptimizableGraph::Edge *e, g2o::JacobianWorkspace &ws, double *form)
+    // weighted as g2o's constructQuadraticForm: the information is scaled by
+    // the first derivative of the robust kernel at the chi2 of the edge
+    {
+        int D = e->dimension();
+        Eigen::Map<const Eigen::VectorXd> err(e->errorData(), D);
+        Eigen::Map<const Eigen::MatrixXd> info(e->informationData(), D, D);
+        double w = 1;
+
+        if (e->robustKernel())
+        {
+            Eigen::Vector3d rho;
+            e->robustKernel()->robustify(e->chi2(), rho);
+            w = rho[1];
+        }
+
+        Eigen::MatrixXd WJ;
+        Eigen::VectorXd Wr = -w * (info * err);
+
+        for (int a = 0; a < e->vertices().size(); ++a)
+        {
+            g2o::OptimizableGraph::Vertex *va = vertexOf(e, a);
+            int da = va->dimension();
+
+            if (va->hessianIndex() < 0) continue;
+
+            Eigen::Map<const Eigen::MatrixXd> Ja(ws.workspaceForVertex(a), D, da);
+            WJ.noalias() = w * (info * Ja);
+            Eigen::Map<Eigen::MatrixXd>(form, da, da).noalias() = Ja.transpose() * WJ;
+            form += da * da;
+            Eigen::Map<Eigen::VectorXd>(form, da).noalias() = Ja.transpose() * Wr;
+            form += da;
+
+            for (int b = a + 1; b < e->vertices().size(); ++b)
+            {
+                g2o::OptimizableGraph::Vertex *vb = vertexOf(e, b);
+                int db = vb->dimension();
+
+                if (vb->hessianIndex() < 0) continue;
+
+                Eigen::Map<const Eigen::MatrixXd> Jb(ws.workspaceForVertex(b), D, db);
+                Eigen::Map<Eigen::MatrixXd>(form, db, da).noalias() = Jb.transpose() * WJ;
+                form += da * db;
+            }
+        }
+    }
+
+    static void addForm(g2o::OptimizableGraph::Edge *e, const double *form, const PairBlock *pair)
+    {
+        for (int a = 0; a < e->vertices().size(); ++a)
+        {
+            g2o::OptimizableGraph::Vertex *va = vertexOf(e, a);
+            int da = va->dimension();
+
+            if (va->hessianIndex() < 0) continue;
+
+            Eigen::Map<Eigen::MatrixXd>(va->hessianData(), da, da) += Eigen::Map<const Eigen::MatrixXd>(form, da, da);
+            form += da * da;
+            Eigen::Map<Eigen::VectorXd>(va->bData(), da) += Eigen::Map<const Eigen::VectorXd>(form, da);
+            form += da;
+
+            for (int b = a + 1; b < e->vertices().size(); ++b)
+            {
+                g2o::OptimizableGraph::Vertex *vb = vertexOf(e, b);
+                int db = vb->dimension();
+
+                if (vb->hessianIndex() < 0) continue;
+
+                // form holds Jb'*W*Ja, the transpose of the (a,b) block
+                Eigen::Map<const Eigen::MatrixXd> Hba(form, db, da);
+
+                if (pair->transposed)
+                    Eigen::Map<Eigen::MatrixXd>(pair->data, db, da) += Hba;
+                else
+                    Eigen::Map<Eigen::MatrixXd>(pair->data, da, db) += Hba.transpose();
+
+                form += da * db;
+                ++pair;
+            }
+        }
+    }
+};
+
+#endif
@@ -24,296 +24,170 @@
  * Estimate 3D points from 2D image points using optimization
  ********************************************************************************/
 
+#include "est3dpt.h"
 #include "utils.h"
-#include "settings.h"
-
-#include <Eigen/StdVector>
-
-#include <vector>
-#include <stdint.h>
-
-#if defined(_MSC_VER)
-//#include <unordered_set>
-#include <unordered_map>
-//#ifdef __APPLE__
-#elif defined(__APPLE__)
-#include <unordered_map>
-#else
-// TODO: FIXME
-//#include <tr1/unordered_set>
-#include <tr1/unordered_map>
-#endif
-
-#include "g2o/config.h"
-#include "g2o/core/sparse_optimizer.h"
-#include "g2o/core/block_solver.h"
-#include "g2o/core/solver.h"
-#include "g2o/core/robust_kernel_impl.h"
-#include "g2o/core/optimization_algorithm_levenberg.h"
-#include "g2o/core/optimization_algorithm_gauss_newton.h"
-#include "g2o/solvers/dense/linear_solver_dense.h"
-#include "g2o/types/icp/types_icp.h"
-#include "g2o/solvers/structure_only/structure_only_solver.h"
-
-#if defined G2O_HAVE_CHOLMOD
-#include "g2o/solvers/cholmod/linear_solver_cholmod.h"
-#endif
-#if defined G2O_HAVE_CSPARSE
-#include "g2o/solvers/csparse/linear_solver_csparse.h"
-#endif
-
-#include "g2o/types/sba/sbacam.h"
-//#include "edge_se3_lineendpts.h"
-#include <fstream>
-//#include "levmar-2.6\lm.h"
-#include "levmar-2.6/levmar.h"
-//#include <Windows.h>
-
-using namespace Eigen;
-using namespace std;
 
-struct Data_EST3D
-{
-    vector<cv::Mat> Rs,  ts;
-    cv::Mat K;
-    vector<cv::Point2d>  pt;
-    vector<vector<double> > KRs, Kts;
+#include <math.h>
 
-};
+using namespace std;
 
-void costFun_EST3D(double *p, double *error, int numPara, int numMeas, void *adata)
+TriCamera::TriCamera(const cv::Mat &K, const cv::Mat &R, const cv::Mat &t)
 {
-    struct Data_EST3D *dp = (struct Data_EST3D *) adata;
-    double cost = 0;
-    cv::Mat X = (cv::Mat_<double>(3, 1) << p[0], p[1], p[2]);
+    cv::Mat KR = K * R, Kt = K * t;
 
-    for (int i = 0; i < dp->pt.size(); ++i)
+    for (int r = 0; r < 3; ++r)
     {
-        cv::Point2d pi = mat2cvpt(dp->K * (dp->Rs[i] * X + dp->ts[i]));
-        error[i * 2] = pi.x - dp->pt[i].x;
-        error[i * 2 + 1] = pi.y - dp->pt[i].y;
-        cost = cost + error[i * 2] * error[i * 2] + error[i * 2 + 1] * error[i * 2 + 1];
-
+        P[r * 4] = KR.at<double>(r, 0);
+        P[r * 4 + 1] = KR.at<double>(r, 1);
+        P[r * 4 + 2] = KR.at<double>(r, 2);
+        P[r * 4 + 3] = Kt.at<double>(r);
     }
-
 }
 
-
-void costFun_EST3D2(double *p, double *error, int numPara, int numMeas, void *adata)
+static double triNormalEquations(const TriCamera *cams, const TriTrack &trk, const double *X,
+                                 double *H, double *g)
+// squared reprojection error of X, and if H is given the normal equations:
+// H (upper triangle, row major 3x3) = sum J'J, g = sum J'r
 {
-    struct Data_EST3D *dp = (struct Data_EST3D *) adata;
     double cost = 0;
-    cv::Mat X = (cv::Mat_<double>(3, 1) << p[0], p[1], p[2]);
 
-    for (int i = 0; i < dp->pt.size(); ++i)
+    if (H)
     {
-        cv::Point2d pi = mat2cvpt(dp->K * (dp->Rs[i] * X + dp->ts[i]));
-        double xh = dp->KRs[i][0] * p[0] + dp->KRs[i][1] * p[1] + dp->KRs[i][2] * p[2] + dp->Kts[i][0];
-        double yh = dp->KRs[i][3] * p[0] + dp->KRs[i][4] * p[1] + dp->KRs[i][5] * p[2] + dp->Kts[i][1];
-        double zh = dp->KRs[i][6] * p[0] + dp->KRs[i][7] * p[1] + dp->KRs[i][8] * p[2] + dp->Kts[i][2];
-        error[i * 2] = (xh / zh) - dp->pt[i].x;
-        error[i * 2 + 1] = (yh / zh) - dp->pt[i].y;
+        for (int k = 0; k < 9; ++k) H[k] = 0;
+        for (int k = 0; k < 3; ++k) g[k] = 0;
+    }
 
-//		cost = cost + error[i*2]*error[i*2] + error[i*2+1]*error[i*2+1];
+    for (int i = 0; i < trk.numObs; ++i)
+    {
+        const double *P = cams[trk.cam[i]].P;
+        double a = P[0] * X[0] + P[1] * X[1] + P[2] * X[2] + P[3];
+        double b = P[4] * X[0] + P[5] * X[1] + P[6] * X[2] + P[7];
+        double c = P[8] * X[0] + P[9] * X[1] + P[10] * X[2] + P[11];
 
-    }
+        if (fabs(c) < 1e-12) continue;
 
-}
+        double iz = 1 / c;
+        double ru = a * iz - trk.u[i], rv = b * iz - trk.v[i];
+        cost += ru * ru + rv * rv;
 
-void est3dpt(vector<cv::Mat> Rs, vector<cv::Mat> ts, cv::Mat K, vector<cv::Point2d> pt, cv::Mat &X, int maxIter)
-// input: Rs, ts, pt
-// output: X
-{
-    // ----- LM parameter setting -----
-    double opts[LM_OPTS_SZ], info[LM_INFO_SZ];
-    opts[0] = LM_INIT_MU; //
-    opts[1] = 1E-50; // gradient threshold, original 1e-15
-    opts[2] = 1E-20; // relative para change threshold? original 1e-50
-    opts[3] = 1E-20; // error threshold (below it, stop)
-    opts[4] = LM_DIFF_DELTA;
-
-
-    int numPara = 3, numMeas = pt.size() * 2;
-    double *para = new double[numPara];
-    para[0] = X.at<double>(0);
-    para[1] = X.at<double>(1);
-    para[2] = X.at<double>(2);
-    double *meas = new double[numMeas];
-
-    for (int i = 0; i < numMeas; ++i) meas[i] = 0;
-
-    Data_EST3D data;
-    data.pt = pt;
-    data.Rs = Rs;
-    data.ts = ts;
-    data.K = K;
-    data.KRs.resize(Rs.size());
-    data.Kts.resize(ts.size());
-
-    for (int i = 0; i < Rs.size(); ++i)
-    {
-        cv::Mat KR = K * Rs[i];
-        cv::Mat Kt = K * ts[i];
-        data.KRs[i].resize(9);
-        data.Kts[i].resize(3);
-        data.KRs[i][0] = KR.at<double>(0, 0);
-        data.KRs[i][1] = KR.at<double>(0, 1);
-        data.KRs[i][2] = KR.at<double>(0, 2);
-        data.KRs[i][3] = KR.at<double>(1, 0);
-        data.KRs[i][4] = KR.at<double>(1, 1);
-        data.KRs[i][5] = KR.at<double>(1, 2);
-        data.KRs[i][6] = KR.at<double>(2, 0);
-        data.KRs[i][7] = KR.at<double>(2, 1);
-        data.KRs[i][8] = KR.at<double>(2, 2);
-        data.Kts[i][0] = Kt.at<double>(0);
-        data.Kts[i][1] = Kt.at<double>(1);
-        data.Kts[i][2] = Kt.at<double>(2);
-    }
+        if (!H) continue;
 
-    double *para2 = new double[3];
-    para2[0] = para[0];
-    para2[1] = para[1];
-    para2[2] = para[2];
+        double Ju[3], Jv[3];
 
-    // ----- start LM solver -----
-    int ret = dlevmar_dif(costFun_EST3D2, para, meas, numPara, numMeas,
-                          maxIter, opts, info, NULL, NULL, (void *)&data);
-    X = (cv::Mat_<double>(3, 1) << para[0], para[1], para[2]);
+        for (int k = 0; k < 3; ++k)
+        {
+            Ju[k] = (P[k] - a * iz * P[8 + k]) * iz;
+            Jv[k] = (P[4 + k] - b * iz * P[8 + k]) * iz;
+        }
 
-    delete[] meas;
-    delete[] para;
-    delete[] para2;
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int s = r; s < 3; ++s)
+                H[r * 3 + s] += Ju[r] * Ju[s] + Jv[r] * Jv[s];
 
+            g[r] += Ju[r] * ru + Jv[r] * rv;
+        }
+    }
 
+    return cost;
 }
 
-void est3dpt_g2o(vector<cv::Mat> Rs, vector<cv::Mat> ts, cv::Mat K, vector<cv::Point2d> pts2d, cv::Mat &X)
+static bool solve3x3(const double *A, const double *b, double *x)
+// Cholesky solve of A x = b, A symmetric positive definite given by its upper triangle
 {
-    // ----- G2O parameter setting -----
-    int maxIters = 15;
-    // some handy typedefs
-    typedef g2o::BlockSolver< g2o::BlockSolverTraits<Eigen::Dynamic, Eigen::Dynamic> >  MyBlockSolver;
-    typedef g2o::LinearSolverCSparse<MyBlockSolver::PoseMatrixType> MyLinearSolver;
-
-    // setup the solver
-    g2o::SparseOptimizer optimizer;
-    optimizer.setVerbose(false);
-    MyLinearSolver *linearSolver = new MyLinearSolver();
-
-    MyBlockSolver *solver_ptr = new MyBlockSolver(linearSolver);
-    g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
-
-    // -- add the parameter representing the sensor offset  !!!!
-    g2o::ParameterSE3Offset *sensorOffset = new g2o::ParameterSE3Offset;
-    sensorOffset->setOffset(Eigen::Isometry3d::Identity());
-    sensorOffset->setId(0);
-    optimizer.addParameter(sensorOffset);
-
-    // ----- set g2o vertices ------
-    int vertex_id = 0;
-#ifdef __APPLE__
-    unordered_map<int, int> camfid2vid;
-#else
-    tr1::unordered_map<int, int> camfid2vid;
-#endif
-
-    int n = Rs.size(); //number of observations
-    // ----- optimization parameters -----
-    vector<g2o::VertexCam *> camvertVec;
-    camvertVec.reserve(n);
-
-    // ---- camera pose parameters ----
-    for (int i = 0; i < n; ++i)
-    {
-        Eigen:: Quaterniond q = r2q(Rs[i]);
-        Eigen::Isometry3d pose;
-        pose = q;
-        pose.translation() = Eigen::Vector3d(ts[i].at<double>(0), ts[i].at<double>(1), ts[i].at<double>(2));
-        g2o::VertexCam *v_cam = new g2o::VertexCam();
-        v_cam->setId(vertex_id);
-        g2o::SBACam sc(q.inverse(), pose.inverse().translation());
-        sc.setKcam(K.at<double>(0, 0), K.at<double>(1, 1), K.at<double>(0, 2), K.at<double>(1, 2), 0); 
-        v_cam->setEstimate(sc);
-        v_cam->setFixed(true);
-
-        optimizer.addVertex(v_cam);
-        camfid2vid[i] = vertex_id;
-        ++vertex_id;
-        camvertVec.push_back(v_cam);
-    }
-
-    // ---- structure parameters ----
-    g2o::VertexSBAPointXYZ *v_p = new g2o::VertexSBAPointXYZ();
-    v_p->setId(vertex_id);
-    Eigen::Vector3d pt(X.at<double>(0), X.at<double>(1), X.at<double>(2));
-    v_p->setEstimate(pt);
+    double l00 = A[0];
+    if (l00 <= 0) return false;
+    l00 = sqrt(l00);
+    double l10 = A[1] / l00, l20 = A[2] / l00;
+    double l11 = A[4] - l10 * l10;
+    if (l11 <= 0) return false;
+    l11 = sqrt(l11);
+    double l21 = (A[5] - l20 * l10) / l11;
+    double l22 = A[8] - l20 * l20 - l21 * l21;
+    if (l22 <= 0) return false;
+    l22 = sqrt(l22);
+
+    // L y = b, L' x = y
+    double y0 = b[0] / l00;
+    double y1 = (b[1] - l10 * y0) / l11;
+    double y2 = (b[2] - l20 * y0 - l21 * y1) / l22;
+    x[2] = y2 / l22;
+    x[1] = (y1 - l21 * x[2]) / l11;
+    x[0] = (y0 - l10 * x[1] - l20 * x[2]) / l00;
+    return true;
+}
 
-    v_p->setFixed(false);
+void refineTriTrack(const TriCamera *cams, TriTrack &trk, int maxIter)
+{
+    if (trk.numObs < 2) return;
 
-    optimizer.addVertex(v_p);
-    int	pt_vertext_id = vertex_id;
+    double H[9], g[3], A[9], dx[3], Xn[3];
+    double lambda = 1e-3;
+    double cost = triNormalEquations(cams, trk, trk.X, H, g);
 
-    // ----- optimization measurements -----
-    for (int i = 0; i < n; ++i)
+    for (int iter = 0; iter < maxIter; ++iter)
     {
-        g2o::EdgeProjectP2MC *e = new g2o::EdgeProjectP2MC();
-        e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                           (optimizer.vertices().find(pt_vertext_id)->second);
+        for (int k = 0; k < 9; ++k) A[k] = H[k];
+        for (int k = 0; k < 3; ++k) A[k * 4] *= 1 + lambda;
+
+        double mg[3] = {-g[0], -g[1], -g[2]};
 
-        if (e->vertices()[0] == 0)
+        if (!solve3x3(A, mg, dx))
         {
-            cerr << "no pt vert found ... terminated \n";
-            exit(0);
+            lambda *= 10;
+            continue;
         }
 
-        e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                           (optimizer.vertices().find(camfid2vid[i])->second);
+        for (int k = 0; k < 3; ++k) Xn[k] = trk.X[k] + dx[k];
 
-        if (e->vertices()[1] == 0)
+        double newCost = triNormalEquations(cams, trk, Xn, 0, 0);
+
+        if (newCost < cost)
         {
-            cerr << "no cam vert found ... terminated \n";
-            exit(0);
-        }
+            for (int k = 0; k < 3; ++k) trk.X[k] = Xn[k];
+
+            double step = dx[0] * dx[0] + dx[1] * dx[1] + dx[2] * dx[2];
+            double norm = trk.X[0] * trk.X[0] + trk.X[1] * trk.X[1] + trk.X[2] * trk.X[2];
 
-        Eigen::Vector2d meas(pts2d[i].x, pts2d[i].y);
-        e->setMeasurement(meas);
-        e->information() = Matrix2d::Identity();
-        /*				g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-        rk->setDelta(mfgSettings->getBaKernelDeltaPoint());
-        e->setRobustKernel(rk);
+            if (step < 1e-20 * (norm + 1e-20) || cost - newCost < 1e-12 * cost)
+                break;
+
+            lambda = max(lambda / 10, 1e-12);
+            cost = triNormalEquations(cams, trk, trk.X, H, g);
+        }
+        else
+        {
+            lambda *= 10;
 
-        */
-        optimizer.addEdge(e);
+            if (lambda > 1e12) break;
+        }
     }
+}
+
+void BatchTriangulator::refine(int maxIter)
+{
+    const TriCamera *cams = cameras.empty() ? 0 : &cameras[0];
 
-    // ----- start g2o -----
-    optimizer.initializeOptimization();
-    optimizer.computeActiveErrors();
-    double baerr = optimizer.activeChi2();
-    optimizer.optimize(maxIters);
+    #pragma omp parallel for schedule(dynamic, 32)
 
-    X.at<double>(0) = v_p->estimate()(0);
-    X.at<double>(1) = v_p->estimate()(1);
-    X.at<double>(2) = v_p->estimate()(2);
-    optimizer.clear();
+    for (int i = 0; i < tracks.size(); ++i)
+        refineTriTrack(cams, tracks[i], maxIter);
 }
+
 cv::Mat triangulatePoint_nonlin(const cv::Mat &R1, const cv::Mat &t1, const cv::Mat &R2,
                                 const cv::Mat &t2, const cv::Mat &K,	cv::Point2d pt1, cv::Point2d pt2)
 // nonlinear triangulation of 3d pt
 {
-    vector<cv::Mat> Rs, ts;
-    Rs.push_back(R1);
-    Rs.push_back(R2);
-    ts.push_back(t1);
-    ts.push_back(t2);
-    vector<cv::Point2d> pts;
-    pts.push_back(pt1);
-    pts.push_back(pt2);
     cv::Mat X = triangulatePoint(R1, t1, R2, t2, K, pt1, pt2);  // linear triangulation
 
-//	est3dpt_g2o (Rs, ts, K, pts, X);
-    est3dpt(Rs, ts, K, pts, X, 80);
-    return X;
-}
+    TriCamera cams[2] = {TriCamera(K, R1, t1), TriCamera(K, R2, t2)};
+    TriTrack trk;
+    trk.add(0, pt1.x, pt1.y);
+    trk.add(1, pt2.x, pt2.y);
+
+    for (int k = 0; k < 3; ++k) trk.X[k] = X.at<double>(k);
 
+    refineTriTrack(cams, trk, 20);
+
+    return (cv::Mat_<double>(3, 1) << trk.X[0], trk.X[1], trk.X[2]);
+}
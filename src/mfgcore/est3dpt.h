@@ -0,0 +1,101 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Estimate 3D points from 2D image points using optimization
+ ********************************************************************************/
+
+#ifndef EST3DPT_H_
+#define EST3DPT_H_
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// Projection of a camera, P = K*[R|t], row major
+struct TriCamera
+{
+    double P[12];
+
+    TriCamera() {}
+    TriCamera(const cv::Mat &K, const cv::Mat &R, const cv::Mat &t);
+};
+
+// Observations of one point and its estimate. Everything is stored inline, so
+// refining a track does not allocate. A full track keeps its first observation,
+// the widest baseline to the new ones, and the most recent ones; the others are
+// dropped and counted.
+struct TriTrack
+{
+    enum { MAX_OBS = 32 };
+
+    int    numObs;
+    int    numDropped;             // observations dropped because the track was full
+    int    cam[MAX_OBS];           // camera index of each observation
+    double u[MAX_OBS], v[MAX_OBS]; // image point of each observation
+    double X[3];                   // initial guess in, estimate out
+
+    TriTrack() : numObs(0), numDropped(0) {}
+
+    // observations are added oldest first; false if one had to be dropped
+    bool add(int camIdx, double _u, double _v)
+    {
+        bool full = numObs == MAX_OBS;
+
+        if (full)
+        {
+            for (int i = 1; i + 1 < MAX_OBS; ++i)
+            {
+                cam[i] = cam[i + 1];
+                u[i] = u[i + 1];
+                v[i] = v[i + 1];
+            }
+
+            --numObs;
+            ++numDropped;
+        }
+
+        cam[numObs] = camIdx;
+        u[numObs] = _u;
+        v[numObs] = _v;
+        ++numObs;
+        return !full;
+    }
+};
+
+// Levenberg-Marquardt refinement of a point minimizing its reprojection error,
+// the normal equations are 3x3 and solved in place
+void refineTriTrack(const TriCamera *cams, TriTrack &trk, int maxIter = 15);
+
+// BatchTriangulator refines the points of all tracks of a keyframe at once; the
+// cameras are shared by all tracks, the tracks are independent and refined in
+// parallel.
+class BatchTriangulator
+{
+public:
+    std::vector<TriCamera> cameras;
+    std::vector<TriTrack>  tracks;   // tracks without observations are skipped
+
+    void refine(int maxIter = 15);
+};
+
+#endif
@@ -27,8 +27,11 @@
 // Methods of estimating fundamental matrix / essential matrix
 // using nister's 5-point algorithm
 #include "consts.h"
+#include "geokernels.h"
+#include "ransac.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -41,147 +44,233 @@ using namespace Eigen;
 using namespace std;
 
 
-int essn_ransac(cv::Mat *pts1, cv::Mat *pts2, cv::Mat *E, cv::Mat K,
-                cv::Mat *inlierMask, int imsize)
-// running 5-point algorithm
-// re-estimation at the end
-// Input: points pairs normalized by camera matrix K
-// output:
+static void soaPoints(const cv::Mat &pts, SoaPoints3d &soa)
+// columns of pts, 2 or 3 rows, as homogeneous points
 {
-    cv::Mat bestMss1, bestMss2;
-    int maxIterNum = 500, N = pts1->cols;
-    int maxIterNum0 = maxIterNum;
-    double confidence = 0.995;
-    double threshDist = 1;// (0.5*imsize/640.0);		//  in image units 0.64
-    int iter = 0;
-    vector<int> rnd;
+    cv::Mat p;
+    pts.convertTo(p, CV_64F);
 
-    for (int i = 0; i < N; ++i)
-        rnd.push_back(i);
+    for (int i = 0; i < p.cols; ++i)
+        soa.push_back(p.at<double>(0, i), p.at<double>(1, i), p.rows > 2 ? p.at<double>(2, i) : 1);
+}
 
-    cv::Mat mss1(3, 5, CV_64F), mss2(3, 5, CV_64F);
-    vector<int> maxInlierSet;
-    cv::Mat bestE;
+static cv::Mat essnToMat(const Matrix3d &E)
+{
+    cv::Mat Em(3, 3, CV_64F);
 
-    while (iter < maxIterNum)
-    {
-        ++iter;
-        // --- choose minimal solution set: mss1<->mss2
-        random_unique(rnd.begin(), rnd.end(), mss1.cols);
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            Em.at<double>(i, j) = E(i, j);
 
-        for (int i = 0; i < mss1.cols; ++i)
-        {
-            pts1->col(rnd[i]).copyTo(mss1.col(i));
-            pts2->col(rnd[i]).copyTo(mss2.col(i));
-        }
+    return Em;
+}
 
-        // compute minimal solution by 5-point
-        vector<cv::Mat> Es;   // multiple results from 5point alg.
-        fivepoint_stewnister(mss1, mss2, Es);
-        // find concensus set
-        vector<int> curInlierSet;
+// Model of essn_ransac, F is E in image units, row major
+struct EssnModel
+{
+    Matrix3d E;
+    double   F[9];
+};
 
-        for (int k = 0; k < Es.size(); ++k)
-        {
-            curInlierSet.clear();
-            cv::Mat F = K.t().inv() * Es[k] * K.inv();
+// 5-point estimation of E for ransac(). The point pairs are kept in image
+// units, one array per coordinate, for sampsonErrors. The error of a pair is
+// its squared sampson error.
+struct EssnProblem : public RansacProblem
+{
+    typedef EssnModel Model;
+    enum { SAMPLE_SIZE = 5, MAX_MODELS = 10 };
 
-            for (int i = 0; i < N; ++i)
-            {
-                double dist = sqrt(fund_samperr(K * pts1->col(i), K * pts2->col(i), F));
+    const cv::Mat &pts1, &pts2, &K;
+    Matrix3d invK;
+    SoaPoints3d Kpts1, Kpts2;
 
-                if (dist < threshDist)
-                    curInlierSet.push_back(i);
-            }
+    const cv::Mat *t_prior;            // solutions must agree with it, if set
+    const vector<cv::Mat> *knownEs;    // and differ from these, if set
 
-            if (curInlierSet.size() > maxInlierSet.size())
-            {
-                maxInlierSet = curInlierSet;
-                bestE = Es[k];
-            }
-        }
+    EssnProblem(const cv::Mat &_pts1, const cv::Mat &_pts2, const cv::Mat &_K);
 
-        //re-compute maximum iteration number:maxIterNum
-        if (maxInlierSet.size() > 0)
-        {
-            maxIterNum = min(maxIterNum0,
-                             (int)abs(log(1 - confidence) / log(1 - pow(double(maxInlierSet.size()) / N, 5.0))));
-        }
+    int numData() const { return Kpts1.size(); }
+    int fit(const int *sample, Model *models) const;
+    void errors(const Model &m, int begin, int end, double *err) const;
+    bool refit(const vector<int> &inliers, Model &m) const;
+
+    void setE(const Matrix3d &E, Model &m) const;
+    bool accept(const Matrix3d &E) const;
+    double meanError(const Model &m, const vector<int> &inliers) const;
+};
+
+EssnProblem::EssnProblem(const cv::Mat &_pts1, const cv::Mat &_pts2, const cv::Mat &_K)
+    : pts1(_pts1), pts2(_pts2), K(_K), t_prior(0), knownEs(0)
+{
+    cv::Mat Kinv = K.inv();
+
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            invK(i, j) = Kinv.at<double>(i, j);
+
+    soaPoints(K * pts1, Kpts1);
+    soaPoints(K * pts2, Kpts2);
+}
+
+void EssnProblem::setE(const Matrix3d &E, Model &m) const
+// F = K^-T * E * K^-1
+{
+    Matrix<double, 3, 3, RowMajor> F = invK.transpose() * E * invK;
 
+    m.E = E;
+
+    for (int i = 0; i < 9; ++i)
+        m.F[i] = F.data()[i];
+}
+
+bool EssnProblem::accept(const Matrix3d &E) const
+{
+    if (!t_prior && !knownEs) return true;
+
+    cv::Mat Ek = essnToMat(E);
+
+    if (t_prior)  //use prior translation vector to filter
+    {
+        cv::Mat Ra, Rb, t1;
+        decEssential(&Ek, &Ra, &Rb, &t1);
+        double angleThresh = 40; // degree
+
+        if (abs(t1.dot(*t_prior) / cv::norm(t1) / cv::norm(*t_prior)) < cos(angleThresh * PI / 180))
+            return false;
     }
 
-    if (maxInlierSet.size() < mss1.cols)
+    for (int k = 0; knownEs && k < knownEs->size(); ++k)
     {
-        cout << "essn_ransac: Largest concensus set is too small for minimal estimation."
-             << endl;
-        return 0;
+        if (isEssnMatSimilar((*knownEs)[k], Ek))
+            return false;
     }
 
-    cv::Mat tmpE = bestE.clone();
+    return true;
+}
 
-    while (true)
-    {
-        vector<cv::Mat> Es;
-        vector<int> maxInlierSet_k;
-        cv::Mat bestE_k;
-        // re-estimate
-        cv::Mat inliers1(3, maxInlierSet.size(), CV_64F),
-        inliers2(3, maxInlierSet.size(), CV_64F);
+int EssnProblem::fit(const int *sample, Model *models) const
+{
+    Matrix<double, 3, 5> mss1, mss2;
 
-        for (int i = 0; i < maxInlierSet.size(); ++i)
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < 3; ++j)
         {
-            pts1->col(maxInlierSet[i]).copyTo(inliers1.col(i));
-            pts2->col(maxInlierSet[i]).copyTo(inliers2.col(i));
+            mss1(j, i) = pts1.at<double>(j, sample[i]);
+            mss2(j, i) = pts2.at<double>(j, sample[i]);
         }
 
-        //opt_essn_pts (inliers1, inliers2, &tmpE);
-        optimizeEmat(inliers1, inliers2, K, &tmpE);
-        vector<int> curInlierSet;
+    // compute minimal solution by 5-point, fixed-size solver
+    Matrix3d Es[10];
+    int numSols = fivepoint_stewnister(mss1, mss2, Es), numModels = 0;
 
-        for (int i = 0; i < N; ++i)
-        {
-            double dist = sqrt(fund_samperr(K * pts1->col(i), K * pts2->col(i),
-                                            K.t().inv() * tmpE * K.inv()));
+    for (int k = 0; k < numSols; ++k)
+    {
+        if (accept(Es[k]))
+            setE(Es[k], models[numModels++]);
+    }
 
-            if (dist < threshDist)
-                curInlierSet.push_back(i);
-        }
+    return numModels;
+}
 
-        if (curInlierSet.size() > maxInlierSet.size())
-        {
-            maxInlierSet = curInlierSet;
-            bestE = tmpE;
-        }
-        else
-            break;
+void EssnProblem::errors(const Model &m, int begin, int end, double *err) const
+{
+    sampsonErrors(m.F, &Kpts1.x[begin], &Kpts1.y[begin], &Kpts1.z[begin],
+                  &Kpts2.x[begin], &Kpts2.y[begin], &Kpts2.z[begin], end - begin, err);
+}
+
+bool EssnProblem::refit(const vector<int> &inliers, Model &m) const
+// re-estimate by optimization
+{
+    cv::Mat inliers1(3, inliers.size(), CV_64F),
+    inliers2(3, inliers.size(), CV_64F);
+
+    for (int i = 0; i < inliers.size(); ++i)
+    {
+        pts1.col(inliers[i]).copyTo(inliers1.col(i));
+        pts2.col(inliers[i]).copyTo(inliers2.col(i));
     }
 
-    cv::Mat inliers1(3, maxInlierSet.size(), CV_64F),
-    inliers2(3, maxInlierSet.size(), CV_64F);
+    cv::Mat E = essnToMat(m.E);
+    optimizeEmat(inliers1, inliers2, K, &E);
 
-    for (int i = 0; i < maxInlierSet.size(); ++i)
+    Matrix3d Eopt;
+
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            Eopt(i, j) = E.at<double>(i, j);
+
+    setE(Eopt, m);
+    return true;
+}
+
+double EssnProblem::meanError(const Model &m, const vector<int> &inliers) const
+{
+    double resd = 0;
+
+    for (int i = 0; i < inliers.size(); ++i)
     {
-        pts1->col(maxInlierSet[i]).copyTo(inliers1.col(i));
-        pts2->col(maxInlierSet[i]).copyTo(inliers2.col(i));
+        double err;
+        errors(m, inliers[i], inliers[i] + 1, &err);
+        resd += err;
     }
 
-    //	opt_essn_pts (inliers1, inliers2, &bestE);
+    return resd / inliers.size();
+}
+
+static void printRansacStats(const char *name, const RansacStats &st)
+{
+    cout << name << ": " << st.iterations << " hypotheses, " << st.models << " models ("
+         << st.rejected << " cut short), " << st.loRuns << " local optimizations, "
+         << st.score << " inliers" << endl;
+}
+
+int essn_ransac(cv::Mat *pts1, cv::Mat *pts2, cv::Mat *E, cv::Mat K,
+                cv::Mat *inlierMask, xrand_state *rng, int imsize, bool sorted)
+// running 5-point algorithm, with local optimization of each new best model
+// Input: points pairs normalized by camera matrix K, best first if sorted
+// output:
+{
+    int N = pts1->cols;
+    double threshDist = 1;// (0.5*imsize/640.0);		//  in image units 0.64
+
+    EssnProblem prob(*pts1, *pts2, K);
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = 0.995;
+    opts.threshold = threshDist * threshDist;
+    opts.parallel = true;
+    opts.prosac = sorted;
+    opts.loIter = 10; // re-estimate on the inliers as long as they grow
+
+    EssnModel best;
+    vector<int> maxInlierSet;
+    RansacStats stats;
+
+    if (ransac(prob, opts, rng, best, maxInlierSet, &stats) < 5)
+    {
+        cout << "essn_ransac: Largest concensus set is too small for minimal estimation."
+             << endl;
+        return 0;
+    }
+
+    printRansacStats("essn_ransac", stats);
+
     inlierMask->create(N, 1, CV_8U);
     *inlierMask = *inlierMask * 0;
 
     for (int i = 0; i < maxInlierSet.size(); ++i)
         inlierMask->at<uchar>(maxInlierSet[i]) = 1;
 
-    *E = bestE;
+    *E = essnToMat(best.E);
 
     return 1;
 }
 
 void essn_ransac(cv::Mat *pts1, cv::Mat *pts2, vector<cv::Mat> &bestEs, cv::Mat K,
-                 vector<cv::Mat> &inlierMasks, int imsize, bool usePrior, cv::Mat t_prior)
-// running 5-point algorithm
-// re-estimation at the end
-// Input: points pairs normalized by camera matrix K
+                 vector<cv::Mat> &inlierMasks, int imsize, xrand_state *rng,
+                 bool usePrior, cv::Mat t_prior, bool sorted)
+// running 5-point algorithm, with local optimization of each new best model
+// Input: points pairs normalized by camera matrix K, best first if sorted
 // output:
 
 {
@@ -189,168 +278,50 @@ void essn_ransac(cv::Mat *pts1, cv::Mat *pts2, vector<cv::Mat> &bestEs, cv::Mat
     inlierMasks.clear();
     int maxSize;
     int trialNum = 5;
-    int maxIterNum = 500, maxIterNum0 = 500;
-    double confidence = 0.999;
+    int N = pts1->cols;
     double threshDist = 1;		//  in image units 0.64
 
+    // solutions inconsistent with the prior translation or already found by
+    // an earlier trial are not scored
+    EssnProblem prob(*pts1, *pts2, K);
+    prob.t_prior = usePrior ? &t_prior : 0;
+    prob.knownEs = &bestEs;
+
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = 0.999;
+    opts.threshold = threshDist * threshDist;
+    opts.parallel = true;
+    opts.prosac = sorted;
+    opts.loIter = 10; // re-estimate on the inliers as long as they grow
+
     vector<int> numInlier_E; // num of inliers for each E
+    RansacStats stats;        // of all trials
     vector<double> resds;
 
     for (int trial = 0; trial < trialNum;  ++trial)
     {
-        cv::Mat bestMss1, bestMss2;
-        int N = pts1->cols;
-        cv::Mat Kpts1 = K * (*pts1);
-        cv::Mat Kpts2 = K * (*pts2);
-        vector<int> rnd;
-
-        for (int i = 0; i < N; ++i)	rnd.push_back(i);
+        // each trial samples from its own stream
+        xrand_state trialRng;
+        split_xrand_r(rng, trial, &trialRng);
 
-        cv::Mat mss1(3, 5, CV_64F), mss2(3, 5, CV_64F);
+        EssnModel best;
         vector<int> maxInlierSet;
-        cv::Mat bestE;
-        double best_resd;
-        int iter = 0;
-
-        while (iter < maxIterNum)
-        {
-            ++iter;
-            // --- choose minimal solution set: mss1<->mss2
-            random_unique(rnd.begin(), rnd.end(), mss1.cols);
-
-            for (int i = 0; i < mss1.cols; ++i)
-            {
-                pts1->col(rnd[i]).copyTo(mss1.col(i));
-                pts2->col(rnd[i]).copyTo(mss2.col(i));
-                
-            }
-
-            // compute minimal solution by 5-point
-            vector<cv::Mat> Es;   // multiple results from 5point alg.
-            fivepoint_stewnister(mss1, mss2, Es);
-
-            // find concensus set
-            vector<int> curInlierSet;
-
-            for (int k = 0; k < Es.size(); ++k)
-            {
-                curInlierSet.clear();
-                bool consitent_with_prior = true;
-
-                if (usePrior)  //use prior translation vector to filter
-                {
-                    cv::Mat Ra, Rb, t1;
-                    decEssential(&Es[k], &Ra, &Rb, &t1);
-                    double angleThresh = 40; // degree
-
-                    if (abs(t1.dot(t_prior) / cv::norm(t1) / cv::norm(t_prior)) < cos(angleThresh * PI / 180))
-                        consitent_with_prior = false;
-                }
-
-                if (!consitent_with_prior)	continue;
-
-                // check if already found
-                bool existE = false;
-
-                for (int kk = 0; kk < bestEs.size(); ++ kk)
-                {
-                    if (isEssnMatSimilar(bestEs[kk], Es[k]))
-                    {
-                        existE = true;
-                        break;
-                    }
-                }
+        RansacStats trialStats;
+        int score = ransac(prob, opts, &trialRng, best, maxInlierSet, &trialStats);
 
-                if (existE) continue;
+        stats.iterations += trialStats.iterations;
+        stats.models += trialStats.models;
+        stats.rejected += trialStats.rejected;
+        stats.evaluations += trialStats.evaluations;
+        stats.loRuns += trialStats.loRuns;
+        stats.score = max(stats.score, trialStats.score);
 
-                double resd = 0;
-                cv::Mat F = K.t().inv() * Es[k] * K.inv();
-
-                for (int i = 0; i < N; ++i)
-                {
-                    double dist_sq = fund_samperr(Kpts1.col(i), Kpts2.col(i), F);
-
-                    if (dist_sq < threshDist * threshDist)
-                    {
-                        curInlierSet.push_back(i);
-                        resd += dist_sq;
-                    }
-                }
-
-                resd = resd / curInlierSet.size();
-
-                if (curInlierSet.size() > maxInlierSet.size())
-                {
-                    maxInlierSet = curInlierSet;
-                    bestE = Es[k];
-                    best_resd = resd;
-                }
-            }
-
-            //re-compute maximum iteration number:maxIterNum
-            if (maxInlierSet.size() > 0)
-            {
-                maxIterNum = min(maxIterNum0,
-                                 (int)abs(log(1 - confidence) / log(1 - pow(double(maxInlierSet.size()) / N, 5.0))));
-            }
-        }
-
-        if (maxInlierSet.size() < mss1.cols)
+        if (score < 5)
             continue;
 
-        cv::Mat tmpE = bestE.clone();
-
-        while (true)
-        {
-            vector<cv::Mat> Es;
-            vector<int> maxInlierSet_k;
-            cv::Mat bestE_k;
-            // re-estimate by optimization
-            cv::Mat inliers1(3, maxInlierSet.size(), CV_64F),
-            inliers2(3, maxInlierSet.size(), CV_64F);
-
-            for (int i = 0; i < maxInlierSet.size(); ++i)
-            {
-                pts1->col(maxInlierSet[i]).copyTo(inliers1.col(i));
-                pts2->col(maxInlierSet[i]).copyTo(inliers2.col(i));
-            }
-
-            optimizeEmat(inliers1, inliers2, K, &tmpE);
-            vector<int> curInlierSet;
-            double resd = 0;
-            cv::Mat F = K.t().inv() * tmpE * K.inv();
-
-            for (int i = 0; i < N; ++i)
-            {
-                double dist_sq = fund_samperr(Kpts1.col(i), Kpts2.col(i), F);
-
-                if (dist_sq < threshDist * threshDist)
-                {
-                    curInlierSet.push_back(i);
-                    resd += dist_sq;
-                }
-            }
-
-            resd = resd / curInlierSet.size();
-
-            if (curInlierSet.size() > maxInlierSet.size())
-            {
-                maxInlierSet = curInlierSet;
-                bestE = tmpE;
-                best_resd = resd;
-            }
-            else
-                break;
-        }
-
-        cv::Mat inliers1(3, maxInlierSet.size(), CV_64F),
-        inliers2(3, maxInlierSet.size(), CV_64F);
-
-        for (int i = 0; i < maxInlierSet.size(); ++i)
-        {
-            pts1->col(maxInlierSet[i]).copyTo(inliers1.col(i));
-            pts2->col(maxInlierSet[i]).copyTo(inliers2.col(i));
-        }
+        cv::Mat bestE = essnToMat(best.E);
+        double best_resd = prob.meanError(best, maxInlierSet);
 
         cv::Mat inlierMask = cv::Mat::zeros(N, 1, CV_8U);
 
@@ -398,6 +369,8 @@ void essn_ransac(cv::Mat *pts1, cv::Mat *pts2, vector<cv::Mat> &bestEs, cv::Mat
             trialNum = 2;
     }
 
+    printRansacStats("essn_ransac", stats);
+
     for (int i = 0; i < bestEs.size(); ++i)
     {
         cv::Mat Ra, Rb, t;
@@ -481,8 +454,8 @@ float fund_samperr_float(cv::Mat x1, cv::Mat x2, cv::Mat F)
 
 struct data_essn_pts
 {
-    cv::Mat p1;
-    cv::Mat p2;
+    SoaPoints3d p1;
+    SoaPoints3d p2;
 };
 void costfun_essn_pts(double *p, double *error, int m, int n, void *adata)
 {
@@ -503,13 +476,12 @@ void costfun_essn_pts(double *p, double *error, int m, int n, void *adata)
                   p[6], 0 ,  -p[4],
                   -p[5], p[4], 0);
     cv::Mat E = tx * R;
-    double cost = 0;
+
+    sampsonErrors(E.ptr<double>(), &dptr->p1.x[0], &dptr->p1.y[0], &dptr->p1.z[0],
+                  &dptr->p2.x[0], &dptr->p2.y[0], &dptr->p2.z[0], n, error);
 
     for (int i = 0; i < n; ++i)
-    {
-        error[i] = sqrt(fund_samperr(dptr->p1.col(i), dptr->p2.col(i), E));
-        cost = cost + error[i] * error[i];
-    }
+        error[i] = sqrt(error[i]);
 }
 
 void opt_essn_pts(cv::Mat p1, cv::Mat p2, cv::Mat *E)
@@ -547,8 +519,8 @@ void opt_essn_pts(cv::Mat p1, cv::Mat p2, cv::Mat *E)
                      };
 
     data_essn_pts data;
-    data.p1 = p1;
-    data.p2 = p2;
+    soaPoints(p1, data.p1);
+    soaPoints(p2, data.p2);
 
     int ret = dlevmar_dif(costfun_essn_pts, para, measurement, 7, n,
                           matIter, opts, info, NULL, NULL, (void *)&data);
@@ -572,8 +544,8 @@ void opt_essn_pts(cv::Mat p1, cv::Mat p2, cv::Mat *E)
 
 struct data_optimizeEmat
 {
-    cv::Mat p1;  // normalized points (by K)
-    cv::Mat p2;
+    SoaPoints3d Kp1;  // points in image units
+    SoaPoints3d Kp2;
     cv::Mat K;
 };
 void costfun_optimizeEmat(double *p, double *error, int m, int n, void *adata)
@@ -597,11 +569,12 @@ void costfun_optimizeEmat(double *p, double *error, int m, int n, void *adata)
                   -p[5], p[4], 0);
     cv::Mat E = tx * R;
     cv::Mat F = K.t().inv() * E * K.inv();
-    double cost = 0;
-    cv::Mat Kp1 = K * dptr->p1, Kp2 = K * dptr->p2;
+
+    sampsonErrors(F.ptr<double>(), &dptr->Kp1.x[0], &dptr->Kp1.y[0], &dptr->Kp1.z[0],
+                  &dptr->Kp2.x[0], &dptr->Kp2.y[0], &dptr->Kp2.z[0], n, error);
 
     for (int i = 0; i < n; ++i)
-        error[i] = sqrt(fund_samperr(Kp1.col(i), Kp2.col(i), F));
+        error[i] = sqrt(error[i]);
 }
 void optimizeEmat(cv::Mat p1, cv::Mat p2, cv::Mat K, cv::Mat *E)
 // input: p1, p2, normalized image points correspondences
@@ -642,8 +615,8 @@ void optimizeEmat(cv::Mat p1, cv::Mat p2, cv::Mat K, cv::Mat *E)
                      };
 
     data_optimizeEmat data;
-    data.p1 = p1;
-    data.p2 = p2;
+    soaPoints(K * p1, data.Kp1);
+    soaPoints(K * p2, data.Kp2);
     data.K  = K;
 
     int ret = dlevmar_dif(costfun_optimizeEmat, para, measurement, 7, n,
@@ -796,69 +769,94 @@ findTrueRt(cv::Mat R1, cv::Mat R2, cv::Mat t, cv::Point2d q1, cv::Point2d q2)
 }
 
 
-bool fund_ransac(cv::Mat pts1, cv::Mat pts2, cv::Mat F, vector<uchar> &mask, double distThresh, double confidence)
-// running 8-point algorithm
-// re-estimation at the end
-// Input: points pairs normalized by camera matrix K
-// output:
+// 8-point estimation of F for ransac(), points are 2xN CV_32F; the error of a
+// pair is its squared sampson error
+struct FundProblem : public RansacProblem
 {
-    int maxIterNum = 500, N = pts1.cols;
-    int iter = 0;
-    vector<int> rnd;
+    typedef cv::Mat Model;
+    enum { SAMPLE_SIZE = 8, MAX_MODELS = 1 };
 
-    for (int i = 0; i < N; ++i)		rnd.push_back(i);
+    const cv::Mat &pts1, &pts2;
+    SoaPoints3d soa1, soa2;
 
-    cv::Mat mss1(2, 8, CV_32F), mss2(2, 8, CV_32F);
-    vector<int> maxInlierSet;
-    cv::Mat bestF;
-    vector<uchar> maxInlierMask(N);
+    FundProblem(const cv::Mat &_pts1, const cv::Mat &_pts2) : pts1(_pts1), pts2(_pts2)
+    {
+        soaPoints(pts1, soa1);
+        soaPoints(pts2, soa2);
+    }
+
+    int numData() const { return pts1.cols; }
 
-    while (iter < maxIterNum)
+    int fit(const int *sample, Model *models) const
     {
-        ++iter;
-        // --- choose minimal solution set: mss1<->mss2
-        random_unique(rnd.begin(), rnd.end(), mss1.cols);
+        cv::Mat mss1(2, 8, CV_32F), mss2(2, 8, CV_32F);
 
         for (int i = 0; i < mss1.cols; ++i)
         {
-            pts1.col(rnd[i]).copyTo(mss1.col(i));
-            pts2.col(rnd[i]).copyTo(mss2.col(i));
+            pts1.col(sample[i]).copyTo(mss1.col(i));
+            pts2.col(sample[i]).copyTo(mss2.col(i));
         }
 
         // compute minimal solution by 8-point
-        cv::Mat minF = cv::findFundamentalMat(mss1.t(), mss2.t(), cv::FM_8POINT);
-        // find concensus set
-        vector<int> curInlierSet;
-        vector<uchar> inlierMask(N);
+        models[0] = cv::findFundamentalMat(mss1.t(), mss2.t(), cv::FM_8POINT);
+        return models[0].empty() ? 0 : 1;
+    }
 
-        for (int i = 0; i < N; ++i)
-        {
-            float dist_sq = fund_samperr_float(pts1.col(i), pts2.col(i), minF);
+    void errors(const Model &F, int begin, int end, double *err) const
+    {
+        sampsonErrors(F.ptr<double>(), &soa1.x[begin], &soa1.y[begin], &soa1.z[begin],
+                      &soa2.x[begin], &soa2.y[begin], &soa2.z[begin], end - begin, err);
+    }
 
-            if (dist_sq < distThresh * distThresh)
-            {
-                curInlierSet.push_back(i);
-                inlierMask[i] = 1;
-            }
-            else
-                inlierMask[i] = 0;
-        }
+    // 8-point on all inliers
+    bool refit(const vector<int> &inliers, Model &F) const
+    {
+        cv::Mat in1(2, inliers.size(), CV_32F), in2(2, inliers.size(), CV_32F);
 
-        if (curInlierSet.size() > maxInlierSet.size())
+        for (int i = 0; i < inliers.size(); ++i)
         {
-            maxInlierSet = curInlierSet;
-            bestF = minF;
-            maxInlierMask = inlierMask;
+            pts1.col(inliers[i]).copyTo(in1.col(i));
+            pts2.col(inliers[i]).copyTo(in2.col(i));
         }
 
-        //re-compute maximum iteration number:maxIterNum
-        maxIterNum = abs(log(1 - confidence) / log(1 - pow(double(maxInlierSet.size()) / N, 8.0)));
+        cv::Mat Fin = cv::findFundamentalMat(in1.t(), in2.t(), cv::FM_8POINT);
+
+        if (Fin.rows != 3 || Fin.cols != 3) return false;
+
+        F = Fin;
+        return true;
     }
+};
 
-    if (maxInlierSet.size() < mss1.cols)
+bool fund_ransac(cv::Mat pts1, cv::Mat pts2, cv::Mat F, vector<uchar> &mask, double distThresh, double confidence,
+                 xrand_state *rng)
+// running 8-point algorithm, with local optimization of each new best model
+// Input: points pairs normalized by camera matrix K
+// output:
+{
+    int N = pts1.cols;
+
+    FundProblem prob(pts1, pts2);
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = confidence;
+    opts.threshold = distThresh * distThresh;
+    opts.loIter = 10;
+
+    cv::Mat bestF;
+    vector<int> maxInlierSet;
+    RansacStats stats;
+
+    if (ransac(prob, opts, rng, bestF, maxInlierSet, &stats) < FundProblem::SAMPLE_SIZE)
         return false;
 
-    mask = maxInlierMask;
+    printRansacStats("fund_ransac", stats);
+
+    mask.assign(N, 0);
+
+    for (int i = 0; i < maxInlierSet.size(); ++i)
+        mask[maxInlierSet[i]] = 1;
+
     F = bestF;
     return true;
 }
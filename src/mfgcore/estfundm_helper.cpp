@@ -27,7 +27,13 @@
  ********************************************************************************/
 
 
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
 #include <opencv2/core/core.hpp>
+#include <Eigen/Dense>
 #include <Eigen/StdVector>
 #include <Eigen/Eigenvalues>
 
@@ -35,38 +41,11 @@ using namespace Eigen;
 //using namespace std;
 
 
-void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::Mat> &Es)
+static void fivepointCoeffs(const double *EE, double *arA)
+// coefficients of the 10 cubic constraints on E = EE * [x y z 1]', EE is the
+// 9x4 null space basis, row major; arA is the 10x20 coefficient matrix, column
+// major
 {
-    // Input: normalized point corrodinates, P1 from I, P2 from I', 3xN, N>=5
-    // Output: vector of essential matrix
-    
-    assert(P1.cols >= 5 && P2.cols >= 5);
-    cv::Mat Q1 = P2.t(); // in stew's matlab code, Q1 is from I', Q2 from I.
-    cv::Mat Q2 = P1.t();
-    cv::Mat Q(Q1.rows, 9, CV_64F);
-    cv::Mat col;
-    col = Q1.col(0).mul(Q2.col(0));
-    col.copyTo(Q.col(0));
-    col = Q1.col(1).mul(Q2.col(0));
-    col.copyTo(Q.col(1));
-    col = Q1.col(2).mul(Q2.col(0));
-    col.copyTo(Q.col(2));
-    col = Q1.col(0).mul(Q2.col(1));
-    col.copyTo(Q.col(3));
-    col = Q1.col(1).mul(Q2.col(1));
-    col.copyTo(Q.col(4));
-    col = Q1.col(2).mul(Q2.col(1));
-    col.copyTo(Q.col(5));
-    col = Q1.col(0).mul(Q2.col(2));
-    col.copyTo(Q.col(6));
-    col = Q1.col(1).mul(Q2.col(2));
-    col.copyTo(Q.col(7));
-    col = Q1.col(2).mul(Q2.col(2));
-    col.copyTo(Q.col(8));
-
-    cv::SVD svd(Q, cv::SVD::FULL_UV);
-    cv::Mat EE = svd.vt.rowRange(5, 9).t(); // EE size: 9x4
-
     double e00, e01, e02, e03, e04, e05, e06, e07, e08;
     double e10, e11, e12, e13, e14, e15, e16, e17, e18;
     double e20, e21, e22, e23, e24, e25, e26, e27, e28;
@@ -82,42 +61,42 @@ void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::
     double e203, e213, e223, e233, e243, e253, e263, e273, e283;
     double e303, e313, e323, e333, e343, e353, e363, e373, e383;
 
-    e00 = EE.at<double>(0, 0);
-    e10 = EE.at<double>(0, 1);
-    e20 = EE.at<double>(0, 2);
-    e30 = EE.at<double>(0, 3);
-    e01 = EE.at<double>(1, 0);
-    e11 = EE.at<double>(1, 1);
-    e21 = EE.at<double>(1, 2);
-    e31 = EE.at<double>(1, 3);
-    e02 = EE.at<double>(2, 0);
-    e12 = EE.at<double>(2, 1);
-    e22 = EE.at<double>(2, 2);
-    e32 = EE.at<double>(2, 3);
-    e03 = EE.at<double>(3, 0);
-    e13 = EE.at<double>(3, 1);
-    e23 = EE.at<double>(3, 2);
-    e33 = EE.at<double>(3, 3);
-    e04 = EE.at<double>(4, 0);
-    e14 = EE.at<double>(4, 1);
-    e24 = EE.at<double>(4, 2);
-    e34 = EE.at<double>(4, 3);
-    e05 = EE.at<double>(5, 0);
-    e15 = EE.at<double>(5, 1);
-    e25 = EE.at<double>(5, 2);
-    e35 = EE.at<double>(5, 3);
-    e06 = EE.at<double>(6, 0);
-    e16 = EE.at<double>(6, 1);
-    e26 = EE.at<double>(6, 2);
-    e36 = EE.at<double>(6, 3);
-    e07 = EE.at<double>(7, 0);
-    e17 = EE.at<double>(7, 1);
-    e27 = EE.at<double>(7, 2);
-    e37 = EE.at<double>(7, 3);
-    e08 = EE.at<double>(8, 0);
-    e18 = EE.at<double>(8, 1);
-    e28 = EE.at<double>(8, 2);
-    e38 = EE.at<double>(8, 3);
+    e00 = EE[0];
+    e10 = EE[1];
+    e20 = EE[2];
+    e30 = EE[3];
+    e01 = EE[4];
+    e11 = EE[5];
+    e21 = EE[6];
+    e31 = EE[7];
+    e02 = EE[8];
+    e12 = EE[9];
+    e22 = EE[10];
+    e32 = EE[11];
+    e03 = EE[12];
+    e13 = EE[13];
+    e23 = EE[14];
+    e33 = EE[15];
+    e04 = EE[16];
+    e14 = EE[17];
+    e24 = EE[18];
+    e34 = EE[19];
+    e05 = EE[20];
+    e15 = EE[21];
+    e25 = EE[22];
+    e35 = EE[23];
+    e06 = EE[24];
+    e16 = EE[25];
+    e26 = EE[26];
+    e36 = EE[27];
+    e07 = EE[28];
+    e17 = EE[29];
+    e27 = EE[30];
+    e37 = EE[31];
+    e08 = EE[32];
+    e18 = EE[33];
+    e28 = EE[34];
+    e38 = EE[35];
 
     e002 = e00 * e00;
     e102 = e10 * e10;
@@ -193,7 +172,6 @@ void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::
     e283 = e28 * e28 * e28;
     e383 = e38 * e38 * e38;
 
-    double arA[200];
     arA[0 + 10 * 0] = 0.5 * e003 + 0.5 * e00 * e012 + 0.5 * e00 * e022 + 0.5 * e00 * e032 + e03 * e01 * e04 + e03 * e02 * e05 + 0.5 * e00 * e062 + e06 * e01 * e07 + e06 * e02 * e08 - 0.5 * e00 * e042 - 0.5 * e00 * e052 - 0.5 * e00 * e072 - 0.5 * e00 * e082;
     arA[0 + 10 * 1] = e00 * e11 * e01 + e00 * e12 * e02 + e03 * e00 * e13 + e03 * e11 * e04 + e03 * e01 * e14 + e03 * e12 * e05 + e03 * e02 * e15 + e13 * e01 * e04 + e13 * e02 * e05 + e06 * e00 * e16 + 1.5 * e10 * e002 + 0.5 * e10 * e012 + 0.5 * e10 * e022 + 0.5 * e10 * e062 - 0.5 * e10 * e042 - 0.5 * e10 * e052 - 0.5 * e10 * e072 + 0.5 * e10 * e032 + e06 * e11 * e07 + e06 * e01 * e17 + e06 * e12 * e08 + e06 * e02 * e18 + e16 * e01 * e07 + e16 * e02 * e08 - e00 * e14 * e04 - e00 * e17 * e07 - e00 * e15 * e05 - e00 * e18 * e08 - 0.5 * e10 * e082;
     arA[0 + 10 * 2] = e16 * e02 * e18 + e03 * e12 * e15 + e10 * e11 * e01 + e10 * e12 * e02 + e03 * e10 * e13 + e03 * e11 * e14 + e13 * e11 * e04 + e13 * e01 * e14 + e13 * e12 * e05 + e13 * e02 * e15 + e06 * e10 * e16 + e06 * e12 * e18 + e06 * e11 * e17 + e16 * e11 * e07 + e16 * e01 * e17 + e16 * e12 * e08 - e10 * e14 * e04 - e10 * e17 * e07 - e10 * e15 * e05 - e10 * e18 * e08 + 1.5 * e00 * e102 + 0.5 * e00 * e122 + 0.5 * e00 * e112 + 0.5 * e00 * e132 + 0.5 * e00 * e162 - 0.5 * e00 * e152 - 0.5 * e00 * e172 - 0.5 * e00 * e182 - 0.5 * e00 * e142;
@@ -395,6 +373,435 @@ void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::
     arA[9 + 10 * 18] = -e20 * e35 * e37 + e20 * e34 * e38 + e30 * e24 * e38 - e30 * e35 * e27 - e30 * e25 * e37 + e30 * e34 * e28 + e23 * e32 * e37 - e23 * e31 * e38 - e33 * e21 * e38 - e33 * e31 * e28 + e33 * e22 * e37 + e33 * e32 * e27 + e26 * e31 * e35 - e26 * e32 * e34 - e36 * e22 * e34 - e36 * e32 * e24 + e36 * e21 * e35 + e36 * e31 * e25;
     arA[9 + 10 * 19] = -e33 * e31 * e38 - e30 * e35 * e37 + e36 * e31 * e35 + e33 * e32 * e37 + e30 * e34 * e38 - e36 * e32 * e34;
 
+}
+
+// polynomials are coefficient arrays, lowest degree first
+
+static inline void polyMul(const double *a, int na, const double *b, int nb, double *c)
+// c = a * b of degrees na and nb, c has na + nb + 1 coefficients
+{
+    for (int i = 0; i <= na + nb; ++i)
+        c[i] = 0;
+
+    for (int i = 0; i <= na; ++i)
+        for (int j = 0; j <= nb; ++j)
+            c[i + j] += a[i] * b[j];
+}
+
+static inline double polyEval(const double *p, int n, double x)
+{
+    double v = p[n];
+
+    for (int i = n - 1; i >= 0; --i)
+        v = v * x + p[i];
+
+    return v;
+}
+
+static int sturmChanges(const double (*s)[11], const int *deg, int len, double x)
+// sign changes of the Sturm sequence s at x
+{
+    int changes = 0;
+    double last = 0;
+
+    for (int k = 0; k < len; ++k)
+    {
+        double v = polyEval(s[k], deg[k], x);
+
+        if (v == 0) continue;
+        if (last != 0 && (v < 0) != (last < 0)) ++changes;
+        last = v;
+    }
+
+    return changes;
+}
+
+static int sturmRoots(const double *p, int n, double *roots)
+// distinct real roots of p of degree n <= 10: isolated by bisection on the
+// Sturm sequence, then refined by Newton steps kept inside the bracket;
+// returns their num
+{
+    while (n > 0 && std::abs(p[n]) <= 1e-14 * std::abs(p[n - 1]))
+        --n;
+
+    if (n < 1)
+        return 0;
+
+    // s[0] = p monic, s[1] = p', s[k + 1] = -rem(s[k - 1], s[k]) scaled
+    double s[11][11];
+    int deg[11], len = 2;
+
+    for (int i = 0; i <= n; ++i)
+        s[0][i] = p[i] / p[n];
+
+    for (int i = 1; i <= n; ++i)
+        s[1][i - 1] = i * s[0][i];
+
+    deg[0] = n;
+    deg[1] = n - 1;
+
+    while (deg[len - 1] > 0)
+    {
+        const double *a = s[len - 2], *b = s[len - 1];
+        int da = deg[len - 2], db = deg[len - 1];
+        double r[11];
+
+        for (int i = 0; i <= da; ++i)
+            r[i] = a[i];
+
+        for (int i = da; i >= db; --i)
+        {
+            double q = r[i] / b[db];
+
+            for (int j = 0; j <= db; ++j)
+                r[i - db + j] -= q * b[j];
+        }
+
+        int dr = db - 1;
+        double scale = 0;
+
+        for (int i = 0; i <= dr; ++i)
+            scale = std::max(scale, std::abs(r[i]));
+
+        if (scale == 0) // multiple root, the sequence ends with gcd(p, p')
+            break;
+
+        while (dr > 0 && std::abs(r[dr]) <= 1e-12 * scale)
+            --dr;
+
+        for (int i = 0; i <= dr; ++i)
+            s[len][i] = -r[i] / scale;
+
+        deg[len++] = dr;
+    }
+
+    // all roots are within the Fujiwara bound
+    double bound = std::pow(std::abs(s[0][0]) / 2, 1.0 / n);
+
+    for (int i = 1; i < n; ++i)
+        bound = std::max(bound, std::pow(std::abs(s[0][i]), 1.0 / (n - i)));
+
+    bound *= 2;
+
+    // stack of intervals (lo, hi] holding at least one root, at most n
+    double lo[10], hi[10];
+    int clo[10], chi[10], numIntervals = 1, numRoots = 0;
+    lo[0] = -bound;
+    hi[0] = bound;
+    clo[0] = sturmChanges(s, deg, len, -bound);
+    chi[0] = sturmChanges(s, deg, len, bound);
+
+    if (clo[0] <= chi[0])
+        return 0;
+
+    while (numIntervals > 0)
+    {
+        --numIntervals;
+        double a = lo[numIntervals], b = hi[numIntervals];
+        int ca = clo[numIntervals], cb = chi[numIntervals];
+
+        if (ca - cb > 1 && b - a > 1e-12 * bound)
+        {
+            double m = 0.5 * (a + b);
+            int cm = sturmChanges(s, deg, len, m);
+
+            if (ca > cm)
+            {
+                lo[numIntervals] = a;
+                hi[numIntervals] = m;
+                clo[numIntervals] = ca;
+                chi[numIntervals++] = cm;
+            }
+
+            if (cm > cb)
+            {
+                lo[numIntervals] = m;
+                hi[numIntervals] = b;
+                clo[numIntervals] = cm;
+                chi[numIntervals++] = cb;
+            }
+
+            continue;
+        }
+
+        double fa = polyEval(s[0], n, a), fb = polyEval(s[0], n, b);
+        double x = 0.5 * (a + b);
+
+        if ((fa < 0) == (fb < 0)) // root of even multiplicity, or a cluster
+        {
+            roots[numRoots++] = x;
+            continue;
+        }
+
+        for (int it = 0; it < 100 && b - a > 1e-15 * std::max(1.0, std::abs(x)); ++it)
+        {
+            double fx = polyEval(s[0], n, x);
+
+            if (fx == 0) break;
+
+            if ((fx < 0) == (fa < 0))
+                a = x;
+            else
+                b = x;
+
+            double d = polyEval(s[1], n - 1, x);
+            double xn = d != 0 ? x - fx / d : a;
+            x = (xn > a && xn < b) ? xn : 0.5 * (a + b);
+        }
+
+        roots[numRoots++] = x;
+    }
+
+    return numRoots;
+}
+
+static int fivepointFromNullspace(const Matrix<double, 9, 4, RowMajor> &EE, Matrix3d *Es)
+// solves the constraints as a degree 10 polynomial in z (Nister), with z as
+// hidden variable; returns the num of real solutions
+{
+    double arA[200];
+    fivepointCoeffs(EE.data(), arA);
+
+    // the columns of A are the monomials x^3 x^2y xy^2 y^3 x^2z xyz y^2z xz^2
+    // yz^2 z^3 | x^2 xy y^2 xz yz z^2 x y z 1; after elimination, row k of
+    // [I B] gives the k-th cubic monomial in terms of the others
+    Map<const Matrix<double, 10, 20> > A(arA);
+    Matrix<double, 10, 10> B = A.leftCols<10>().partialPivLu().solve(A.rightCols<10>());
+
+    // the rows of x^2z xyz y^2z, and of xz^2 yz^2 z^3, over [x^2 xy y^2] and
+    // [x y 1] with coefficients in z: L*quad + S*lin = 0, Q*quad + P*lin = 0
+    double L[3][3][2], S[3][3][3], P[3][3][4];
+    Matrix3d Q;
+
+    for (int r = 0; r < 3; ++r)
+    {
+        const int k = 4 + r, m = 7 + r;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            L[r][c][0] = B(k, c);
+            L[r][c][1] = c == r ? 1 : 0;
+            Q(r, c) = B(m, c);
+        }
+
+        S[r][0][0] = B(k, 6);
+        S[r][0][1] = B(k, 3);
+        S[r][0][2] = 0;
+        S[r][1][0] = B(k, 7);
+        S[r][1][1] = B(k, 4);
+        S[r][1][2] = 0;
+        S[r][2][0] = B(k, 9);
+        S[r][2][1] = B(k, 8);
+        S[r][2][2] = B(k, 5);
+
+        P[r][0][0] = B(m, 6);
+        P[r][0][1] = B(m, 3);
+        P[r][0][2] = r == 0 ? 1 : 0;
+        P[r][0][3] = 0;
+        P[r][1][0] = B(m, 7);
+        P[r][1][1] = B(m, 4);
+        P[r][1][2] = r == 1 ? 1 : 0;
+        P[r][1][3] = 0;
+        P[r][2][0] = B(m, 9);
+        P[r][2][1] = B(m, 8);
+        P[r][2][2] = B(m, 5);
+        P[r][2][3] = r == 2 ? 1 : 0;
+    }
+
+    // quad = -Q^-1*P*lin, so N*lin = 0 with N = S - L*Q^-1*P, whose columns
+    // have degree 3, 3 and 4 in z
+    Matrix3d Qi = Q.inverse();
+    double G[3][3][4], N[3][3][5];
+
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            for (int d = 0; d < 4; ++d)
+                G[r][c][d] = Qi(r, 0) * P[0][c][d] + Qi(r, 1) * P[1][c][d] + Qi(r, 2) * P[2][c][d];
+
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int d = 0; d < 5; ++d)
+                N[r][c][d] = d < 3 ? S[r][c][d] : 0;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                N[r][c][0] -= L[r][j][0] * G[j][c][0];
+
+                for (int d = 1; d < 4; ++d)
+                    N[r][c][d] -= L[r][j][0] * G[j][c][d] + L[r][j][1] * G[j][c][d - 1];
+
+                N[r][c][4] -= L[r][j][1] * G[j][c][3];
+            }
+        }
+
+    // det(N), expanded along the first row
+    double m12[8], m02[8], m01[7], tmp[8], det[11], term[11];
+
+    polyMul(N[1][1], 3, N[2][2], 4, m12);
+    polyMul(N[1][2], 4, N[2][1], 3, tmp);
+    for (int i = 0; i < 8; ++i) m12[i] -= tmp[i];
+
+    polyMul(N[1][0], 3, N[2][2], 4, m02);
+    polyMul(N[1][2], 4, N[2][0], 3, tmp);
+    for (int i = 0; i < 8; ++i) m02[i] -= tmp[i];
+
+    polyMul(N[1][0], 3, N[2][1], 3, m01);
+    polyMul(N[1][1], 3, N[2][0], 3, tmp);
+    for (int i = 0; i < 7; ++i) m01[i] -= tmp[i];
+
+    polyMul(N[0][0], 3, m12, 7, det);
+    polyMul(N[0][1], 3, m02, 7, term);
+    for (int i = 0; i < 11; ++i) det[i] -= term[i];
+    polyMul(N[0][2], 4, m01, 6, term);
+    for (int i = 0; i < 11; ++i) det[i] += term[i];
+
+    double zs[10];
+    int numRoots = sturmRoots(det, 10, zs), numSols = 0;
+
+    for (int i = 0; i < numRoots; ++i)
+    {
+        Matrix3d Nz;
+
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 3; ++c)
+                Nz(r, c) = polyEval(N[r][c], 4, zs[i]);
+
+        // [x y 1] spans the null space of N(z): the largest cross product of two rows
+        Vector3d v = Nz.row(0).cross(Nz.row(1));
+        Vector3d w = Nz.row(0).cross(Nz.row(2));
+        Vector3d u = Nz.row(1).cross(Nz.row(2));
+
+        if (w.squaredNorm() > v.squaredNorm()) v = w;
+        if (u.squaredNorm() > v.squaredNorm()) v = u;
+        if (v(2) == 0) continue;
+
+        Matrix<double, 9, 1> Evec = EE * Vector4d(v(0) / v(2), v(1) / v(2), zs[i], 1);
+        Evec.normalize();
+
+        Es[numSols++] <<
+                      Evec(0), Evec(3), Evec(6),
+                      Evec(1), Evec(4), Evec(7),
+                      Evec(2), Evec(5), Evec(8);
+    }
+
+    return numSols;
+}
+
+int fivepoint_stewnister(const Matrix<double, 3, 5> &P1, const Matrix<double, 3, 5> &P2, Matrix3d *Es)
+{
+    // Input: normalized point coordinates, P1 from I, P2 from I'
+    // Output: up to 10 essential matrices, returns their num
+    // Everything has a fixed size, nothing is allocated on the heap.
+
+    // epipolar constraint of each pair, Q(i, 3a+b) = P1(a,i) * P2(b,i)
+    Matrix<double, 9, 5> Qt;
+
+    for (int i = 0; i < 5; ++i)
+        for (int a = 0; a < 3; ++a)
+            for (int b = 0; b < 3; ++b)
+                Qt(3 * a + b, i) = P1(a, i) * P2(b, i);
+
+    // null space of Q: the last 4 columns of the orthogonal factor of Q'
+    HouseholderQR<Matrix<double, 9, 5> > qr(Qt);
+    Matrix<double, 9, 9> H = qr.householderQ();
+    Matrix<double, 9, 4, RowMajor> EE = H.rightCols<4>();
+
+    return fivepointFromNullspace(EE, Es);
+}
+
+static void pushEssentials(const Matrix3d *sols, int numSols, std::vector<cv::Mat> &Es)
+{
+    for (int k = 0; k < numSols; ++k)
+    {
+        cv::Mat E(3, 3, CV_64F);
+
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                E.at<double>(i, j) = sols[k](i, j);
+
+        Es.push_back(E);
+    }
+}
+
+static cv::Mat svdNullspace(const cv::Mat &P1, const cv::Mat &P2)
+// 9x4 null space basis of the epipolar constraints of N >= 5 point pairs, row
+// major
+{
+    cv::Mat Q1 = P2.t(); // in stew's matlab code, Q1 is from I', Q2 from I.
+    cv::Mat Q2 = P1.t();
+    cv::Mat Q(Q1.rows, 9, CV_64F);
+    cv::Mat col;
+    col = Q1.col(0).mul(Q2.col(0));
+    col.copyTo(Q.col(0));
+    col = Q1.col(1).mul(Q2.col(0));
+    col.copyTo(Q.col(1));
+    col = Q1.col(2).mul(Q2.col(0));
+    col.copyTo(Q.col(2));
+    col = Q1.col(0).mul(Q2.col(1));
+    col.copyTo(Q.col(3));
+    col = Q1.col(1).mul(Q2.col(1));
+    col.copyTo(Q.col(4));
+    col = Q1.col(2).mul(Q2.col(1));
+    col.copyTo(Q.col(5));
+    col = Q1.col(0).mul(Q2.col(2));
+    col.copyTo(Q.col(6));
+    col = Q1.col(1).mul(Q2.col(2));
+    col.copyTo(Q.col(7));
+    col = Q1.col(2).mul(Q2.col(2));
+    col.copyTo(Q.col(8));
+
+    cv::SVD svd(Q, cv::SVD::FULL_UV);
+    return svd.vt.rowRange(5, 9).t();
+}
+
+void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::Mat> &Es)
+{
+    // Input: normalized point corrodinates, P1 from I, P2 from I', 3xN, N>=5
+    // Output: vector of essential matrix
+    
+    assert(P1.cols >= 5 && P2.cols >= 5);
+    Matrix<double, 9, 4, RowMajor> EE;
+    Matrix3d sols[10];
+
+    if (P1.cols == 5)
+    {
+        // minimal sample, fixed-size solver
+        Matrix<double, 3, 5> X1, X2;
+
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 5; ++j)
+            {
+                X1(i, j) = P1.at<double>(i, j);
+                X2(i, j) = P2.at<double>(i, j);
+            }
+
+        int numSols = fivepoint_stewnister(X1, X2, sols);
+        pushEssentials(sols, numSols, Es);
+        return;
+    }
+
+    cv::Mat nullspace = svdNullspace(P1, P2);
+
+    for (int i = 0; i < 9; ++i)
+        for (int j = 0; j < 4; ++j)
+            EE(i, j) = nullspace.at<double>(i, j);
+
+    int numSols = fivepointFromNullspace(EE, sols);
+    pushEssentials(sols, numSols, Es);
+}
+
+void fivepoint_stewnister_ref(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::Mat> &Es)
+// the solver as it was before the fixed-size one: SVD null space, cv::Mat
+// elimination and a single precision complex eigensolver; kept as the baseline
+// of mfg-bench
+{
+    assert(P1.cols >= 5 && P2.cols >= 5);
+    cv::Mat EE = svdNullspace(P1, P2);
+
+    double arA[200];
+    fivepointCoeffs(EE.ptr<double>(), arA);
+
     cv::Mat A(20, 10, CV_64F, &arA);
     A = A.t();
     A = A.colRange(0, 10).inv() * A.colRange(10, 20);
@@ -441,7 +848,6 @@ void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::
     {
         Evec.col(i) = Evec.col(i) / sqrt(Evec.col(i).array().square().sum());
 
-        //Evec.col(i).normalize();
         if (Evec.col(i).imag().norm() > 1e-5)   // ignore complex vector
             continue;
 
@@ -451,8 +857,4 @@ void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::
                      Evec(2, i).real(), Evec(5, i).real(), Evec(8, i).real());
         Es.push_back(E);
     }
-
-//	for (int i=0; i<Es.size(); ++i)
-//		cout<<"Ei"<<Es[i]<<endl;
-    return;
 }
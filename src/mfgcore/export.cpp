@@ -26,8 +26,42 @@
 
 #include "utils.h"
 #include "export.h"
+#include "archive.h"
 #include <fstream>
 #include <QDir>
+// Landmarks evicted to the archive (see Mfg::archiveOldViews) are exported
+// from their archive record
+
+static bool isMapKeyPoint(const Mfg &m, int gid)
+{
+    return (m.keyPoints[gid].is3D && m.keyPoints[gid].gid >= 0) || (m.archive && m.archive->hasKeyPoint(gid));
+}
+
+static bool isMapIdealLine(const Mfg &m, int gid)
+{
+    return (m.idealLines[gid].is3D && m.idealLines[gid].gid >= 0) || (m.archive && m.archive->hasIdealLine(gid));
+}
+
+static KeyPoint3d mapKeyPoint(const Mfg &m, int gid)
+{
+    KeyPoint3d kpt = m.keyPoints[gid];
+
+    if (!(kpt.is3D && kpt.gid >= 0) && m.archive)
+        m.archive->readKeyPoint(gid, kpt);
+
+    return kpt;
+}
+
+static IdealLine3d mapIdealLine(const Mfg &m, int gid)
+{
+    IdealLine3d iln = m.idealLines[gid];
+
+    if (!(iln.is3D && iln.gid >= 0) && m.archive)
+        m.archive->readIdealLine(gid, iln);
+
+    return iln;
+}
+
 void exportCamPose(Mfg &m, string fname)
 {
     ofstream file(fname);
@@ -70,7 +104,7 @@ void exportMfgNode(Mfg &m, string fname)
 
     for (int i = 0; i < m.keyPoints.size(); ++i)
     {
-        if (!m.keyPoints[i].is3D || m.keyPoints[i].gid < 0) continue; // only output 3d pt
+        if (!isMapKeyPoint(m, i)) continue; // only output 3d pt
 
         ++kpNum;
     }
@@ -79,11 +113,12 @@ void exportMfgNode(Mfg &m, string fname)
 
     for (int i = 0; i < m.keyPoints.size(); ++i)
     {
-        if (!m.keyPoints[i].is3D || m.keyPoints[i].gid < 0) continue; // only output 3d pt
+        if (!isMapKeyPoint(m, i)) continue; // only output 3d pt
 
-        file << m.keyPoints[i].x << '\t' << m.keyPoints[i].y << '\t' << m.keyPoints[i].z
-             << m.keyPoints[i].gid << '\t' << m.keyPoints[i].estViewId << '\t'
-             << m.keyPoints[i].pGid << '\n';
+        KeyPoint3d kpt = mapKeyPoint(m, i);
+        file << kpt.x << '\t' << kpt.y << '\t' << kpt.z
+             << kpt.gid << '\t' << kpt.estViewId << '\t'
+             << kpt.pGid << '\n';
     }
 
     // ideal line
@@ -91,7 +126,7 @@ void exportMfgNode(Mfg &m, string fname)
 
     for (int i = 0; i < m.idealLines.size(); ++i)
     {
-        if (!m.idealLines[i].is3D || m.idealLines[i].gid < 0) continue; // only output 3d
+        if (!isMapIdealLine(m, i)) continue; // only output 3d
 
         ++ilNum;
     }
@@ -100,14 +135,15 @@ void exportMfgNode(Mfg &m, string fname)
 
     for (int i = 0; i < m.idealLines.size(); ++i)
     {
-        if (!m.idealLines[i].is3D || m.idealLines[i].gid < 0) continue; // only output 3d
-
-        file << m.idealLines[i].extremity1().x << '\t' << m.idealLines[i].extremity1().y << '\t'
-             << m.idealLines[i].extremity1().z << '\t'
-             << m.idealLines[i].extremity2().x << '\t' << m.idealLines[i].extremity2().y << '\t'
-             << m.idealLines[i].extremity2().z << '\t'
-             << m.idealLines[i].gid << '\t' << m.idealLines[i].estViewId << '\t'
-             << m.idealLines[i].vpGid << '\t' << m.idealLines[i].pGid << '\n';
+        if (!isMapIdealLine(m, i)) continue; // only output 3d
+
+        IdealLine3d iln = mapIdealLine(m, i);
+        file << iln.extremity1().x << '\t' << iln.extremity1().y << '\t'
+             << iln.extremity1().z << '\t'
+             << iln.extremity2().x << '\t' << iln.extremity2().y << '\t'
+             << iln.extremity2().z << '\t'
+             << iln.gid << '\t' << iln.estViewId << '\t'
+             << iln.vpGid << '\t' << iln.pGid << '\n';
     }
 
     file << m.vanishingPoints.size() << '\n';
@@ -144,7 +180,7 @@ void Mfg::exportAll(string root_dir)
 
     for (int i = 0; i < keyPoints.size(); ++i)
     {
-        if (!keyPoints[i].is3D || keyPoints[i].gid < 0) continue; // only output 3d pt
+        if (!isMapKeyPoint(*this, i)) continue; // only output 3d pt
 
         ++kpNum;
     }
@@ -154,14 +190,15 @@ void Mfg::exportAll(string root_dir)
 
     for (int i = 0; i < keyPoints.size(); ++i)
     {
-        if (!keyPoints[i].is3D || keyPoints[i].gid < 0) continue; // only output 3d pt
+        if (!isMapKeyPoint(*this, i)) continue; // only output 3d pt
 
-        feat3d_ofs << keyPoints[i].gid << '\t' << keyPoints[i].x << '\t' << keyPoints[i].y << '\t' << keyPoints[i].z << '\t'
-                   << keyPoints[i].pGid << '\t' << keyPoints[i].estViewId << '\t';
-        feat3d_ofs << keyPoints[i].viewId_ptLid.size() << '\t';
+        KeyPoint3d kpt = mapKeyPoint(*this, i);
+        feat3d_ofs << kpt.gid << '\t' << kpt.x << '\t' << kpt.y << '\t' << kpt.z << '\t'
+                   << kpt.pGid << '\t' << kpt.estViewId << '\t';
+        feat3d_ofs << kpt.viewId_ptLid.size() << '\t';
 
-        for (int j = 0; j < keyPoints[i].viewId_ptLid.size(); ++j)
-            feat3d_ofs << keyPoints[i].viewId_ptLid[j][0] << '\t' << keyPoints[i].viewId_ptLid[j][1] << '\t';
+        for (int j = 0; j < kpt.viewId_ptLid.size(); ++j)
+            feat3d_ofs << kpt.viewId_ptLid[j][0] << '\t' << kpt.viewId_ptLid[j][1] << '\t';
 
         feat3d_ofs << '\n';
     }
@@ -171,7 +208,7 @@ void Mfg::exportAll(string root_dir)
 
     for (int i = 0; i < idealLines.size(); ++i)
     {
-        if (!idealLines[i].is3D || idealLines[i].gid < 0) continue; // only output 3d pt
+        if (!isMapIdealLine(*this, i)) continue; // only output 3d pt
 
         ++ilNum;
     }
@@ -181,15 +218,16 @@ void Mfg::exportAll(string root_dir)
 
     for (int i = 0; i < idealLines.size(); ++i)
     {
-        if (!idealLines[i].is3D || idealLines[i].gid < 0) continue; // only output 3d pt
+        if (!isMapIdealLine(*this, i)) continue; // only output 3d pt
 
-        feat3d_ofs << idealLines[i].gid << '\t' << idealLines[i].extremity1().x << '\t' << idealLines[i].extremity1().y << '\t' << idealLines[i].extremity1().z << '\t'
-                   << idealLines[i].extremity2().x << '\t' << idealLines[i].extremity2().y << '\t' << idealLines[i].extremity2().z << '\t'
-                   << idealLines[i].pGid << '\t' << idealLines[i].vpGid << '\t' << idealLines[i].estViewId << '\t';
-        feat3d_ofs << idealLines[i].viewId_lnLid.size() << '\t';
+        IdealLine3d iln = mapIdealLine(*this, i);
+        feat3d_ofs << iln.gid << '\t' << iln.extremity1().x << '\t' << iln.extremity1().y << '\t' << iln.extremity1().z << '\t'
+                   << iln.extremity2().x << '\t' << iln.extremity2().y << '\t' << iln.extremity2().z << '\t'
+                   << iln.pGid << '\t' << iln.vpGid << '\t' << iln.estViewId << '\t';
+        feat3d_ofs << iln.viewId_lnLid.size() << '\t';
 
-        for (int j = 0; j < idealLines[i].viewId_lnLid.size(); ++j)
-            feat3d_ofs << idealLines[i].viewId_lnLid[j][0] << '\t' << idealLines[i].viewId_lnLid[j][1] << '\t';
+        for (int j = 0; j < iln.viewId_lnLid.size(); ++j)
+            feat3d_ofs << iln.viewId_lnLid[j][0] << '\t' << iln.viewId_lnLid[j][1] << '\t';
 
         feat3d_ofs << '\n';
     }
@@ -218,7 +256,7 @@ void Mfg::exportAll(string root_dir)
     for (int i = 0; i < primaryPlanes.size(); ++i)
     {
         feat3d_ofs << primaryPlanes[i].gid << '\t'
-                   << primaryPlanes[i].n.at<double>(0) << '\t' << primaryPlanes[i].n.at<double>(1) << '\t' << primaryPlanes[i].n.at<double>(2) << '\t'
+                   << primaryPlanes[i].n[0] << '\t' << primaryPlanes[i].n[1] << '\t' << primaryPlanes[i].n[2] << '\t'
                    << primaryPlanes[i].d << '\t' << primaryPlanes[i].estViewId << '\t' << primaryPlanes[i].recentViewId << '\t';
         feat3d_ofs << primaryPlanes[i].kptGids.size() << '\t';
 
@@ -242,30 +280,42 @@ void Mfg::exportAll(string root_dir)
 
     for (int i = 0; i < views.size(); ++i)
     {
+        // archived views are read back from the archive file, the pose in memory is kept
+        View archived;
+        bool isArchived = !views[i].matchable && archive && archive->readView(views[i].id, archived);
+
+        if (isArchived)
+        {
+            archived.R = views[i].R;
+            archived.t = views[i].t;
+        }
+
+        const View &v = isArchived ? archived : views[i];
+
         string view_fname = views_dir + "/view_" + num2str(i) + ".txt";
         ofstream view_ofs(view_fname.c_str());
-        view_ofs << "keyframe_id:\t" << views[i].id << '\n';
-        view_ofs << "rawframe_id:\t" << views[i].frameId << '\n';
-        view_ofs << "image_path:\t" << views[i].filename << '\n';
-        view_ofs << "rotation_mat:\t" << views[i].R.at<double>(0, 0) << '\t' << views[i].R.at<double>(0, 1) << '\t' << views[i].R.at<double>(0, 2) << '\t'
-                 << views[i].R.at<double>(1, 0) << '\t' << views[i].R.at<double>(1, 1) << '\t' << views[i].R.at<double>(1, 2) << '\t'
-                 << views[i].R.at<double>(2, 0) << '\t' << views[i].R.at<double>(2, 1) << '\t' << views[i].R.at<double>(2, 2) << '\n';
-        view_ofs << "translation:\t" << views[i].t.at<double>(0) << '\t' << views[i].t.at<double>(1) << '\t' << views[i].t.at<double>(2) << '\n';
+        view_ofs << "keyframe_id:\t" << v.id << '\n';
+        view_ofs << "rawframe_id:\t" << v.frameId << '\n';
+        view_ofs << "image_path:\t" << v.filename << '\n';
+        view_ofs << "rotation_mat:\t" << v.R.at<double>(0, 0) << '\t' << v.R.at<double>(0, 1) << '\t' << v.R.at<double>(0, 2) << '\t'
+                 << v.R.at<double>(1, 0) << '\t' << v.R.at<double>(1, 1) << '\t' << v.R.at<double>(1, 2) << '\t'
+                 << v.R.at<double>(2, 0) << '\t' << v.R.at<double>(2, 1) << '\t' << v.R.at<double>(2, 2) << '\n';
+        view_ofs << "translation:\t" << v.t.at<double>(0) << '\t' << v.t.at<double>(1) << '\t' << v.t.at<double>(2) << '\n';
 
         // === 2d points ===
-        view_ofs << "feat_pts_number: " << views[i].featurePoints.size() << '\n';
+        view_ofs << "feat_pts_number: " << v.featurePoints.size() << '\n';
         view_ofs << "#format: local_id\tglobal_id\tx\ty\tdesc_dim\tdescriptor_vector\n";
 
-        for (int j = 0; j < views[i].featurePoints.size(); ++j)
+        for (int j = 0; j < v.featurePoints.size(); ++j)
         {
-            view_ofs << views[i].featurePoints[j].lid << '\t' << views[i].featurePoints[j].gid << '\t' << views[i].featurePoints[j].x << '\t' << views[i].featurePoints[j].y << '\t';
-            int desc_dim =  views[i].featurePoints[j].siftDesc.rows * views[i].featurePoints[j].siftDesc.cols;
+            view_ofs << v.featurePoints[j].lid << '\t' << v.featurePoints[j].gid << '\t' << v.featurePoints[j].x << '\t' << v.featurePoints[j].y << '\t';
+            int desc_dim =  v.featurePoints[j].siftDesc.rows * v.featurePoints[j].siftDesc.cols;
             view_ofs << desc_dim << '\t';
 
-            if (views[i].featurePoints[j].siftDesc.type() == CV_32FC1)
-                for (int k = 0; k < desc_dim; ++k) view_ofs << views[i].featurePoints[j].siftDesc.at<float>(k) << '\t';
-            else if (views[i].featurePoints[j].siftDesc.type() == CV_64FC1)
-                for (int k = 0; k < desc_dim; ++k) view_ofs << views[i].featurePoints[j].siftDesc.at<double>(k) << '\t';
+            if (v.featurePoints[j].siftDesc.type() == CV_32FC1)
+                for (int k = 0; k < desc_dim; ++k) view_ofs << v.featurePoints[j].siftDesc.at<float>(k) << '\t';
+            else if (v.featurePoints[j].siftDesc.type() == CV_64FC1)
+                for (int k = 0; k < desc_dim; ++k) view_ofs << v.featurePoints[j].siftDesc.at<double>(k) << '\t';
             else
             {
                 cout << "pt descriptor type error in exportAll\n";
@@ -276,22 +326,22 @@ void Mfg::exportAll(string root_dir)
         }
 
         // === line segments ===
-        view_ofs << "line_segment_number: " << views[i].lineSegments.size() << '\n';
+        view_ofs << "line_segment_number: " << v.lineSegments.size() << '\n';
         view_ofs << "format: local_id\tx1\ty1\tx2\ty2\tvp_lid\tideal_line_lid\tgx\tgy\tdesc_dim\tmsld_desc\n";
 
-        for (int j = 0; j < views[i].lineSegments.size(); ++j)
+        for (int j = 0; j < v.lineSegments.size(); ++j)
         {
-            view_ofs << views[i].lineSegments[j].lid << '\t' << views[i].lineSegments[j].endpt1.x << '\t' << views[i].lineSegments[j].endpt1.y << '\t'
-                     << views[i].lineSegments[j].endpt2.x << '\t' << views[i].lineSegments[j].endpt2.y << '\t'
-                     << views[i].lineSegments[j].vpLid << '\t' << views[i].lineSegments[j].idlnLid << '\t'
-                     << views[i].lineSegments[j].gradient.x << '\t' << views[i].lineSegments[j].gradient.y << '\t';
-            int desc_dim = views[i].lineSegments[j].msldDesc.rows * views[i].lineSegments[j].msldDesc.cols;
+            view_ofs << v.lineSegments[j].lid << '\t' << v.lineSegments[j].endpt1.x << '\t' << v.lineSegments[j].endpt1.y << '\t'
+                     << v.lineSegments[j].endpt2.x << '\t' << v.lineSegments[j].endpt2.y << '\t'
+                     << v.lineSegments[j].vpLid << '\t' << v.lineSegments[j].idlnLid << '\t'
+                     << v.lineSegments[j].gradient.x << '\t' << v.lineSegments[j].gradient.y << '\t';
+            int desc_dim = v.lineSegments[j].msldDesc.rows * v.lineSegments[j].msldDesc.cols;
             view_ofs << desc_dim << '\t';
 
-            if (views[i].lineSegments[j].msldDesc.type() == CV_32FC1)
-                for (int k = 0; k < desc_dim; ++k) view_ofs << views[i].lineSegments[j].msldDesc.at<float>(k) << '\t';
-            else if (views[i].lineSegments[j].msldDesc.type() == CV_64FC1)
-                for (int k = 0; k < desc_dim; ++k) view_ofs << views[i].lineSegments[j].msldDesc.at<double>(k) << '\t';
+            if (v.lineSegments[j].msldDesc.type() == CV_32FC1)
+                for (int k = 0; k < desc_dim; ++k) view_ofs << v.lineSegments[j].msldDesc.at<float>(k) << '\t';
+            else if (v.lineSegments[j].msldDesc.type() == CV_64FC1)
+                for (int k = 0; k < desc_dim; ++k) view_ofs << v.lineSegments[j].msldDesc.at<double>(k) << '\t';
             else
             {
                 cout << "line descriptor type error in exportAll\n";
@@ -302,41 +352,41 @@ void Mfg::exportAll(string root_dir)
         }
 
         // === ideal lines ===
-        view_ofs << "ideal_line_number: " << views[i].idealLines.size() << '\n';
+        view_ofs << "ideal_line_number: " << v.idealLines.size() << '\n';
         view_ofs << "format: local_id\tglobal_id\tvp_lid\tplane_gid\tx1\ty1\tx2\ty2\tgx\tgy\tchild_segment_number\tchild_segment_lids\n";
 
-        for (int j = 0; j < views[i].idealLines.size(); ++j)
+        for (int j = 0; j < v.idealLines.size(); ++j)
         {
-            view_ofs << views[i].idealLines[j].lid << '\t' << views[i].idealLines[j].gid << '\t' << views[i].idealLines[j].vpLid << '\t' << views[i].idealLines[j].pGid << '\t'
-                     << views[i].idealLines[j].extremity1.x << '\t' << views[i].idealLines[j].extremity1.y << '\t' << views[i].idealLines[j].extremity2.x << '\t' << views[i].idealLines[j].extremity2.y << '\t'
-                     << views[i].idealLines[j].gradient.x << '\t' << views[i].idealLines[j].gradient.y << '\t';
-            view_ofs << views[i].idealLines[j].lsLids.size() << '\t';
+            view_ofs << v.idealLines[j].lid << '\t' << v.idealLines[j].gid << '\t' << v.idealLines[j].vpLid << '\t' << v.idealLines[j].pGid << '\t'
+                     << v.idealLines[j].extremity1.x << '\t' << v.idealLines[j].extremity1.y << '\t' << v.idealLines[j].extremity2.x << '\t' << v.idealLines[j].extremity2.y << '\t'
+                     << v.idealLines[j].gradient.x << '\t' << v.idealLines[j].gradient.y << '\t';
+            view_ofs << v.idealLines[j].lsLids.size() << '\t';
 
-            for (int k = 0; k < views[i].idealLines[j].lsLids.size(); ++k) view_ofs << views[i].idealLines[j].lsLids[k] << '\t';
+            for (int k = 0; k < v.idealLines[j].lsLids.size(); ++k) view_ofs << v.idealLines[j].lsLids[k] << '\t';
 
             view_ofs << '\n';
         }
 
         // === vanishing points ===
-        view_ofs << "vanishing_points_number: " << views[i].vanishPoints.size() << '\n';
+        view_ofs << "vanishing_points_number: " << v.vanishPoints.size() << '\n';
         view_ofs << "format: local_id\tglobal_id\tx\ty\tw\tcov_2x2\tchild_iline_number\tchild_iline_lids\n";
 
-        for (int j = 0; j < views[i].vanishPoints.size(); ++j)
+        for (int j = 0; j < v.vanishPoints.size(); ++j)
         {
-            view_ofs << views[i].vanishPoints[j].lid << '\t' << views[i].vanishPoints[j].gid << '\t'
-                     << views[i].vanishPoints[j].x << '\t' << views[i].vanishPoints[j].y << '\t' << views[i].vanishPoints[j].w << '\t'
-                     << views[i].vanishPoints[j].cov_ab.at<double>(0, 0) << '\t' << views[i].vanishPoints[j].cov_ab.at<double>(0, 1) << '\t'
-                     << views[i].vanishPoints[j].cov_ab.at<double>(1, 0) << '\t' << views[i].vanishPoints[j].cov_ab.at<double>(1, 1) << '\t';
-            view_ofs << views[i].vanishPoints[j].idlnLids.size() << '\t';
+            view_ofs << v.vanishPoints[j].lid << '\t' << v.vanishPoints[j].gid << '\t'
+                     << v.vanishPoints[j].x << '\t' << v.vanishPoints[j].y << '\t' << v.vanishPoints[j].w << '\t'
+                     << v.vanishPoints[j].cov_ab.at<double>(0, 0) << '\t' << v.vanishPoints[j].cov_ab.at<double>(0, 1) << '\t'
+                     << v.vanishPoints[j].cov_ab.at<double>(1, 0) << '\t' << v.vanishPoints[j].cov_ab.at<double>(1, 1) << '\t';
+            view_ofs << v.vanishPoints[j].idlnLids.size() << '\t';
 
-            for (int k = 0; k < views[i].vanishPoints[j].idlnLids.size(); ++k) view_ofs << views[i].vanishPoints[j].idlnLids[k] << '\t';
+            for (int k = 0; k < v.vanishPoints[j].idlnLids.size(); ++k) view_ofs << v.vanishPoints[j].idlnLids[k] << '\t';
 
             view_ofs << '\n';
         }
 
         // === misc ===
-        view_ofs << "angular_velocity: " << views[i].angVel << " deg_per_sec\n";
-        view_ofs << "line_segment2d_len_thresh: " << views[i].lsLenThresh << '\n';
+        view_ofs << "angular_velocity: " << v.angVel << " deg_per_sec\n";
+        view_ofs << "line_segment2d_len_thresh: " << v.lsLenThresh << '\n';
     }
 
     cout << "MFG exported.\n";
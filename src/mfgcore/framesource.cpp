@@ -0,0 +1,336 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Frame source: loads and prepares raw frames ahead of the tracking thread
+ ********************************************************************************/
+
+#include "framesource.h"
+
+#include <iostream>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "settings.h"
+#include "utils.h"
+
+using namespace std;
+
+static bool isSameMat(const cv::Mat &a, const cv::Mat &b)
+{
+    return a.size() == b.size() && a.type() == b.type()
+           && (a.empty() || cv::norm(a, b, cv::NORM_INF) == 0);
+}
+
+const UndistortMap &getUndistortMap(cv::Mat K, cv::Mat dc, cv::Size srcSize)
+// the tables only depend on the camera, so they are kept for the whole run
+{
+    static list<UndistortMap> maps; // list keeps references valid
+    static mutex mapsMtx;
+
+    lock_guard<mutex> lock(mapsMtx);
+
+    for (list<UndistortMap>::iterator it = maps.begin(); it != maps.end(); ++it)
+        if (it->srcSize == srcSize && isSameMat(it->K, K) && isSameMat(it->dc, dc))
+            return *it;
+
+    UndistortMap umap;
+    umap.K = K.clone();
+    umap.dc = dc.clone();
+    umap.srcSize = srcSize;
+    cv::initUndistortRectifyMap(K, dc, cv::Mat(), K, srcSize, CV_16SC2, umap.map1, umap.map2);
+
+    maps.push_back(umap);
+    return maps.back();
+}
+
+PreparedFrame prepareFrame(const string &imgName, cv::Mat K, cv::Mat dc, int imageWidth)
+// read image from file, remove lens distortion and resize it to imageWidth
+{
+    PreparedFrame frm;
+    frm.filename = imgName;
+    cv::Mat oriImg = cv::imread(imgName, CV_LOAD_IMAGE_COLOR);
+
+    if (oriImg.empty())
+    {
+        cerr << "prepareFrame: failed to read " << imgName << endl;
+        return frm;
+    }
+
+    if (cv::norm(dc) > 1e-6)
+    {
+        // remove lens distortion at the raw resolution, the resize below
+        // filters the image, a shrinking remap would alias
+        const UndistortMap &umap = getUndistortMap(K, dc, oriImg.size());
+        cv::Mat tmpImg;
+        cv::remap(oriImg, tmpImg, umap.map1, umap.map2, cv::INTER_LINEAR);
+        oriImg = tmpImg;
+    }
+
+    if (imageWidth > 1)
+    {
+        // resize image and ajust camera matrix
+        double scl = imageWidth / double(oriImg.cols);
+        cv::resize(oriImg, frm.img, cv::Size(), scl, scl, cv::INTER_AREA);
+        frm.K = K * scl;
+        frm.K.at<double>(2, 2) = 1;
+    }
+    else
+    {
+        frm.img = oriImg;
+        frm.K = K;
+    }
+
+    if (frm.img.channels() == 3)
+        cv::cvtColor(frm.img, frm.grayImg, CV_RGB2GRAY);
+    else
+        frm.grayImg = frm.img;
+
+    return frm;
+}
+
+FrameSource::FrameSource(cv::Mat _K, cv::Mat _dc, int _imIdLen, MfgSettings *_settings)
+    : K(_K), dc(_dc), imIdLen(_imIdLen), mfgSettings(_settings), stopping(false)
+{
+    cacheSize = mfgSettings->getFrameCacheSize();
+
+    int numFrames  = mfgSettings->getPrefetchFrames();
+    int numThreads = mfgSettings->getPrefetchThreads();
+
+    if (numFrames <= 0 || numThreads <= 0) // no prefetching, frames are loaded on request
+        return;
+
+    ring.resize(numFrames);
+
+    for (int i = 0; i < ring.size(); ++i)
+    {
+        ring[i].state = SLOT_EMPTY;
+        ring[i].order = 0;
+    }
+
+    for (int i = 0; i < numThreads; ++i)
+        workers.push_back(thread(&FrameSource::work, this));
+}
+
+FrameSource::~FrameSource()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    taskCond.notify_all();
+
+    for (int i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+int FrameSource::frameId(const string &imgName) const
+{
+    return atoi(imgName.substr(imgName.size() - imIdLen - 4, imIdLen).c_str());
+}
+
+bool FrameSource::fromCache(int fid, PreparedFrame &frm)
+// look up frame fid and mark it as most recently used, mtx must be held
+{
+    map<int, CacheEntry>::iterator it = cache.find(fid);
+
+    if (it == cache.end()) return false;
+
+    cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.second);
+    frm = it->second.first;
+    return true;
+}
+
+void FrameSource::toCache(int fid, const PreparedFrame &frm)
+// insert frame fid, dropping the least recently used one if full, mtx must be held
+{
+    if (cacheSize <= 0 || frm.img.empty()) return;
+
+    map<int, CacheEntry>::iterator it = cache.find(fid);
+
+    if (it != cache.end())
+    {
+        cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.second);
+        it->second.first = frm;
+        return;
+    }
+
+    if (cache.size() >= cacheSize)
+    {
+        cache.erase(cacheOrder.back());
+        cacheOrder.pop_back();
+    }
+
+    cacheOrder.push_front(fid);
+    cache[fid] = CacheEntry(frm, cacheOrder.begin());
+}
+
+int FrameSource::findSlot(const string &imgName) const
+{
+    for (int i = 0; i < ring.size(); ++i)
+        if (ring[i].state != SLOT_EMPTY && ring[i].filename == imgName)
+            return i;
+
+    return -1;
+}
+
+void FrameSource::prefetch(const string &imgName, int stride)
+{
+    if (ring.empty()) return;
+
+    stride = max(1, stride);
+
+    // frames expected to be visited next
+    vector<string> window;
+    string name = imgName;
+
+    while (window.size() < ring.size() && isFileExist(name))
+    {
+        window.push_back(name);
+        name = nextImgName(name, imIdLen, stride);
+    }
+
+    unique_lock<mutex> lock(mtx);
+
+    // keep slots already holding frames of the window
+    vector<bool> inWindow(ring.size(), false);
+
+    for (int i = 0; i < window.size(); ++i)
+    {
+        int s = findSlot(window[i]);
+
+        if (s < 0) continue;
+
+        inWindow[s] = true;
+        ring[s].order = i;
+    }
+
+    // reuse the other slots for missing frames, a slot being loaded is never reused
+    for (int i = 0; i < window.size(); ++i)
+    {
+        if (findSlot(window[i]) >= 0 || cache.count(frameId(window[i]))) continue;
+
+        int victim = -1;
+
+        for (int s = 0; s < ring.size(); ++s)
+        {
+            if (inWindow[s] || ring[s].state == SLOT_LOADING) continue;
+
+            if (victim < 0 || ring[s].state == SLOT_EMPTY)
+                victim = s;
+
+            if (ring[s].state == SLOT_EMPTY) break;
+        }
+
+        if (victim < 0) break; // ring is full
+
+        // keep the frame if it was prepared but not requested yet
+        if (ring[victim].state == SLOT_READY && !cache.count(frameId(ring[victim].filename)))
+            toCache(frameId(ring[victim].filename), ring[victim].frame);
+
+        ring[victim].filename = window[i];
+        ring[victim].state = SLOT_PENDING;
+        ring[victim].order = i;
+        ring[victim].frame = PreparedFrame();
+        inWindow[victim] = true;
+    }
+
+    lock.unlock();
+    taskCond.notify_all();
+}
+
+PreparedFrame FrameSource::get(const string &imgName)
+{
+    unique_lock<mutex> lock(mtx);
+    int fid = frameId(imgName);
+    PreparedFrame frm;
+
+    while (true)
+    {
+        if (fromCache(fid, frm))
+            return frm;
+
+        int s = findSlot(imgName);
+
+        if (s < 0) // not scheduled, load it here
+        {
+            lock.unlock();
+            frm = prepareFrame(imgName, K, dc, mfgSettings->getImageWidth());
+            lock.lock();
+            toCache(fid, frm);
+            return frm;
+        }
+
+        if (ring[s].state == SLOT_PENDING) // no worker picked it up yet
+            load(lock, s);
+
+        if (ring[s].state == SLOT_READY && ring[s].filename == imgName)
+        {
+            frm = ring[s].frame;
+            toCache(fid, frm);
+            return frm;
+        }
+
+        // being loaded, look the frame up again once a slot is ready since
+        // the slot may be reused meanwhile when there are several consumers
+        readyCond.wait(lock);
+    }
+}
+
+void FrameSource::load(unique_lock<mutex> &lock, int s)
+// prepare the frame of slot s, lock is released while the image is processed
+{
+    ring[s].state = SLOT_LOADING;
+    string name = ring[s].filename;
+    lock.unlock();
+
+    PreparedFrame frm = prepareFrame(name, K, dc, mfgSettings->getImageWidth());
+
+    lock.lock();
+    ring[s].frame = frm;
+    ring[s].state = SLOT_READY;
+    readyCond.notify_all();
+}
+
+void FrameSource::work()
+{
+    unique_lock<mutex> lock(mtx);
+
+    while (!stopping)
+    {
+        // take the pending frame that comes first in the window
+        int next = -1;
+
+        for (int s = 0; s < ring.size(); ++s)
+            if (ring[s].state == SLOT_PENDING && (next < 0 || ring[s].order < ring[next].order))
+                next = s;
+
+        if (next < 0)
+        {
+            taskCond.wait(lock);
+            continue;
+        }
+
+        load(lock, next);
+    }
+}
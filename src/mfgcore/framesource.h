@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Frame source: loads and prepares raw frames ahead of the tracking thread
+ ********************************************************************************/
+
+#ifndef FRAMESOURCE_H_
+#define FRAMESOURCE_H_
+
+#include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core/core.hpp>
+
+class MfgSettings;
+
+// Raw frame after decoding, undistortion and resizing
+class PreparedFrame
+{
+public:
+    std::string filename;
+    cv::Mat img;         // resized color image
+    cv::Mat grayImg;     // resized gray image
+    cv::Mat K;           // camera matrix adjusted to the resized image
+};
+
+// Undistortion of a camera at the raw resolution as one fixed-point remap table;
+// the undistorted image keeps the camera matrix K, as cv::undistort does
+class UndistortMap
+{
+public:
+    cv::Mat  K, dc;       // camera matrix and distortion coefficients
+    cv::Size srcSize;     // raw image size
+    cv::Mat  map1, map2;  // remap tables (CV_16SC2, CV_16UC1)
+};
+
+// get the remap table of a camera, built once on first use, see framesource.cpp
+const UndistortMap &getUndistortMap(cv::Mat K, cv::Mat dc, cv::Size srcSize);
+
+// decode, undistort and resize a frame, see framesource.cpp
+PreparedFrame prepareFrame(const std::string &imgName, cv::Mat K, cv::Mat dc, int imageWidth);
+
+// FrameSource prepares the frames following the current one on background
+// threads and keeps them in a bounded ring buffer until they are requested.
+// Requested frames are kept in a LRU cache keyed by frame id, so a frame
+// visited again during keyframe search is not decoded twice.
+class FrameSource
+{
+public:
+    FrameSource(cv::Mat _K, cv::Mat _dc, int _imIdLen, MfgSettings *_settings);
+    ~FrameSource();
+
+    // schedule frames imgName, imgName+stride, imgName+2*stride, ... for loading
+    void prefetch(const std::string &imgName, int stride);
+    // get a prepared frame, waits if it is being loaded (thread safe)
+    PreparedFrame get(const std::string &imgName);
+
+private:
+    enum SlotState { SLOT_EMPTY, SLOT_PENDING, SLOT_LOADING, SLOT_READY };
+
+    struct Slot
+    {
+        std::string   filename;
+        SlotState     state;
+        int           order;  // position in the prefetch window, lower loads first
+        PreparedFrame frame;
+    };
+
+    cv::Mat K, dc;
+    int imIdLen;
+    MfgSettings *mfgSettings;
+
+    std::vector<Slot>        ring;
+    std::vector<std::thread> workers;
+    std::mutex               mtx;
+    std::condition_variable  taskCond;  // signals workers a slot is pending
+    std::condition_variable  readyCond; // signals consumer a slot is ready
+    bool                     stopping;
+
+    // LRU cache of prepared frames, keyed by frame id
+    typedef std::pair<PreparedFrame, std::list<int>::iterator> CacheEntry;
+    std::list<int>             cacheOrder; // most recently used first
+    std::map<int, CacheEntry>  cache;
+    int                        cacheSize;
+
+    int  frameId(const std::string &imgName) const;
+    bool fromCache(int fid, PreparedFrame &frm);
+    void toCache(int fid, const PreparedFrame &frm);
+    int  findSlot(const std::string &imgName) const;
+    void load(std::unique_lock<std::mutex> &lock, int slot);
+    void work();
+};
+
+#endif
@@ -0,0 +1,532 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Global mapper: optimizes the whole trajectory in background
+ ********************************************************************************/
+
+#include "globalmapper.h"
+
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+#include "g2o/config.h"
+#include "g2o/core/block_solver.h"
+#include "g2o/core/optimization_algorithm_levenberg.h"
+#include "g2o/core/sparse_optimizer.h"
+#include "g2o/types/sba/types_sba.h"
+
+#if defined G2O_HAVE_CHOLMOD
+#include "g2o/solvers/cholmod/linear_solver_cholmod.h"
+#endif
+#include "g2o/solvers/csparse/linear_solver_csparse.h"
+
+#include "archive.h"
+#include "edge_cam_cam_dist.h"
+#include "mfgutils.h"
+#include "settings.h"
+#include "utils.h"
+
+#define GLB_BA_NUM_FRAMES (100)  // window BA: latest keyframes optimized
+
+extern bool mfg_writing;
+
+using namespace std;
+
+GlobalMapper::GlobalMapper(MfgSettings *_settings)
+    : mfgSettings(_settings), lastStart(0), lastLoops(0), closing(false), windowBa(false),
+      state(GLB_IDLE), stopping(false), numMerges(0)
+{
+    interval = mfgSettings->getGlobalOptInterval();
+    windowBa = mfgSettings->getGlobalWindowBa();
+
+    if (interval > 0)
+        worker = thread(&GlobalMapper::work, this);
+}
+
+GlobalMapper::~GlobalMapper()
+{
+    if (!worker.joinable()) return;
+
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cond.notify_all();
+    worker.join();
+}
+
+void GlobalMapper::optimize(Mfg &map)
+{
+    if (!worker.joinable())
+        return;
+
+    if (!tryMerge(map))
+        return; // still running, a due optimization starts at a later keyframe
+
+    bool newLoops = map.loop_constraints.size() > lastLoops;
+
+    if ((int)map.views.size() - lastStart < interval && !newLoops)
+        return;
+
+    lastStart = map.views.size();
+    lastLoops = map.loop_constraints.size();
+    closing = newLoops;
+
+    // the worker is idle, the snapshot needs no lock
+    snapR.resize(map.views.size());
+    snapT.resize(map.views.size());
+
+    for (int i = 0; i < map.views.size(); ++i)
+    {
+        snapR[i] = map.views[i].R.clone();
+        snapT[i] = map.views[i].t.clone();
+    }
+
+    camdist.insert(camdist.end(), map.camdist_constraints.begin() + camdist.size(), map.camdist_constraints.end());
+    loops.insert(loops.end(), map.loop_constraints.begin() + loops.size(), map.loop_constraints.end());
+    odom.insert(odom.end(), map.odom_constraints.begin() + odom.size(), map.odom_constraints.end());
+
+    if (windowBa && !closing)
+        copyBaWindow(map);
+
+    {
+        lock_guard<mutex> lock(mtx);
+        state = GLB_RUNNING;
+    }
+    cond.notify_all();
+}
+
+void GlobalMapper::copyBaWindow(const Mfg &map)
+// the last GLB_BA_NUM_FRAMES keyframes that still hold their features, the
+// landmarks they observe, vanishing points and planes
+{
+    int front = max(0, (int)map.views.size() - GLB_BA_NUM_FRAMES);
+
+    while (front < map.views.size() && map.views[front].featurePoints.empty())
+        ++front;
+
+    for (int i = front; i < map.views.size(); ++i)
+    {
+        winViews.push_back(i);
+
+        for (int j = 0; j < map.views[i].featurePoints.size(); ++j)
+            if (map.views[i].featurePoints[j].gid >= 0)
+                winKpts.push_back(map.views[i].featurePoints[j].gid);
+
+        for (int j = 0; j < map.views[i].idealLines.size(); ++j)
+            if (map.views[i].idealLines[j].gid >= 0)
+                winLns.push_back(map.views[i].idealLines[j].gid);
+    }
+
+    sort(winKpts.begin(), winKpts.end());
+    winKpts.erase(unique(winKpts.begin(), winKpts.end()), winKpts.end());
+    sort(winLns.begin(), winLns.end());
+    winLns.erase(unique(winLns.begin(), winLns.end()), winLns.end());
+
+    // views outside the window are shells, their observations are not used
+    while (window.views.size() < map.views.size())
+    {
+        window.views.push_back(View());
+        window.views.back().id = window.views.size() - 1;
+        window.views.back().matchable = false;
+    }
+
+    window.keyPoints.resize(map.keyPoints.size());
+    window.idealLines.resize(map.idealLines.size(), emptyIdealLine());
+
+    for (int i = 0; i < winViews.size(); ++i)
+        window.views[winViews[i]] = map.views[winViews[i]];
+
+    for (int i = 0; i < winKpts.size(); ++i)
+        window.keyPoints[winKpts[i]] = map.keyPoints[winKpts[i]];
+
+    for (int i = 0; i < winLns.size(); ++i)
+        window.idealLines[winLns[i]] = map.idealLines[winLns[i]];
+
+    // BA reads only the constraints of the last keyframes
+    int numDist = min(map.camdist_constraints.size(), winViews.size());
+    window.camdist_constraints.assign(map.camdist_constraints.end() - numDist, map.camdist_constraints.end());
+    window.K = map.K;
+    window.vanishingPoints = map.vanishingPoints;
+    window.primaryPlanes = map.primaryPlanes;
+    window.need_scale_to_real = map.need_scale_to_real;
+    window.angVel = map.angVel;
+}
+
+void GlobalMapper::clearWindow()
+// empty the window entries of the copy, so it holds no outdated data
+{
+    for (int i = 0; i < winViews.size(); ++i)
+    {
+        View &v = window.views[winViews[i]];
+        v = View();
+        v.id = winViews[i];
+        v.matchable = false;
+    }
+
+    for (int i = 0; i < winKpts.size(); ++i)
+        window.keyPoints[winKpts[i]] = KeyPoint3d();
+
+    for (int i = 0; i < winLns.size(); ++i)
+        window.idealLines[winLns[i]] = emptyIdealLine();
+
+    window.vanishingPoints.clear();
+    window.primaryPlanes.clear();
+    window.camdist_constraints.clear();
+    winViews.clear();
+    winKpts.clear();
+    winLns.clear();
+}
+
+bool GlobalMapper::tryMerge(Mfg &map)
+// merge a finished optimization without waiting, false if one is running
+{
+    {
+        lock_guard<mutex> lock(mtx);
+
+        if (state == GLB_RUNNING)
+            return false;
+
+        if (state != GLB_DONE)
+            return true;
+
+        state = GLB_IDLE;
+    }
+
+    apply(map);
+    return true;
+}
+
+void GlobalMapper::merge(Mfg &map)
+{
+    {
+        unique_lock<mutex> lock(mtx);
+
+        while (state == GLB_RUNNING)
+            cond.wait(lock);
+
+        if (state != GLB_DONE)
+            return;
+
+        state = GLB_IDLE;
+    }
+
+    apply(map);
+}
+
+void GlobalMapper::apply(Mfg &map)
+// correct map with the optimized snapshot, as rigid transforms of the world:
+// C_i maps a point in the old world to the new one while keeping its position
+// in keyframe i, that is X' = Rc*X + tc with Rc = R1'*R0, tc = R1'*(t0 - t1)
+{
+    int n = min(optR.size(), map.views.size());
+
+    if (n < 2)
+    {
+        clearWindow();
+        return;
+    }
+
+    vector<cv::Matx33d> Rc(n);
+    vector<cv::Vec3d> tc(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Rc[i] = cv::Mat(optR[i].t() * snapR[i]);
+        tc[i] = cv::Mat(optR[i].t() * (snapT[i] - optT[i]));
+    }
+
+    mfg_writing = true;
+
+    // keyframes: R' = R*Rc', t' = t - R*Rc'*tc, keyframes added after the
+    // snapshot follow the last optimized one
+    for (int i = 0; i < map.views.size(); ++i)
+    {
+        int c = min(i, n - 1);
+        cv::Mat R = map.views[i].R * cv::Mat(Rc[c].t());
+        map.views[i].t = map.views[i].t - R * cv::Mat(tc[c]);
+        map.views[i].R = R;
+    }
+
+    // landmarks follow the keyframe that first observed them
+    for (int i = 0; i < map.keyPoints.size(); ++i)
+    {
+        KeyPoint3d &kpt = map.keyPoints[i];
+
+        if (!kpt.is3D || kpt.gid < 0 || kpt.viewId_ptLid.empty()) continue;
+
+        int c = min(kpt.viewId_ptLid[0][0], n - 1);
+        cv::Vec3d X = Rc[c] * kpt.vec() + tc[c];
+        kpt.x = X[0];
+        kpt.y = X[1];
+        kpt.z = X[2];
+    }
+
+    for (int i = 0; i < map.idealLines.size(); ++i)
+    {
+        IdealLine3d &iln = map.idealLines[i];
+
+        if (!iln.is3D || iln.gid < 0 || iln.viewId_lnLid.empty()) continue;
+
+        int c = min(iln.viewId_lnLid[0][0], n - 1);
+        cv::Vec3d M = Rc[c] * cv::Vec3d(iln.midpt) + tc[c];
+        iln.midpt = cv::Point3d(M[0], M[1], M[2]);
+        iln.direct = Rc[c] * iln.direct;
+    }
+
+    // the window BA optimized the landmarks of its window, those still in the
+    // map take the optimized position instead of the rigid correction
+    if (!winViews.empty())
+    {
+        for (int i = 0; i < winKpts.size(); ++i)
+        {
+            int gid = winKpts[i];
+
+            if (gid >= map.keyPoints.size() || !map.keyPoints[gid].is3D || map.keyPoints[gid].gid < 0)
+                continue;
+
+            map.keyPoints[gid].x = window.keyPoints[gid].x;
+            map.keyPoints[gid].y = window.keyPoints[gid].y;
+            map.keyPoints[gid].z = window.keyPoints[gid].z;
+        }
+
+        for (int i = 0; i < winLns.size(); ++i)
+        {
+            int gid = winLns[i];
+
+            if (gid >= map.idealLines.size() || !map.idealLines[gid].is3D || map.idealLines[gid].gid < 0)
+                continue;
+
+            map.idealLines[gid].midpt = window.idealLines[gid].midpt;
+            map.idealLines[gid].direct = window.idealLines[gid].direct;
+        }
+
+        for (int i = 0; i < min(map.vanishingPoints.size(), window.vanishingPoints.size()); ++i)
+        {
+            map.vanishingPoints[i].x = window.vanishingPoints[i].x;
+            map.vanishingPoints[i].y = window.vanishingPoints[i].y;
+            map.vanishingPoints[i].z = window.vanishingPoints[i].z;
+        }
+
+        clearWindow();
+    }
+
+    mfg_writing = false;
+
+    // archived records are corrected when they are read back
+    if (map.archive && map.archive->isOpen())
+        map.archive->correct(Rc, tc, map.views.size());
+
+    ++numMerges;
+}
+
+static g2o::SE3Quat relativePose(const vector<double> &c)
+// measurement of an EdgeSBACam from keyframe c[0] to c[1] for a relative pose
+// as in Mfg::loop_constraints, x1 = R*x0 + t: the pose of c[1] in c[0]
+{
+    Eigen::Matrix3d R;
+
+    for (int k = 0; k < 9; ++k)
+        R(k / 3, k % 3) = c[3 + k];
+
+    return g2o::SE3Quat(R, Eigen::Vector3d(c[12], c[13], c[14])).inverse();
+}
+
+void GlobalMapper::optimizePoseGraph()
+// pose graph over all keyframes: the odometry between neighbouring keyframes,
+// the camera distance (scale) constraints and the loops
+{
+    typedef g2o::BlockSolver_6_3 PgBlockSolver;
+    PgBlockSolver::LinearSolverType *linearSolver;
+#if defined G2O_HAVE_CHOLMOD && defined MFG_HAVE_CHOLMOD
+    linearSolver = new g2o::LinearSolverCholmod<PgBlockSolver::PoseMatrixType>();
+#else
+    linearSolver = new g2o::LinearSolverCSparse<PgBlockSolver::PoseMatrixType>();
+#endif
+    g2o::SparseOptimizer optimizer;
+    optimizer.setVerbose(false);
+    optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(new PgBlockSolver(linearSolver)));
+
+    int n = snapR.size();
+    vector<g2o::VertexCam *> cams(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Eigen::Quaterniond q = r2q(snapR[i]);
+        Eigen::Isometry3d pose;
+        pose = q;
+        pose.translation() = Eigen::Vector3d(snapT[i].at<double>(0), snapT[i].at<double>(1), snapT[i].at<double>(2));
+        g2o::SBACam sc(q.inverse(), pose.inverse().translation());
+        sc.setKcam(1, 1, 0, 0, 0); // projection is not used
+
+        cams[i] = new g2o::VertexCam();
+        cams[i]->setId(i);
+        cams[i]->setEstimate(sc);
+        cams[i]->setFixed(i == 0);
+        optimizer.addVertex(cams[i]);
+    }
+
+    // each keyframe is tied to its two predecessors by the relative pose the
+    // local BA left; keyframes still in the local window have none recorded
+    // yet and use the relative pose of the snapshot
+    map<pair<int, int>, int> odomIdx;
+
+    for (int k = 0; k < odom.size(); ++k)
+        odomIdx[make_pair((int)odom[k][0], (int)odom[k][1])] = k;
+
+    for (int i = 1; i < n; ++i)
+    {
+        for (int j = max(0, i - 2); j < i; ++j)
+        {
+            map<pair<int, int>, int>::const_iterator it = odomIdx.find(make_pair(j, i));
+            g2o::EdgeSBACam *e = new g2o::EdgeSBACam();
+            e->setVertex(0, cams[j]);
+            e->setVertex(1, cams[i]);
+
+            if (it != odomIdx.end())
+                e->setMeasurement(relativePose(odom[it->second]));
+            else
+                e->setMeasurement(cams[j]->estimate().inverse() * cams[i]->estimate());
+
+            e->information().setIdentity();
+            e->information().block<3, 3>(3, 3) *= 100; // rotation is well observed
+            optimizer.addEdge(e);
+        }
+    }
+
+    int numDist = 0;
+
+    for (int i = 0; i < camdist.size(); ++i)
+    {
+        int a = (int)camdist[i][0], b = (int)camdist[i][1];
+
+        if (a < 0 || b < 0 || a >= n || b >= n) continue;
+
+        g2o::EdgeCamCamDist *e = new g2o::EdgeCamCamDist();
+        e->setVertex(0, cams[a]);
+        e->setVertex(1, cams[b]);
+        e->setMeasurement(camdist[i][2]);
+        e->information().setIdentity();
+        e->information() = e->information() * camdist[i][3]; // observaion info
+        optimizer.addEdge(e);
+        ++numDist;
+    }
+
+    // a loop ties keyframe b to the pose it has relative to keyframe a
+    int numLoops = 0;
+
+    for (int i = 0; i < loops.size(); ++i)
+    {
+        int a = (int)loops[i][0], b = (int)loops[i][1];
+
+        if (a < 0 || b < 0 || a >= n || b >= n) continue;
+
+        g2o::EdgeSBACam *e = new g2o::EdgeSBACam();
+        e->setVertex(0, cams[a]);
+        e->setVertex(1, cams[b]);
+        e->setMeasurement(relativePose(loops[i]));
+        e->information().setIdentity();
+        e->information().block<3, 3>(3, 3) *= 100;
+        optimizer.addEdge(e);
+        ++numLoops;
+    }
+
+    optR = snapR;
+    optT = snapT;
+
+    if (numDist == 0 && numLoops == 0) return; // nothing to correct
+
+    optimizer.initializeOptimization();
+    optimizer.optimize(20);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Eigen::Vector3d t = cams[i]->estimate().inverse().translation();
+        Eigen::Quaterniond q(cams[i]->estimate().inverse().rotation());
+        double qd[] = {q.w(), q.x(), q.y(), q.z()};
+        optR[i] = q2r(qd);
+        optT[i] = (cv::Mat_<double>(3, 1) << t(0), t(1), t(2));
+    }
+}
+
+void GlobalMapper::optimizeWindow()
+// bundle adjustment over the window copied by copyBaWindow
+{
+    optR = snapR;
+    optT = snapT;
+
+    if (winViews.size() < 3)
+    {
+        clearWindow(); // nothing optimized, apply() must not take the copies
+        return;
+    }
+
+    int first = winViews.front(), last = winViews.back();
+    window.bundle_adjust_between(first, last, first + 1);
+
+    for (int i = first; i <= last; ++i)
+    {
+        optR[i] = window.views[i].R.clone();
+        optT[i] = window.views[i].t.clone();
+    }
+
+    // keyframes before the window are not in the BA, keep them attached to the first one
+    for (int i = 0; i < first; ++i)
+    {
+        cv::Mat Rc = optR[first].t() * snapR[first];
+        cv::Mat tc = optR[first].t() * (snapT[first] - optT[first]);
+        optR[i] = snapR[i] * Rc.t();
+        optT[i] = snapT[i] - optR[i] * tc;
+    }
+}
+
+void GlobalMapper::work()
+{
+    unique_lock<mutex> lock(mtx);
+
+    while (true)
+    {
+        while (!stopping && state != GLB_RUNNING)
+            cond.wait(lock);
+
+        if (state != GLB_RUNNING) // stopping
+            return;
+
+        lock.unlock();
+        MyTimer tm;
+        tm.start();
+
+        if (windowBa && !closing)
+            optimizeWindow();
+        else
+            optimizePoseGraph();
+
+        tm.end();
+        cout << "global optimization of " << snapR.size() << " keyframes: " << tm.time_ms << " ms" << endl;
+        lock.lock();
+
+        state = GLB_DONE;
+        cond.notify_all();
+    }
+}
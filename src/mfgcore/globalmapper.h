@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Global mapper: optimizes the whole trajectory in background
+ ********************************************************************************/
+
+#ifndef GLOBALMAPPER_H_
+#define GLOBALMAPPER_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "mfg.h"
+
+class MfgSettings;
+
+// GlobalMapper corrects the drift of the whole trajectory, mostly the scale
+// drift between ground plane scale constraints (Mfg::camdist_constraints), and
+// the drift along loops (Mfg::loop_constraints). Every few keyframes, or when a
+// loop was closed, it takes a snapshot of the keyframe poses and runs a pose
+// graph over all of them on its own thread, with the relative poses of
+// Mfg::odom_constraints as odometry; or, when window BA is enabled and no loop
+// is new, a bundle adjustment over the last keyframes that still hold their
+// features (a window, not the whole map: older keyframes follow the first one
+// of the window rigidly). optimize() never waits for the worker: it merges a
+// finished result, and skips starting an optimization while one is running, so
+// the next keyframe tries again; only merge() at the end waits. The local map
+// must be committed (see LocalMapper) when either is called. A pose graph
+// result is a rigid correction per keyframe: keyframes added meanwhile follow
+// the correction of the last optimized one, landmarks follow the keyframe that
+// first observed them. Archived records get the correction lazily (see
+// MfgArchive::correct). A window BA result also sets the landmarks it optimized.
+class GlobalMapper
+{
+public:
+    GlobalMapper(MfgSettings *_settings);
+    ~GlobalMapper();
+
+    // merge a finished optimization; if one is due and none is running, start it
+    void optimize(Mfg &map);
+    // wait for a running optimization and merge it
+    void merge(Mfg &map);
+
+    int numMerged() const { return numMerges; }
+
+private:
+    enum MapperState { GLB_IDLE, GLB_RUNNING, GLB_DONE };
+
+    MfgSettings *mfgSettings;
+    int          interval;    // keyframes between two optimizations, 0 = off
+    int          lastStart;   // number of keyframes at the last optimization
+    int          lastLoops;   // and of loops
+
+    // snapshot, only the worker touches it while running; the constraints are
+    // append-only in the map and only new ones are copied
+    std::vector<cv::Mat> snapR, snapT;         // keyframe poses before optimization
+    std::vector<cv::Mat> optR, optT;           // and after
+    std::vector<std::vector<double> > camdist; // cam1_id, cam2_id, dist, confidence
+    std::vector<std::vector<double> > loops;   // see Mfg::loop_constraints
+    std::vector<std::vector<double> > odom;    // see Mfg::odom_constraints
+    bool         closing;     // new loops in the snapshot
+    bool         windowBa;
+
+    // BA window, indexed like the map with only the window entries filled
+    // (as the copy of LocalMapper), so the copy does not grow with the map
+    Mfg          window;
+    std::vector<int> winViews, winKpts, winLns; // ascending ids
+
+    std::thread              worker;
+    std::mutex               mtx;
+    std::condition_variable  cond;
+    MapperState              state;
+    bool                     stopping;
+
+    int    numMerges;
+
+    bool tryMerge(Mfg &map);
+    void copyBaWindow(const Mfg &map);
+    void clearWindow();
+    void optimizePoseGraph();
+    void optimizeWindow();
+    void apply(Mfg &map);
+    void work();
+};
+
+#endif
@@ -0,0 +1,246 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Local mapper: optimizes the local map of new keyframes in background
+ ********************************************************************************/
+
+#include "localmapper.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include "mfgutils.h"
+#include "settings.h"
+#include "utils.h"
+
+extern bool mfg_writing;
+
+using namespace std;
+
+LocalMapper::LocalMapper(MfgSettings *_settings)
+    : mfgSettings(_settings), state(MAP_IDLE), stopping(false), numJobs(0), waitMs(0)
+{
+    if (mfgSettings->getLocalMappingThread())
+        worker = thread(&LocalMapper::work, this);
+}
+
+LocalMapper::~LocalMapper()
+{
+    if (!worker.joinable()) return;
+
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cond.notify_all();
+    worker.join();
+}
+
+void LocalMapper::optimize(Mfg &map)
+{
+    ++numJobs;
+
+    if (!worker.joinable()) // serial mode
+    {
+        map.optimizeLocalMap();
+        return;
+    }
+
+    commit(map); // previous keyframe first
+
+    // Copy what the optimization reads or changes, the worker is idle so the
+    // copy needs no lock: the views of the window, the views observing its
+    // landmarks (outlier removal checks all their observations) and the
+    // landmarks themselves. Vanishing points and planes are few, and copied whole
+    map.collectLocalWindow(winKpts, winLns);
+    winViews.clear();
+
+    for (int i = map.localWindowFront(); i < map.views.size(); ++i)
+        winViews.push_back(i);
+
+    for (int k = 0; k < winKpts.size(); ++k)
+        for (int j = 0; j < map.keyPoints[winKpts[k]].viewId_ptLid.size(); ++j)
+            winViews.push_back(map.keyPoints[winKpts[k]].viewId_ptLid[j][0]);
+
+    for (int k = 0; k < winLns.size(); ++k)
+        for (int j = 0; j < map.idealLines[winLns[k]].viewId_lnLid.size(); ++j)
+            winViews.push_back(map.idealLines[winLns[k]].viewId_lnLid[j][0]);
+
+    sort(winViews.begin(), winViews.end());
+    winViews.erase(unique(winViews.begin(), winViews.end()), winViews.end());
+
+    // local keeps the ids of map, entries outside the window are empty
+    // (see clearLocal) and not read by the optimization
+    while (local.views.size() < map.views.size())
+    {
+        local.views.push_back(View());
+        local.views.back().id = local.views.size() - 1;
+        local.views.back().matchable = false;
+    }
+
+    local.keyPoints.resize(map.keyPoints.size());
+    local.idealLines.resize(map.idealLines.size(), emptyIdealLine());
+
+    for (int i = 0; i < winViews.size(); ++i)
+        local.views[winViews[i]] = map.views[winViews[i]];
+
+    for (int i = 0; i < winKpts.size(); ++i)
+        local.keyPoints[winKpts[i]] = map.keyPoints[winKpts[i]];
+
+    for (int i = 0; i < winLns.size(); ++i)
+        local.idealLines[winLns[i]] = map.idealLines[winLns[i]];
+
+    local.K = map.K;
+    local.vanishingPoints = map.vanishingPoints;
+    local.primaryPlanes = map.primaryPlanes;
+    local.camdist_constraints = map.camdist_constraints;
+    local.need_scale_to_real = map.need_scale_to_real;
+    local.angVel = map.angVel;
+
+    {
+        lock_guard<mutex> lock(mtx);
+        state = MAP_RUNNING;
+    }
+    cond.notify_all();
+}
+
+bool LocalMapper::tryCommit(Mfg &map)
+{
+    unique_lock<mutex> lock(mtx);
+
+    if (state == MAP_RUNNING)
+        return false;
+
+    if (state == MAP_DONE)
+    {
+        state = MAP_IDLE;
+        lock.unlock();
+        handOver(map);
+    }
+
+    return true;
+}
+
+void LocalMapper::commit(Mfg &map)
+{
+    unique_lock<mutex> lock(mtx);
+
+    if (state == MAP_RUNNING)
+    {
+        MyTimer tm;
+        tm.start();
+
+        while (state == MAP_RUNNING)
+            cond.wait(lock);
+
+        tm.end();
+        waitMs += tm.time_ms;
+    }
+
+    if (state == MAP_DONE)
+    {
+        state = MAP_IDLE;
+        lock.unlock();
+        handOver(map);
+    }
+}
+
+void LocalMapper::handOver(Mfg &map)
+// merge the optimized window back into map by view id and gid; tracking does
+// not change the map between optimize() and commit(), so nothing is lost
+{
+    if (local.views.size() != map.views.size())
+    {
+        cerr << "LocalMapper: map changed during optimization, result dropped" << endl;
+        clearLocal();
+        return;
+    }
+
+    mfg_writing = true; // keep the viewer away while merging
+
+    // views are moved one by one, so references into map.views stay valid
+    for (int i = 0; i < winViews.size(); ++i)
+        map.views[winViews[i]] = std::move(local.views[winViews[i]]);
+
+    for (int i = 0; i < winKpts.size(); ++i)
+        map.keyPoints[winKpts[i]] = std::move(local.keyPoints[winKpts[i]]);
+
+    for (int i = 0; i < winLns.size(); ++i)
+        map.idealLines[winLns[i]] = std::move(local.idealLines[winLns[i]]);
+
+    // new planes may have been added, and point/line gids of planes changed
+    map.vanishingPoints.swap(local.vanishingPoints);
+    map.primaryPlanes.swap(local.primaryPlanes);
+    map.numBa = local.numBa;
+    map.baTimeMs = local.baTimeMs;
+
+    mfg_writing = false;
+
+    clearLocal();
+}
+
+void LocalMapper::clearLocal()
+// empty the window entries of local, so it holds no outdated copies
+{
+    for (int i = 0; i < winViews.size(); ++i)
+    {
+        View &v = local.views[winViews[i]];
+        v = View();
+        v.id = winViews[i];
+        v.matchable = false;
+    }
+
+    for (int i = 0; i < winKpts.size(); ++i)
+        local.keyPoints[winKpts[i]] = KeyPoint3d();
+
+    for (int i = 0; i < winLns.size(); ++i)
+        local.idealLines[winLns[i]] = emptyIdealLine();
+
+    local.vanishingPoints.clear();
+    local.primaryPlanes.clear();
+    local.camdist_constraints.clear();
+    winViews.clear();
+    winKpts.clear();
+    winLns.clear();
+}
+
+void LocalMapper::work()
+{
+    unique_lock<mutex> lock(mtx);
+
+    while (true)
+    {
+        while (!stopping && state != MAP_RUNNING)
+            cond.wait(lock);
+
+        if (state != MAP_RUNNING) // stopping
+            return;
+
+        lock.unlock();
+        local.optimizeLocalMap();
+        lock.lock();
+
+        state = MAP_DONE;
+        cond.notify_all();
+    }
+}
@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Local mapper: optimizes the local map of new keyframes in background
+ ********************************************************************************/
+
+#ifndef LOCALMAPPER_H_
+#define LOCALMAPPER_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "mfg.h"
+
+class MfgSettings;
+
+// LocalMapper owns the local map optimization of a new keyframe (plane update,
+// outlier removal and bundle adjustment, see Mfg::optimizeLocalMap). The work
+// is done on a private copy of the local window (see Mfg::collectLocalWindow),
+// so the tracking thread keeps reading the last committed map meanwhile. The
+// copy is indexed like the map, by view id and gid, and the optimized views and
+// landmarks are merged back by commit(). Only one keyframe is optimized at a
+// time.
+class LocalMapper
+{
+public:
+    LocalMapper(MfgSettings *_settings);
+    ~LocalMapper();
+
+    // optimize the local map after a keyframe was added, in place when the thread is off
+    void optimize(Mfg &map);
+    // hand the optimized map over if ready, returns false while still optimizing
+    bool tryCommit(Mfg &map);
+    // wait until the optimization is done and hand the optimized map over
+    void commit(Mfg &map);
+
+    int    numOptimized() const { return numJobs; }
+    double waitTime() const { return waitMs; }   // time tracking waited in commit (ms)
+
+private:
+    enum MapperState { MAP_IDLE, MAP_RUNNING, MAP_DONE };
+
+    MfgSettings *mfgSettings;
+    Mfg          local;       // window being optimized, only the worker touches it while running
+    std::vector<int> winViews, winKpts, winLns; // what local holds of the map, ascending ids
+
+    std::thread              worker;
+    std::mutex               mtx;
+    std::condition_variable  cond;
+    MapperState              state;
+    bool                     stopping;
+
+    int    numJobs;
+    double waitMs;
+
+    void handOver(Mfg &map);
+    void clearLocal();
+    void work();
+};
+
+#endif
@@ -0,0 +1,330 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Loop closer: bag-of-words place recognition over keyframes
+ ********************************************************************************/
+
+#include "loopcloser.h"
+
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+#include <opencv2/features2d/features2d.hpp>
+
+#include "archive.h"
+#include "settings.h"
+#include "utils.h"
+
+extern double THRESH_POINT_MATCH_RATIO;
+
+using namespace std;
+
+LoopCloser::LoopCloser(MfgSettings *_settings)
+    : mfgSettings(_settings), minScore(0.3), loops(0)
+{
+    minGap = max(1, mfgSettings->getLoopMinGap());
+    minInliers = max(8, mfgSettings->getLoopMinInliers()); // more than the PnP min set of 7
+
+    QString fname = mfgSettings->getLoopVocabulary();
+
+    if (fname.isEmpty()) return;
+
+    if (!voc.load(fname.toStdString()))
+    {
+        cerr << "LoopCloser: no vocabulary, loop closure disabled" << endl;
+        return;
+    }
+
+    invFile.resize(voc.size());
+    cout << "LoopCloser: " << voc.size() << " words loaded from " << fname.toStdString() << endl;
+}
+
+bool LoopCloser::process(Mfg &map)
+{
+    if (!enabled()) return false;
+
+    int id = map.views.size() - 1;
+    const View &v = map.views[id];
+
+    if (keyframes.size() <= id)
+        keyframes.resize(id + 1);
+
+    Keyframe &kf = keyframes[id];
+    cv::Mat descs;
+
+    for (int i = 0; i < v.featurePoints.size(); ++i)
+    {
+        if (v.featurePoints[i].siftDesc.empty()) continue;
+
+        descs.push_back(cv::Mat(v.featurePoints[i].siftDesc.t()));
+        kf.lids.push_back(i);
+    }
+
+    if (!descs.empty() && descs.cols != voc.descriptorSize())
+    {
+        cerr << "LoopCloser: descriptors do not match the vocabulary, loop closure disabled" << endl;
+        voc = Vocabulary();
+        return false;
+    }
+
+    voc.transform(descs, kf.bow, &kf.words);
+
+    // landmarks of older keyframes are settled now
+    if (id - minGap >= 0)
+        index(map, id - minGap);
+
+    if (kf.bow.empty() || id == 0) return false;
+
+    // scores are relative to the one of the previous keyframe, which sees
+    // about the same place
+    double prevScore = Vocabulary::score(kf.bow, keyframes[id - 1].bow);
+
+    if (prevScore <= 0) return false;
+
+    std::map<int, double> scores;
+
+    for (BowVector::const_iterator it = kf.bow.begin(); it != kf.bow.end(); ++it)
+    {
+        const vector<pair<int, double> > &hits = invFile[it->first];
+
+        for (int i = 0; i < hits.size(); ++i)
+            scores[hits[i].first] += it->second + hits[i].second - fabs(it->second - hits[i].second);
+    }
+
+    vector<pair<double, int> > cands;
+
+    for (std::map<int, double>::iterator it = scores.begin(); it != scores.end(); ++it)
+    {
+        if (it->second / 2 >= minScore * prevScore)
+            cands.push_back(make_pair(it->second / 2, it->first));
+    }
+
+    sort(cands.rbegin(), cands.rend());
+
+    for (int i = 0; i < cands.size() && i < 3; ++i)
+    {
+        if (verify(map, id, cands[i].second))
+        {
+            ++loops;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void LoopCloser::index(const Mfg &map, int id)
+// put keyframe id into the inverted index, keeping only the points that have a
+// landmark
+{
+    Keyframe &kf = keyframes[id];
+    const View &v = map.views[id];
+
+    vector<int> lids, words, gids;
+
+    for (int i = 0; i < kf.lids.size(); ++i)
+    {
+        int lid = kf.lids[i];
+
+        if (lid >= v.featurePoints.size() || v.featurePoints[lid].gid < 0) continue;
+
+        lids.push_back(lid);
+        words.push_back(kf.words[i]);
+        gids.push_back(v.featurePoints[lid].gid);
+    }
+
+    kf.lids.swap(lids);
+    kf.words.swap(words);
+    kf.gids.swap(gids);
+
+    if (kf.lids.empty()) return; // nothing to verify against
+
+    for (BowVector::const_iterator it = kf.bow.begin(); it != kf.bow.end(); ++it)
+        invFile[it->first].push_back(make_pair(id, it->second));
+}
+
+bool LoopCloser::descriptors(const Mfg &map, int id, cv::Mat &descs, vector<int> &idx) const
+// descriptors of the points of keyframe id, one per row, from the view while it
+// has them, else from the archive; idx is the point of each row in the keyframe
+{
+    const Keyframe &kf = keyframes[id];
+    const View &v = map.views[id];
+    bool inView = true;
+
+    descs.release();
+    idx.clear();
+
+    for (int i = 0; i < kf.lids.size() && inView; ++i)
+        inView = kf.lids[i] < v.featurePoints.size() && !v.featurePoints[kf.lids[i]].siftDesc.empty();
+
+    if (inView)
+    {
+        for (int i = 0; i < kf.lids.size(); ++i)
+        {
+            descs.push_back(cv::Mat(v.featurePoints[kf.lids[i]].siftDesc.t()));
+            idx.push_back(i);
+        }
+
+        return !descs.empty();
+    }
+
+    vector<int> lids;
+    cv::Mat stored;
+
+    if (!map.archive || !map.archive->readDescriptors(v.id, lids, stored))
+        return false;
+
+    // both id lists are ascending
+    for (int i = 0, j = 0; i < lids.size(); ++i)
+    {
+        while (j < kf.lids.size() && kf.lids[j] < lids[i]) ++j;
+
+        if (j < kf.lids.size() && kf.lids[j] == lids[i])
+        {
+            descs.push_back(stored.row(i));
+            idx.push_back(j);
+        }
+    }
+
+    return !descs.empty();
+}
+
+void LoopCloser::matchWords(int id, int cand, vector<pair<int, int> > &matches) const
+// points of keyframes id and cand that are the only ones of their word in both
+{
+    const Keyframe &q = keyframes[id];
+    const Keyframe &c = keyframes[cand];
+    std::map<int, int> qw, cw; // word -> point, -1 if not unique
+
+    for (int i = 0; i < q.words.size(); ++i)
+    {
+        std::map<int, int>::iterator it = qw.find(q.words[i]);
+
+        if (it == qw.end()) qw[q.words[i]] = i;
+        else it->second = -1;
+    }
+
+    for (int i = 0; i < c.words.size(); ++i)
+    {
+        std::map<int, int>::iterator it = cw.find(c.words[i]);
+
+        if (it == cw.end()) cw[c.words[i]] = i;
+        else it->second = -1;
+    }
+
+    matches.clear();
+
+    for (std::map<int, int>::iterator it = qw.begin(); it != qw.end(); ++it)
+    {
+        std::map<int, int>::iterator jt = cw.find(it->first);
+
+        if (it->second >= 0 && jt != cw.end() && jt->second >= 0)
+            matches.push_back(make_pair(it->second, jt->second));
+    }
+}
+
+bool LoopCloser::verify(Mfg &map, int id, int cand)
+// estimate the pose of keyframe id from the landmarks of keyframe cand
+{
+    const Keyframe &q = keyframes[id];
+    const Keyframe &c = keyframes[cand];
+
+    // (point of id, point of cand)
+    vector<pair<int, int> > matches;
+    cv::Mat qDescs, cDescs;
+    vector<int> qIdx, cIdx;
+
+    if (descriptors(map, id, qDescs, qIdx) && descriptors(map, cand, cDescs, cIdx))
+    {
+        vector<vector<cv::DMatch> > knnMatches;
+        cv::BFMatcher matcher(cv::NORM_L2, false);
+        matcher.knnMatch(qDescs, cDescs, knnMatches, 2);
+
+        for (int i = 0; i < knnMatches.size(); ++i)
+        {
+            if (knnMatches[i].size() < 2 ||
+                    knnMatches[i][0].distance > THRESH_POINT_MATCH_RATIO * knnMatches[i][1].distance)
+                continue;
+
+            matches.push_back(make_pair(qIdx[knnMatches[i][0].queryIdx], cIdx[knnMatches[i][0].trainIdx]));
+        }
+    }
+    else
+    {
+        matchWords(id, cand, matches);
+    }
+
+    vector<cv::Point3d> X;
+    vector<cv::Point2d> x;
+    set<int> used;
+
+    for (int i = 0; i < matches.size(); ++i)
+    {
+        int gid = c.gids[matches[i].second];
+        KeyPoint3d kpt = gid < map.keyPoints.size() ? map.keyPoints[gid] : KeyPoint3d();
+
+        // landmarks of old keyframes may have been evicted to the archive
+        if (!(kpt.is3D && kpt.gid >= 0) && map.archive)
+            map.archive->readKeyPoint(gid, kpt);
+
+        if (!kpt.is3D || !used.insert(gid).second) continue;
+
+        const FeatPoint2d &pt = map.views[id].featurePoints[q.lids[matches[i].first]];
+        X.push_back(cv::Point3d(kpt.x, kpt.y, kpt.z));
+        x.push_back(cv::Point2d(pt.x, pt.y));
+    }
+
+    if (X.size() < minInliers) return false;
+
+    // one stream per keyframe pair, whatever was verified before
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_LOOP, (uint64_t(id) << 32) | cand);
+
+    cv::Mat R, t;
+    int inliers = computePnP_ransac(X, x, map.K, R, t, &rng, 100);
+
+    if (inliers < minInliers) return false;
+
+    // pose of keyframe id relative to keyframe cand
+    cv::Mat Rrel = R * map.views[cand].R.t();
+    cv::Mat trel = t - Rrel * map.views[cand].t;
+
+    vector<double> loop;
+    loop.push_back(cand);
+    loop.push_back(id);
+    loop.push_back(inliers);
+
+    for (int i = 0; i < 9; ++i)
+        loop.push_back(Rrel.at<double>(i / 3, i % 3));
+
+    for (int i = 0; i < 3; ++i)
+        loop.push_back(trel.at<double>(i));
+
+    map.loop_constraints.push_back(loop);
+
+    cout << "loop closed: keyframe " << id << " -> " << cand << ", " << inliers << " inliers" << endl;
+    return true;
+}
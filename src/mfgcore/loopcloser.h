@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Loop closer: bag-of-words place recognition over keyframes
+ ********************************************************************************/
+
+#ifndef LOOPCLOSER_H_
+#define LOOPCLOSER_H_
+
+#include <utility>
+#include <vector>
+
+#include "mfg.h"
+#include "vocabulary.h"
+
+class MfgSettings;
+
+// LoopCloser keeps the bag of words of every keyframe, built from the feature
+// point descriptors of View::featurePoints, in an inverted index (word ->
+// keyframes), so a query only visits keyframes sharing words with it. A keyframe
+// enters the index minGap keyframes after it was added, once its points have
+// their landmarks, and only the points with a landmark are kept, as their ids
+// and words. Descriptors are not kept: candidates of a new keyframe are verified
+// by matching its descriptors to the ones of the candidate, read from the view
+// while it has them and from the archive after it released them (see
+// Mfg::releaseOldViews); without an archive, points are matched by word. The pose
+// of the new keyframe is then estimated from the matched landmarks with
+// computePnP_ransac. A verified loop is appended to Mfg::loop_constraints as the
+// pose of the new keyframe relative to the old one, for the global optimization.
+class LoopCloser
+{
+public:
+    LoopCloser(MfgSettings *_settings);
+
+    bool enabled() const { return !voc.empty(); }
+
+    // add the last keyframe of map, returns true if it closed a loop
+    bool process(Mfg &map);
+
+    int numLoops() const { return loops; }
+
+private:
+    struct Keyframe
+    {
+        BowVector        bow;
+        std::vector<int> lids;  // feature points with a descriptor
+        std::vector<int> words; // and their words
+        std::vector<int> gids;  // and their landmarks, once indexed
+    };
+
+    MfgSettings *mfgSettings;
+    Vocabulary   voc;
+    int          minGap;      // min num of keyframes between loop ends
+    int          minInliers;  // min num of PnP inliers of a loop, above the min set
+    double       minScore;    // min score relative to the previous keyframe
+
+    std::vector<Keyframe> keyframes;                            // by view id
+    std::vector<std::vector<std::pair<int, double> > > invFile; // word -> keyframe, weight
+    int          loops;
+
+    void index(const Mfg &map, int id);
+    bool descriptors(const Mfg &map, int id, cv::Mat &descs, std::vector<int> &idx) const;
+    void matchWords(int id, int cand, std::vector<std::pair<int, int> > &matches) const;
+    bool verify(Mfg &map, int id, int cand);
+};
+
+#endif
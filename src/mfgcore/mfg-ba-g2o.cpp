@@ -43,6 +43,7 @@
 #include "settings.h"
 
 #include <Eigen/StdVector>
+#include <tuple>
 #include <stdint.h>
 
 #ifdef _MSC_VER
@@ -72,6 +73,7 @@
 #if defined G2O_HAVE_CSPARSE
 #include "g2o/solvers/csparse/linear_solver_csparse.h"
 #endif
+#include "g2o/solvers/pcg/linear_solver_pcg.h"
 
 #include "vertex_vnpt.h"
 #include "vertex_plane.h"
@@ -80,29 +82,64 @@
 #include "edge_point_plane.h"
 #include "edge_line_vp_plane.h"
 #include "edge_cam_cam_dist.h"
+#include "bablocksolver.h"
 #include <fstream>
+#include <map>
+#include <set>
+#include <algorithm>
 #include "levmar-2.6/levmar.h"
 
 using namespace Eigen;
 extern MfgSettings *mfgSettings;
 extern bool mfg_writing;
 
+g2o::OptimizationAlgorithmLevenberg *newBaAlgorithm(BaLinearSolver solver, bool parallelBuild)
+// solver of the MFG bundle adjustment, the [ba] linear_solver and parallel_build
+// settings in MFG
+{
+    typedef BaBlockSolver::PoseMatrixType PoseMatrixType;
+    BaBlockSolver::LinearSolverType *linearSolver = 0;
+
+    switch (solver)
+    {
+    case BA_SOLVER_CHOLMOD:
+#if defined G2O_HAVE_CHOLMOD && defined MFG_HAVE_CHOLMOD
+        linearSolver = new g2o::LinearSolverCholmod<PoseMatrixType>();
+#else
+        cerr << "BA: CHOLMOD not available, using CSparse" << endl;
+#endif
+        break;
+
+    case BA_SOLVER_DENSE:
+        linearSolver = new g2o::LinearSolverDense<PoseMatrixType>();
+        break;
+
+    case BA_SOLVER_PCG:
+        linearSolver = new g2o::LinearSolverPCG<PoseMatrixType>();
+        break;
+
+    default:
+        break;
+    }
+
+    if (!linearSolver)
+        linearSolver = new g2o::LinearSolverCSparse<PoseMatrixType>();
+
+    if (parallelBuild)
+        return new g2o::OptimizationAlgorithmLevenberg(new BaParallelBlockSolver(linearSolver));
+
+    return new g2o::OptimizationAlgorithmLevenberg(new BaBlockSolver(linearSolver));
+}
+
 void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
 {
     // ----------------- G2O parameter setting -----------------//
     int maxIters = 25;
-    // some handy typedefs
-    typedef g2o::BlockSolver< g2o::BlockSolverTraits<Eigen::Dynamic, Eigen::Dynamic> >  MyBlockSolver;
-    typedef g2o::LinearSolverCSparse<MyBlockSolver::PoseMatrixType> MyLinearSolver;
-    typedef g2o::LinearSolverDense<MyBlockSolver::PoseMatrixType> MyDenseLinearSolver;
 
     // setup the solver
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
-    MyLinearSolver *linearSolver = new MyLinearSolver();
-    MyBlockSolver *solver_ptr = new MyBlockSolver(linearSolver);
-    g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    optimizer.setAlgorithm(newBaAlgorithm(mfgSettings->getBaLinearSolver(), mfgSettings->getBaParallelBuild()));
 
     // add the parameter representing the sensor offset  !!!!
     g2o::ParameterSE3Offset *sensorOffset = new g2o::ParameterSE3Offset;
@@ -282,6 +319,7 @@ void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
             if (idealLines[i].viewId_lnLid[j][0] >= frontPosIdx)
             {
                 g2o::VertexSBAPointXYZ *v_lnpt = new g2o::VertexSBAPointXYZ();
+                v_lnpt->setMarginalized(true);
                 Vector3d pt(idealLines[i].midpt.x, idealLines[i].midpt.y, idealLines[i].midpt.z);
                 v_lnpt->setEstimate(pt);
                 v_lnpt->setId(vertex_id);
@@ -343,9 +381,9 @@ void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
 
         g2o::VertexPlane3d *v_pl = new g2o::VertexPlane3d();
         v_pl->setId(vertex_id);
-        Eigen::Vector3d pl(primaryPlanes[i].n.at<double>(0) / primaryPlanes[i].d,
-                           primaryPlanes[i].n.at<double>(1) / primaryPlanes[i].d,
-                           primaryPlanes[i].n.at<double>(2) / primaryPlanes[i].d);
+        Eigen::Vector3d pl(primaryPlanes[i].n[0] / primaryPlanes[i].d,
+                           primaryPlanes[i].n[1] / primaryPlanes[i].d,
+                           primaryPlanes[i].n[2] / primaryPlanes[i].d);
         v_pl->setEstimate(pl);
 
         if (primaryPlanes[i].estViewId < frontPosIdx)
@@ -843,8 +881,8 @@ void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
         idealLines[lnGid].midpt.x = lnvertVec[i]->estimate()(0);
         idealLines[lnGid].midpt.y = lnvertVec[i]->estimate()(1);
         idealLines[lnGid].midpt.z = lnvertVec[i]->estimate()(2);
-        cv::Mat vp = vanishingPoints[idealLines[lnGid].vpGid].mat(0);
-        idealLines[lnGid].direct = vp / cv::norm(vp);
+        cv::Vec3d vp = vanishingPoints[idealLines[lnGid].vpGid].vec();
+        idealLines[lnGid].direct = vp * (1 / cv::norm(vp));
         cv::Point3d oldMidPt = idealLines[lnGid].midpt;
         idealLines[lnGid].midpt = projectPt3d2Ln3d(idealLines[lnGid], oldMidPt);
     }
@@ -863,7 +901,7 @@ void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
 
         primaryPlanes[plGid].d = 1 / plvertVec[i]->estimate().norm();
         Vector3d n = plvertVec[i]->estimate() / plvertVec[i]->estimate().norm();
-        primaryPlanes[plGid].n = (cv::Mat_<double>(3, 1) << n(0), n(1), n(2));
+        primaryPlanes[plGid].n = cv::Vec3d(n(0), n(1), n(2));
     }
 
     mfg_writing = false;
@@ -1020,6 +1058,263 @@ void Mfg::bundle_adjust_between(int view_from, int view_to, int cam_from)
     optimizer.clear(); //this releases the memory of all vertices and edges in the graph   
 }
 
+// BaGraph keeps the optimizer of adjustBundle_G2O across keyframes. Vertices
+// are keyed by feature type and global id (view index for cameras), edges by
+// the observation they stand for. Vertices and edges still in the window are
+// reused, new ones are added, and those that left the window (features out of
+// the window, observations removed as outliers or older than the window) are
+// removed. The graph also indexes the planes holding each landmark.
+class BaGraph
+{
+public:
+    enum VertexType { VT_CAM, VT_KPT, VT_VNPT, VT_LINE, VT_PLANE };
+    enum EdgeType { ET_CAMDIST, ET_KPT, ET_VNPT, ET_LINE, ET_POINT_PLANE, ET_LINE_PLANE };
+
+    g2o::SparseOptimizer optimizer;
+
+    BaGraph() : nextId(0)
+    {
+        optimizer.setVerbose(false);
+        optimizer.setAlgorithm(newBaAlgorithm(mfgSettings->getBaLinearSolver(), mfgSettings->getBaParallelBuild()));
+
+        // -- add the parameter representing the sensor offset  !!!!
+        g2o::ParameterSE3Offset *sensorOffset = new g2o::ParameterSE3Offset;
+        sensorOffset->setOffset(Eigen::Isometry3d::Identity());
+        sensorOffset->setId(0);
+        optimizer.addParameter(sensorOffset);
+    }
+
+    // start a new keyframe: no vertex or edge is in use
+    void begin()
+    {
+        used.clear();
+        usedEdges.clear();
+    }
+
+    // vertex of feature (type, gid), added to the optimizer on first use
+    template <class VertexT>
+    VertexT *vertex(VertexType type, int gid)
+    {
+        g2o::OptimizableGraph::Vertex *&v = vertices[make_pair((int)type, gid)];
+
+        if (!v)
+        {
+            v = new VertexT();
+            v->setId(nextId++);
+            optimizer.addVertex(v);
+        }
+
+        used.insert(v);
+        return static_cast<VertexT *>(v);
+    }
+
+    // vertex by optimizer id, 0 if there is none
+    g2o::OptimizableGraph::Vertex *byId(int id)
+    {
+        g2o::HyperGraph::VertexIDMap::iterator it = optimizer.vertices().find(id);
+        return it == optimizer.vertices().end() ? 0 : static_cast<g2o::OptimizableGraph::Vertex *>(it->second);
+    }
+
+    // edge (type, a, b, c) on vertices v0, v1 and v2 (0 for binary edges), the
+    // key names the observation, e.g. landmark gid, view id and local id. The
+    // edge kept from the last keyframe is returned as it is; otherwise a new
+    // edge is created on the vertices and isNew is set, the caller sets up its
+    // measurement and adds it to the optimizer
+    template <class EdgeT>
+    EdgeT *edge(EdgeType type, int a, int b, int c, g2o::HyperGraph::Vertex *v0,
+                g2o::HyperGraph::Vertex *v1, g2o::HyperGraph::Vertex *v2, bool &isNew)
+    {
+        EdgeKey key((int)type, a, b, c);
+        map<EdgeKey, g2o::OptimizableGraph::Edge *>::iterator it = edges.find(key);
+
+        if (it != edges.end())
+        {
+            g2o::OptimizableGraph::Edge *e = it->second;
+
+            if (e->vertices()[0] == v0 && e->vertices()[1] == v1
+                    && (e->vertices().size() < 3 || e->vertices()[2] == v2))
+            {
+                usedEdges.insert(e);
+                isNew = false;
+                return static_cast<EdgeT *>(e);
+            }
+
+            // same observation on other vertices, e.g. the vp of a line changed
+            edgeKeys.erase(e);
+            optimizer.removeEdge(e);
+            edges.erase(it);
+        }
+
+        EdgeT *e = new EdgeT();
+        e->vertices()[0] = v0;
+        e->vertices()[1] = v1;
+
+        if (e->vertices().size() > 2)
+            e->vertices()[2] = v2;
+
+        edges[key] = e;
+        edgeKeys[e] = key;
+        usedEdges.insert(e);
+        isNew = true;
+        return e;
+    }
+
+    // remove vertices not used since begin(), and their edges, returns the
+    // number of vertices removed
+    int removeUnused()
+    {
+        int n = 0;
+
+        for (map<pair<int, int>, g2o::OptimizableGraph::Vertex *>::iterator it = vertices.begin(); it != vertices.end();)
+        {
+            if (used.count(it->second))
+            {
+                ++it;
+                continue;
+            }
+
+            // the optimizer deletes the edges of the vertex
+            const g2o::HyperGraph::EdgeSet &es = it->second->edges();
+
+            for (g2o::HyperGraph::EdgeSet::const_iterator ei = es.begin(); ei != es.end(); ++ei)
+            {
+                map<g2o::HyperGraph::Edge *, EdgeKey>::iterator ki = edgeKeys.find(*ei);
+
+                if (ki == edgeKeys.end()) continue;
+
+                edges.erase(ki->second);
+                usedEdges.erase(static_cast<g2o::OptimizableGraph::Edge *>(*ei));
+                edgeKeys.erase(ki);
+            }
+
+            optimizer.removeVertex(it->second);
+            vertices.erase(it++);
+            ++n;
+        }
+
+        return n;
+    }
+
+    // remove edges not used since begin(), returns the number removed
+    int removeUnusedEdges()
+    {
+        int n = 0;
+
+        for (map<EdgeKey, g2o::OptimizableGraph::Edge *>::iterator it = edges.begin(); it != edges.end();)
+        {
+            if (usedEdges.count(it->second))
+            {
+                ++it;
+                continue;
+            }
+
+            edgeKeys.erase(it->second);
+            optimizer.removeEdge(it->second);
+            edges.erase(it++);
+            ++n;
+        }
+
+        return n;
+    }
+
+    // index the plane members added since the last call; member lists of
+    // planes only grow, so only their sizes are compared
+    void indexPlanes(const vector<PrimPlane3d> &planes)
+    {
+        if (planes.size() < numIndexed.size()) // planes were replaced, start over
+        {
+            numIndexed.clear();
+            kptPlaneIdx.clear();
+            lnPlaneIdx.clear();
+        }
+
+        numIndexed.resize(planes.size(), make_pair(0, 0));
+
+        for (int i = 0; i < planes.size(); ++i)
+        {
+            pair<int, int> &num = numIndexed[i];
+
+            if (num.first == planes[i].kptGids.size() && num.second == planes[i].ilnGids.size())
+                continue;
+
+            if (num.first > planes[i].kptGids.size() || num.second > planes[i].ilnGids.size())
+            {
+                numIndexed.clear(); // a member list shrank, start over
+                kptPlaneIdx.clear();
+                lnPlaneIdx.clear();
+                indexPlanes(planes);
+                return;
+            }
+
+            for (; num.first < planes[i].kptGids.size(); ++num.first)
+                addToIndex(kptPlaneIdx[planes[i].kptGids[num.first]], i);
+
+            for (; num.second < planes[i].ilnGids.size(); ++num.second)
+                addToIndex(lnPlaneIdx[planes[i].ilnGids[num.second]], i);
+        }
+    }
+
+    // planes holding key point / ideal line gid, ascending
+    const vector<int> &kptPlanes(int gid) const { return planesOf(kptPlaneIdx, gid); }
+    const vector<int> &lnPlanes(int gid) const { return planesOf(lnPlaneIdx, gid); }
+
+private:
+    typedef std::tuple<int, int, int, int> EdgeKey;
+
+    map<pair<int, int>, g2o::OptimizableGraph::Vertex *> vertices;
+    set<g2o::OptimizableGraph::Vertex *> used;
+    map<EdgeKey, g2o::OptimizableGraph::Edge *> edges;
+    map<g2o::HyperGraph::Edge *, EdgeKey> edgeKeys;
+    set<g2o::OptimizableGraph::Edge *> usedEdges;
+    int nextId;
+
+    vector<pair<int, int> > numIndexed;  // point and line members indexed, per plane
+    unordered_map<int, vector<int> > kptPlaneIdx, lnPlaneIdx;
+    vector<int> noPlanes;
+
+    static void addToIndex(vector<int> &pls, int plGid)
+    {
+        vector<int>::iterator it = lower_bound(pls.begin(), pls.end(), plGid);
+
+        if (it == pls.end() || *it != plGid)
+            pls.insert(it, plGid);
+    }
+
+    const vector<int> &planesOf(const unordered_map<int, vector<int> > &idx, int gid) const
+    {
+        unordered_map<int, vector<int> >::const_iterator it = idx.find(gid);
+        return it == idx.end() ? noPlanes : it->second;
+    }
+};
+
+void Mfg::collectWindowFeatures(int frontIdx, vector<int> &kptGids, vector<int> &vptGids, vector<int> &lnGids) const
+// global ids of features observed in views[frontIdx...], found through the
+// views so that the cost grows with the window and not with the map
+{
+    for (int i = max(0, frontIdx); i < views.size(); ++i)
+    {
+        for (int j = 0; j < views[i].featurePoints.size(); ++j)
+            if (views[i].featurePoints[j].gid >= 0)
+                kptGids.push_back(views[i].featurePoints[j].gid);
+
+        for (int j = 0; j < views[i].vanishPoints.size(); ++j)
+            if (views[i].vanishPoints[j].gid >= 0)
+                vptGids.push_back(views[i].vanishPoints[j].gid);
+
+        for (int j = 0; j < views[i].idealLines.size(); ++j)
+            if (views[i].idealLines[j].gid >= 0)
+                lnGids.push_back(views[i].idealLines[j].gid);
+    }
+
+    // same order as a scan over the whole map
+    sort(kptGids.begin(), kptGids.end());
+    kptGids.erase(unique(kptGids.begin(), kptGids.end()), kptGids.end());
+    sort(vptGids.begin(), vptGids.end());
+    vptGids.erase(unique(vptGids.begin(), vptGids.end()), vptGids.end());
+    sort(lnGids.begin(), lnGids.end());
+    lnGids.erase(unique(lnGids.begin(), lnGids.end()), lnGids.end());
+}
+
 void Mfg::adjustBundle_G2O(int numPos, int numFrm)
 // local bundle adjustment: points+vp
 {
@@ -1027,27 +1322,17 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
 
     // ----------------- G2O parameter setting -----------------//
     int maxIters = 25;
-    // some handy typedefs
-    typedef g2o::BlockSolver< g2o::BlockSolverTraits<Eigen::Dynamic, Eigen::Dynamic> >  MyBlockSolver;
-    typedef g2o::LinearSolverCSparse<MyBlockSolver::PoseMatrixType> MyLinearSolver;
-    typedef g2o::LinearSolverDense<MyBlockSolver::PoseMatrixType> MyDenseLinearSolver;
 
-    // setup the solver
-    g2o::SparseOptimizer optimizer;
-    optimizer.setVerbose(false);
-    MyLinearSolver *linearSolver = new MyLinearSolver();
-    MyBlockSolver *solver_ptr = new MyBlockSolver(linearSolver);
-    g2o::OptimizationAlgorithmLevenberg *solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    // the optimizer is kept across keyframes, vertices still in the window
+    // are reused and start from the estimates written back last time
+    if (!baGraph)
+        baGraph = make_shared<BaGraph>();
 
-    // -- add the parameter representing the sensor offset  !!!!
-    g2o::ParameterSE3Offset *sensorOffset = new g2o::ParameterSE3Offset;
-    sensorOffset->setOffset(Eigen::Isometry3d::Identity());
-    sensorOffset->setId(0);
-    optimizer.addParameter(sensorOffset);
+    BaGraph &graph = *baGraph;
+    g2o::SparseOptimizer &optimizer = graph.optimizer;
+    graph.begin();
 
     // ----- set g2o vertices ------
-    int vertex_id = 0;
     int frontPosIdx = max(1, (int)views.size() - numPos);
     int frontFrmIdx = max(0, (int)views.size() - numFrm);
     int frontVptIdx = max(0, (int)views.size() - mfgSettings->getBaNumFramesVPoint()); // first frame used for keep VP estimate consistent
@@ -1068,19 +1353,18 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
         Eigen::Isometry3d pose;
         pose = q;
         pose.translation() = Eigen::Vector3d(views[i].t.at<double>(0), views[i].t.at<double>(1), views[i].t.at<double>(2));
-        g2o::VertexCam *v_cam = new g2o::VertexCam();
-        v_cam->setId(vertex_id);
+        g2o::VertexCam *v_cam = graph.vertex<g2o::VertexCam>(BaGraph::VT_CAM, i);
         g2o::SBACam sc(q.inverse(), pose.inverse().translation());
         sc.setKcam(K.at<double>(0, 0), K.at<double>(1, 1), K.at<double>(0, 2), K.at<double>(1, 2), 0);
         v_cam->setEstimate(sc);
 
         if (i < 1 || i < frontPosIdx)
             v_cam->setFixed(true);
+        else
+            v_cam->setFixed(false);
 
-        optimizer.addVertex(v_cam);
-        camvid2fid[vertex_id] = i;
-        camfid2vid[i] = vertex_id;
-        ++vertex_id;
+        camvid2fid[v_cam->id()] = i;
+        camfid2vid[i] = v_cam->id();
         camvertVec.push_back(v_cam);
     }
 
@@ -1095,29 +1379,26 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
         {
             maxIters = 20;
             //  optimizer.setVerbose(true);
-            g2o::EdgeCamCamDist *e = new g2o::EdgeCamCamDist();
-            e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(camfid2vid[(int)camdist_constraints[i][0]])->second);
+            g2o::OptimizableGraph::Vertex *v0 = graph.byId(camfid2vid[(int)camdist_constraints[i][0]]),
+                                          *v1 = graph.byId(camfid2vid[(int)camdist_constraints[i][1]]);
 
-            if (e->vertices()[0] == 0)
+            if (v0 == 0 || v1 == 0)
             {
                 cerr << "no cam vertex found ... terminated \n";
                 exit(0);
             }
 
-            e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(camfid2vid[(int)camdist_constraints[i][1]])->second);
-
-            if (e->vertices()[1] == 0)
-            {
-                cerr << "no cam vertex found ... terminated \n";
-                exit(0);
-            }
+            bool isNew;
+            g2o::EdgeCamCamDist *e = graph.edge<g2o::EdgeCamCamDist>(BaGraph::ET_CAMDIST, i, 0, 0, v0, v1, 0, isNew);
 
+            // the information is raised during the optimization, reset every time
             e->setMeasurement(camdist_constraints[i][2]);
             e->information().setIdentity();
             e->information() = e->information() * camdist_constraints[i][3]; // observaion info
-            optimizer.addEdge(e);
+
+            if (isNew)
+                optimizer.addEdge(e);
+
             edges_camdist.push_back(e);
         }
     }
@@ -1139,10 +1420,16 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
     vector<int> kptIdx2Opt;        // keyPoint idx to optimize
     vector<int> kptIdx2Rpj_notOpt; // keypoint idx to reproject but not optimize
 
+    // only features observed in the window can have vertices
+    vector<int> winKptGids, winVptGids, winLnGids;
+    collectWindowFeatures(frontPosIdx, winKptGids, winVptGids, winLnGids);
+
     // points-to-optimize contains those first appearing after frontFrmIdx and still being observed after frontPosIdx
-    for (int i = 0; i < keyPoints.size(); ++i)
+    for (int k = 0; k < winKptGids.size(); ++k)
     {
-        if (!keyPoints[i].is3D || keyPoints[i].gid < 0) continue;
+        int i = winKptGids[k];
+
+        if (i >= keyPoints.size() || !keyPoints[i].is3D || keyPoints[i].gid < 0) continue;
 
         for (int j = 0; j < keyPoints[i].viewId_ptLid.size(); ++j)
         {
@@ -1150,8 +1437,7 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
             {
                 // don't optimize too-old (established before frontFrmIdx) points,
                 // but still use their recent observations/reprojections after frontPosIdx
-                g2o::VertexSBAPointXYZ *v_p = new g2o::VertexSBAPointXYZ();
-                v_p->setId(vertex_id);
+                g2o::VertexSBAPointXYZ *v_p = graph.vertex<g2o::VertexSBAPointXYZ>(BaGraph::VT_KPT, keyPoints[i].gid);
                 v_p->setMarginalized(true);
                 Eigen::Vector3d pt(keyPoints[i].x, keyPoints[i].y, keyPoints[i].z);
                 v_p->setEstimate(pt);
@@ -1171,10 +1457,8 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
                     ptvertVec.push_back(v_p);
                 }
 
-                optimizer.addVertex(v_p);
-                ptgid2vid[keyPoints[i].gid] = vertex_id;
-                ptvid2gid[vertex_id] = keyPoints[i].gid;
-                ++vertex_id;
+                ptgid2vid[keyPoints[i].gid] = v_p->id();
+                ptvid2gid[v_p->id()] = keyPoints[i].gid;
                 break;
             }
         }
@@ -1186,22 +1470,24 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
     vector<g2o::VertexVanishPoint *> vpvertVec;
 
     // vp that is observed in current window
-    for (int i = 0; i < vanishingPoints.size(); ++i)
+    for (int k = 0; k < winVptGids.size(); ++k)
     {
+        int i = winVptGids[k];
+
+        if (i >= vanishingPoints.size()) continue;
+
         for (int j = 0; j < vanishingPoints[i].viewId_vpLid.size(); ++j)
         {
             if (vanishingPoints[i].viewId_vpLid[j][0] >= frontPosIdx)  // observed recently
             {
                 vpIdx2Opt.push_back(i);
-                g2o::VertexVanishPoint *v_vp = new g2o::VertexVanishPoint();
-                v_vp->setId(vertex_id);
+                g2o::VertexVanishPoint *v_vp = graph.vertex<g2o::VertexVanishPoint>(BaGraph::VT_VNPT, vanishingPoints[i].gid);
                 Eigen::Vector3d pt(vanishingPoints[i].x, vanishingPoints[i].y, vanishingPoints[i].z);
                 v_vp->setEstimate(pt);
-                optimizer.addVertex(v_vp);
+                v_vp->setFixed(false);
                 vpvertVec.push_back(v_vp);
-                vpvid2gid[vertex_id] = vanishingPoints[i].gid;
-                vpgid2vid[vanishingPoints[i].gid] = vertex_id;
-                ++vertex_id;
+                vpvid2gid[v_vp->id()] = vanishingPoints[i].gid;
+                vpgid2vid[vanishingPoints[i].gid] = v_vp->id();
                 break;
             }
         }
@@ -1212,20 +1498,22 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
     vector<int> lnIdx2Opt, lnIdx2Rpj_notOpt;
     vector<g2o::VertexSBAPointXYZ *> lnvertVec;
 
-    for (int i = 0; i < idealLines.size(); ++i)
+    for (int k = 0; k < winLnGids.size(); ++k)
     {
-        if (!idealLines[i].is3D || idealLines[i].gid < 0) continue;
+        int i = winLnGids[k];
+
+        if (i >= idealLines.size() || !idealLines[i].is3D || idealLines[i].gid < 0) continue;
 
         for (int j = 0; j < idealLines[i].viewId_lnLid.size(); ++j)
         {
             if (idealLines[i].viewId_lnLid[j][0] >= frontPosIdx)
             {
-                g2o::VertexSBAPointXYZ *v_lnpt = new g2o::VertexSBAPointXYZ();
+                g2o::VertexSBAPointXYZ *v_lnpt = graph.vertex<g2o::VertexSBAPointXYZ>(BaGraph::VT_LINE, idealLines[i].gid);
+                v_lnpt->setMarginalized(true);
                 Vector3d pt(idealLines[i].midpt.x, idealLines[i].midpt.y, idealLines[i].midpt.z);
                 v_lnpt->setEstimate(pt);
-                v_lnpt->setId(vertex_id);
-                lngid2vid[idealLines[i].gid] = vertex_id;
-                lnvid2gid[vertex_id] = idealLines[i].gid;
+                lngid2vid[idealLines[i].gid] = v_lnpt->id();
+                lnvid2gid[v_lnpt->id()] = idealLines[i].gid;
 
                 if (idealLines[i].viewId_lnLid[0][0] < frontFrmIdx
                         && idealLines[i].estViewId < views.back().id)
@@ -1240,49 +1528,50 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
                     lnvertVec.push_back(v_lnpt);
                 }
 
-                optimizer.addVertex(v_lnpt);
-                ++vertex_id;
                 break;
             }
         }
     }
 
     // ---- primary planes ----
+    // planes holding a landmark that has a vertex, found through the plane index
+    // of the graph rather than through the member lists of all planes
     unordered_map<int, int> plgid2vid, plvid2gid;
     vector<int> plIdx2Opt;
     vector<g2o::VertexPlane3d *> plvertVec;
 
-    for (int i = 0; i < primaryPlanes.size(); ++i)
+    graph.indexPlanes(primaryPlanes);
+    vector<int> ptGidsInBa(kptIdx2Opt), lnGidsInBa(lnIdx2Opt);
+    ptGidsInBa.insert(ptGidsInBa.end(), kptIdx2Rpj_notOpt.begin(), kptIdx2Rpj_notOpt.end());
+    lnGidsInBa.insert(lnGidsInBa.end(), lnIdx2Rpj_notOpt.begin(), lnIdx2Rpj_notOpt.end());
+    sort(ptGidsInBa.begin(), ptGidsInBa.end());
+    sort(lnGidsInBa.begin(), lnGidsInBa.end());
+
+    for (int k = 0; k < ptGidsInBa.size(); ++k)
     {
-        if (views.back().id - primaryPlanes[i].estViewId < 3) continue;
+        const vector<int> &pls = graph.kptPlanes(ptGidsInBa[k]);
+        plIdx2Opt.insert(plIdx2Opt.end(), pls.begin(), pls.end());
+    }
 
-        bool usePlane = false;
+    for (int k = 0; k < lnGidsInBa.size(); ++k)
+    {
+        const vector<int> &pls = graph.lnPlanes(lnGidsInBa[k]);
+        plIdx2Opt.insert(plIdx2Opt.end(), pls.begin(), pls.end());
+    }
 
-        for (int j = 0; j < primaryPlanes[i].kptGids.size(); ++j)
-        {
-            if (ptgid2vid.find(primaryPlanes[i].kptGids[j]) != ptgid2vid.end())
-            {
-                usePlane = true;
-                break;
-            }
-        }
+    sort(plIdx2Opt.begin(), plIdx2Opt.end());
+    plIdx2Opt.erase(unique(plIdx2Opt.begin(), plIdx2Opt.end()), plIdx2Opt.end());
 
-        for (int j = 0; j < primaryPlanes[i].ilnGids.size(); ++j)
-        {
-            if (lngid2vid.find(primaryPlanes[i].ilnGids[j]) != lngid2vid.end())
-            {
-                usePlane = true;
-                break;
-            }
-        }
+    for (int k = 0; k < plIdx2Opt.size(); ++k)
+    {
+        int i = plIdx2Opt[k];
 
-        if (!usePlane) continue;
+        if (views.back().id - primaryPlanes[i].estViewId < 3) continue;
 
-        g2o::VertexPlane3d *v_pl = new g2o::VertexPlane3d();
-        v_pl->setId(vertex_id);
-        Eigen::Vector3d pl(primaryPlanes[i].n.at<double>(0) / primaryPlanes[i].d,
-                           primaryPlanes[i].n.at<double>(1) / primaryPlanes[i].d,
-                           primaryPlanes[i].n.at<double>(2) / primaryPlanes[i].d);
+        g2o::VertexPlane3d *v_pl = graph.vertex<g2o::VertexPlane3d>(BaGraph::VT_PLANE, i);
+        Eigen::Vector3d pl(primaryPlanes[i].n[0] / primaryPlanes[i].d,
+                           primaryPlanes[i].n[1] / primaryPlanes[i].d,
+                           primaryPlanes[i].n[2] / primaryPlanes[i].d);
         v_pl->setEstimate(pl);
 
         if (primaryPlanes[i].estViewId < frontPosIdx)
@@ -1290,15 +1579,18 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
         else
             v_pl->setFixed(false);
 
-        optimizer.addVertex(v_pl);
-        plgid2vid[i] = vertex_id;
-        plvid2gid[vertex_id] = i;
-        plIdx2Opt.push_back(i);
+        plgid2vid[i] = v_pl->id();
+        plvid2gid[v_pl->id()] = i;
         plvertVec.push_back(v_pl);
-        ++vertex_id;
     }
 
+    // features that left the window, with their edges
+    graph.removeUnused();
+
 // (2) add g2o edges (keypoints, vanishpoints, lines, primary planes) to optimizer  
+    // Edges kept from the last keyframe are reused as they are: an edge is keyed
+    // by its observation, whose measurement and weight do not change. Only new
+    // observations get new edges, see BaGraph::edge
     vector<g2o::EdgeVnptCam *>      vecEdgeVnpt;
     vector<g2o::EdgeProjectP2MC *>  vecEdgeKpt;
     vector<g2o::EdgeLineVpCam *>    vecEdgeLine;
@@ -1306,95 +1598,54 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
     vector<g2o::EdgeLineVpPlane *>  vecEdgeLinePlane;
 
     // ---- keypoints ----
-    for (int i = 0; i < kptIdx2Opt.size(); ++i)// keyPoint idx to optimize
+    for (int k = 0; k < ptGidsInBa.size(); ++k)// keypoints to optimize or only to reproject
     {
-        for (int j = 0; j < keyPoints[kptIdx2Opt[i]].viewId_ptLid.size(); ++j)
+        int ptGid = ptGidsInBa[k];
+
+        for (int j = 0; j < keyPoints[ptGid].viewId_ptLid.size(); ++j)
         {
-            int fid = keyPoints[kptIdx2Opt[i]].viewId_ptLid[j][0]; //fram(view) id
-            int lid = keyPoints[kptIdx2Opt[i]].viewId_ptLid[j][1];//local id
+            int fid = keyPoints[ptGid].viewId_ptLid[j][0]; //fram(view) id
+            int lid = keyPoints[ptGid].viewId_ptLid[j][1];//local id
 
             if (!views[fid].matchable) continue;
 
             if (fid >= frontFrmIdx)
             {
-                g2o::EdgeProjectP2MC *e = new g2o::EdgeProjectP2MC();
-                e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(ptgid2vid[kptIdx2Opt[i]])->second);
+                g2o::OptimizableGraph::Vertex *v0 = graph.byId(ptgid2vid[ptGid]);
 
-                if (e->vertices()[0] == 0)
+                if (v0 == 0)
                 {
                     cerr << "no pt vert found ... terminated \n";
                     exit(0);
                 }
 
-                e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(camfid2vid[fid])->second);
+                g2o::OptimizableGraph::Vertex *v1 = graph.byId(camfid2vid[fid]);
 
-                if (e->vertices()[1] == 0)
+                if (v1 == 0)
                 {
                     cerr << "no cam vert found ... terminated \n";
                     exit(0);
                 }
 
-                Eigen::Vector2d meas(views[fid].featurePoints[lid].x, views[fid].featurePoints[lid].y);
-                e->setMeasurement(meas);
+                bool isNew;
+                g2o::EdgeProjectP2MC *e = graph.edge<g2o::EdgeProjectP2MC>(BaGraph::ET_KPT, ptGid, fid, lid, v0, v1, 0, isNew);
 
-                if (mfgSettings->getBaUseKernel())
+                if (isNew)
                 {
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    rk->setDelta(mfgSettings->getBaKernelDeltaPoint());
-                    e->setRobustKernel(rk);
-                }
+                    Eigen::Vector2d meas(views[fid].featurePoints[lid].x, views[fid].featurePoints[lid].y);
+                    e->setMeasurement(meas);
 
-                e->information() = Matrix2d::Identity();
-                optimizer.addEdge(e);
-                vecEdgeKpt.push_back(e);
-            }
-        }
-    }
-
-    for (int i = 0; i < kptIdx2Rpj_notOpt.size(); ++i)// keypoint idx to reproject but not optimize
-    {
-        for (int j = 0; j < keyPoints[kptIdx2Rpj_notOpt[i]].viewId_ptLid.size(); ++j)
-        {
-            int fid = keyPoints[kptIdx2Rpj_notOpt[i]].viewId_ptLid[j][0] ;
-            int lid = keyPoints[kptIdx2Rpj_notOpt[i]].viewId_ptLid[j][1] ;
-
-            if (!views[fid].matchable) continue;
-
-            if (fid >= frontFrmIdx)
-            {
-                g2o::EdgeProjectP2MC *e = new g2o::EdgeProjectP2MC();
-                e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(ptgid2vid[kptIdx2Rpj_notOpt[i]])->second);
-
-                if (e->vertices()[0] == 0)
-                {
-                    cerr << "no pt vert found ... terminated \n";
-                    exit(0);
-                }
-
-                e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(camfid2vid[fid])->second);
-
-                if (e->vertices()[1] == 0)
-                {
-                    cerr << "no cam vert found ... terminated \n";
-                    exit(0);
-                }
-
-                Eigen::Vector2d meas(views[fid].featurePoints[lid].x, views[fid].featurePoints[lid].y);
-                e->setMeasurement(meas);
-                e->information() = Matrix2d::Identity();
+                    if (mfgSettings->getBaUseKernel())
+                    {
+                        g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+                        rk->setDelta(mfgSettings->getBaKernelDeltaPoint());
+                        e->setRobustKernel(rk);
+                    }
 
-                if (mfgSettings->getBaUseKernel())
-                {
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    rk->setDelta(mfgSettings->getBaKernelDeltaPoint());
-                    e->setRobustKernel(rk);
+                    e->information() = Matrix2d::Identity();
+                    optimizer.addEdge(e);
                 }
 
-                optimizer.addEdge(e);
                 vecEdgeKpt.push_back(e);
             }
         }
@@ -1414,166 +1665,113 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
 
             if (fid >= frontVptIdx)  // different from frontFrmIdx
             {
-                g2o::EdgeVnptCam *e = new g2o::EdgeVnptCam();
-                e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(vpgid2vid[vpGid])->second);
+                g2o::OptimizableGraph::Vertex *v0 = graph.byId(vpgid2vid[vpGid]);
 
-                if (e->vertices()[0] == 0)
+                if (v0 == 0)
                 {
                     cerr << "no vpt vert found ... terminated \n";
                     exit(0);
                 }
 
-                e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(camfid2vid[fid])->second);
+                g2o::OptimizableGraph::Vertex *v1 = graph.byId(camfid2vid[fid]);
 
-                if (e->vertices()[1] == 0)
+                if (v1 == 0)
                 {
                     cerr << "no cam vert found ... terminated \n";
                     exit(0);
                 }
 
-                cv::Mat univec_meas = K.inv() * views[fid].vanishPoints[lid].mat();
-                univec_meas = univec_meas / cv::norm(univec_meas);
-                double alpha, beta;
-                unitVec2angle(univec_meas, &alpha, &beta);
-                Eigen::Vector2d meas(alpha, beta);
-                e->setMeasurement(meas);
-                e->information() = Matrix2d::Identity();
-                e->computeError();
-                double err_raw = e->chi2();
-                cv::Mat egvals;
-                cv::eigen(views[fid].vanishPoints[lid].cov_pt(K), egvals);
-                Matrix2d cov;
-                cov(0, 0) = max(views[fid].vanishPoints[lid].cov_ab.at<double>(0, 0), 1e-3);
-                cov(0, 1) = views[fid].vanishPoints[lid].cov_ab.at<double>(0, 1) * 0;
-                cov(1, 0) = views[fid].vanishPoints[lid].cov_ab.at<double>(1, 0) * 0;
-                cov(1, 1) = max(views[fid].vanishPoints[lid].cov_ab.at<double>(1, 1), 1e-3);
-                e->information() = mfgSettings->getBaWeightVPoint() * cov.inverse(); // observaion info
+                bool isNew;
+                g2o::EdgeVnptCam *e = graph.edge<g2o::EdgeVnptCam>(BaGraph::ET_VNPT, vpGid, fid, lid, v0, v1, 0, isNew);
 
-                if (mfgSettings->getBaUseKernel())
+                if (isNew)
                 {
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    rk->setDelta(mfgSettings->getBaKernelDeltaVPoint());
-                    e->setRobustKernel(rk);
+                    cv::Mat univec_meas = K.inv() * views[fid].vanishPoints[lid].mat();
+                    univec_meas = univec_meas / cv::norm(univec_meas);
+                    double alpha, beta;
+                    unitVec2angle(univec_meas, &alpha, &beta);
+                    Eigen::Vector2d meas(alpha, beta);
+                    e->setMeasurement(meas);
+                    Matrix2d cov;
+                    cov(0, 0) = max(views[fid].vanishPoints[lid].cov_ab.at<double>(0, 0), 1e-3);
+                    cov(0, 1) = views[fid].vanishPoints[lid].cov_ab.at<double>(0, 1) * 0;
+                    cov(1, 0) = views[fid].vanishPoints[lid].cov_ab.at<double>(1, 0) * 0;
+                    cov(1, 1) = max(views[fid].vanishPoints[lid].cov_ab.at<double>(1, 1), 1e-3);
+                    e->information() = mfgSettings->getBaWeightVPoint() * cov.inverse(); // observaion info
+
+                    if (mfgSettings->getBaUseKernel())
+                    {
+                        g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+                        rk->setDelta(mfgSettings->getBaKernelDeltaVPoint());
+                        e->setRobustKernel(rk);
+                    }
+
+                    optimizer.addEdge(e);
                 }
 
-                optimizer.addEdge(e);
                 vecEdgeVnpt.push_back(e);
             }
         }
     }
 
     // ---- lines ----
-    for (int i = 0; i < lnIdx2Opt.size(); ++i)// lnIdx2Opt idx to optimize 
+    for (int k = 0; k < lnGidsInBa.size(); ++k)// lines to optimize or only to reproject
     {
-        for (int j = 0; j < idealLines[lnIdx2Opt[i]].viewId_lnLid.size(); ++j)
+        int lnGid = lnGidsInBa[k];
+
+        for (int j = 0; j < idealLines[lnGid].viewId_lnLid.size(); ++j)
         {
-            int fid = idealLines[lnIdx2Opt[i]].viewId_lnLid[j][0];
-            int lid = idealLines[lnIdx2Opt[i]].viewId_lnLid[j][1];
+            int fid = idealLines[lnGid].viewId_lnLid[j][0];
+            int lid = idealLines[lnGid].viewId_lnLid[j][1];
 
             if (!views[fid].matchable) continue;
 
             if (fid >= frontFrmIdx)
             {
-                g2o::EdgeLineVpCam *e = new g2o::EdgeLineVpCam();
-                e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(lngid2vid[lnIdx2Opt[i]])->second);
+                g2o::OptimizableGraph::Vertex *v0 = graph.byId(lngid2vid[lnGid]);
 
-                if (e->vertices()[0] == 0)
+                if (v0 == 0)
                 {
                     cerr << "no lnpt vert found ... terminated \n";
                     exit(0);
                 }
 
-                e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(vpgid2vid[idealLines[lnIdx2Opt[i]].vpGid])->second);
+                g2o::OptimizableGraph::Vertex *v1 = graph.byId(vpgid2vid[idealLines[lnGid].vpGid]);
 
-                if (e->vertices()[1] == 0)
+                if (v1 == 0)
                 {
                     cerr << "no vpt vert found ... terminated \n";
                     exit(0);
                 }
 
-                e->vertices()[2] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(camfid2vid[fid])->second);
+                g2o::OptimizableGraph::Vertex *v2 = graph.byId(camfid2vid[fid]);
 
-                if (e->vertices()[2] == 0)
+                if (v2 == 0)
                 {
                     cerr << "no cam vert found ... terminated \n";
                     exit(0);
                 }
 
-                double meas = 0;
-                e->setMeasurement(meas);
-                e->information() = e->information() * mfgSettings->getBaWeightLine();
-
-                if (mfgSettings->getBaUseKernel())
-                {
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    rk->setDelta(mfgSettings->getBaKernelDeltaLine());
-                    e->setRobustKernel(rk);
-                }
-
-                e->segpts = views[fid].idealLines[lid].lsEndpoints;
-                optimizer.addEdge(e);
-                vecEdgeLine.push_back(e);
-            }
-        }
-    }
-
-    for (int i = 0; i < lnIdx2Rpj_notOpt.size(); ++i)// lnIdx2Rpj_notOpt idx to reproject but not optimize
-    {
-        for (int j = 0; j < idealLines[lnIdx2Rpj_notOpt[i]].viewId_lnLid.size(); ++j)
-        {
-            int fid = idealLines[lnIdx2Rpj_notOpt[i]].viewId_lnLid[j][0];
-            int lid = idealLines[lnIdx2Rpj_notOpt[i]].viewId_lnLid[j][1];
-
-            if (!views[fid].matchable) continue;
-
-            if (fid >= frontFrmIdx)
-            {
-                g2o::EdgeLineVpCam *e = new g2o::EdgeLineVpCam();
-                e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(lngid2vid[lnIdx2Rpj_notOpt[i]])->second);
-
-                if (e->vertices()[0] == 0)
-                {
-                    cerr << "no lnpt vert found ... terminated \n";
-                    exit(0);
-                }
-
-                e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(vpgid2vid[idealLines[lnIdx2Rpj_notOpt[i]].vpGid])->second);
-
-                if (e->vertices()[1] == 0)
-                {
-                    cerr << "no vpt vert found ... terminated \n";
-                    exit(0);
-                }
-
-                e->vertices()[2] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                                   (optimizer.vertices().find(camfid2vid[fid])->second);
+                bool isNew;
+                g2o::EdgeLineVpCam *e = graph.edge<g2o::EdgeLineVpCam>(BaGraph::ET_LINE, lnGid, fid, lid, v0, v1, v2, isNew);
 
-                if (e->vertices()[2] == 0)
+                if (isNew)
                 {
-                    cerr << "no cam vert found ... terminated \n";
-                    exit(0);
-                }
+                    double meas = 0;
+                    e->setMeasurement(meas);
+                    e->information() = e->information() * mfgSettings->getBaWeightLine();
 
-                double meas = 0;
-                e->setMeasurement(meas);
-                e->information() = e->information() * mfgSettings->getBaWeightLine();
-                e->segpts = views[fid].idealLines[lid].lsEndpoints;
+                    if (mfgSettings->getBaUseKernel())
+                    {
+                        g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+                        rk->setDelta(mfgSettings->getBaKernelDeltaLine());
+                        e->setRobustKernel(rk);
+                    }
 
-                if (mfgSettings->getBaUseKernel())
-                {
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    rk->setDelta(mfgSettings->getBaKernelDeltaLine());
-                    e->setRobustKernel(rk);
+                    e->segpts = views[fid].idealLines[lid].lsEndpoints;
+                    optimizer.addEdge(e);
                 }
 
-                optimizer.addEdge(e);
                 vecEdgeLine.push_back(e);
             }
         }
@@ -1581,107 +1779,123 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
 
 
     // ---- primary planes ----
-    for (int i = 0; i < plIdx2Opt.size(); ++i)
+    // --- point to plane dists ---
+    for (int k = 0; k < ptGidsInBa.size(); ++k)
     {
-        int plGid = plIdx2Opt[i];
+        int ptGid = ptGidsInBa[k];
+        const vector<int> &pls = graph.kptPlanes(ptGid);
 
-        // --- point to plane dists ---
-        for (int j = 0; j < primaryPlanes[plGid].kptGids.size(); ++j)
+        for (int j = 0; j < pls.size(); ++j)
         {
-            int ptGid = primaryPlanes[plGid].kptGids[j];
+            int plGid = pls[j];
 
-            if (ptgid2vid.find(ptGid) == ptgid2vid.end()) continue;
+            if (plgid2vid.find(plGid) == plgid2vid.end()) continue;
 
-            g2o::EdgePointPlane3d *e = new g2o::EdgePointPlane3d();
-            e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(ptgid2vid[ptGid])->second);
+            g2o::OptimizableGraph::Vertex *v0 = graph.byId(ptgid2vid[ptGid]);
 
-            if (e->vertices()[0] == 0)
+            if (v0 == 0)
             {
                 cerr << "no kpt vert found ... terminated \n";
                 exit(0);
             }
 
-            e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(plgid2vid[plGid])->second);
+            g2o::OptimizableGraph::Vertex *v1 = graph.byId(plgid2vid[plGid]);
 
-            if (e->vertices()[1] == 0)
+            if (v1 == 0)
             {
                 cerr << "no plane vert found ... terminated \n";
                 exit(0);
             }
 
-            e->setMeasurement(0);
-            e->information().setIdentity();
-            e->information() = mfgSettings->getBaWeightPlane() * e->information(); // observaion info
+            bool isNew;
+            g2o::EdgePointPlane3d *e = graph.edge<g2o::EdgePointPlane3d>(BaGraph::ET_POINT_PLANE, ptGid, plGid, 0, v0, v1, 0, isNew);
 
-            if (mfgSettings->getBaUseKernel())
+            if (isNew)
             {
-                g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                rk->setDelta(mfgSettings->getBaKernelDeltaPlane());
-                e->setRobustKernel(rk);
+                e->setMeasurement(0);
+                e->information().setIdentity();
+                e->information() = mfgSettings->getBaWeightPlane() * e->information(); // observaion info
+
+                if (mfgSettings->getBaUseKernel())
+                {
+                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+                    rk->setDelta(mfgSettings->getBaKernelDeltaPlane());
+                    e->setRobustKernel(rk);
+                }
+
+                optimizer.addEdge(e);
             }
 
-            optimizer.addEdge(e);
             vecEdgePointPlane.push_back(e);
         }
+    }
 
-        // --- line to plane dists ---
-        for (int j = 0; j < primaryPlanes[plGid].ilnGids.size(); ++j)
+    // --- line to plane dists ---
+    for (int k = 0; k < lnGidsInBa.size(); ++k)
+    {
+        int lnGid = lnGidsInBa[k];
+        const vector<int> &pls = graph.lnPlanes(lnGid);
+
+        for (int j = 0; j < pls.size(); ++j)
         {
-            int lnGid = primaryPlanes[plGid].ilnGids[j];
+            int plGid = pls[j];
 
-            if (lngid2vid.find(lnGid) == lngid2vid.end()) continue;
+            if (plgid2vid.find(plGid) == plgid2vid.end()) continue;
 
-            g2o::EdgeLineVpPlane *e = new g2o::EdgeLineVpPlane();
-            e->vertices()[0] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(lngid2vid[lnGid])->second);
+            g2o::OptimizableGraph::Vertex *v0 = graph.byId(lngid2vid[lnGid]);
 
-            if (e->vertices()[0] == 0)
+            if (v0 == 0)
             {
                 cerr << "no line vertex found ... terminated \n";
                 exit(0);
             }
 
-            e->vertices()[1] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(vpgid2vid[idealLines[lnGid].vpGid])->second);
+            g2o::OptimizableGraph::Vertex *v1 = graph.byId(vpgid2vid[idealLines[lnGid].vpGid]);
 
-            if (e->vertices()[1] == 0)
+            if (v1 == 0)
             {
                 cerr << "no vp vertex found ... terminated \n";
                 exit(0);
             }
 
-            e->vertices()[2] = dynamic_cast<g2o::OptimizableGraph::Vertex *>
-                               (optimizer.vertices().find(plgid2vid[plGid])->second);
+            g2o::OptimizableGraph::Vertex *v2 = graph.byId(plgid2vid[plGid]);
 
-            if (e->vertices()[2] == 0)
+            if (v2 == 0)
             {
                 cerr << "no plane vert found ... terminated \n";
                 exit(0);
             }
 
-            e->setMeasurement(0);
-            e->information().setIdentity();
-            e->information() = e->information() * mfgSettings->getBaWeightPlane(); // observaion info
+            bool isNew;
+            g2o::EdgeLineVpPlane *e = graph.edge<g2o::EdgeLineVpPlane>(BaGraph::ET_LINE_PLANE, lnGid, plGid, 0, v0, v1, v2, isNew);
+
+            // the end points follow the line estimate
             e->endptA = idealLines[lnGid].extremity1();
             e->endptB = idealLines[lnGid].extremity2();
 
-            if (mfgSettings->getBaUseKernel())
+            if (isNew)
             {
-                g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                rk->setDelta(mfgSettings->getBaKernelDeltaPlane()*sqrt(2.0));
-                e->setRobustKernel(rk);
+                e->setMeasurement(0);
+                e->information().setIdentity();
+                e->information() = e->information() * mfgSettings->getBaWeightPlane(); // observaion info
+
+                if (mfgSettings->getBaUseKernel())
+                {
+                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+                    rk->setDelta(mfgSettings->getBaKernelDeltaPlane()*sqrt(2.0));
+                    e->setRobustKernel(rk);
+                }
+
+                optimizer.addEdge(e);
             }
 
-            optimizer.addEdge(e);
             vecEdgeLinePlane.push_back(e);
-            e->computeError();
-            Vector3d rho;
-            e->robustKernel()->robustify(e->chi2(), rho);
         }
     }
 
+    // observations gone since the last keyframe (outliers, views out of the window)
+    graph.removeUnusedEdges();
+
 
     // -----------------      start g2o       -----------------//
     MyTimer timer;
@@ -1704,6 +1918,8 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
         optimizer.optimize(maxIters);
 
     timer.end();
+    ++numBa;
+    baTimeMs += timer.time_ms;
     cout << "LBA time:" << timer.time_ms << " ms,";
 
  // -------------- update camera and structure parameters  (update vertex) --------------//
@@ -1779,8 +1995,8 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
         idealLines[lnGid].midpt.x = lnvertVec[i]->estimate()(0);
         idealLines[lnGid].midpt.y = lnvertVec[i]->estimate()(1);
         idealLines[lnGid].midpt.z = lnvertVec[i]->estimate()(2);
-        cv::Mat vp = vanishingPoints[idealLines[lnGid].vpGid].mat(0);
-        idealLines[lnGid].direct = vp / cv::norm(vp);
+        cv::Vec3d vp = vanishingPoints[idealLines[lnGid].vpGid].vec();
+        idealLines[lnGid].direct = vp * (1 / cv::norm(vp));
         cv::Point3d oldMidPt = idealLines[lnGid].midpt;
         idealLines[lnGid].midpt = projectPt3d2Ln3d(idealLines[lnGid], oldMidPt);
     }
@@ -1799,7 +2015,7 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
 
         primaryPlanes[plGid].d = 1 / plvertVec[i]->estimate().norm();
         Vector3d n = plvertVec[i]->estimate() / plvertVec[i]->estimate().norm();
-        primaryPlanes[plGid].n = (cv::Mat_<double>(3, 1) << n(0), n(1), n(2));
+        primaryPlanes[plGid].n = cv::Vec3d(n(0), n(1), n(2));
     }
 
     mfg_writing = false;
@@ -1958,5 +2174,5 @@ void Mfg::adjustBundle_G2O(int numPos, int numFrm)
     views.back().errLn = errLine;
     views.back().errPl = errPlane;
 
-    optimizer.clear(); //this releases the memory of all vertices and edges in the graph
+    // vertices and edges are kept for the next keyframe, see BaGraph
 }
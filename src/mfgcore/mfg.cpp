@@ -36,6 +36,7 @@
 
 // Standard library
 #include <math.h>
+#include <algorithm>
 #include <fstream>
 #ifdef _MSC_VER
 #include <unordered_map>
@@ -45,12 +46,21 @@
 
 // MFG
 #include "mfgutils.h"
+#include "framesource.h"
+#include "localmapper.h"
+#include "archive.h"
+#include "est3dpt.h"
 #include "export.h"
+#include "geokernels.h"
+#include "ransac.h"
 #include "utils.h"
 #include "settings.h"
+#include "omp.h"
 
 #define THRESH_PARALLAX (7) 
 #define THRESH_PARALLAX_DEGREE (0.9)
+#define LBA_NUM_POSES (8)     // local BA: free camera poses
+#define LBA_NUM_FRAMES (10)   // local BA: keyframes whose observations are used
 
 extern double THRESH_POINT_MATCH_RATIO, SIFT_THRESH, SIFT_THRESH_HIGH, SIFT_THRESH_LOW;
 extern int IDEAL_IMAGE_WIDTH;
@@ -71,6 +81,123 @@ struct cvpt2dCompare
     }
 };
 
+// [KR|Kt] of a camera
+static cv::Matx34d projMatx(const cv::Matx33d &KR, const cv::Vec3d &Kt)
+{
+    cv::Matx34d P;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            P(i, j) = KR(i, j);
+
+        P(i, 3) = Kt[i];
+    }
+
+    return P;
+}
+
+// Scale of a relative translation for ransac(): the data are matches whose
+// point is triangulated both in the map and with the relative pose [Ri|ti],
+// a single match gives the scale s and the translation of the new view is
+// tn = Ri*t_prev + s*ti. The error of a match is its reprojection distance.
+struct TransScaleProblem : public RansacProblem
+{
+    struct Model
+    {
+        double  s;
+        cv::Vec3d tn;
+    };
+    enum { SAMPLE_SIZE = 1, MAX_MODELS = 1 };
+
+    vector<int> matchIdx;     // index of each datum in the matches
+    SoaPoints3d X;            // map point
+    SoaPoints2d x;            // image point in the new view
+    vector<double> scale;     // scale of the relative translation by each datum
+    cv::Matx33d K, Rn;
+    cv::Vec3d Rt_prev, ti;    // Ri*t_prev and ti
+
+    int numData() const { return X.size(); }
+
+    int fit(const int *sample, Model *models) const
+    {
+        models[0].s = scale[sample[0]];
+        models[0].tn = Rt_prev + ti * models[0].s;
+        return 1;
+    }
+
+    void errors(const Model &m, int begin, int end, double *err) const
+    {
+        cv::Matx34d P = projMatx(K * Rn, K * m.tn);
+
+        reprojErrors(P.val, &X.x[begin], &X.y[begin], &X.z[begin],
+                     &x.x[begin], &x.y[begin], end - begin, err);
+    }
+};
+
+// Translation given the rotation Rn for ransac(), from 2 map points and their
+// image points by pnp_withR; translations whose direction relative to the
+// previous view differs from t_prev by more than 40 degrees are rejected if
+// t_prev is known. The error of a point is its reprojection distance.
+struct TransWithRProblem : public RansacProblem
+{
+    typedef cv::Mat Model;
+    enum { SAMPLE_SIZE = 2, MAX_MODELS = 1 };
+
+    const vector<cv::Point3d> &pt3d;
+    const vector<cv::Point2d> &pt2d;
+    SoaPoints3d X;
+    SoaPoints2d x;
+    cv::Mat K, Rn, Rt_prev, t_prev; // Rt_prev = Ri*t of the previous view
+
+    TransWithRProblem(const vector<cv::Point3d> &_pt3d, const vector<cv::Point2d> &_pt2d)
+        : pt3d(_pt3d), pt2d(_pt2d)
+    {
+        for (int i = 0; i < pt3d.size(); ++i)
+        {
+            X.push_back(pt3d[i].x, pt3d[i].y, pt3d[i].z);
+            x.push_back(pt2d[i].x, pt2d[i].y);
+        }
+    }
+
+    int numData() const { return pt3d.size(); }
+
+    int fit(const int *sample, Model *models) const
+    {
+        // Set 3D-2D point correspondence
+        vector<cv::Point3d> samplePt3d(2);
+        vector<cv::Point2d> samplePt2d(2);
+
+        for (int k = 0; k < 2; ++k)
+        {
+            samplePt3d[k] = pt3d[sample[k]];
+            samplePt2d[k] = pt2d[sample[k]];
+        }
+
+        // Given R, compute t with PnP
+        cv::Mat tn = pnp_withR(samplePt3d, samplePt2d, K, Rn);
+        cv::Mat t_rel = tn - Rt_prev;
+        t_rel = t_rel / cv::norm(t_rel);
+
+        //  motion smooth
+        if (cv::norm(t_prev) > 0.1 && t_rel.dot(t_prev) < cos(40 * PI / 180))
+            return 0;
+
+        models[0] = tn;
+        return 1;
+    }
+
+    void errors(const Model &tn, int begin, int end, double *err) const
+    {
+        cv::Matx33d Kx = K, Rx = Rn;
+        cv::Vec3d tx(tn.at<double>(0), tn.at<double>(1), tn.at<double>(2));
+        cv::Matx34d P = projMatx(Kx * Rx, Kx * tx);
+
+        reprojErrors(P.val, &X.x[begin], &X.y[begin], &X.z[begin],
+                     &x.x[begin], &x.y[begin], end - begin, err);
+    }
+};
+
 /**
  * Given the fist view, this constructor reads in raw frames until the first frame step 
  * is reached. Feature points are tracked in each raw frame to establish feature point
@@ -89,7 +216,8 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
     fps = fps_;
 
 	// Store 1st view
-    views.push_back(v0);
+    views.push_back(std::move(v0));
+    View &first = views[0];
 
 	//----------------------------------------------------------------------
 	// Do feature point tracking to establish feature point correspondence 
@@ -99,15 +227,15 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
 	// Set 1st view feature points as "previous" feature points
     vector<Point2f> prev_pts;
     vector<int> v0_idx; // point ids in first view that is being tracked using optical flow
-    for (int i = 0; i < v0.featurePoints.size(); ++i) {
-        prev_pts.push_back(Point2f(v0.featurePoints[i].x, v0.featurePoints[i].y));
-        v0_idx.push_back(v0.featurePoints[i].lid);
+    for (int i = 0; i < first.featurePoints.size(); ++i) {
+        prev_pts.push_back(Point2f(first.featurePoints[i].x, first.featurePoints[i].y));
+        v0_idx.push_back(first.featurePoints[i].lid);
     }
    
    	// Set 1st view image as "previous" image
-	K = v0.K;
-    Mat prev_img = v0.grayImg;
-    string imgName = v0.filename;
+	K = first.K;
+    Mat prev_img = first.grayImg;
+    string imgName = first.filename;
 	
 	// Track feature points in subsequent views until first frame step is reached
     for (int idx = 0; idx < ini_incrt; ++idx)
@@ -115,25 +243,13 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
 		// Set next image
         imgName = nextImgName(imgName, 5, 1);
 
-		// Read next image
-        Mat oriImg = cv::imread(imgName, 1);
-
-		// Remove lens distortion
-        if (cv::norm(dc) > 1e-6)
-            cv::undistort(oriImg, oriImg, K, dc);
-
-        // Resize image and ajust camera matrix
-        if (mfgSettings->getImageWidth() > 1) {
-            double scl = mfgSettings->getImageWidth() / double(oriImg.cols);
-            cv::resize(oriImg, oriImg, cv::Size(), scl, scl, cv::INTER_AREA);
-        }
+		// Read next image, remove lens distortion and resize it
+		// (the remap table is built for the raw camera matrix, not the resized K)
+        PreparedFrame frm = prepareFrame(imgName, Mat(mfgSettings->getIntrinsics()), dc,
+                                         mfgSettings->getImageWidth());
 
 		// Set gray-scale image (for optical flow)
-        Mat grayImg;
-        if (oriImg.channels() == 3)
-            cv::cvtColor(oriImg, grayImg, CV_RGB2GRAY);
-        else
-            grayImg = oriImg;
+        Mat grayImg = frm.grayImg;
 
 		// Compute optical flow
         vector<Point2f> curr_pts;
@@ -169,7 +285,7 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
     Mat F, E, R, t;
 
 	// Create 2nd view
-    View v1(imgName, K, dc, 1, mfgSettings);
+    View v1(imgName, Mat(mfgSettings->getIntrinsics()), dc, 1, mfgSettings);
     v1.featurePoints.clear();
 
 	// Set feature point correspondence between 1st and 2nd views
@@ -180,7 +296,7 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
         v1.featurePoints.push_back(FeatPoint2d(prev_pts[i].x, prev_pts[i].y, i));
 		// Store corresponding feature point location
         vector<Point2d> match;
-        match.push_back(v0.featurePoints[v0_idx[i]].cvpt());
+        match.push_back(first.featurePoints[v0_idx[i]].cvpt());
         match.push_back(v1.featurePoints.back().cvpt());
         featPtMatches.push_back(match);
        	// Store corresponding index 
@@ -191,7 +307,7 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
     }
 
 	// Store 2nd view
-    views.push_back(v1);
+    views.push_back(std::move(v1));
 
 	//----------------------------------------------------------------------
 	// Compute R and t using 1st and 2nd view epipolar geometry
@@ -202,9 +318,11 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
     view1.frameId = atoi(imgName.substr(imgName.size() - 5 - 4, 5).c_str());
 
 	// Compute R and t between first two views
-    computeEpipolar(featPtMatches, pairIdx, K, F, R, E, t, true);
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_INIT, 0);
+    computeEpipolar(featPtMatches, pairIdx, K, F, R, E, t, &rng, true);
 	cout << "R=" << R << endl << "t=" << t << endl;
-	v1.t_loc = t;
+	view1.t_loc = t;
     
 	bool isRgood = true;
     vector<vector<int>> vpPairIdx;
@@ -309,14 +427,16 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
 	// Set 3D vanishing points
 	//----------------------------------------------------------------------
    
+    cv::Matx33d Kinv = cv::Matx33d(K).inv();
+
    	// Loop through each vanishing point matches 
 	for (int i = 0; i < vpPairIdx.size(); ++i)
     {
-        Mat tmpvp = K.inv() * view0.vanishPoints[vpPairIdx[i][0]].mat();
-        tmpvp = tmpvp / cv::norm(tmpvp);
+        cv::Vec3d tmpvp = Kinv * view0.vanishPoints[vpPairIdx[i][0]].vec();
+        tmpvp = tmpvp * (1 / cv::norm(tmpvp));
 
         // Set 3D-2D correspondence
-        VanishPnt3d vp(tmpvp.at<double>(0), tmpvp.at<double>(1), tmpvp.at<double>(2));
+        VanishPnt3d vp(tmpvp[0], tmpvp[1], tmpvp[2]);
         vp.gid = vanishingPoints.size();
         vanishingPoints.push_back(vp);
         view0.vanishPoints[vpPairIdx[i][0]].gid = vp.gid;
@@ -339,6 +459,16 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
 	// Set 3D coplanar points
 	//----------------------------------------------------------------------
    
+    // homography of each plane between the two views, and its inverse
+    vector<cv::Matx33d> Hs(primaryPlanes.size()), Hinvs(primaryPlanes.size());
+
+    for (int j = 0; j < primaryPlanes.size(); ++j)
+    {
+        cv::Matx33d Rt = cv::Matx33d(R) - cv::Vec3d(t) * primaryPlanes[j].n.t() * (1 / primaryPlanes[j].d);
+        Hs[j] = cv::Matx33d(K) * Rt * Kinv;
+        Hinvs[j] = Hs[j].inv();
+    }
+
    	// Loop through each key points
 	for (int i = 0; i < keyPoints.size(); ++i)
     {
@@ -346,18 +476,15 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0) 
 			continue;
 
-        FeatPoint2d p0 = view0.featurePoints[keyPoints[i].viewId_ptLid[0][1]];
-        FeatPoint2d p1 = view1.featurePoints[keyPoints[i].viewId_ptLid[1][1]];
+        const FeatPoint2d &p0 = view0.featurePoints[keyPoints[i].viewId_ptLid[0][1]];
+        const FeatPoint2d &p1 = view1.featurePoints[keyPoints[i].viewId_ptLid[1][1]];
 
 		// Loop through each plane
         for (int j = 0; j < primaryPlanes.size(); ++j)
         {
-			// Compute homography
-            Mat H = K * (R - t * primaryPlanes[j].n.t() / primaryPlanes[j].d) * K.inv();
-
             double dist = 
-				0.5 * cv::norm(mat2cvpt(H * p0.mat()) - mat2cvpt(p1.mat())) + 
-				0.5 * cv::norm(mat2cvpt(H.inv() * p1.mat()) - mat2cvpt(p0.mat()));
+				0.5 * cv::norm(vec2cvpt(Hs[j] * p0.vec()) - cv::Point2d(p1.x, p1.y)) + 
+				0.5 * cv::norm(vec2cvpt(Hinvs[j] * p1.vec()) - cv::Point2d(p0.x, p0.y));
 			
 			// Check if point is on plane
             if (dist < distThresh_PtHomography) {
@@ -412,7 +539,7 @@ Mfg::Mfg(View v0, int ini_incrt, Mat dc, double fps_)
 
             // 3D line and vp angle too large
             int vpGid = view0.vanishPoints[view0.idealLines[ilinePairIdx[i][0]].vpLid].gid;
-            if (abs(vanishingPoints[vpGid].mat().dot(line.direct) / cv::norm(line.direct)) < cos(vpLnAngleThrseh * PI / 180))
+            if (abs(vanishingPoints[vpGid].vec().dot(line.directVec()) / cv::norm(vanishingPoints[vpGid].vec())) < cos(vpLnAngleThrseh * PI / 180))
                 continue; // invalid line
 
             line.is3D = true;
@@ -498,7 +625,9 @@ void Mfg::initialize()
 	// Compute R and t
     allFeatPtMatches = featPtMatches;
     allPairIdx = pairIdx;
-    computeEpipolar(featPtMatches, pairIdx, K, F, R, E, t, true);
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_INIT, 0);
+    computeEpipolar(featPtMatches, pairIdx, K, F, R, E, t, &rng, true, true);
     cout << "R=" << R << endl << "t=" << t << endl;
     view1.t_loc = t;
    
@@ -521,7 +650,7 @@ void Mfg::initialize()
         
 		// Compute all potential relative poses from 5-point ransac algorithm
         vector<Mat> Fs, Es, Rs, ts;
-        computePotenEpipolar(allFeatPtMatches, allPairIdx, K, Fs, Es, Rs, ts);
+        computePotenEpipolar(allFeatPtMatches, allPairIdx, K, Fs, Es, Rs, ts, &rng, false, Mat(0, 0, CV_8U), true);
        
 	   	// Find best R and t
 		double difR, idx = 0, minDif = 100;
@@ -667,14 +796,16 @@ void Mfg::initialize()
 	// Set 3D vanishing points
 	//----------------------------------------------------------------------
     
+    cv::Matx33d Kinv = cv::Matx33d(K).inv();
+
    	// Loop through each vanishing point matches 
 	for (int i = 0; i < vpPairIdx.size(); ++i)
     {
-        Mat tmpvp = K.inv() * view0.vanishPoints[vpPairIdx[i][0]].mat();
-        tmpvp = tmpvp / cv::norm(tmpvp);
+        cv::Vec3d tmpvp = Kinv * view0.vanishPoints[vpPairIdx[i][0]].vec();
+        tmpvp = tmpvp * (1 / cv::norm(tmpvp));
 
         // Set 3D-2D correspondence
-        VanishPnt3d vp(tmpvp.at<double>(0),	tmpvp.at<double>(1), tmpvp.at<double>(2));
+        VanishPnt3d vp(tmpvp[0], tmpvp[1], tmpvp[2]);
         vp.gid = vanishingPoints.size();
         vanishingPoints.push_back(vp);
         view0.vanishPoints[vpPairIdx[i][0]].gid = vp.gid;
@@ -697,6 +828,16 @@ void Mfg::initialize()
 	// Set 3D coplanar points
 	//----------------------------------------------------------------------
     
+    // homography of each plane between the two views, and its inverse
+    vector<cv::Matx33d> Hs(primaryPlanes.size()), Hinvs(primaryPlanes.size());
+
+    for (int j = 0; j < primaryPlanes.size(); ++j)
+    {
+        cv::Matx33d Rt = cv::Matx33d(R) - cv::Vec3d(t) * primaryPlanes[j].n.t() * (1 / primaryPlanes[j].d);
+        Hs[j] = cv::Matx33d(K) * Rt * Kinv;
+        Hinvs[j] = Hs[j].inv();
+    }
+
    	// Loop through each key points
 	for (int i = 0; i < keyPoints.size(); ++i)
     {
@@ -704,18 +845,15 @@ void Mfg::initialize()
         if (! keyPoints[i].is3D || keyPoints[i].gid < 0) 
 			continue;
 
-        FeatPoint2d p0 = view0.featurePoints[keyPoints[i].viewId_ptLid[0][1]];
-        FeatPoint2d p1 = view1.featurePoints[keyPoints[i].viewId_ptLid[1][1]];
+        const FeatPoint2d &p0 = view0.featurePoints[keyPoints[i].viewId_ptLid[0][1]];
+        const FeatPoint2d &p1 = view1.featurePoints[keyPoints[i].viewId_ptLid[1][1]];
 
 		// Loop through each plane
         for (int j = 0; j < primaryPlanes.size(); ++j)
         {
-			// Compute homography
-            Mat H = K * (R - t * primaryPlanes[j].n.t() / primaryPlanes[j].d) * K.inv();
-
             double dist = 
-				0.5 * cv::norm(mat2cvpt(H * p0.mat()) - mat2cvpt(p1.mat())) + 
-				0.5 * cv::norm(mat2cvpt(H.inv() * p1.mat()) - mat2cvpt(p0.mat()));
+				0.5 * cv::norm(vec2cvpt(Hs[j] * p0.vec()) - cv::Point2d(p1.x, p1.y)) + 
+				0.5 * cv::norm(vec2cvpt(Hinvs[j] * p1.vec()) - cv::Point2d(p0.x, p0.y));
 
 			// Check if point is on plane
             if (dist < distThresh_PtHomography) {
@@ -768,7 +906,7 @@ void Mfg::initialize()
 
             // 3D line and vp angle too large
             int vpGid = view0.vanishPoints[view0.idealLines[ilinePairIdx[i][0]].vpLid].gid;
-            if (abs(vanishingPoints[vpGid].mat().dot(line.direct) / cv::norm(line.direct)) < cos(vpLnAngleThrseh * PI / 180))
+            if (abs(vanishingPoints[vpGid].vec().dot(line.directVec()) / cv::norm(vanishingPoints[vpGid].vec())) < cos(vpLnAngleThrseh * PI / 180))
                 continue; // invalid line
 
             line.is3D = true;
@@ -825,27 +963,92 @@ void Mfg::initialize()
     return;
 }
 
-void Mfg::expand(View &nview, int fid)
+void Mfg::expand(View &&nview, int fid, LocalMapper *mapper)
+// with a mapper, the local map is optimized in background and committed
+// back to this map by the mapper, see localmapper.h
 {
+	// Take the optimized map of the previous keyframe
+    if (mapper)
+        mapper->commit(*this);
+
 	// Store current view
     nview.id = views.size();
     nview.frameId = fid;
-    views.push_back(nview);
+    views.push_back(std::move(nview));
 
 	// Expand MFG using two views
     expand_keyPoints(views[views.size() - 2], views[views.size() - 1]);
 
+	// Bound memory of old keyframes, before the mapper copies the views
+    if (mfgSettings->getKeyframeWindow() > 0)
+        releaseOldViews(max(2, mfgSettings->getKeyframeWindow()));
+
+	// Move keyframes far behind to the archive, the BA window stays in memory
+    if (mfgSettings->getArchiveWindow() > 0 && !mfgSettings->getArchiveFile().isEmpty())
+        archiveOldViews(max(mfgSettings->getArchiveWindow(), max(10, mfgSettings->getBaNumFramesVPoint())));
+
+	// Relative poses the local BA is done with, for the global pose graph
+    recordOdometry();
+
+	// Optimize local map
+    if (mapper)
+        mapper->optimize(*this);
+    else
+        optimizeLocalMap();
+}
+
+void Mfg::optimizeLocalMap()
+// plane update, outlier removal and bundle adjustment after a keyframe is added,
+// touches only K, the views and landmarks of the local window (see
+// collectLocalWindow), vanishing points, planes and camdist_constraints
+{
+    // Landmarks outside the window keep their observations and the poses of
+    // their views, so the checks below would find nothing new on them
+    vector<int> kptGids, lnGids;
+    collectLocalWindow(kptGids, lnGids);
+
+	// Update primary planes (when ground detection is off)
+    if (mfgSettings->getDetectGround() == 0 || (mfgSettings->getDetectGround() && !need_scale_to_real))
+        updatePrimPlane(kptGids, lnGids);
+
     // Remove point and line outliers
-    detectPtOutliers(5 * IDEAL_IMAGE_WIDTH / 640.0);
-    detectLnOutliers(10 * IDEAL_IMAGE_WIDTH / 640.0);
+    detectPtOutliers(5 * IDEAL_IMAGE_WIDTH / 640.0, kptGids);
+    detectLnOutliers(10 * IDEAL_IMAGE_WIDTH / 640.0, lnGids);
 
 	// Do bundle adjustment
     adjustBundle();
 
     // Further remove point and line outliers
-    detectPtOutliers(2 * IDEAL_IMAGE_WIDTH / 640.0);
-    detectLnOutliers(3 * IDEAL_IMAGE_WIDTH / 640.0);
+    detectPtOutliers(2 * IDEAL_IMAGE_WIDTH / 640.0, kptGids);
+    detectLnOutliers(3 * IDEAL_IMAGE_WIDTH / 640.0, lnGids);
+
+}
 
+int Mfg::localWindowFront() const
+// first view read by the local map optimization: the oldest camera of the
+// local bundle adjustment, see adjustBundle_G2O
+{
+    int front = min((int)views.size() - LBA_NUM_FRAMES, (int)views.size() - mfgSettings->getBaNumFramesVPoint());
+    return max(0, front);
+}
+
+void Mfg::collectLocalWindow(vector<int> &kptGids, vector<int> &lnGids) const
+// 3d key points and ideal lines observed in views[localWindowFront()...], in
+// ascending gid order
+{
+    vector<int> vptGids, pts, lns;
+    collectWindowFeatures(localWindowFront(), pts, vptGids, lns);
+
+    kptGids.clear();
+    lnGids.clear();
+
+    for (int i = 0; i < pts.size(); ++i)
+        if (pts[i] < keyPoints.size() && keyPoints[pts[i]].is3D && keyPoints[pts[i]].gid >= 0)
+            kptGids.push_back(pts[i]);
+
+    for (int i = 0; i < lns.size(); ++i)
+        if (lns[i] < idealLines.size() && idealLines[lns[i]].is3D && idealLines[lns[i]].gid >= 0)
+            lnGids.push_back(lns[i]);
 }
 
 void Mfg::expand_keyPoints(View &prev, View &nview)
@@ -863,15 +1066,20 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
     double parallaxDegThresh = THRESH_PARALLAX_DEGREE;
     double accel_max = 10; // m/s/s
 
+    // all sampling of this keyframe draws from its own stream
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_KEYFRAME, nview.id);
+
 	//----------------------------------------------------------------------
 	// Find feature point correspondence between two views
 	//----------------------------------------------------------------------
 
     vector<vector<Point2d>> featPtMatches;
     vector<vector<int>> pairIdx;
+    bool sortedMatches = mfgSettings->getKeypointAlgorithm() < 3; // best ratio first
 
 	// Use SIFT or SURF for feature matching? 
-    if (mfgSettings->getKeypointAlgorithm() < 3)
+    if (sortedMatches)
 	{
         pairIdx = matchKeyPoints(prev.featurePoints, nview.featurePoints, featPtMatches);
     } 
@@ -981,14 +1189,15 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
     
 	//Mat t_prev = prev.t - (prev.R * views[views.size()-3].R.t()) * views[views.size()-3].t;
     Mat t_prev = views[views.size() - 2].t_loc;
+    cv::Vec3d prevC = prev.center(); // camera center of prev, for the scale of the matches
 
     Mat F, R, E, t; // relative pose between last two views
     vector<Mat> Fs, Es, Rs, ts;
     
 	if (mfgSettings->getDetectGround())
-        computeEpipolar(featPtMatches, pairIdx, K, Fs, Es, Rs, ts);
+        computeEpipolar(featPtMatches, pairIdx, K, Fs, Es, Rs, ts, &rng, sortedMatches);
     else
-        computePotenEpipolar(featPtMatches, pairIdx, K, Fs, Es, Rs, ts, false, t_prev);
+        computePotenEpipolar(featPtMatches, pairIdx, K, Fs, Es, Rs, ts, &rng, false, t_prev, sortedMatches);
 
     R = Rs[0];
     t = ts[0];
@@ -1124,70 +1333,48 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
             // Find best t based on 3D points
 			//----------------------------------------------------------------------
             
-			int maxIter = 100, maxmaxIter = 1000;
-            vector<int> maxInliers;
-            double best_s = -1;
-
-			// Generate and test different ts
-            for (int it = 0, itt = 0; it < maxIter && itt < maxmaxIter; ++it, ++itt)
+            TransScaleProblem prob;
+            prob.K = K;
+            prob.Rn = Rn;
+            prob.Rt_prev = Mat(Ri * prev.t);
+            prob.ti = ti;
+
+            // Matches usable to compute the scale
+            for (int j = 0; j < featPtMatches.size(); ++j)
             {
-				// Randomly pick feature point
-                int i = xrand() % featPtMatches.size();
-
-                int iGid = prev.featurePoints[pairIdx[i][0]].gid;
+                int jGid = prev.featurePoints[pairIdx[j][0]].gid;
 
 				// If this feature point not observed before...
-                if (iGid < 0) {
-                    --it;                        
-					continue;
-                }
+                if (jGid < 0)
+                    continue;
 
 				// If this feature point is not triangulated yet...
-                if (!keyPoints[iGid].is3D || keyPoints[iGid].gid < 0) {
-                    --it;    
+                if (!keyPoints[jGid].is3D || keyPoints[jGid].gid < 0)
                     continue;
-                }
 
-                if (!tmpkp[i].is3D) {
-                    --it;
+                if (!tmpkp[j].is3D)
                     continue;
-                }
 
-                // Compute scale (minimum solution)
-                double s = cv::norm(keyPoints[iGid].mat(0) + (prev.R.t() * prev.t)) / cv::norm(tmpkp[i].mat());
-
-				// Compute t
-                Mat tn = Ri * prev.t + ti * s;
-               
-				// Find inliers that conform to this R and t pair
-				vector<int> inliers;
-                for (int j = 0; j < featPtMatches.size(); ++j)
-                {
-                    int jGid = prev.featurePoints[pairIdx[j][0]].gid;
-
-                    if (jGid < 0) 
-						continue;
-
-                    if (!keyPoints[jGid].is3D || keyPoints[jGid].gid < 0) 
-						continue;
+                prob.matchIdx.push_back(j);
+                prob.X.push_back(keyPoints[jGid].x, keyPoints[jGid].y, keyPoints[jGid].z);
+                prob.x.push_back(featPtMatches[j][1].x, featPtMatches[j][1].y);
+                prob.scale.push_back(cv::norm(keyPoints[jGid].vec() - prevC) / homoNorm(tmpkp[j].vec()));
+            }
 
-                    if (!tmpkp[j].is3D) 
-						continue;
+			// Generate and test different ts, each from the scale of one match
+            RansacOptions opts;
+            opts.maxIter = 100;
+            opts.threshold = reprjThresh;
 
-                    // Project 3D to n-th view
-                    Mat pt = K * Rn * (keyPoints[jGid].mat(0) + Rn.t() * tn);
+            TransScaleProblem::Model best;
+            vector<int> maxInliers;
+            double best_s = -1;
 
-					// Is reprojection error less than threshold
-                    if (cv::norm(featPtMatches[j][1] - mat2cvpt(pt)) < reprjThresh)
-                        inliers.push_back(j); // add to inlier set
-                }
+            if (ransac(prob, opts, &rng, best, maxInliers) > 0)
+                best_s = best.s;
 
-				// Does this t have the largest inlier set?
-                if (maxInliers.size() < inliers.size()) {
-                    maxInliers = inliers;
-                    best_s = s;
-                }
-            }
+            for (int j = 0; j < maxInliers.size(); ++j)
+                maxInliers[j] = prob.matchIdx[maxInliers[j]];
 
 			cout << ti.t() << " " << maxInliers.size() << endl;
 			
@@ -1256,7 +1443,7 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
 				continue;
 
 			// Compute scale
-            double s = cv::norm(keyPoints[gid].mat(0) + (prev.R.t() * prev.t)) / cv::norm(localKeyPts[j].mat());
+            double s = cv::norm(keyPoints[gid].vec() - prevC) / homoNorm(localKeyPts[j].vec());
 			
             if (maxInliers_Rt.size() > 5 && (abs(s - bestScale) > 0.3 || (bestScale > 0.2 && max(s / bestScale, bestScale / s) > 1.5)))
                 continue ; // could be outlier
@@ -1408,60 +1595,20 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
                 // Find best t based on 3D points
 				//----------------------------------------------------------------------
                 
-				int maxIter = 100, maxmaxIter = 1000;
-                vector<int> maxInliers;
-                Mat good_tn;
-                double best_s = -1;
-
-				// Generate and test different ts
-                for (int it = 0, itt = 0; it < maxIter && itt < maxmaxIter; ++it, ++itt)
-                {
-                    if (pt3d.size() < 2) 
-						break;
-
-					// Randomly pick two points
-                    int i = xrand() % pt3d.size();
-                    int j = xrand() % pt3d.size();
-                    if (i == j) {
-                        --it;
-                        continue;
-                    }
-
-					// Set 3D-2D point correspondence
-                    vector<Point3d> samplePt3d;
-                    samplePt3d.push_back(pt3d[i]);
-                    samplePt3d.push_back(pt3d[j]);
-                    vector<Point2d> samplePt2d;
-                    samplePt2d.push_back(pt2d[i]);
-                    samplePt2d.push_back(pt2d[j]);
-
-					// Given R, compute t with PnP
-                    Mat tn = pnp_withR(samplePt3d, samplePt2d, K, Rn);
-                    Mat t_rel = tn - Ri * prev.t;
-                    t_rel = t_rel / cv::norm(t_rel);
-
-					//  motion smooth
-                    if (cv::norm(t_prev) > 0.1 && abs(t_rel.dot(t_prev) < cos(40 * PI / 180)))
-                        continue;
-
-					// Find inliers that conform to R and t
-                    vector<int> inliers;
-                    for (int j = 0; j < pt3d.size(); ++j) 
-					{
-                        // Project 3D to n-th view
-                        Mat pt = K * (Rn * cvpt2mat(pt3d[j], 0) + tn);
+                TransWithRProblem prob(pt3d, pt2d);
+                prob.K = K;
+                prob.Rn = Rn;
+                prob.Rt_prev = Ri * prev.t;
+                prob.t_prev = t_prev;
 
-						// If reprojection error is small enough
-                        if (cv::norm(pt2d[j] - mat2cvpt(pt)) < reprjThresh)
-                            inliers.push_back(j); // add as inlier
-                    }
+				// Generate and test different ts, each from two points
+                RansacOptions opts;
+                opts.maxIter = 100;
+                opts.threshold = reprjThresh;
 
-					// Is inlier set larger than max inlier set?
-                    if (maxInliers.size() < inliers.size()) {
-                        maxInliers = inliers;
-                        good_tn = tn;
-                    }
-                }
+                vector<int> maxInliers;
+                Mat good_tn;
+                ransac(prob, opts, &rng, good_tn, maxInliers);
 
                 cout << ti.t() << ",, " << maxInliers.size() << endl;
                 
@@ -1643,7 +1790,7 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
 		// Detect ground plane
         bool gp_detect_valid = false;
         gp_detect_valid = detectGroundPlane(prev.grayImg, nview.grayImg, R, t, K, 
-			n_gp_pts, gp_depth, gp_norm_vec, gp_quality, gp_roi, baseline);
+			n_gp_pts, gp_depth, gp_norm_vec, gp_quality, gp_roi, baseline, &rng);
 
 		// If we have good ground detection...
         if (gp_detect_valid && gp_quality >= gp_qual_thres - 0.02)
@@ -2025,15 +2172,31 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
 	//----------------------------------------------------------------------
     // Conver image point track to 3D points
 	//----------------------------------------------------------------------
-    
-	#pragma omp parallel for
+
+    // The map is only read while matches are checked in parallel: each thread
+    // proposes the new observations of 2D tracks, and the tracks ready to become
+    // 3D points, in its own buffer. The proposals are merged in match order, so
+    // the result does not depend on the number of threads.
+    struct TrackProposal
+    {
+        int      match;  // index into featPtMatches
+        int      ptGid;
+        TriTrack trk;    // observations of the new 3D point, empty if not ready
+    };
+
+    vector<vector<TrackProposal> > proposals(omp_get_max_threads());
+    const Matx33d Kx = K;
+
+    #pragma omp parallel
+    {
+    vector<TrackProposal> &buffer = proposals[omp_get_thread_num()];
+
+    #pragma omp for schedule(dynamic, 16)
 
 	// Loop through feature matches
     for (int i = 0; i < featPtMatches.size(); ++i)
     {
-        vector<int> view_point;
         int ptGid = prev.featurePoints[pairIdx[i][0]].gid;
-        nview.featurePoints[pairIdx[i][1]].gid = ptGid;
 
 		// If point is triangulated...
         if (ptGid >= 0 && keyPoints[ptGid].is3D)
@@ -2041,35 +2204,28 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
         }
         else if (ptGid >= 0 && !keyPoints[ptGid].is3D && keyPoints[ptGid].gid >= 0) // point exist as 2D track
         {
-            cv::Scalar color(rand() % 255, rand() % 255, rand() % 255, 0);
-           
-		   	// Compute parallax
-			double parallaxDeg = compParallaxDeg(featPtMatches[i][0], featPtMatches[i][1], K, Mat::eye(3, 3, CV_64F), R);
-
-#ifdef PLOT_MID_RESULTS
-            if (parallaxDeg > parallaxDegThresh) {
-                cv::circle(canv1, featPtMatches[i][0], 2, color, 2);
-                cv::circle(canv2, featPtMatches[i][1], 2, color, 2);
-            }
-#endif
-            // 1) Add current observation into map
-            view_point.push_back(nview.id);
-            view_point.push_back(pairIdx[i][1]);
-            keyPoints[ptGid].viewId_ptLid.push_back(view_point);
-
-            // if(new2_3dPtNum >= maxNumNew2d_3dPt) continue;  //not thread safe
+            // 1) Current observation, appended to the track at merge
+            buffer.push_back(TrackProposal());
+            TrackProposal &prop = buffer.back();
+            prop.match = i;
+            prop.ptGid = ptGid;
+
+            // observations of the track including the current one
+            const vector<vector<int> > &obs = keyPoints[ptGid].viewId_ptLid;
+            int obs_size = obs.size() + 1;
+            auto obsVid = [&](int j) { return j < obs.size() ? obs[j][0] : nview.id; };
+            auto obsLid = [&](int j) { return j < obs.size() ? obs[j][1] : pairIdx[i][1]; };
 
             // 2) Check if a 2D track is ready to establish 3D point
             
 			// start a voting/ransac --
             Mat bestKeyPt;
             vector<int> maxInlier;
-            int obs_size = keyPoints[ptGid].viewId_ptLid.size();
 
             for (int p = 0; p < obs_size - 1 && p < 2; ++p)
             {
-                int pVid = keyPoints[ptGid].viewId_ptLid[p][0],
-                    pLid = keyPoints[ptGid].viewId_ptLid[p][1];
+                int pVid = obsVid(p),
+                    pLid = obsLid(p);
 
                 if (!views[pVid].matchable) 
 					break;
@@ -2080,8 +2236,8 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
                 for (int q = obs_size - 1; q >= p + 1 && q > obs_size - 3; --q)
                 {
                     // try to triangulate every pair of 2d pt
-                    int qVid = keyPoints[ptGid].viewId_ptLid[q][0],
-                        qLid = keyPoints[ptGid].viewId_ptLid[q][1];
+                    int qVid = obsVid(q),
+                        qLid = obsLid(q);
 
                     if (!views[qVid].matchable) 
 						break;
@@ -2103,11 +2259,13 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
 
                     // Check if every 2D observation agrees with this 3d point
                     vector<int> inlier;
-                    for (int j = 0; j < keyPoints[ptGid].viewId_ptLid.size(); ++j)
+                    Vec4d X(ptpq.at<double>(0), ptpq.at<double>(1), ptpq.at<double>(2), 1);
+                    for (int j = 0; j < obs_size; ++j)
                     {
-                        int vid = keyPoints[ptGid].viewId_ptLid[j][0];
-                        int lid = keyPoints[ptGid].viewId_ptLid[j][1];
-                        Point2d pt_j = mat2cvpt(K * (views[vid].R * ptpq + views[vid].t));
+                        int vid = obsVid(j);
+                        int lid = obsLid(j);
+                        Vec3d x_j = views[vid].projection(Kx) * X;
+                        Point2d pt_j(x_j[0] / x_j[2], x_j[1] / x_j[2]);
                         
 						double dist = cv::norm(views[vid].featurePoints[lid].cvpt() - pt_j);
                         if (dist < 2) // inlier;
@@ -2126,36 +2284,111 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
             if (maxInlier.size() < 3)
                 continue;
 
-            // Non-linear estimation of 3D points
-            vector<Mat> Rs, ts;
-            vector<Point2d> pt;
+            // Observations for the non-linear estimation of the 3D point
+            TriTrack &trk = prop.trk;
             for (int a = 0; a < maxInlier.size(); ++a) {
-                int vid = keyPoints[ptGid].viewId_ptLid[maxInlier[a]][0];
-                int lid = keyPoints[ptGid].viewId_ptLid[maxInlier[a]][1];
+                int vid = obsVid(maxInlier[a]);
+                int lid = obsLid(maxInlier[a]);
                 if (!views[vid].matchable) 
 					continue;
-                Rs.push_back(views[vid].R);
-                ts.push_back(views[vid].t);
-                pt.push_back(views[vid].featurePoints[lid].cvpt());
+                trk.add(vid, views[vid].featurePoints[lid].x, views[vid].featurePoints[lid].y);
             }
 
-            est3dpt_g2o(Rs, ts, K, pt, bestKeyPt);  // nonlinear estimation
+            trk.X[0] = bestKeyPt.at<double>(0);
+            trk.X[1] = bestKeyPt.at<double>(1);
+            trk.X[2] = bestKeyPt.at<double>(2);
+        }
+    }
+    } // omp parallel
+
+    // Merge the proposals in match order
+    vector<TrackProposal> merged;
+
+    for (int i = 0; i < proposals.size(); ++i)
+    {
+        merged.insert(merged.end(), proposals[i].begin(), proposals[i].end());
+        vector<TrackProposal>().swap(proposals[i]);
+    }
+
+    sort(merged.begin(), merged.end(),
+         [](const TrackProposal &a, const TrackProposal &b) { return a.match < b.match; });
+
+    // Tracks ready to become 3D points are refined in one batch, with a camera
+    // for each view the tracks observe
+    BatchTriangulator tri;
+    vector<int> triProp; // proposal of each track
+    unordered_map<int, int> triCam; // view id -> camera
+    int numObsDropped = 0;
+
+    for (int k = 0; k < merged.size(); ++k)
+    {
+        const TrackProposal &prop = merged[k];
+        int i = prop.match;
+
+        // 1) Add current observation into map
+        vector<int> view_point;
+        view_point.push_back(nview.id);
+        view_point.push_back(pairIdx[i][1]);
+        keyPoints[prop.ptGid].viewId_ptLid.push_back(view_point);
 
-            // 3) Establish 3D point
-            keyPoints[ptGid].is3D = true;
-            keyPoints[ptGid].estViewId = nview.id;
-            keyPoints[ptGid].x = bestKeyPt.at<double>(0);
-            keyPoints[ptGid].y = bestKeyPt.at<double>(1);
-            keyPoints[ptGid].z = bestKeyPt.at<double>(2);
 #ifdef PLOT_MID_RESULTS
-            cv::circle(canv1, featPtMatches[i][0], 7, color, 2);
-            cv::circle(canv2, featPtMatches[i][1], 7, color, 2);
-            cv::putText(canv1, " " + num2str(cv::norm(bestKeyPt + nview.R.t()*nview.t)), featPtMatches[i][0], 1, 1, color);
+        cv::Scalar color(rand() % 255, rand() % 255, rand() % 255, 0);
+        if (compParallaxDeg(featPtMatches[i][0], featPtMatches[i][1], K, Mat::eye(3, 3, CV_64F), R) > parallaxDegThresh) {
+            cv::circle(canv1, featPtMatches[i][0], 2, color, 2);
+            cv::circle(canv2, featPtMatches[i][1], 2, color, 2);
+        }
 #endif
-            new2_3dPtNum++;
+        if (prop.trk.numObs == 0 || tri.tracks.size() >= maxNumNew2d_3dPt)
+            continue;
+
+        tri.tracks.push_back(prop.trk);
+        triProp.push_back(k);
+
+        // observations hold view ids until here
+        TriTrack &trk = tri.tracks.back();
+        numObsDropped += trk.numDropped;
+
+        for (int j = 0; j < trk.numObs; ++j)
+        {
+            unordered_map<int, int>::iterator it = triCam.find(trk.cam[j]);
+
+            if (it == triCam.end())
+            {
+                it = triCam.insert(make_pair(trk.cam[j], (int)tri.cameras.size())).first;
+                tri.cameras.push_back(TriCamera(K, views[trk.cam[j]].R, views[trk.cam[j]].t));
+            }
+
+            trk.cam[j] = it->second;
         }
     }
 
+    if (numObsDropped > 0)
+        cout << numObsDropped << " observations beyond " << (int)TriTrack::MAX_OBS
+             << " per track not used for triangulation" << endl;
+
+    tri.refine();  // nonlinear estimation
+
+    // 3) Establish 3D points
+    for (int k = 0; k < tri.tracks.size(); ++k)
+    {
+        const TriTrack &trk = tri.tracks[k];
+        int ptGid = merged[triProp[k]].ptGid;
+
+        keyPoints[ptGid].is3D = true;
+        keyPoints[ptGid].estViewId = nview.id;
+        keyPoints[ptGid].x = trk.X[0];
+        keyPoints[ptGid].y = trk.X[1];
+        keyPoints[ptGid].z = trk.X[2];
+#ifdef PLOT_MID_RESULTS
+        int i = merged[triProp[k]].match;
+        cv::Scalar color(rand() % 255, rand() % 255, rand() % 255, 0);
+        cv::circle(canv1, featPtMatches[i][0], 7, color, 2);
+        cv::circle(canv2, featPtMatches[i][1], 7, color, 2);
+        cv::putText(canv1, " " + num2str(cv::norm(keyPoints[ptGid].mat(0) + nview.R.t()*nview.t)), featPtMatches[i][0], 1, 1, color);
+#endif
+        new2_3dPtNum++;
+    }
+
     // Remove outliers
     if (!use_const_vel_model)
     {
@@ -2168,9 +2401,9 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
 				continue;
 
 			// Compute scale
-            double s = cv::norm(keyPoints[gid].mat(0) + (prev.R.t() * prev.t)) / cv::norm(localKeyPts[j].mat());
+            double s = cv::norm(keyPoints[gid].vec() - prevC) / homoNorm(localKeyPts[j].vec());
 		
-            if (abs(s - cv::norm(-nview.R.t()*nview.t + prev.R.t()*prev.t)) > 0.15)
+            if (abs(s - cv::norm(nview.center() - prevC)) > 0.15)
             {
                 // delete outliers
                 keyPoints[gid].gid = -1;
@@ -2265,9 +2498,7 @@ void Mfg::expand_keyPoints(View &prev, View &nview)
     matchIdealLines(prev, nview, vpPairIdx, featPtMatches, F, ilinePairIdx, 1);
 	update3dIdealLine(ilinePairIdx, nview);
 
-	// Update primary planes (when ground detection is off)
-    if (mfgSettings->getDetectGround() == 0 || (mfgSettings->getDetectGround() && !need_scale_to_real))
-        updatePrimPlane();
+	// Primary planes are updated with the local map optimization, see optimizeLocalMap()
 
 #ifdef PLOT_MID_RESULTS
     // Write to images for debugging
@@ -2288,6 +2519,7 @@ void Mfg::update3dIdealLine(vector<vector<int>> ilinePairIdx, View &nview)
     double epNeibRds = 60.0 * IDEAL_IMAGE_WIDTH / 640;
     double parallaxThresh = THRESH_PARALLAX;
     double parallaxAngleThresh = THRESH_PARALLAX_DEGREE;
+    const Matx33d Kx = K;
 
     if (rotateMode())
         parallaxThresh = parallaxThresh * 1.5;
@@ -2339,8 +2571,8 @@ void Mfg::update3dIdealLine(vector<vector<int>> ilinePairIdx, View &nview)
                 linewidth = 1; // for debugging plotting purpose
 
             // Avoid those close to epipole
-            if (point2LineDist(prev.idealLines[ilinePairIdx[i][0]].lineEq(), prev.epipoleA) < epNeibRds || 
-				point2LineDist(nview.idealLines[ilinePairIdx[i][1]].lineEq(), nview.epipoleB) < epNeibRds)
+            if (point2LineDist(prev.idealLines[ilinePairIdx[i][0]].lineVec(), prev.epipoleA) < epNeibRds || 
+				point2LineDist(nview.idealLines[ilinePairIdx[i][1]].lineVec(), nview.epipoleB) < epNeibRds)
                 continue;
 
             // 2) check if a 2D track is ready to establish 3D line
@@ -2401,7 +2633,7 @@ void Mfg::update3dIdealLine(vector<vector<int>> ilinePairIdx, View &nview)
                         {
                             int vid = idealLines[lnGid].viewId_lnLid[j][0];
                             int lid = idealLines[lnGid].viewId_lnLid[j][1];
-                            Mat ln2d = projectLine(lnpq, views[vid].R, views[vid].t, K);
+                            Vec3d ln2d = projectLine(lnpq, views[vid].projection(Kx));
                             double sumDist = 0;
 
                             for (int k = 0; k < views[vid].idealLines[lid].lsEndpoints.size(); ++k)
@@ -2429,7 +2661,7 @@ void Mfg::update3dIdealLine(vector<vector<int>> ilinePairIdx, View &nview)
 
                 // 3) Establish a new 3D line in MFG
                 idealLines[lnGid].midpt = bestLine.midpt;
-                idealLines[lnGid].direct = bestLine.direct.clone();
+                idealLines[lnGid].direct = bestLine.direct;
                 idealLines[lnGid].length = bestLine.length;
                 idealLines[lnGid].is3D = true;
                 idealLines[lnGid].pGid = prev.idealLines[ilinePairIdx[i][0]].pGid;
@@ -2452,11 +2684,27 @@ void Mfg::update3dIdealLine(vector<vector<int>> ilinePairIdx, View &nview)
 #endif
 }
 
+// Primary plane update over all 3d key points and ideal lines
+void Mfg::updatePrimPlane()
+{
+    vector<int> kptGids, lnGids;
+
+    for (int i = 0; i < keyPoints.size(); ++i)
+        kptGids.push_back(i);
+
+    for (int i = 0; i < idealLines.size(); ++i)
+        lnGids.push_back(i);
+
+    updatePrimPlane(kptGids, lnGids);
+}
+
 // Primary plane update
 //
 // 1. assosciate new points or lines to exiting planes
 // 2. use 3d key points and ideal lines to discover new planes
-void Mfg::updatePrimPlane()
+//
+// Only the given key points and lines (gids in ascending order) are considered
+void Mfg::updatePrimPlane(const vector<int> &kptGids, const vector<int> &lnGids)
 {
     // 0. set prameters/thresholds
     double pt2PlaneDistThresh = mfgSettings->getMfgPointToPlaneDistance();
@@ -2464,8 +2712,10 @@ void Mfg::updatePrimPlane()
     // 1. check if any newly added points/lines belong to existing planes
 
     // 1.1 check points
-    for (int i = 0; i < keyPoints.size(); ++i)
+    for (int k = 0; k < kptGids.size(); ++k)
     {
+        int i = kptGids[k];
+
 		// If point is not triangulated yet...
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0) 
 			continue;
@@ -2481,7 +2731,7 @@ void Mfg::updatePrimPlane()
             if (views.back().id - primaryPlanes[j].recentViewId > 5) 
 				continue; // obsolete, not use
 
-            double dist = abs(keyPoints[i].mat(0).dot(primaryPlanes[j].n) + primaryPlanes[j].d) / cv::norm(primaryPlanes[j].n);
+            double dist = abs(keyPoints[i].vec().dot(primaryPlanes[j].n) + primaryPlanes[j].d) / cv::norm(primaryPlanes[j].n);
             if (dist < minDist) {
                 minDist = dist;
                 minIdx = j;
@@ -2497,8 +2747,10 @@ void Mfg::updatePrimPlane()
     }
 
     // 1.2 check lines
-    for (int i = 0; i < idealLines.size(); ++i)
+    for (int k = 0; k < lnGids.size(); ++k)
     {
+        int i = lnGids[k];
+
         if (!idealLines[i].is3D || idealLines[i].gid < 0) continue;
 
         if (idealLines[i].estViewId < views.back().id) continue;
@@ -2510,8 +2762,8 @@ void Mfg::updatePrimPlane()
         {
             if (views.back().id - primaryPlanes[j].recentViewId > 5) continue; // obsolete
 
-            double dist = (abs(cvpt2mat(idealLines[i].extremity1(), 0).dot(primaryPlanes[j].n) + primaryPlanes[j].d)
-                           + abs(cvpt2mat(idealLines[i].extremity2(), 0).dot(primaryPlanes[j].n) + primaryPlanes[j].d))
+            double dist = (abs(cv::Vec3d(idealLines[i].extremity1()).dot(primaryPlanes[j].n) + primaryPlanes[j].d)
+                           + abs(cv::Vec3d(idealLines[i].extremity2()).dot(primaryPlanes[j].n) + primaryPlanes[j].d))
                           / (2 * cv::norm(primaryPlanes[j].n));
 
             if (dist < minDist)
@@ -2533,8 +2785,10 @@ void Mfg::updatePrimPlane()
     vector<KeyPoint3d> lonePts; // used for finding new planes
     int ptNumLimit = mfgSettings->getMfgNumRecentPoints();
 
-    for (int i = keyPoints.size() - 1; i >= 0; --i)
+    for (int k = kptGids.size() - 1; k >= 0; --k) // most recent first
     {
+        int i = kptGids[k];
+
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0 || keyPoints[i].pGid >= 0) continue;
 
         lonePts.push_back(keyPoints[i]);
@@ -2545,8 +2799,10 @@ void Mfg::updatePrimPlane()
     vector<IdealLine3d> loneLns;
     int lnNumLimit = mfgSettings->getMfgNumRecentLines();
 
-    for (int i = idealLines.size() - 1; i >= 0; --i)
+    for (int k = lnGids.size() - 1; k >= 0; --k)
     {
+        int i = lnGids[k];
+
         if (!idealLines[i].is3D || idealLines[i].gid < 0 || idealLines[i].pGid >= 0) continue;
 
         loneLns.push_back(idealLines[i]);
@@ -2556,7 +2812,9 @@ void Mfg::updatePrimPlane()
 
     vector<vector<int>> ptIdxGroups, lnIdxGroups;
     vector<Mat> planeVecs;
-    find3dPlanes_pts_lns_VPs(lonePts, loneLns, vanishingPoints, ptIdxGroups, lnIdxGroups, planeVecs);
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_PLANE, views.back().id);
+    find3dPlanes_pts_lns_VPs(lonePts, loneLns, vanishingPoints, ptIdxGroups, lnIdxGroups, planeVecs, &rng);
 
     for (int i = 0; i < ptIdxGroups.size(); ++i)
     {
@@ -2669,26 +2927,25 @@ void Mfg::draw3D() const
 // Local bundle adjustment
 void Mfg::adjustBundle()
 {
-    int numPos = 8, numFrm = 10;
+    int numPos = LBA_NUM_POSES, numFrm = LBA_NUM_FRAMES;
 
     if (views.size() <= numFrm)
         numPos = numFrm;
 
     adjustBundle_G2O(numPos, numFrm);
-
-	// Write to file
-    exportCamPose(*this, "camPose.txt");
-    exportMfgNode(*this, "mfgNode.txt");
 }
 
-// Detect lines that are too far or too long.
-void Mfg::detectLnOutliers(double threshPt2LnDist)
+// Detect lines that are too far or too long, among lines lnGids
+void Mfg::detectLnOutliers(double threshPt2LnDist, const vector<int> &lnGids)
 {
     double ilineLenLimit = 10;
+    const Matx33d Kx = K;
 
 	// Loop through each ideal line
-    for (int i = 0; i < idealLines.size(); ++i)
+    for (int k = 0; k < lnGids.size(); ++k)
     {
+        int i = lnGids[k];
+
 		// Skip lines that are not triangulated yet
         if (!idealLines[i].is3D || idealLines[i].gid < 0) 
 			continue;
@@ -2716,8 +2973,10 @@ void Mfg::detectLnOutliers(double threshPt2LnDist)
 
     // Line reprojection
 
-    for (int i = 0; i < idealLines.size(); ++i)
+    for (int k = 0; k < lnGids.size(); ++k)
     {
+        int i = lnGids[k];
+
         if (!idealLines[i].is3D || idealLines[i].gid < 0) 
 			continue;
 
@@ -2732,7 +2991,7 @@ void Mfg::detectLnOutliers(double threshPt2LnDist)
             if (!views[vid].matchable) 
 				continue;
 
-            Mat lneq = projectLine(idealLines[i], views[vid].R, views[vid].t, K);
+            Vec3d lneq = projectLine(idealLines[i], views[vid].projection(Kx));
            
 		    double sumDist = 0;
             for (int k = 0; k < views[vid].idealLines[lid].lsEndpoints.size(); ++k)
@@ -2765,15 +3024,17 @@ void Mfg::detectLnOutliers(double threshPt2LnDist)
     }
 }
 
-// Detect lines that are too far or too long.
-void Mfg::detectPtOutliers(double threshPt2PtDist)
+// Detect points that are too far or reproject badly, among points kptGids
+void Mfg::detectPtOutliers(double threshPt2PtDist, const vector<int> &kptGids)
 {
     //double threshPt2PtDist = 2;
     double rangeLimit = 30;
 
 	// Loop through each key point
-    for (int i = 0; i < keyPoints.size(); ++i)
+    for (int k = 0; k < kptGids.size(); ++k)
     {
+        int i = kptGids[k];
+
 		// Skip key point if it is not triangulated yet
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0) 
 			continue;
@@ -2782,7 +3043,7 @@ void Mfg::detectPtOutliers(double threshPt2PtDist)
         double minD = 100;
         for (int j = 0; j < keyPoints[i].viewId_ptLid.size(); ++j) {
             int vid = keyPoints[i].viewId_ptLid[j][0];
-            double dist = cv::norm(keyPoints[i].mat(0) + views[vid].R.t() * views[vid].t);
+            double dist = cv::norm(keyPoints[i].vec() - views[vid].center());
             if (dist < minD)
                 minD = dist;
         }
@@ -2805,31 +3066,84 @@ void Mfg::detectPtOutliers(double threshPt2PtDist)
 
     int n_del = 0;
 
+    // Reprojection errors of the observations, gathered by view and computed
+    // in one batch per view; only the views observing the points get a slot
+    unordered_map<int, int> viewSlot;
+    vector<int> slotVid;
+    vector<SoaPoints3d> viewPt3d;
+    vector<SoaPoints2d> viewPt2d;
+    vector<vector<pair<int, int>>> viewObs; // index in kptGids, observation
+    vector<vector<uchar>> isOutlier(kptGids.size());
+
+    for (int k = 0; k < kptGids.size(); ++k)
+    {
+        int i = kptGids[k];
+
+        if (!keyPoints[i].is3D || keyPoints[i].gid < 0)
+            continue;
+
+        isOutlier[k].assign(keyPoints[i].viewId_ptLid.size(), 0);
+
+        for (int j = 0; j < keyPoints[i].viewId_ptLid.size(); ++j)
+        {
+            int vid = keyPoints[i].viewId_ptLid[j][0];
+            int lid = keyPoints[i].viewId_ptLid[j][1];
+            if (!views[vid].matchable)
+                continue;
+
+            unordered_map<int, int>::iterator it = viewSlot.find(vid);
+            if (it == viewSlot.end())
+            {
+                it = viewSlot.insert(make_pair(vid, (int)slotVid.size())).first;
+                slotVid.push_back(vid);
+                viewPt3d.push_back(SoaPoints3d());
+                viewPt2d.push_back(SoaPoints2d());
+                viewObs.push_back(vector<pair<int, int>>());
+            }
+
+            int s = it->second;
+            viewPt3d[s].push_back(keyPoints[i].x, keyPoints[i].y, keyPoints[i].z);
+            viewPt2d[s].push_back(views[vid].featurePoints[lid].x, views[vid].featurePoints[lid].y);
+            viewObs[s].push_back(make_pair(k, j));
+        }
+    }
+
+    const Matx33d Kx = K;
+
+    for (int s = 0; s < slotVid.size(); ++s)
+    {
+        int num = viewObs[s].size();
+        vector<double> dist(num);
+        Matx34d P = views[slotVid[s]].projection(Kx);
+        reprojErrors(P.val, &viewPt3d[s].x[0], &viewPt3d[s].y[0], &viewPt3d[s].z[0],
+                     &viewPt2d[s].x[0], &viewPt2d[s].y[0], num, &dist[0]);
+
+        for (int k = 0; k < num; ++k)
+        {
+            if (dist[k] > threshPt2PtDist)  // outlier;
+                isOutlier[viewObs[s][k].first][viewObs[s][k].second] = 1;
+        }
+    }
+
 	// Loop through each key point
-    for (int i = 0; i < keyPoints.size(); ++i)
+    for (int k = 0; k < kptGids.size(); ++k)
     {
+        int i = kptGids[k];
+
 		// Skip key point if it is not triangulated yet
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0) 
 			continue;
 
         //if (keyPoints[i].viewId_ptLid.size()<5) continue;  // allow some time to ajust position via lba
-        Mat pt3d = keyPoints[i].mat(0);
-
-        for (int j = 0; j < keyPoints[i].viewId_ptLid.size(); ++j) // for each
+        for (int j = keyPoints[i].viewId_ptLid.size() - 1; j >= 0; --j) // for each, last first
         {
+            if (!isOutlier[k][j])
+                continue;
+
             int vid = keyPoints[i].viewId_ptLid[j][0];
             int lid = keyPoints[i].viewId_ptLid[j][1];
-            if (!views[vid].matchable) 
-				continue;
-
-            double dist = cv::norm(mat2cvpt(K * (views[vid].R * pt3d + views[vid].t)) - views[vid].featurePoints[lid].cvpt());
-
-            if (dist > threshPt2PtDist)  // outlier;
-            {
-                views[vid].featurePoints[lid].gid = -1;
-                keyPoints[i].viewId_ptLid.erase(keyPoints[i].viewId_ptLid.begin() + j); // delete
-                --j;
-            }
+            views[vid].featurePoints[lid].gid = -1;
+            keyPoints[i].viewId_ptLid.erase(keyPoints[i].viewId_ptLid.begin() + j); // delete
         }
 
 		// if too few observations survive
@@ -2852,8 +3166,10 @@ void Mfg::detectPtOutliers(double threshPt2PtDist)
     }
 
     // detect newly established points when baseline too short
-    for (int i = 0; i < keyPoints.size(); ++i)
+    for (int k = 0; k < kptGids.size(); ++k)
     {
+        int i = kptGids[k];
+
         if (!keyPoints[i].is3D || keyPoints[i].gid < 0) continue;
 
         if (views.size() < 2) continue;
@@ -2968,3 +3284,153 @@ void Mfg::cleanup(int n_kf_keep)
         views[i].matchable = false;
     }
 }
+
+void Mfg::releaseOldViews(int n_keep)
+// sliding window: views older than the last n_keep ones keep only their pose and
+// feature observations, they can still be used by bundle adjustment. With an
+// archive, the descriptors are written to it first, for loop verification
+{
+    for (int i = (int)views.size() - n_keep - 1; i >= 0; --i)
+    {
+        if (views[i].img.empty()) break; // released before
+
+        if (openArchive())
+            archive->appendDescriptors(views[i]);
+
+        views[i].releaseMatchingData();
+    }
+}
+
+bool Mfg::openArchive()
+// create the archive on first use, false if none is configured
+{
+    if (mfgSettings->getArchiveWindow() <= 0 || mfgSettings->getArchiveFile().isEmpty())
+        return false;
+
+    if (!archive)
+    {
+        archive = make_shared<MfgArchive>();
+        archive->open(mfgSettings->getArchiveFile().toStdString());
+    }
+
+    return archive->isOpen();
+}
+
+void Mfg::recordOdometry()
+// keyframes before the local window are not moved by local BA anymore, their
+// relative poses are the odometry measurements of GlobalMapper's pose graph
+{
+    int i = odom_constraints.empty() ? 1 : (int)odom_constraints.back()[1] + 1;
+
+    for (; i < localWindowFront(); ++i)
+    {
+        for (int j = max(0, i - 2); j < i; ++j)
+        {
+            // x_i = R*x_j + t
+            cv::Mat R = views[i].R * views[j].R.t();
+            cv::Mat t = views[i].t - R * views[j].t;
+            vector<double> odom;
+            odom.push_back(j);
+            odom.push_back(i);
+            odom.push_back(1);
+
+            for (int k = 0; k < 9; ++k)
+                odom.push_back(R.at<double>(k / 3, k % 3));
+
+            for (int k = 0; k < 3; ++k)
+                odom.push_back(t.at<double>(k));
+
+            odom_constraints.push_back(odom);
+        }
+    }
+}
+
+void Mfg::archiveOldViews(int n_keep)
+// views older than the last n_keep ones are written to the archive and keep only
+// their pose in memory (like cleanup). Landmarks seen only by archived views are
+// written too and evicted from memory: their gid entry is left empty, like a
+// removed outlier, and they are read back from the archive when needed (export,
+// corrections of GlobalMapper). 2D tracks keep only their observations in views
+// still in memory, the only ones expand_keyPoints can triangulate from
+{
+    int numActive = (int)views.size() - n_keep; // first view id of the active map
+
+    if (numActive <= 0 || !openArchive()) return;
+
+    // landmarks seen by the views archived now are the only candidates
+    vector<int> kptGids, lnGids;
+
+    for (int i = numActive - 1; i >= 0; --i)
+    {
+        if (archive->hasView(views[i].id)) break; // archived before
+
+        archive->appendView(views[i]);
+
+        for (int j = 0; j < views[i].featurePoints.size(); ++j)
+            if (views[i].featurePoints[j].gid >= 0)
+                kptGids.push_back(views[i].featurePoints[j].gid);
+
+        for (int j = 0; j < views[i].idealLines.size(); ++j)
+            if (views[i].idealLines[j].gid >= 0)
+                lnGids.push_back(views[i].idealLines[j].gid);
+
+        vector<FeatPoint2d>().swap(views[i].featurePoints);
+        vector<LineSegmt2d>().swap(views[i].lineSegments);
+        vector<VanishPnt2d>().swap(views[i].vanishPoints);
+        vector<IdealLine2d>().swap(views[i].idealLines);
+        views[i].img.release();
+        views[i].grayImg.release();
+        views[i].matchable = false;
+    }
+
+    // landmarks whose last observation is archived will not be updated anymore
+    sort(kptGids.begin(), kptGids.end());
+    kptGids.erase(unique(kptGids.begin(), kptGids.end()), kptGids.end());
+
+    for (int k = 0; k < kptGids.size(); ++k)
+    {
+        int i = kptGids[k];
+
+        if (i >= keyPoints.size() || keyPoints[i].gid < 0 || keyPoints[i].viewId_ptLid.empty())
+            continue;
+
+        if (!keyPoints[i].is3D)
+        {
+            // 2D track: the image points of its archived observations are gone,
+            // they are dropped so the rest can still be triangulated
+            vector<vector<int> > &obs = keyPoints[i].viewId_ptLid;
+            obs.erase(remove_if(obs.begin(), obs.end(),
+                                [numActive](const vector<int> &o) { return o[0] < numActive; }),
+                      obs.end());
+
+            if (obs.empty())
+                keyPoints[i] = KeyPoint3d();
+
+            continue;
+        }
+
+        if (keyPoints[i].viewId_ptLid.back()[0] >= numActive || archive->hasKeyPoint(i)) continue;
+
+        archive->appendKeyPoint(keyPoints[i]);
+        keyPoints[i] = KeyPoint3d();
+    }
+
+    sort(lnGids.begin(), lnGids.end());
+    lnGids.erase(unique(lnGids.begin(), lnGids.end()), lnGids.end());
+
+    for (int k = 0; k < lnGids.size(); ++k)
+    {
+        int i = lnGids[k];
+
+        if (i >= idealLines.size() || !idealLines[i].is3D || idealLines[i].gid < 0 || idealLines[i].viewId_lnLid.empty())
+            continue;
+
+        if (idealLines[i].viewId_lnLid.back()[0] >= numActive || archive->hasIdealLine(i)) continue;
+
+        archive->appendIdealLine(idealLines[i]);
+        idealLines[i].gid = -1;
+        idealLines[i].is3D = false;
+        idealLines[i].direct = cv::Vec3d();
+        vector<vector<int> >().swap(idealLines[i].viewId_lnLid);
+    }
+}
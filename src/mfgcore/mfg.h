@@ -26,6 +26,8 @@
 // Standard library
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <deque>
 
 // OpenCV
 #include <opencv/cv.h>
@@ -42,6 +44,7 @@
 #include <QThread>
 
 // MFG
+#include "consts.h"
 #include "view.h"
 #include "features2d.h"
 #include "features3d.h"
@@ -52,6 +55,15 @@ using namespace std;	// this should be removed
 //#define PLOT_MID_RESULTS
 
 class MfgSettings;
+class PreparedFrame;
+class LocalMapper;
+class MfgArchive;
+class BaGraph;
+
+namespace g2o
+{
+class OptimizationAlgorithmLevenberg;
+}
 
 // Frame type: This class is used for feature tacking in raw frames
 class Frame {
@@ -63,12 +75,24 @@ public:
     std::vector<int> pt_lid_in_last_view;
 };
 
+// ProbeFrame type: This class holds what is needed to decide if a raw frame
+// is a keyframe, full feature extraction is left to View
+class ProbeFrame {
+public:
+    std::string filename;
+    cv::Mat grayImg;						// gray image
+    std::vector<cv::Mat> pyramid;			// optical flow pyramid of grayImg (GFTT tracking)
+    std::vector<FeatPoint2d> featurePoints;	// only detected for SIFT/SURF
+
+    ProbeFrame(const PreparedFrame &frm, MfgSettings *_settings); // see mfgutils.cpp
+};
+
 // Mfg type: This class contains the 3D information of MFG views
 class Mfg
 {
 public:
     cv::Mat						K;
-	std::vector<View>			views;
+	std::deque<View>			views;		// references stay valid when keyframes are added
     std::vector<KeyPoint3d>		keyPoints;
     std::vector<KeyPoint3d>		pointTrack; // points that are being tracked but not triangulated yet
     std::vector<IdealLine3d>	idealLines;
@@ -86,37 +110,62 @@ public:
     std::vector<double> scale_vals;
     double camera_height;
     std::vector<std::vector<double> > camdist_constraints; // cam1_id, cam2_id, dist, confidence
+    // Loops found by place recognition: cam1_id, cam2_id, num of inliers, then R (row
+    // major) and t of cam2 relative to cam1, x2 = R*x1 + t
+    std::vector<std::vector<double> > loop_constraints;
+    // Relative poses of each keyframe to its two predecessors, recorded once the
+    // local BA no longer moves them: cam1_id, cam2_id, confidence, then R and t
+    // as in loop_constraints
+    std::vector<std::vector<double> > odom_constraints;
 
     // For feature point tracking
     std::vector<Frame> trackFrms;
     double angleSinceLastKfrm;
 
+    // Keyframes and landmarks that left the active map, see archiveOldViews()
+    std::shared_ptr<MfgArchive> archive;
+
+    // Optimizer of the local bundle adjustment, kept across keyframes
+    std::shared_ptr<BaGraph> baGraph;
+    int    numBa = 0;          // local BA runs and their total solver time
+    double baTimeMs = 0;
+
     Mfg() {}
     Mfg(View v0, int ini_incrt, cv::Mat dc, double fps_);
     Mfg(View v0, View v1, double fps_) 
 	{
-        views.push_back(v0);
-        views.push_back(v1);
+        views.push_back(std::move(v0));
+        views.push_back(std::move(v1));
         fps = fps_;
         initialize();
     }
 
     void initialize(); // initializes MFG with first two views
-    void expand(View &, int frameId);
+    void expand(View &&, int frameId, LocalMapper *mapper = 0); // takes over the view
     void expand_keyPoints(View &prev, View &nview);
     void expand_idealLines(View &prev, View &nview);
-    void detectLnOutliers(double threshPt2LnDist);
-    void detectPtOutliers(double threshPt2PtDist);
+    void detectLnOutliers(double threshPt2LnDist, const std::vector<int> &lnGids);
+    void detectPtOutliers(double threshPt2PtDist, const std::vector<int> &kptGids);
+    void optimizeLocalMap();
+    int  localWindowFront() const;
+    void collectLocalWindow(std::vector<int> &kptGids, std::vector<int> &lnGids) const;
     void adjustBundle();
     void adjustBundle_G2O(int numPos, int numFrm);
+    void collectWindowFeatures(int frontIdx, std::vector<int> &kptGids,
+                               std::vector<int> &vptGids, std::vector<int> &lnGids) const;
     void est3dIdealLine(int lnGid);
     void update3dIdealLine(std::vector< std::vector<int> > ilinePairIdx, View &nview);
     void updatePrimPlane();
+    void updatePrimPlane(const std::vector<int> &kptGids, const std::vector<int> &lnGids);
     void draw3D() const;
     bool rotateMode();
     void exportAll(std::string root_dir);
     void scaleLocalMap(int from_view_id, int to_view_id, double, bool);
     void cleanup(int n_keep);
+    void releaseOldViews(int n_keep);
+    void archiveOldViews(int n_keep);
+    bool openArchive();
+    void recordOdometry();
     void bundle_adjust_between(int from_view, int to_view, int);
 };
 
@@ -147,4 +196,9 @@ private:
     MfgSettings *mfgSettings;
 };
 
+// Levenberg-Marquardt solver of the bundle adjustment with the given linear
+// solver for the reduced system, the system is built by BaParallelBlockSolver
+// if parallelBuild, in mfg-ba-g2o.cpp
+g2o::OptimizationAlgorithmLevenberg *newBaAlgorithm(BaLinearSolver solver, bool parallelBuild = false);
+
 #endif
@@ -37,9 +37,14 @@
 // Standard library
 #include <math.h>
 #include <fstream>
+#include <future>
 
 // MFG
 #include "mfgutils.h"
+#include "framesource.h"
+#include "localmapper.h"
+#include "globalmapper.h"
+#include "loopcloser.h"
 #include "export.h"
 #include "utils.h"
 #include "settings.h"
@@ -69,6 +74,19 @@ void MfgThread::run()
         thresh3dPtNum = 7;		
     }
 
+    // Frames are decoded on background threads ahead of the tracker
+    FrameSource frames(K, distCoeffs, imIdLen, mfgSettings);
+
+    // View of the expected next keyframe, built while the map expands
+    future<View> nextView;
+    string nextViewName;
+    int numNextViews = 0, numNextViewsUsed = 0;
+
+    // Local map of new keyframes is optimized while tracking continues
+    LocalMapper mapper(mfgSettings);
+    GlobalMapper globalMapper(mfgSettings);
+    LoopCloser loopCloser(mfgSettings);
+
     MyTimer timer;
     timer.start();
 
@@ -77,6 +95,9 @@ void MfgThread::run()
 	// Expand MFG until no more frames to process
 	for (int i = 0; !finished; ++i)
     {
+		// Track against the optimized map as soon as it is ready
+        mapper.tryCommit(*pMap);
+
 		// If the camera is rotating or moved enough...
         if (pMap->rotateMode() || pMap->angleSinceLastKfrm > 10 * PI / 180)
         {
@@ -117,8 +138,11 @@ void MfgThread::run()
             finished = true; // this will be the last loop
         }
 
-		// Create view
-        View v(imgName, K, distCoeffs, mfgSettings);
+		// Schedule the frames that may be visited next
+        frames.prefetch(imgName, max(increment / 4, 1));
+
+		// Create probe frame
+        ProbeFrame v(frames.get(imgName), mfgSettings);
         int fid = atoi(imgName.substr(imgName.size() - imIdLen - 4, imIdLen).c_str());
 
 		// If we reached maximum num of images to process...
@@ -155,8 +179,8 @@ void MfgThread::run()
 					break;
 
 				// Check if this frame should be considered as a key frame
-                View v(imgName, K, distCoeffs, mfgSettings);
-                if (!isKeyframe(*pMap, View(imgName, K, distCoeffs, mfgSettings), 50, thresh3dPtNum))
+                ProbeFrame v(frames.get(imgName), mfgSettings);
+                if (!isKeyframe(*pMap, v, 50, thresh3dPtNum))
                 {
                     selName = imgName;
                     found = true;
@@ -201,20 +225,82 @@ void MfgThread::run()
 		   	// Create view
 			MyTimer tm;
             tm.start();
-			View imgView(imgName, K, distCoeffs, -1, mfgSettings);
+			View imgView;
+
+			if (nextView.valid() && nextViewName == imgName)
+            {
+				// Already built while the map was expanding
+                imgView = nextView.get();
+                ++numNextViewsUsed;
+            }
+            else
+            {
+                if (nextView.valid()) // wrong guess, drop it
+                    nextView.get();
+
+                imgView = View(frames.get(imgName), -1, mfgSettings);
+            }
             // tm.end(); 
 			// cout << "view setup time " << tm.time_ms << " ms" << endl;
+
+			// Build the view of the expected next keyframe in the background,
+			// assuming the same frame interval as between the last two keyframes.
+			// View construction does not touch the map or the global PRNG, so
+			// results are the same as in serial mode.
+            if (mfgSettings->getPipelineViews())
+            {
+                nextViewName = nextImgName(imgName, imIdLen, max(1, fid - pMap->views.back().frameId));
+
+                if (isFileExist(nextViewName))
+                {
+                    nextView = async(launch::async, [this, &frames](string name)
+                    {
+                        return View(frames.get(name), -1, mfgSettings);
+                    }, nextViewName);
+                    ++numNextViews;
+                }
+            }
            
+			// Merge and start global corrections between keyframes, with the
+			// local map committed, so they land at the same keyframes in every run
+            mapper.commit(*pMap);
+			globalMapper.optimize(*pMap);
+
 		   	// Expand MFG with current view
-			pMap->expand(imgView, fid);
+			pMap->expand(std::move(imgView), fid, &mapper);
+			loopCloser.process(*pMap);
         }
     }
 
+    if (nextView.valid())
+        nextView.wait();
+
+    mapper.commit(*pMap);
+    globalMapper.merge(*pMap);
+
     timer.end();
     cout << "total time = " << timer.time_s << "s" << endl;
 
-	// Save camera trajectory to file
+    if (mfgSettings->getPipelineViews())
+        cout << "pipelined views used = " << numNextViewsUsed << "/" << numNextViews << endl;
+
+    if (mfgSettings->getLocalMappingThread())
+        cout << "local mapping: " << mapper.numOptimized() << " keyframes, tracking waited "
+             << mapper.waitTime() << " ms" << endl;
+
+    if (mfgSettings->getGlobalOptInterval() > 0)
+        cout << "global optimization: " << globalMapper.numMerged() << " corrections merged" << endl;
+
+    if (loopCloser.enabled())
+        cout << "loop closure: " << loopCloser.numLoops() << " loops" << endl;
+
+    cout << "local BA: " << pMap->numBa << " runs, " << pMap->baTimeMs / max(1, pMap->numBa)
+         << " ms per run (linear solver " << mfgSettings->getBaLinearSolver() << ")" << endl;
+    cout << "peak RSS = " << peakRssMB() << " MB" << endl;
+
+	// Save camera trajectory and map nodes to file
     exportCamPose(*pMap, "camPose.txt") ;
+    exportMfgNode(*pMap, "mfgNode.txt");
 	//pMap->exportAll("MFG");
 
 	// Signal that MFG thread finished
@@ -42,12 +42,25 @@
 
 // TODO: FIXME: circular dependency
 #include "mfg.h"
+#include "framesource.h"
 
 using namespace std;
 extern MfgSettings *mfgSettings;
 
 
-bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
+ProbeFrame::ProbeFrame(const PreparedFrame &frm, MfgSettings *_settings)
+{
+    filename = frm.filename;
+    grayImg = frm.grayImg;
+
+    if (_settings->getKeypointAlgorithm() < 3) // sift/surf
+        detectSiftSurfPoints(frm.img, _settings->getKeypointAlgorithm(), featurePoints);
+    else // build the pyramid once for all optical flow calls in isKeyframe
+        cv::buildOpticalFlowPyramid(grayImg, pyramid,
+                                    cv::Size(_settings->getOflkWindowSize(), _settings->getOflkWindowSize()), 3);
+}
+
+bool isKeyframe(Mfg &map, const ProbeFrame &v1, int th_pair, int th_overlap)
 // determine if v1 is a keyframe, given v0 is the last keyframe
 // point matches, overlap
 {
@@ -82,7 +95,7 @@ bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
         }
 
         cv::calcOpticalFlowPyrLK(
-            prev_img, v1.grayImg, // 2 consecutive images
+            prev_img, v1.pyramid, // 2 consecutive images
             prev_pts,             // input point positions in first im
             curr_pts,             // output point positions in the 2nd
             status,               // tracking success
@@ -96,7 +109,7 @@ bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
         vector<cv::Point2f> prev_pts_rvs = prev_pts, curr_pts_rvs = curr_pts;
         vector<uchar> status_reverse;
         cv::calcOpticalFlowPyrLK(
-            v1.grayImg, prev_img,// 2 consecutive images
+            v1.pyramid, prev_img,// 2 consecutive images
             curr_pts_rvs,        //  point positions in the 2nd
             prev_pts_rvs,
             status_reverse,      // tracking success
@@ -246,8 +259,8 @@ bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
 
                 cv::Point2d pt = mat2cvpt(map.K * (Rn * map.keyPoints[i].mat(0) + tn));
 
-                if (int(pt.x - radius) < 0 || (pt.x + radius) > v1.img.cols - 1 ||
-                        int(pt.y - radius) < 0 || (pt.y + radius) > v1.img.rows - 1) continue;
+                if (int(pt.x - radius) < 0 || (pt.x + radius) > v1.grayImg.cols - 1 ||
+                        int(pt.y - radius) < 0 || (pt.y + radius) > v1.grayImg.rows - 1) continue;
 
                 // detect pts
                 cv::Mat mask = cv::Mat::zeros(v1.grayImg.size(), CV_8UC1);
@@ -327,7 +340,7 @@ bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
             }
 
             cv::calcOpticalFlowPyrLK(
-                pp_img, v1.grayImg, // 2 consecutive images
+                pp_img, v1.pyramid, // 2 consecutive images
                 pp_pts,   // input point positions in first im
                 curr_pts, // output point positions in the 2nd
                 status,   // tracking success
@@ -339,7 +352,7 @@ bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap)
                 mfgSettings->getOflkMinEigenval()  // minEignVal threshold for the 2x2 spatial motion matrix, to eleminate bad points
             );
             cv::calcOpticalFlowPyrLK(
-                v1.grayImg, pp_img,  // 2 consecutive images
+                v1.pyramid, pp_img,  // 2 consecutive images
                 curr_pts, // input point positions in first im
                 pp_pts2,  // output point positions in the 2nd
                 status2,  // tracking success
@@ -517,3 +530,12 @@ vector<vector<int>> matchVanishPts_withR(View &view1, View &view2, cv::Mat R, bo
 
     return pairIdx;
 }
+
+IdealLine3d emptyIdealLine()
+// IdealLine3d() leaves gid and is3D unset
+{
+    IdealLine3d l;
+    l.gid = -1;
+    l.is3D = false;
+    return l;
+}
@@ -30,14 +30,17 @@
 #include <opencv2/core/core.hpp>
 
 class View;
+class ProbeFrame;
 class IdealLine2d;
+class IdealLine3d;
 class PrimPlane3d;
 class Mfg;
 
-std::vector< std::vector<int> > F_guidedLinematch(cv::Mat F, std::vector<IdealLine2d> lines1,
-        std::vector<IdealLine2d> lines2, cv::Mat img1, cv::Mat img2);                // see ../features/linematch.cpp
+std::vector< std::vector<int> > F_guidedLinematch(cv::Mat F, const std::vector<IdealLine2d> &lines1,
+        const std::vector<IdealLine2d> &lines2, cv::Mat img1, cv::Mat img2,
+        bool describeAll = false);                                                      // see ../features/linematch.cpp
 
-bool isKeyframe(Mfg &map, const View &v1, int th_pair, int th_overlap);              // TODO: FIXME: circular dependency  
+bool isKeyframe(Mfg &map, const ProbeFrame &v1, int th_pair, int th_overlap);             // TODO: FIXME: circular dependency  
                                                                                      // see mfgutils.cpp 
 void drawFeatPointMatches(View &, View &, std::vector< std::vector<cv::Point2d> >);  // see mfgutils.cpp 
 
@@ -47,4 +50,6 @@ void  matchIdealLines(View &view1, View &view2, std::vector< std::vector<int> >
 
 std::vector< std::vector<int> > matchVanishPts_withR(View &view1, View &view2, cv::Mat R, bool &goodR);// see mfgutils.cpp 
 
+IdealLine3d emptyIdealLine();  // placeholder of a line gid not held by a partial map copy, see mfgutils.cpp
+
 #endif
@@ -45,6 +45,7 @@
 
 #include "utils.h"
 #include "consts.h"
+#include "geokernels.h"
 #include "mfgutils.h"
 #include "levmar.h"
 #include "view.h"
@@ -57,7 +58,7 @@ using namespace std;
 
 struct Data_optimizeRt_withVP
 {
-    vector<vector<cv::Point2d>> pointPairs;
+    SoaPoints3d pts1, pts2; // point pairs, homogeneous
     cv::Mat K;
     vector<vector<cv::Mat>>		vpPairs;
     double weightVP;
@@ -89,10 +90,13 @@ void costFun_optimizeRt_withVP(double *p, double *error, int N, int M, void *ada
 
     cv::Mat F = K.t().inv() * (vec2SkewMat(t) * R) * K.inv();
 
-    for (int i = 0; i < dptr->pointPairs.size(); ++i, ++errEndIdx)
+    int numPts = dptr->pts1.size();
+    sampsonErrors(F.ptr<double>(), &dptr->pts1.x[0], &dptr->pts1.y[0], &dptr->pts1.z[0],
+                  &dptr->pts2.x[0], &dptr->pts2.y[0], &dptr->pts2.z[0], numPts, error);
+
+    for (int i = 0; i < numPts; ++i, ++errEndIdx)
     {
-        error[errEndIdx] = sqrt(fund_samperr(cvpt2mat(dptr->pointPairs[i][0]),
-                                             cvpt2mat(dptr->pointPairs[i][1]), F));
+        error[errEndIdx] = sqrt(error[errEndIdx]);
         cost += error[errEndIdx] * error[errEndIdx];
     }
 
@@ -147,7 +151,13 @@ void optimizeRt_withVP(cv::Mat K, vector<vector<cv::Mat>> vppairs, double weight
 
     // --- pass additional data ---
     Data_optimizeRt_withVP data;
-    data.pointPairs = featPtMatches;
+
+    for (int i = 0; i < featPtMatches.size(); ++i)
+    {
+        data.pts1.push_back(featPtMatches[i][0].x, featPtMatches[i][0].y, 1);
+        data.pts2.push_back(featPtMatches[i][1].x, featPtMatches[i][1].y, 1);
+    }
+
     data.K = K;
     data.vpPairs = vppairs;
     data.weightVP =  weightVP;
@@ -174,7 +184,7 @@ void optimizeRt_withVP(cv::Mat K, vector<vector<cv::Mat>> vppairs, double weight
 
 struct Data_optimize_t_givenR
 {
-    vector<vector<cv::Point2d>> pointPairs;
+    SoaPoints3d pts1, pts2; // point pairs, homogeneous
     cv::Mat K, R;
 };
 
@@ -198,10 +208,13 @@ void costFun_optimize_t_givenR(double *p, double *error, int N, int M, void *ada
 
     cv::Mat F = K.t().inv() * (vec2SkewMat(t) * R) * K.inv();
 
-    for (int i = 0; i < dptr->pointPairs.size(); ++i, ++errEndIdx)
+    int numPts = dptr->pts1.size();
+    sampsonErrors(F.ptr<double>(), &dptr->pts1.x[0], &dptr->pts1.y[0], &dptr->pts1.z[0],
+                  &dptr->pts2.x[0], &dptr->pts2.y[0], &dptr->pts2.z[0], numPts, error);
+
+    for (int i = 0; i < numPts; ++i, ++errEndIdx)
     {
-        error[errEndIdx] = sqrt(fund_samperr(cvpt2mat(dptr->pointPairs[i][0]),
-                                             cvpt2mat(dptr->pointPairs[i][1]), F));
+        error[errEndIdx] = sqrt(error[errEndIdx]);
         cost += error[errEndIdx] * error[errEndIdx];
     }
 
@@ -235,7 +248,13 @@ void optimize_t_givenR(cv::Mat K, cv::Mat R, vector<vector<cv::Point2d>> &featPt
 
     // --- pass additional data ---
     Data_optimize_t_givenR data;
-    data.pointPairs = featPtMatches;
+
+    for (int i = 0; i < featPtMatches.size(); ++i)
+    {
+        data.pts1.push_back(featPtMatches[i][0].x, featPtMatches[i][0].y, 1);
+        data.pts2.push_back(featPtMatches[i][1].x, featPtMatches[i][1].y, 1);
+    }
+
     data.K = K;
     data.R = R;
 
@@ -37,51 +37,38 @@
 #include <iostream>
 
 #include "mfg.h"
+#include "framesource.h"
+#include "geokernels.h"
+#include "ransac.h"
 #include "settings.h"
 #include "utils.h"
 //#include "lsd/lsd.h"
 
-extern int IDEAL_IMAGE_WIDTH;
 extern double SIFT_THRESH;
 
 using namespace std;
 
 
 View::View(string imgName, cv::Mat _K, cv::Mat dc, MfgSettings *_settings)
+    : View(prepareFrame(imgName, _K, dc, _settings->getImageWidth()), _settings)
+{
+}
+
+View::View(string imgName, cv::Mat _K, cv::Mat dc, int _id, MfgSettings *_settings)
+    : View(prepareFrame(imgName, _K, dc, _settings->getImageWidth()), _id, _settings)
+{
+}
+
+View::View(const PreparedFrame &frm, MfgSettings *_settings)
     : mfgSettings(_settings)
       // only deal with points
 {
     angVel = 0;
-    filename = imgName;
+    filename = frm.filename;
     id = -2;
-    cv::Mat oriImg = cv::imread(imgName, 1);
-    cv::Mat tmpImg;
-    tmpImg = oriImg.clone();
-
-    if (cv::norm(dc) > 1e-6)
-        cv::undistort(oriImg, tmpImg, _K, dc);
-
-    // resize image and ajust camera matrix
-    if (mfgSettings->getImageWidth() > 1)
-    {
-        double scl = mfgSettings->getImageWidth() / double(tmpImg.cols);
-        cv::resize(tmpImg, img, cv::Size(), scl, scl, cv::INTER_AREA);
-        K = _K * scl;
-        K.at<double>(2, 2) = 1;
-    }
-    else
-    {
-        img = tmpImg;
-        K = _K;
-    }
-
-    IDEAL_IMAGE_WIDTH = img.cols;
-
-    //	cv::Mat grayImg;
-    if (img.channels() == 3)
-        cv::cvtColor(img, grayImg, CV_RGB2GRAY);
-    else
-        grayImg = img;
+    img = frm.img;
+    grayImg = frm.grayImg;
+    K = frm.K;
 
     if (mfgSettings->getKeypointAlgorithm() < 3) //sift/surf
         detectFeatPoints();
@@ -90,41 +77,15 @@ View::View(string imgName, cv::Mat _K, cv::Mat dc, MfgSettings *_settings)
 
 }
 
-View::View(string imgName, cv::Mat _K, cv::Mat dc, int _id, MfgSettings *_settings)
+View::View(const PreparedFrame &frm, int _id, MfgSettings *_settings)
     : mfgSettings(_settings)
 {
     angVel = 0;
-    filename = imgName;
+    filename = frm.filename;
     id = _id;
-    QString fnStr(imgName.c_str());
-    cv::Mat oriImg = cv::imread(imgName, CV_LOAD_IMAGE_COLOR);
-    cv::Mat tmpImg;
-    tmpImg = oriImg.clone();
-
-    if (cv::norm(dc) > 1e-6)
-        cv::undistort(oriImg, tmpImg, _K, dc);
-
-    // resize image and ajust camera matrix
-    if (mfgSettings->getImageWidth() > 1)
-    {
-        double scl = mfgSettings->getImageWidth() / double(tmpImg.cols);
-        cv::resize(tmpImg, img, cv::Size(), scl, scl, cv::INTER_AREA);
-        K = _K * scl;
-        K.at<double>(2, 2) = 1;
-    }
-    else
-    {
-        img = tmpImg;
-        K = _K;
-    }
-
-    IDEAL_IMAGE_WIDTH = img.cols;
-
-    //	cv::Mat grayImg;
-    if (img.channels() == 3)
-        cv::cvtColor(img, grayImg, CV_RGB2GRAY);
-    else
-        grayImg = img;
+    img = frm.img;
+    grayImg = frm.grayImg;
+    K = frm.K;
 
     lsLenThresh = img.cols / 50.0; // for raw line segments
 
@@ -168,25 +129,27 @@ cv::Point2d LineSegmt2d::getGradient(cv::Mat *xGradient, cv::Mat *yGradient)
     return cv::Point2d(xSum / len, ySum / len);
 }
 
-cv::Mat LineSegmt2d::lineEq()
+static uint64_t nameSeed(const string &fname)
+// FNV-1a hash of the file name without its directory
 {
-    cv::Mat pt1 = (cv::Mat_<double>(3, 1) << endpt1.x, endpt1.y, 1);
-    cv::Mat pt2 = (cv::Mat_<double>(3, 1) << endpt2.x, endpt2.y, 1);
-    cv::Mat lnEq = pt1.cross(pt2); // lnEq = pt1 x pt2
-    lnEq = lnEq / sqrt(lnEq.at<double>(0) * lnEq.at<double>(0)
-                       + lnEq.at<double>(1) * lnEq.at<double>(1)); // normalize, optional
-    return lnEq;
+    uint64_t h = UINT64_C(14695981039346656037);
+
+    for (int i = fname.find_last_of("/\\") + 1; i < fname.size(); ++i)
+    {
+        h ^= (unsigned char)fname[i];
+        h *= UINT64_C(1099511628211);
+    }
 
+    return h;
 }
 
-void View::detectFeatPoints()
+void detectSiftSurfPoints(cv::Mat img, int alg, vector<FeatPoint2d> &featPts)
+// detect SIFT/SURF key points and their descriptors
 {
     vector<cv::KeyPoint>				poses;
     cv::Mat 							descs;
-    vector<cv::Point2f>					ptpos;
 
-    // Only work for opencv 2.3.1
-    switch (mfgSettings->getKeypointAlgorithm())
+    switch (alg)
     {
     case KPT_SIFT:
     {
@@ -214,6 +177,29 @@ void View::detectFeatPoints()
     }
     break;
 
+    default:
+        return;
+    }
+
+    for (int i = 0; i < poses.size(); ++i)
+    {
+        featPts.push_back(
+            FeatPoint2d(poses[i].pt.x, poses[i].pt.y, descs.row(i).t(), i, -1));
+    }
+}
+
+void View::detectFeatPoints()
+{
+    vector<cv::Point2f>					ptpos;
+
+    // Only work for opencv 2.3.1
+    switch (mfgSettings->getKeypointAlgorithm())
+    {
+    case KPT_SIFT:
+    case KPT_SURF:
+        detectSiftSurfPoints(img, mfgSettings->getKeypointAlgorithm(), featurePoints);
+        break;
+
     case KPT_GFTT:
     {
         if (id == -2) break; // don't detect features when tracking between key frames
@@ -235,16 +221,6 @@ void View::detectFeatPoints()
 
     switch (mfgSettings->getKeypointAlgorithm())
     {
-    case KPT_SIFT:
-    case KPT_SURF:
-        for (int i = 0; i < poses.size(); ++i)
-        {
-            featurePoints.push_back(
-                FeatPoint2d(poses[i].pt.x, poses[i].pt.y, descs.row(i).t(), i, -1));
-        }
-
-        break;
-
     case KPT_GFTT:
     {
         /*		vector<cv::KeyPoint> kpts;
@@ -304,6 +280,52 @@ void View::compMsld4AllSegments(cv::Mat grayImg)
         computeMSLD(lineSegments[i], &xGradImg, &yGradImg);
 }
 
+// Horizontal vp through 2 line segments for ransac(), the model is the vp in
+// image coordinates. Only the segments without a vp are data, the error of a
+// segment is its normalized distance to the vp. A vp not orthogonal to v0 or
+// close to one of vps is rejected.
+struct HorizVpProblem : public RansacProblem
+{
+    typedef cv::Mat Model;
+    enum { SAMPLE_SIZE = 2, MAX_MODELS = 1 };
+
+    vector<int> lsIdx;            // index of each datum in lineSegments
+    vector<LineSegmt2d> lines;
+    vector<cv::Mat> lineEqs;
+    vector<double> lengths;
+    cv::Mat Kinv, v0;
+    vector<cv::Mat> vps;          // existing vps, K^-1 applied
+    double orthThresh, vpAngleLB; // degree
+
+    int numData() const { return lines.size(); }
+
+    int fit(const int *sample, Model *models) const
+    {
+        cv::Mat vpSeed = lineEqs[sample[0]].cross(lineEqs[sample[1]]);
+        cv::Mat tmpVp = Kinv * vpSeed;
+        double dotPrdt = v0.dot(tmpVp) / (cv::norm(v0) * cv::norm(tmpVp));
+
+        if (abs(dotPrdt) > orthThresh)   // check orthogonality of VPs
+            return 0; // only keep potential VPs being horizontal
+
+        // if too similar to existing vps, skip
+        for (int vi = 0; vi < vps.size(); ++vi)
+        {
+            if (abs(tmpVp.dot(vps[vi]) / (cv::norm(vps[vi]) * cv::norm(tmpVp))) > cos(vpAngleLB * PI / 180))
+                return 0;
+        }
+
+        models[0] = vpSeed;
+        return 1;
+    }
+
+    void errors(const Model &vp, int begin, int end, double *err) const
+    {
+        for (int i = begin; i < end; ++i)
+            err[i - begin] = mleVp2LineDist(vp, lines[i]) / lengths[i];
+    }
+};
+
 void View::detectVanishPoints()
 // input: line segments
 // output: vanishing points including children segments, vp labels of segments
@@ -319,6 +341,11 @@ void View::detectVanishPoints()
     int num_ls_vp_thres = 100;
     vector<int> oriIdx;  // original index of ls
 
+    // RANSAC draws from a stream of its own, keyed by the image name, so
+    // that views can be built on any thread without changing the results
+    xrand_state rng;
+    seed_xrand_task(&rng, XRAND_VPOINT, nameSeed(filename));
+
     for (int i = 0; i < ls.size(); ++i) oriIdx.push_back(i);
 
     // ======== 1. group vertical line segments using angle threshold =======
@@ -368,77 +395,41 @@ void View::detectVanishPoints()
     int	maxHvpNo  = 2;	// number of horizontal VPs
 
     double vpAngleLB =	80;  //degree
-    double confidence = 0.99;  // for recomputing maxIterNo.
 
     for (int vpNo = 1; vpNo < maxHvpNo + 1; ++vpNo)
     {
         int	inlierNoThresh	= ls.size() / maxHvpNo;
-        vector<int> maxInlierIdx;
         vector<int>	inlierIdx;
-        int	maxIterNo	= 500;   // initial max RANSAC iteration number
-
-        for (int i = 0; i < maxIterNo; ++i)
-        {
-            if (ls.size() < 2) break;
-
-            int j = xrand() % ls.size();
-            int k = xrand() % ls.size();
-
-            //      cout<<j<<"\t"<<k<<"\t"<<ls.size()<<endl;
-            if (j == k || ls[j].vpLid != -1 || ls[k].vpLid != -1) //redo it
-            {
-                --i;
-                continue;
-            }
-
-            cv::Mat vpSeed = ls[j].lineEq().cross(ls[k].lineEq());
-            cv::Mat tmpVp = K.inv() * vpSeed;
-            double dotPrdt = v0.dot(tmpVp) / (cv::norm(v0) * cv::norm(tmpVp));
 
-            if (abs(dotPrdt) > orthThresh)   // check orthogonality of VPs
-            {
-                // only keep potential VPs being horizontal
-                //	--i;
-                continue;
-            }
-
-            // if too similar to existing vps, skip
-            bool overlap = false;
-
-            for (int vi = 0; vi < vanishPoints.size(); ++vi)
-            {
-                if (abs(tmpVp.dot(K.inv()*vanishPoints[vi].mat()) / (cv::norm(K.inv()*vanishPoints[vi].mat())
-                        *cv::norm(tmpVp))) > cos(vpAngleLB * PI / 180))
-                    overlap = true;
-            }
+        HorizVpProblem prob;
+        prob.Kinv = K.inv();
+        prob.v0 = v0;
+        prob.orthThresh = orthThresh;
+        prob.vpAngleLB = vpAngleLB;
 
-            if (overlap)
-            {
-                //	--i;
-                continue;
-            }
+        for (int vi = 0; vi < vanishPoints.size(); ++vi)
+            prob.vps.push_back(prob.Kinv * vanishPoints[vi].mat());
 
-            for (int ii = 0; ii < ls.size(); ++ii)
-            {
-                if (ls[ii].vpLid != -1) continue;
+        for (int i = 0; i < ls.size(); ++i)
+        {
+            if (ls[i].vpLid != -1) continue;
 
-                double dis = mleVp2LineDist(vpSeed, ls[ii]);
+            prob.lsIdx.push_back(i);
+            prob.lines.push_back(ls[i]);
+            prob.lineEqs.push_back(ls[i].lineEq());
+            prob.lengths.push_back(ls[i].length());
+        }
 
-                //				if (dis < line2VpDistThresh )
-                if (dis / ls[ii].length() < vp2LineDistThresh)
-                    inlierIdx.push_back(ii);
-            }
+        RansacOptions opts;
+        opts.maxIter = 500;   // max RANSAC iteration number
+        opts.threshold = vp2LineDistThresh;
 
-            if (inlierIdx.size() > maxInlierIdx.size())
-            {
-                maxInlierIdx.clear();
-                maxInlierIdx = inlierIdx;
-            }
+        cv::Mat vpSeed;
+        vector<int> maxInlierIdx;
+        ransac(prob, opts, &rng, vpSeed, maxInlierIdx);
 
-            inlierIdx.clear();
-            //			maxIterNo = abs(log(1-confidence) // re-compute maxIterNo.
-            //				/log(1-pow(double(maxInlierIdx.size())/ls.size(),2.0)));
-        }
+        for (int i = 0; i < maxInlierIdx.size(); ++i)
+            maxInlierIdx[i] = prob.lsIdx[maxInlierIdx[i]];
 
         if (maxInlierIdx.size() < 2) continue;
 
@@ -619,14 +610,22 @@ double collinearCheckUseVP(cv::Mat vp, vector<LineSegmt2d> &segments,
     cv::SVD::solveZ(A.t(), l); // line equation for a and vp
 
     // 2.  compute avarage pt to l distance from b
-    double sum = 0;
+    SoaPoints2d endpts;
 
     for (int i = 0; i < b.lsLids.size(); ++i)
     {
-        sum = sum + point2LineDist(l, segments[b.lsLids[i]].endpt1)
-              + point2LineDist(l, segments[b.lsLids[i]].endpt2);
+        endpts.push_back(segments[b.lsLids[i]].endpt1.x, segments[b.lsLids[i]].endpt1.y);
+        endpts.push_back(segments[b.lsLids[i]].endpt2.x, segments[b.lsLids[i]].endpt2.y);
     }
 
+    vector<double> dist(endpts.size());
+    pointLineDists(l.ptr<double>(), endpts.x.data(), endpts.y.data(), endpts.size(), dist.data());
+
+    double sum = 0;
+
+    for (int i = 0; i < dist.size(); ++i)
+        sum = sum + dist[i];
+
     return sum / (2 * b.lsLids.size());
 }
 
@@ -669,7 +668,7 @@ void View::extractIdealLines()
                 if (ilines[i][j].gradient.dot(ilines[i][k].gradient) < 0)
                     continue; // gradient not consistent, skip
 
-                if (point2LineDist(ilines[i][j].lineEq(), ilines[i][k].extremity1) > 20)
+                if (point2LineDist(ilines[i][j].lineVec(), ilines[i][k].extremity1) > 20)
                     continue;
 
                 if (collinearCheckUseVP(vp, lineSegments, ilines[i][j], ilines[i][k]) > 1 &&
@@ -738,6 +737,48 @@ void View::extractIdealLines()
     }
 }
 
+void View::releaseMatchingData()
+// drop images, raw line segments and descriptors, which are only needed to match
+// new frames; positions and ids of the features stay for bundle adjustment
+{
+    img.release();
+    grayImg.release();
+    vector<LineSegmt2d>().swap(lineSegments);
+
+    for (int i = 0; i < featurePoints.size(); ++i)
+        featurePoints[i].siftDesc.release();
+
+    for (int i = 0; i < idealLines.size(); ++i)
+        vector<cv::Mat>().swap(idealLines[i].msldDescs);
+}
+
+cv::Matx34d View::projection(const cv::Matx33d &_K) const
+// R and t stay cv::Mat, they are read element-wise so nothing is allocated
+{
+    cv::Matx34d Rt;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            Rt(i, j) = R.at<double>(i, j);
+
+        Rt(i, 3) = t.at<double>(i);
+    }
+
+    return _K * Rt;
+}
+
+cv::Vec3d View::center() const
+{
+    cv::Vec3d c;
+
+    for (int j = 0; j < 3; ++j)
+        c[j] = -(R.at<double>(0, j) * t.at<double>(0) + R.at<double>(1, j) * t.at<double>(1)
+                 + R.at<double>(2, j) * t.at<double>(2));
+
+    return c;
+}
+
 void View::drawLineSegmentGroup(vector<int> idx) // draw grouped line segments
 {
     cv::Mat canvas = img.clone();
@@ -36,6 +36,7 @@
 #include "features2d.h"
 
 class MfgSettings;
+class PreparedFrame;
 
 // View class collects information from a single view, including points,
 // lines etc
@@ -77,11 +78,16 @@ public:
     View() {}
     View(std::string imgName, cv::Mat _K, cv::Mat dc, MfgSettings *_settings);
     View(std::string imgName, cv::Mat _K, cv::Mat dc, int _id, MfgSettings *_settings);
+    View(const PreparedFrame &frm, MfgSettings *_settings);           // only deal with points
+    View(const PreparedFrame &frm, int _id, MfgSettings *_settings);
     void detectFeatPoints();			// detect feature points from image
     void detectLineSegments(cv::Mat);			// detect line segments from image
     void compMsld4AllSegments(cv::Mat grayImg);
     void detectVanishPoints();
     void extractIdealLines();
+    void releaseMatchingData();		// keep only pose and feature observations
+    cv::Matx34d projection(const cv::Matx33d &_K) const; // _K*[R|t], fixed size
+    cv::Vec3d   center() const;                          // -R'*t, fixed size
     void drawLineSegmentGroup(std::vector<int> idx);
     void drawAllLineSegments(bool write2file = false);
     void drawIdealLineGroup(std::vector<IdealLine2d>);
@@ -92,4 +98,7 @@ private:
     MfgSettings *mfgSettings;
 };
 
+// detect SIFT/SURF points with descriptors, alg is a FeatureDetectionAlgorithm
+void detectSiftSurfPoints(cv::Mat img, int alg, std::vector<FeatPoint2d> &featPts);
+
 #endif
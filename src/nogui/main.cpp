@@ -91,6 +91,7 @@ int main(int argc, char *argv[])
 
 	// Create 1st view
     View view0(imgName, K, distCoeffs, 0, mfgSettings);
+    IDEAL_IMAGE_WIDTH = view0.img.cols; // all frames are prepared to this width
     qDebug() << "View initialized";
     view0.frameId = atoi(imgName.substr(imgName.size() - imIdLen - 4, imIdLen).c_str());
    
@@ -101,7 +102,7 @@ int main(int argc, char *argv[])
     if (mfgSettings->getDetectGround())
     {
 		// Create MFG (with first view)
-        Mfg map(view0, ini_incrt, distCoeffs, 10);
+        Mfg map(std::move(view0), ini_incrt, distCoeffs, 10);
         mfgSettings->setKeypointAlgorithm(KPT_GFTT); // use gftt tracking
 
 		// Create, set, and start MFG thread
@@ -126,7 +127,7 @@ int main(int argc, char *argv[])
         view1.frameId = atoi(imgName.substr(imgName.size() - imIdLen - 4, imIdLen).c_str());
         
 		// Create MFG (with first two views)
-		Mfg map(view0, view1, 10);
+		Mfg map(std::move(view0), std::move(view1), 10);
         mfgSettings->setKeypointAlgorithm(KPT_GFTT); // use gftt tracking
 
 		// Create, set, and start MFG thread
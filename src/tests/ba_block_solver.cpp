@@ -0,0 +1,378 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Test of the parallel block solver of the bundle adjustment
+ *
+ * usage: test-ba-block-solver
+ *
+ * Builds the same random MFG bundle adjustment graph (cameras, one of them
+ * fixed, marginalized points and line points, vanishing points, a plane, all
+ * edge types of MFG, robust kernels on some edges) three times, and builds its
+ * system with g2o's BlockSolverX, with the stock BaBlockSolver and with
+ * BaParallelBlockSolver. H (pose, pose-landmark and landmark blocks) and b are
+ * compared entry by entry. Returns nonzero if any entry differs.
+ ********************************************************************************/
+
+// Standard library
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+// g2o
+#include "g2o/core/block_solver.h"
+#include "g2o/core/optimization_algorithm_levenberg.h"
+#include "g2o/core/robust_kernel_impl.h"
+#include "g2o/core/sparse_optimizer.h"
+#include "g2o/solvers/dense/linear_solver_dense.h"
+#include "g2o/types/sba/types_sba.h"
+
+// MFG
+#include "bablocksolver.h"
+#include "edge_cam_cam_dist.h"
+#include "edge_line_vp_cam.h"
+#include "edge_line_vp_plane.h"
+#include "edge_point_plane.h"
+#include "edge_vnpt_cam.h"
+#include "random.h"
+#include "settings.h"
+#include "utils.h"
+#include "vertex_plane.h"
+#include "vertex_vnpt.h"
+
+using namespace std;
+
+// globals of the MFG libraries
+int IDEAL_IMAGE_WIDTH = 640;
+double THRESH_POINT_MATCH_RATIO = 0.50;
+MfgSettings *mfgSettings;
+
+// solver with its system exposed as dense matrices
+template <class Solver>
+class ExposedSolver : public Solver
+{
+public:
+    ExposedSolver(typename Solver::LinearSolverType *linearSolver) : Solver(linearSolver) {}
+
+    int size() const { return this->_sizePoses + this->_sizeLandmarks; }
+
+    Eigen::MatrixXd H() const
+    // Hpp holds the upper triangle; Hll has no blocks between two landmarks here
+    {
+        int np = this->_sizePoses;
+        Eigen::MatrixXd H = Eigen::MatrixXd::Zero(size(), size());
+        addBlocks(*this->_Hpp, H, 0, 0, true);
+
+        if (this->_doSchur)
+        {
+            addBlocks(*this->_Hll, H, np, np, false);
+            addBlocks(*this->_Hpl, H, 0, np, true);
+        }
+
+        return H;
+    }
+
+    Eigen::VectorXd b() const
+    {
+        return Eigen::Map<const Eigen::VectorXd>(this->_b, size());
+    }
+
+private:
+    template <class M>
+    static void addBlocks(const M &sbm, Eigen::MatrixXd &H, int r0, int c0, bool mirror)
+    {
+        for (int c = 0; c < (int)sbm.blockCols().size(); ++c)
+        {
+            for (typename M::IntBlockMap::const_iterator it = sbm.blockCols()[c].begin();
+                    it != sbm.blockCols()[c].end(); ++it)
+            {
+                int r = it->first;
+                int ri = r0 + sbm.rowBaseOfBlock(r), ci = c0 + sbm.colBaseOfBlock(c);
+                const typename M::SparseMatrixBlock &blk = *it->second;
+                H.block(ri, ci, blk.rows(), blk.cols()) = blk;
+
+                if (mirror && (ri != ci || r0 != c0))
+                    H.block(ci, ri, blk.cols(), blk.rows()) = blk.transpose();
+            }
+        }
+    }
+};
+
+typedef ExposedSolver<g2o::BlockSolverX>     StockSolverX;
+typedef ExposedSolver<BaBlockSolver>         StockBaSolver;
+typedef ExposedSolver<BaParallelBlockSolver> ParallelBaSolver;
+
+static double urand(xrand_state *rng, double a, double b)
+{
+    return a + (b - a) * (xrand_r(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static Eigen::Vector3d urand3(xrand_state *rng, double a, double b)
+{
+    return Eigen::Vector3d(urand(rng, a, b), urand(rng, a, b), urand(rng, a, b));
+}
+
+static void setKernel(g2o::OptimizableGraph::Edge *e, xrand_state *rng)
+// Huber kernel on half the edges, with a delta the errors exceed at times
+{
+    if (xrand_r(rng) % 2 == 0) return;
+
+    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
+    rk->setDelta(urand(rng, 0.01, 1));
+    e->setRobustKernel(rk);
+}
+
+static void buildGraph(g2o::SparseOptimizer &opt, uint64_t seed)
+// the same graph for the same seed
+{
+    const int numCams = 5, numPts = 40, numVps = 2, numLines = 12;
+    xrand_state rng;
+    seed_xrand_r(&rng, seed);
+    int id = 0;
+
+    vector<g2o::VertexCam *> cams;
+
+    for (int i = 0; i < numCams; ++i)
+    {
+        Eigen::Vector3d axis = urand3(&rng, -1, 1).normalized();
+        Eigen::Quaterniond q(Eigen::AngleAxisd(urand(&rng, 0, 0.2), axis));
+        g2o::SBACam sc(q, Eigen::Vector3d(0.3 * i, 0, 0) + urand3(&rng, -0.05, 0.05));
+        sc.setKcam(500, 500, 320, 240, 0);
+        g2o::VertexCam *v = new g2o::VertexCam();
+        v->setId(id++);
+        v->setEstimate(sc);
+        v->setFixed(i == 0);
+        opt.addVertex(v);
+        cams.push_back(v);
+    }
+
+    vector<g2o::VertexVanishPoint *> vps;
+
+    for (int i = 0; i < numVps; ++i)
+    {
+        g2o::VertexVanishPoint *v = new g2o::VertexVanishPoint();
+        v->setId(id++);
+        v->setEstimate(urand3(&rng, -1, 1) + Eigen::Vector3d(0, 0, 2));
+        opt.addVertex(v);
+        vps.push_back(v);
+    }
+
+    g2o::VertexPlane3d *plane = new g2o::VertexPlane3d();
+    plane->setId(id++);
+    plane->setEstimate(Eigen::Vector3d(0.05, -0.1, -1).normalized() / 6);
+    opt.addVertex(plane);
+
+    // points, seen by all cameras with noisy measurements
+    for (int i = 0; i < numPts; ++i)
+    {
+        g2o::VertexSBAPointXYZ *v = new g2o::VertexSBAPointXYZ();
+        v->setId(id++);
+        v->setEstimate(urand3(&rng, -2, 2) + Eigen::Vector3d(0, 0, 6));
+        v->setMarginalized(true);
+        opt.addVertex(v);
+
+        for (int j = 0; j < numCams; ++j)
+        {
+            Eigen::Vector4d X(v->estimate()(0), v->estimate()(1), v->estimate()(2), 1);
+            Eigen::Vector3d x = cams[j]->estimate().w2i * X;
+            g2o::EdgeProjectP2MC *e = new g2o::EdgeProjectP2MC();
+            e->setVertex(0, v);
+            e->setVertex(1, cams[j]);
+            e->setMeasurement(Eigen::Vector2d(x(0) / x(2), x(1) / x(2)) + urand3(&rng, -2, 2).head<2>());
+            e->information() = urand(&rng, 0.5, 2) * Eigen::Matrix2d::Identity();
+            setKernel(e, &rng);
+            opt.addEdge(e);
+        }
+
+        // the first points are on the plane
+        if (i < 10)
+        {
+            g2o::EdgePointPlane3d *e = new g2o::EdgePointPlane3d();
+            e->setVertex(0, v);
+            e->setVertex(1, plane);
+            e->setMeasurement(0);
+            e->information() = 100 * Eigen::Matrix<double, 1, 1>::Identity();
+            setKernel(e, &rng);
+            opt.addEdge(e);
+        }
+    }
+
+    // line points, each on a line of a vanishing point seen by two cameras
+    for (int i = 0; i < numLines; ++i)
+    {
+        g2o::VertexSBAPointXYZ *v = new g2o::VertexSBAPointXYZ();
+        v->setId(id++);
+        v->setEstimate(urand3(&rng, -2, 2) + Eigen::Vector3d(0, 0, 6));
+        v->setMarginalized(true);
+        opt.addVertex(v);
+        g2o::VertexVanishPoint *vp = vps[i % numVps];
+
+        for (int j = 0; j < 2; ++j)
+        {
+            g2o::EdgeLineVpCam *e = new g2o::EdgeLineVpCam();
+            e->setVertex(0, v);
+            e->setVertex(1, vp);
+            e->setVertex(2, cams[(i + j) % numCams]);
+
+            for (int k = 0; k < 4; ++k)
+                e->segpts.push_back(cv::Point2d(urand(&rng, 0, 640), urand(&rng, 0, 480)));
+
+            e->information() = Eigen::Matrix<double, 1, 1>::Identity();
+            setKernel(e, &rng);
+            opt.addEdge(e);
+        }
+
+        if (i % 3 == 0)
+        {
+            Eigen::Vector3d A = urand3(&rng, -2, 2), B = urand3(&rng, -2, 2);
+            g2o::EdgeLineVpPlane *e = new g2o::EdgeLineVpPlane();
+            e->setVertex(0, v);
+            e->setVertex(1, vp);
+            e->setVertex(2, plane);
+            e->endptA = cv::Point3d(A(0), A(1), A(2) + 6);
+            e->endptB = cv::Point3d(B(0), B(1), B(2) + 6);
+            e->information() = 10 * Eigen::Matrix<double, 1, 1>::Identity();
+            setKernel(e, &rng);
+            opt.addEdge(e);
+        }
+    }
+
+    // vanishing points seen by every camera
+    for (int i = 0; i < numVps; ++i)
+    {
+        for (int j = 0; j < numCams; ++j)
+        {
+            Eigen::Vector3d w = cams[j]->estimate().w2n.block<3, 3>(0, 0) * vps[i]->estimate();
+            w = w.normalized() + urand3(&rng, -0.05, 0.05);
+            double a, b;
+            unitVec2angle((cv::Mat_<double>(3, 1) << w(0), w(1), w(2)), &a, &b);
+            g2o::EdgeVnptCam *e = new g2o::EdgeVnptCam();
+            e->setVertex(0, vps[i]);
+            e->setVertex(1, cams[j]);
+            e->setMeasurement(Eigen::Vector2d(a, b));
+            e->information() = 15 * Eigen::Matrix2d::Identity();
+            setKernel(e, &rng);
+            opt.addEdge(e);
+        }
+    }
+
+    // scale of the first moving camera
+    g2o::EdgeCamCamDist *e = new g2o::EdgeCamCamDist();
+    e->setVertex(0, cams[0]);
+    e->setVertex(1, cams[1]);
+    e->setMeasurement(0.3);
+    e->information() = Eigen::Matrix<double, 1, 1>::Identity();
+    opt.addEdge(e);
+}
+
+template <class Solver>
+static void buildSystem(uint64_t seed, Eigen::MatrixXd &H, Eigen::VectorXd &b)
+// the steps of OptimizationAlgorithmLevenberg::solve up to the linear solve
+{
+    typedef g2o::LinearSolverDense<typename Solver::PoseMatrixType> LinearSolver;
+    Solver *solver = new Solver(new LinearSolver());
+    g2o::OptimizationAlgorithmLevenberg *alg = new g2o::OptimizationAlgorithmLevenberg(solver);
+    g2o::SparseOptimizer opt;
+    opt.setAlgorithm(alg);
+    buildGraph(opt, seed);
+
+    opt.initializeOptimization();
+    opt.computeActiveErrors();
+    alg->init();
+    solver->buildStructure();
+    solver->buildSystem();
+
+    H = solver->H();
+    b = solver->b();
+}
+
+static int compare(const char *name, const Eigen::MatrixXd &H1, const Eigen::VectorXd &b1,
+                   const Eigen::MatrixXd &H2, const Eigen::VectorXd &b2)
+// number of entries of H and b that differ
+{
+    const double tol = 1e-9;
+
+    if (H1.rows() != H2.rows() || b1.size() != b2.size())
+    {
+        cout << name << ": system sizes differ, " << H1.rows() << " and " << H2.rows() << endl;
+        return 1;
+    }
+
+    int bad = 0;
+    double maxErr = 0;
+
+    for (int i = 0; i < H1.rows(); ++i)
+    {
+        for (int j = 0; j < H1.cols(); ++j)
+        {
+            double err = fabs(H1(i, j) - H2(i, j)) / max(1.0, fabs(H1(i, j)));
+            maxErr = max(maxErr, err);
+
+            if (err > tol)
+            {
+                if (bad < 10)
+                    cout << name << ": H(" << i << "," << j << ") " << H1(i, j) << " vs " << H2(i, j) << endl;
+
+                ++bad;
+            }
+        }
+
+        double err = fabs(b1(i) - b2(i)) / max(1.0, fabs(b1(i)));
+        maxErr = max(maxErr, err);
+
+        if (err > tol)
+        {
+            if (bad < 10)
+                cout << name << ": b(" << i << ") " << b1(i) << " vs " << b2(i) << endl;
+
+            ++bad;
+        }
+    }
+
+    cout << name << ": " << H1.rows() << "x" << H1.cols() << " system, " << bad
+         << " entries differ, max rel. error " << maxErr << endl;
+    return bad;
+}
+
+int main()
+{
+    int bad = 0;
+
+    for (uint64_t seed = 1; seed <= 5; ++seed)
+    {
+        Eigen::MatrixXd Hx, Hba, Hpar;
+        Eigen::VectorXd bx, bba, bpar;
+        buildSystem<StockSolverX>(seed, Hx, bx);
+        buildSystem<StockBaSolver>(seed, Hba, bba);
+        buildSystem<ParallelBaSolver>(seed, Hpar, bpar);
+
+        bad += compare("BlockSolverX vs BaParallelBlockSolver ", Hx, bx, Hpar, bpar);
+        bad += compare("BaBlockSolver vs BaParallelBlockSolver", Hba, bba, Hpar, bpar);
+    }
+
+    cout << (bad ? "FAILED" : "passed") << endl;
+    return bad == 0 ? 0 : 1;
+}
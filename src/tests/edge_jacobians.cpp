@@ -0,0 +1,252 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Test of the analytic jacobians of the custom g2o edges
+ *
+ * usage: test-edge-jacobians [num of configurations]
+ *
+ * For random configurations of each edge, compares linearizeOplus() with
+ * central differences of computeError() taken through the oplus of the
+ * vertices, so the update conventions of the vertices are tested as well.
+ * Prints the max error of each edge type, relative to the size of the
+ * jacobian block. Returns nonzero if any entry differs.
+ ********************************************************************************/
+
+// Standard library
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+// g2o
+#include "g2o/core/jacobian_workspace.h"
+#include "g2o/types/sba/types_sba.h"
+
+// MFG
+#include "edge_cam_cam_dist.h"
+#include "edge_line_vp_cam.h"
+#include "edge_line_vp_plane.h"
+#include "edge_point_plane.h"
+#include "edge_vnpt_cam.h"
+#include "random.h"
+#include "settings.h"
+#include "utils.h"
+#include "vertex_plane.h"
+#include "vertex_vnpt.h"
+
+using namespace std;
+
+// globals of the MFG libraries
+int IDEAL_IMAGE_WIDTH = 640;
+double THRESH_POINT_MATCH_RATIO = 0.50;
+MfgSettings *mfgSettings;
+
+static double urand(xrand_state *rng, double a, double b)
+{
+    return a + (b - a) * (xrand_r(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static Eigen::Vector3d urand3(xrand_state *rng, double a, double b)
+{
+    return Eigen::Vector3d(urand(rng, a, b), urand(rng, a, b), urand(rng, a, b));
+}
+
+static g2o::VertexCam *randomCam(xrand_state *rng)
+// camera near the origin, looking roughly along +z
+{
+    Eigen::Vector3d axis = urand3(rng, -1, 1).normalized();
+    Eigen::Quaterniond q(Eigen::AngleAxisd(urand(rng, 0, 0.3), axis));
+    g2o::SBACam sc(q, urand3(rng, -1, 1));
+    sc.setKcam(500, 500, 320, 240, 0);
+
+    g2o::VertexCam *v = new g2o::VertexCam();
+    v->setEstimate(sc);
+    return v;
+}
+
+static g2o::VertexSBAPointXYZ *randomPoint(xrand_state *rng)
+{
+    g2o::VertexSBAPointXYZ *v = new g2o::VertexSBAPointXYZ();
+    v->setEstimate(urand3(rng, -2, 2) + Eigen::Vector3d(0, 0, 6));
+    return v;
+}
+
+static g2o::VertexVanishPoint *randomVanishPoint(xrand_state *rng)
+{
+    g2o::VertexVanishPoint *v = new g2o::VertexVanishPoint();
+    v->setEstimate(urand3(rng, -1, 1) + Eigen::Vector3d(0, 0, 2));
+    return v;
+}
+
+static g2o::VertexPlane3d *randomPlane(xrand_state *rng)
+// plane n'*x + d = 0 stored as n/d
+{
+    g2o::VertexPlane3d *v = new g2o::VertexPlane3d();
+    v->setEstimate(urand3(rng, -1, 1).normalized() / urand(rng, 2, 8));
+    return v;
+}
+
+static int checkEdge(const char *name, g2o::OptimizableGraph::Edge *e, double &maxErr)
+// number of jacobian blocks that differ from central differences; maxErr is
+// raised to the max error of the blocks
+{
+    const double h = 1e-6, tol = 1e-4;
+    int D = e->dimension(), bad = 0;
+
+    g2o::JacobianWorkspace ws;
+    ws.updateSize(e);
+    ws.allocate();
+    e->linearizeOplus(ws);
+
+    for (int i = 0; i < e->vertices().size(); ++i)
+    {
+        g2o::OptimizableGraph::Vertex *v = static_cast<g2o::OptimizableGraph::Vertex *>(e->vertex(i));
+        int Dv = v->dimension();
+        Eigen::Map<Eigen::MatrixXd> Ja(ws.workspaceForVertex(i), D, Dv);
+        Eigen::MatrixXd Jn(D, Dv);
+
+        for (int k = 0; k < Dv; ++k)
+        {
+            vector<double> dx(Dv, 0);
+            Eigen::VectorXd ep(D), em(D);
+
+            dx[k] = h;
+            v->push();
+            v->oplus(&dx[0]);
+            e->computeError();
+            ep = Eigen::Map<const Eigen::VectorXd>(e->errorData(), D);
+            v->pop();
+
+            dx[k] = -h;
+            v->push();
+            v->oplus(&dx[0]);
+            e->computeError();
+            em = Eigen::Map<const Eigen::VectorXd>(e->errorData(), D);
+            v->pop();
+
+            Jn.col(k) = (ep - em) / (2 * h);
+        }
+
+        double scale = max(1.0, Jn.cwiseAbs().maxCoeff());
+        double err = (Ja - Jn).cwiseAbs().maxCoeff() / scale;
+        maxErr = max(maxErr, err);
+
+        if (err > tol)
+        {
+            ++bad;
+            cout << name << ": vertex " << i << " analytic\n" << Ja << "\nnumeric\n" << Jn << endl;
+        }
+    }
+
+    return bad;
+}
+
+static void deleteEdge(g2o::OptimizableGraph::Edge *e)
+{
+    for (int i = 0; i < e->vertices().size(); ++i)
+        delete e->vertex(i);
+
+    delete e;
+}
+
+int main(int argc, char *argv[])
+{
+    int numConfigs = argc > 1 ? atoi(argv[1]) : 200;
+    int bad = 0;
+    double maxErr[5] = {0, 0, 0, 0, 0};
+    const char *names[5] = {"EdgeCamCamDist", "EdgeVnptCam", "EdgeLineVpCam", "EdgeLineVpPlane",
+                            "EdgePointPlane3d"};
+    xrand_state rng;
+    seed_xrand_r(&rng, 1);
+
+    for (int n = 0; n < numConfigs; ++n)
+    {
+        {
+            g2o::EdgeCamCamDist *e = new g2o::EdgeCamCamDist();
+            e->setVertex(0, randomCam(&rng));
+            e->setVertex(1, randomCam(&rng));
+            e->setMeasurement(urand(&rng, 0.5, 2));
+            bad += checkEdge(names[0], e, maxErr[0]);
+            deleteEdge(e);
+        }
+
+        {
+            g2o::EdgeVnptCam *e = new g2o::EdgeVnptCam();
+            g2o::VertexVanishPoint *vp = randomVanishPoint(&rng);
+            g2o::VertexCam *cam = randomCam(&rng);
+            // measured direction a few degrees off the predicted one
+            Eigen::Vector3d w = cam->estimate().w2n.block<3, 3>(0, 0) * vp->estimate();
+            w = w.normalized() + urand3(&rng, -0.1, 0.1);
+            double a, b;
+            unitVec2angle((cv::Mat_<double>(3, 1) << w(0), w(1), w(2)), &a, &b);
+            e->setVertex(0, vp);
+            e->setVertex(1, cam);
+            e->setMeasurement(Eigen::Vector2d(a, b));
+            bad += checkEdge(names[1], e, maxErr[1]);
+            deleteEdge(e);
+        }
+
+        {
+            g2o::EdgeLineVpCam *e = new g2o::EdgeLineVpCam();
+            e->setVertex(0, randomPoint(&rng));
+            e->setVertex(1, randomVanishPoint(&rng));
+            e->setVertex(2, randomCam(&rng));
+
+            for (int i = 0; i < 4; ++i)
+                e->segpts.push_back(cv::Point2d(urand(&rng, 0, 640), urand(&rng, 0, 480)));
+
+            bad += checkEdge(names[2], e, maxErr[2]);
+            deleteEdge(e);
+        }
+
+        {
+            g2o::EdgeLineVpPlane *e = new g2o::EdgeLineVpPlane();
+            Eigen::Vector3d A = urand3(&rng, -2, 2), B = urand3(&rng, -2, 2);
+            e->setVertex(0, randomPoint(&rng));
+            e->setVertex(1, randomVanishPoint(&rng));
+            e->setVertex(2, randomPlane(&rng));
+            e->endptA = cv::Point3d(A(0), A(1), A(2) + 6);
+            e->endptB = cv::Point3d(B(0), B(1), B(2) + 6);
+            bad += checkEdge(names[3], e, maxErr[3]);
+            deleteEdge(e);
+        }
+
+        {
+            g2o::EdgePointPlane3d *e = new g2o::EdgePointPlane3d();
+            e->setVertex(0, randomPoint(&rng));
+            e->setVertex(1, randomPlane(&rng));
+            e->setMeasurement(0);
+            bad += checkEdge(names[4], e, maxErr[4]);
+            deleteEdge(e);
+        }
+    }
+
+    for (int i = 0; i < 5; ++i)
+        cout << names[i] << ": max error " << maxErr[i] << endl;
+
+    cout << numConfigs << " configurations per edge, " << bad << " jacobian blocks differ" << endl;
+    return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Test of the generic RANSAC
+ *
+ * usage: test-ransac
+ *
+ * Fits 2D lines to synthetic points with outliers through ransac() with each
+ * of its options: plain, parallel, PROSAC, SPRT and local optimization. Checks
+ * that the line and its inliers are found, that the result does not depend on
+ * the scoring being parallel, and that the statistics are consistent. Returns
+ * nonzero if any check fails.
+ ********************************************************************************/
+
+// Standard library
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+// MFG
+#include "random.h"
+#include "ransac.h"
+
+using namespace std;
+
+// Line a*x + b*y + c = 0, (a, b) of unit norm, through 2 points; the error of a
+// point is its distance to the line
+struct LineProblem : public RansacProblem
+{
+    struct Model { double a, b, c; };
+    enum { SAMPLE_SIZE = 2, MAX_MODELS = 1 };
+
+    vector<double> x, y;
+
+    int numData() const { return x.size(); }
+
+    int fit(const int *sample, Model *models) const
+    {
+        double dx = x[sample[1]] - x[sample[0]], dy = y[sample[1]] - y[sample[0]];
+        double len = sqrt(dx * dx + dy * dy);
+
+        if (len < 1e-12) return 0;
+
+        models[0].a = -dy / len;
+        models[0].b = dx / len;
+        models[0].c = -(models[0].a * x[sample[0]] + models[0].b * y[sample[0]]);
+        return 1;
+    }
+
+    void errors(const Model &m, int begin, int end, double *err) const
+    {
+        for (int i = begin; i < end; ++i)
+            err[i - begin] = fabs(m.a * x[i] + m.b * y[i] + m.c);
+    }
+
+    // total least squares on the inliers
+    bool refit(const vector<int> &inliers, Model &m) const
+    {
+        int n = inliers.size();
+        double mx = 0, my = 0, sxx = 0, sxy = 0, syy = 0;
+
+        if (n < 2) return false;
+
+        for (int i = 0; i < n; ++i)
+        {
+            mx += x[inliers[i]] / n;
+            my += y[inliers[i]] / n;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            double dx = x[inliers[i]] - mx, dy = y[inliers[i]] - my;
+            sxx += dx * dx;
+            sxy += dx * dy;
+            syy += dy * dy;
+        }
+
+        // normal is the eigenvector of the smaller eigenvalue of the scatter
+        double theta = 0.5 * atan2(2 * sxy, sxx - syy);
+        m.a = -sin(theta);
+        m.b = cos(theta);
+        m.c = -(m.a * mx + m.b * my);
+        return true;
+    }
+};
+
+static double urand(xrand_state *rng, double a, double b)
+{
+    return a + (b - a) * (xrand_r(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// points of the line y = 0.5*x + 2 with noise, and outliers; with inliersFirst
+// the inliers come first, as data sorted best first for PROSAC
+static LineProblem lineData(xrand_state *rng, int numInliers, int numOutliers, bool inliersFirst,
+                            vector<bool> &isInlier)
+{
+    LineProblem prob;
+    int N = numInliers + numOutliers;
+
+    isInlier.assign(N, false);
+
+    // inliers at positions chosen by a shuffle unless inliersFirst
+    vector<int> pos(N);
+
+    for (int i = 0; i < N; ++i) pos[i] = i;
+
+    if (!inliersFirst)
+        for (int i = N - 1; i > 0; --i)
+            swap(pos[i], pos[xrand_r(rng) % (i + 1)]);
+
+    prob.x.resize(N);
+    prob.y.resize(N);
+
+    for (int k = 0; k < N; ++k)
+    {
+        int i = pos[k];
+        double x = urand(rng, -10, 10);
+
+        if (k < numInliers)
+        {
+            prob.x[i] = x;
+            prob.y[i] = 0.5 * x + 2 + urand(rng, -0.05, 0.05);
+            isInlier[i] = true;
+        }
+        else
+        {
+            prob.x[i] = x;
+            prob.y[i] = urand(rng, -10, 10);
+
+            // keep outliers clearly off the line
+            if (fabs(prob.y[i] - 0.5 * x - 2) < 1) prob.y[i] += 3;
+        }
+    }
+
+    return prob;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        ++failures;
+        cout << "FAILED: " << what << endl;
+    }
+}
+
+static int inliersFound(const vector<int> &inliers, const vector<bool> &isInlier)
+{
+    int n = 0;
+
+    for (int i = 0; i < (int)inliers.size(); ++i)
+        n += isInlier[inliers[i]];
+
+    return n;
+}
+
+static void testOptions(const char *name, const LineProblem &prob, const vector<bool> &isInlier,
+                        const RansacOptions &opts, int numInliers)
+{
+    xrand_state rng;
+    seed_xrand_r(&rng, 7);
+
+    LineProblem::Model m;
+    vector<int> inliers;
+    RansacStats stats;
+    int score = ransac(prob, opts, &rng, m, inliers, &stats);
+
+    cout << name << ": score " << score << ", " << stats.iterations << " hypotheses, "
+         << stats.models << " models, " << stats.rejected << " cut short, "
+         << stats.evaluations << " errors, " << stats.loRuns << " local optimizations" << endl;
+
+    // a point is an inlier of the true line within the noise, so a model of
+    // the line keeps nearly all of them
+    check(inliersFound(inliers, isInlier) >= 0.95 * numInliers, name);
+    check(inliers.size() - inliersFound(inliers, isInlier) <= 0.05 * numInliers, name);
+    check(fabs(-m.a / m.b - 0.5) < 0.02 && fabs(-m.c / m.b - 2) < 0.1, name);
+    check(score == stats.score && score == (int)inliers.size(), name);
+    check(stats.iterations > 0 && stats.iterations <= opts.maxIter, name);
+    check(stats.models >= stats.rejected && stats.evaluations > 0, name);
+    check((opts.loIter > 0) == (stats.loRuns > 0), name);
+}
+
+int main()
+{
+    const int numInliers = 300, numOutliers = 200;
+    xrand_state rng;
+    seed_xrand_r(&rng, 1);
+
+    vector<bool> isInlier, isInlierSorted;
+    LineProblem prob = lineData(&rng, numInliers, numOutliers, false, isInlier);
+    LineProblem sorted = lineData(&rng, numInliers, numOutliers, true, isInlierSorted);
+
+    RansacOptions opts;
+    opts.maxIter = 200;
+    opts.threshold = 0.1;
+    testOptions("plain", prob, isInlier, opts, numInliers);
+
+    opts.confidence = 0.999;
+    testOptions("adaptive", prob, isInlier, opts, numInliers);
+
+    RansacOptions lo = opts;
+    lo.loIter = 5;
+    testOptions("LO", prob, isInlier, lo, numInliers);
+
+    RansacOptions sprt = opts;
+    sprt.sprt = true;
+    sprt.earlyBound = false;
+    testOptions("SPRT", prob, isInlier, sprt, numInliers);
+
+    RansacOptions prosac = opts;
+    prosac.prosac = true;
+    testOptions("PROSAC", sorted, isInlierSorted, prosac, numInliers);
+
+    // the result must not depend on the scoring being parallel
+    RansacOptions par = lo;
+    par.parallel = true;
+    LineProblem::Model m1, m2;
+    vector<int> in1, in2;
+    RansacStats st1, st2;
+    xrand_state r1, r2;
+    seed_xrand_r(&r1, 3);
+    seed_xrand_r(&r2, 3);
+    ransac(prob, lo, &r1, m1, in1, &st1);
+    ransac(prob, par, &r2, m2, in2, &st2);
+    check(in1 == in2 && m1.a == m2.a && m1.b == m2.b && m1.c == m2.c, "parallel");
+    check(st1.iterations == st2.iterations && st1.evaluations == st2.evaluations, "parallel stats");
+
+    // fewer data than a sample: no model, best untouched
+    LineProblem one;
+    one.x.push_back(0);
+    one.y.push_back(0);
+    LineProblem::Model m = {1, 2, 3};
+    vector<int> inliers;
+    check(ransac(one, opts, &rng, m, inliers) == 0 && inliers.empty() && m.a == 1 && m.c == 3,
+          "too few data");
+
+    cout << (failures ? "FAILED" : "passed") << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -37,6 +37,15 @@ enum FeatureDetectionAlgorithm
     KPT_GFTT = 3
 };
 
+// Linear solvers for the reduced camera system of bundle adjustment
+enum BaLinearSolver
+{
+    BA_SOLVER_CSPARSE = 0,
+    BA_SOLVER_CHOLMOD = 1,
+    BA_SOLVER_DENSE = 2,
+    BA_SOLVER_PCG = 3
+};
+
 static const double PI = 3.14159265;
 
 #endif
@@ -0,0 +1,173 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Madison Treat, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Batched geometric error kernels on SoA buffers
+ ********************************************************************************/
+
+#include "geokernels.h"
+
+#include <math.h>
+
+// Each kernel is written once for a type T, double for the points left over or
+// vd, a vector of W doubles; vd has the arithmetic operators of GCC and Clang
+// vector types, so SIMD is only used with these compilers.
+
+#if defined(__GNUC__) && defined(__AVX2__)
+
+#include <immintrin.h>
+#define GEOKERNELS_SIMD
+
+typedef __m256d vd;
+static const int W = 4;
+
+static inline vd vload(const double *p) { return _mm256_loadu_pd(p); }
+static inline void vstore(double *p, vd a) { _mm256_storeu_pd(p, a); }
+static inline vd vset(double a) { return _mm256_set1_pd(a); }
+static inline vd vsqrt(vd a) { return _mm256_sqrt_pd(a); }
+static inline vd vabs(vd a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+
+#elif defined(__GNUC__) && defined(__SSE2__)
+
+#include <emmintrin.h>
+#define GEOKERNELS_SIMD
+
+typedef __m128d vd;
+static const int W = 2;
+
+static inline vd vload(const double *p) { return _mm_loadu_pd(p); }
+static inline void vstore(double *p, vd a) { _mm_storeu_pd(p, a); }
+static inline vd vset(double a) { return _mm_set1_pd(a); }
+static inline vd vsqrt(vd a) { return _mm_sqrt_pd(a); }
+static inline vd vabs(vd a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+
+#endif
+
+static inline double vsqrt(double a) { return sqrt(a); }
+static inline double vabs(double a) { return fabs(a); }
+
+template<class T>
+static inline T sampson(const T *F, T x1, T y1, T w1, T x2, T y2, T w2)
+{
+    T a0 = F[0] * x1 + F[1] * y1 + F[2] * w1; // F * x1
+    T a1 = F[3] * x1 + F[4] * y1 + F[5] * w1;
+    T b0 = F[0] * x2 + F[3] * y2 + F[6] * w2; // F' * x2
+    T b1 = F[1] * x2 + F[4] * y2 + F[7] * w2;
+    T b2 = F[2] * x2 + F[5] * y2 + F[8] * w2;
+    T e = x1 * b0 + y1 * b1 + w1 * b2;
+    return e * e / (a0 * a0 + a1 * a1 + b0 * b0 + b1 * b1);
+}
+
+template<class T>
+static inline T reproj(const T *P, T X, T Y, T Z, T u, T v)
+{
+    T p0 = P[0] * X + P[1] * Y + P[2] * Z + P[3];
+    T p1 = P[4] * X + P[5] * Y + P[6] * Z + P[7];
+    T p2 = P[8] * X + P[9] * Y + P[10] * Z + P[11];
+    T du = p0 / p2 - u, dv = p1 / p2 - v;
+    return vsqrt(du * du + dv * dv);
+}
+
+template<class T>
+static inline T planeDist(const T *pl, T s, T x, T y, T z)
+{
+    return vabs(pl[0] * x + pl[1] * y + pl[2] * z + pl[3]) * s;
+}
+
+template<class T>
+static inline T lineDist(const T *l, T s, T x, T y)
+{
+    return vabs(l[0] * x + l[1] * y + l[2]) * s;
+}
+
+void sampsonErrors(const double *F,
+                   const double *x1, const double *y1, const double *w1,
+                   const double *x2, const double *y2, const double *w2,
+                   int n, double *err)
+{
+    int i = 0;
+
+#ifdef GEOKERNELS_SIMD
+    vd f[9];
+
+    for (int k = 0; k < 9; ++k) f[k] = vset(F[k]);
+
+    for (; i + W <= n; i += W)
+        vstore(err + i, sampson(f, vload(x1 + i), vload(y1 + i), vload(w1 + i),
+                                vload(x2 + i), vload(y2 + i), vload(w2 + i)));
+#endif
+
+    for (; i < n; ++i)
+        err[i] = sampson(F, x1[i], y1[i], w1[i], x2[i], y2[i], w2[i]);
+}
+
+void reprojErrors(const double *P, const double *X, const double *Y, const double *Z,
+                  const double *u, const double *v, int n, double *err)
+{
+    int i = 0;
+
+#ifdef GEOKERNELS_SIMD
+    vd p[12];
+
+    for (int k = 0; k < 12; ++k) p[k] = vset(P[k]);
+
+    for (; i + W <= n; i += W)
+        vstore(err + i, reproj(p, vload(X + i), vload(Y + i), vload(Z + i),
+                               vload(u + i), vload(v + i)));
+#endif
+
+    for (; i < n; ++i)
+        err[i] = reproj(P, X[i], Y[i], Z[i], u[i], v[i]);
+}
+
+void pointPlaneDists(const double *plane, const double *x, const double *y, const double *z,
+                     int n, double *dist)
+{
+    int i = 0;
+    double s = 1 / sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+#ifdef GEOKERNELS_SIMD
+    vd pl[4] = {vset(plane[0]), vset(plane[1]), vset(plane[2]), vset(plane[3])};
+
+    for (; i + W <= n; i += W)
+        vstore(dist + i, planeDist(pl, vset(s), vload(x + i), vload(y + i), vload(z + i)));
+#endif
+
+    for (; i < n; ++i)
+        dist[i] = planeDist(plane, s, x[i], y[i], z[i]);
+}
+
+void pointLineDists(const double *line, const double *x, const double *y, int n, double *dist)
+{
+    int i = 0;
+    double s = 1 / sqrt(line[0] * line[0] + line[1] * line[1]);
+
+#ifdef GEOKERNELS_SIMD
+    vd l[3] = {vset(line[0]), vset(line[1]), vset(line[2])};
+
+    for (; i + W <= n; i += W)
+        vstore(dist + i, lineDist(l, vset(s), vload(x + i), vload(y + i)));
+#endif
+
+    for (; i < n; ++i)
+        dist[i] = lineDist(line, s, x[i], y[i]);
+}
@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Madison Treat, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Batched geometric error kernels on SoA buffers
+ ********************************************************************************/
+
+#ifndef GEOKERNELS_H_
+#define GEOKERNELS_H_
+
+#include <vector>
+
+// The kernels compute one error per point of arrays holding one coordinate
+// each. They use AVX2 or SSE2 when the build enables it (-mavx2 or
+// -march=native, SSE2 is always on for x86-64) and plain loops otherwise; the
+// results are the same up to rounding.
+
+// squared sampson error of x2'*F*x1 = 0, F row major; the same as fund_samperr
+void sampsonErrors(const double *F,
+                   const double *x1, const double *y1, const double *w1,
+                   const double *x2, const double *y2, const double *w2,
+                   int n, double *err);
+
+// distance between the image points (u,v) and the projections of (X,Y,Z) by P,
+// 3x4 row major
+void reprojErrors(const double *P, const double *X, const double *Y, const double *Z,
+                  const double *u, const double *v, int n, double *err);
+
+// distance of 3d points to the plane [n' d]*[x;1] = 0, n need not be unit
+void pointPlaneDists(const double *plane, const double *x, const double *y, const double *z,
+                     int n, double *dist);
+
+// distance of 2d points to the line ax+by+c = 0, line = (a, b, c)
+void pointLineDists(const double *line, const double *x, const double *y, int n, double *dist);
+
+// Point buffers for the kernels
+struct SoaPoints2d
+{
+    std::vector<double> x, y;
+
+    int size() const { return x.size(); }
+
+    void push_back(double _x, double _y)
+    {
+        x.push_back(_x);
+        y.push_back(_y);
+    }
+};
+
+struct SoaPoints3d
+{
+    std::vector<double> x, y, z;
+
+    int size() const { return x.size(); }
+
+    void push_back(double _x, double _y, double _z)
+    {
+        x.push_back(_x);
+        y.push_back(_y);
+        z.push_back(_z);
+    }
+};
+
+#endif
@@ -0,0 +1,175 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Uniform grid over image points for neighborhood queries
+ ********************************************************************************/
+
+#include "pointgrid.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+void PointGrid::build(const vector<cv::Point2d> &_pts, double _cellSize)
+{
+    pts = _pts;
+    cellSize = _cellSize > 0 ? _cellSize : 1;
+    cols = rows = 0;
+    cellStart.clear();
+    cellPts.clear();
+
+    if (pts.empty()) return;
+
+    double x1 = pts[0].x, y1 = pts[0].y;
+    x0 = x1;
+    y0 = y1;
+
+    for (int i = 1; i < pts.size(); ++i)
+    {
+        x0 = min(x0, pts[i].x);
+        y0 = min(y0, pts[i].y);
+        x1 = max(x1, pts[i].x);
+        y1 = max(y1, pts[i].y);
+    }
+
+    // at most about 1024 cells per side, whatever the spread of the points
+    cellSize = max(cellSize, max(x1 - x0, y1 - y0) / 1024);
+    cols = (int)floor((x1 - x0) / cellSize) + 1;
+    rows = (int)floor((y1 - y0) / cellSize) + 1;
+
+    // counting sort of the points by cell
+    vector<int> cell(pts.size());
+    cellStart.assign(cols * rows + 1, 0);
+
+    for (int i = 0; i < pts.size(); ++i)
+    {
+        int c = min(cols - 1, (int)((pts[i].x - x0) / cellSize)),
+            r = min(rows - 1, (int)((pts[i].y - y0) / cellSize));
+        cell[i] = r * cols + c;
+        ++cellStart[cell[i] + 1];
+    }
+
+    for (int k = 0; k < cols * rows; ++k)
+        cellStart[k + 1] += cellStart[k];
+
+    vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    cellPts.resize(pts.size());
+
+    for (int i = 0; i < pts.size(); ++i)
+        cellPts[fill[cell[i]]++] = i;
+}
+
+void PointGrid::appendRow(int r, int c0, int c1, vector<int> &idx) const
+{
+    c0 = max(c0, 0);
+    c1 = min(c1, cols - 1);
+
+    if (r < 0 || r >= rows || c0 > c1) return;
+
+    idx.insert(idx.end(), cellPts.begin() + cellStart[r * cols + c0],
+               cellPts.begin() + cellStart[r * cols + c1 + 1]);
+}
+
+void PointGrid::queryBox(double bx0, double by0, double bx1, double by1, vector<int> &idx) const
+{
+    idx.clear();
+
+    if (pts.empty()) return;
+
+    int c0 = (int)floor((bx0 - x0) / cellSize), c1 = (int)floor((bx1 - x0) / cellSize),
+        r0 = (int)floor((by0 - y0) / cellSize), r1 = (int)floor((by1 - y0) / cellSize);
+
+    for (int r = max(r0, 0); r <= min(r1, rows - 1); ++r)
+        appendRow(r, c0, c1, idx);
+
+    sort(idx.begin(), idx.end());
+}
+
+void PointGrid::queryBand(cv::Point2d a, cv::Point2d b, double halfWidth, vector<int> &idx) const
+// the band is a convex quadrilateral, each row of cells is visited over the x
+// range the band covers within the row
+{
+    idx.clear();
+
+    if (pts.empty()) return;
+
+    double len = cv::norm(b - a);
+
+    if (len <= 0)
+    {
+        queryBox(a.x - halfWidth, a.y - halfWidth, a.x + halfWidth, a.y + halfWidth, idx);
+        return;
+    }
+
+    cv::Point2d n(-(b.y - a.y) * halfWidth / len, (b.x - a.x) * halfWidth / len);
+    cv::Point2d q[4] = {a + n, b + n, b - n, a - n};
+    double qy0 = q[0].y, qy1 = q[0].y;
+
+    for (int k = 1; k < 4; ++k)
+    {
+        qy0 = min(qy0, q[k].y);
+        qy1 = max(qy1, q[k].y);
+    }
+
+    double eps = 1e-9 * cellSize;
+    int r0 = max(0, (int)floor((qy0 - y0) / cellSize)),
+        r1 = min(rows - 1, (int)floor((qy1 - y0) / cellSize));
+
+    for (int r = r0; r <= r1; ++r)
+    {
+        // x range of the band within the strip [sy0, sy1]
+        double sy0 = y0 + r * cellSize - eps, sy1 = y0 + (r + 1) * cellSize + eps;
+        double xmin = 1e300, xmax = -1e300;
+
+        for (int k = 0; k < 4; ++k)
+        {
+            const cv::Point2d &p = q[k], &p2 = q[(k + 1) % 4];
+
+            if (p.y >= sy0 && p.y <= sy1)
+            {
+                xmin = min(xmin, p.x);
+                xmax = max(xmax, p.x);
+            }
+
+            double ys[2] = {sy0, sy1};
+
+            for (int s = 0; s < 2; ++s)
+            {
+                if ((p.y - ys[s]) * (p2.y - ys[s]) < 0)
+                {
+                    double x = p.x + (ys[s] - p.y) * (p2.x - p.x) / (p2.y - p.y);
+                    xmin = min(xmin, x);
+                    xmax = max(xmax, x);
+                }
+            }
+        }
+
+        if (xmin > xmax) continue;
+
+        appendRow(r, (int)floor((xmin - eps - x0) / cellSize),
+                  (int)floor((xmax + eps - x0) / cellSize), idx);
+    }
+
+    sort(idx.begin(), idx.end());
+}
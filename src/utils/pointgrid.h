@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Uniform grid over image points for neighborhood queries
+ ********************************************************************************/
+
+#ifndef POINTGRID_H_
+#define POINTGRID_H_
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// PointGrid buckets a set of image points into square cells, stored as one
+// array of point indices sorted by cell and the start of each cell in it. It is
+// built once per point set; a query only visits the cells it overlaps, so its
+// cost grows with the number of points near the query region, not with the
+// size of the set. Queries return a superset of the points in the region, in
+// ascending index order; the caller applies its exact test.
+class PointGrid
+{
+public:
+    PointGrid() : cellSize(1), cols(0), rows(0) {}
+    PointGrid(const std::vector<cv::Point2d> &_pts, double _cellSize) { build(_pts, _cellSize); }
+
+    void build(const std::vector<cv::Point2d> &_pts, double _cellSize);
+
+    int size() const { return pts.size(); }
+    const cv::Point2d &pt(int i) const { return pts[i]; }
+
+    // points of the cells overlapping the rectangle of half width halfWidth
+    // around segment a-b
+    void queryBand(cv::Point2d a, cv::Point2d b, double halfWidth, std::vector<int> &idx) const;
+
+    // points of the cells overlapping the box [x0,x1]x[y0,y1]
+    void queryBox(double x0, double y0, double x1, double y1, std::vector<int> &idx) const;
+
+private:
+    std::vector<cv::Point2d> pts;
+    double           cellSize;
+    double           x0, y0;      // corner of cell (0,0)
+    int              cols, rows;
+    std::vector<int> cellStart;   // cols*rows+1 offsets into cellPts
+    std::vector<int> cellPts;     // point indices, grouped by cell
+
+    void appendRow(int r, int c0, int c1, std::vector<int> &idx) const;
+};
+
+#endif
@@ -71,8 +71,11 @@ uint64_t xorshift1024star(void)
  * algorithm, then using that seeded algorithm to generate the 1024-bit seed for
  * the 1024-bit algorithm (the real seed value for our implementation).
  */
+static uint64_t run_seed; /* seed of the whole run, see seed_xrand_task() */
+
 void seed_xrand(uint64_t seed)
 {
+    run_seed = seed;
     x = seed;
 
     for (int i = 0; i < 16; i++)
@@ -83,3 +86,54 @@ uint64_t xrand(void)
 {
     return xorshift1024star();
 }
+
+/*
+ * Same seeding and algorithm as above, on a caller owned state.
+ */
+void seed_xrand_r(xrand_state *state, uint64_t seed)
+{
+    uint64_t x = seed;
+
+    for (int i = 0; i < 16; i++)
+    {
+        x ^= x >> 12; // a
+        x ^= x << 25; // b
+        x ^= x >> 27; // c
+        state->s[i] = x * UINT64_C(2685821657736338717);
+    }
+
+    state->p = 0;
+    state->key = seed;
+}
+
+uint64_t xrand_r(xrand_state *state)
+{
+    uint64_t s0 = state->s[ state->p ];
+    uint64_t s1 = state->s[ state->p = (state->p + 1) & 15 ];
+    s1 ^= s1 << 31; // a
+    s1 ^= s1 >> 11; // b
+    s0 ^= s0 >> 30; // c
+    return (state->s[ state->p ] = s0 ^ s1) * UINT64_C(1181783497276652981);
+}
+
+/*
+ * SplitMix64 (Steele, Lea, Flood 2014) of the parent key and the task id.
+ */
+static uint64_t split_key(uint64_t key, uint64_t task)
+{
+    uint64_t z = key + (task + 1) * UINT64_C(0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    z ^= z >> 31;
+    return z ? z : 1; /* xorshift needs a nonzero seed */
+}
+
+void split_xrand_r(const xrand_state *parent, uint64_t task, xrand_state *child)
+{
+    seed_xrand_r(child, split_key(parent->key, task));
+}
+
+void seed_xrand_task(xrand_state *state, uint64_t site, uint64_t task)
+{
+    seed_xrand_r(state, split_key(split_key(run_seed, site), task));
+}
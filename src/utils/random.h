@@ -70,6 +70,45 @@ uint64_t xorshift1024star(void);
 void seed_xrand(uint64_t val);
 uint64_t xrand(void);
 
+/*
+ * Reentrant variant of xorshift1024star() keeping its state in the caller, for
+ * computations that need a stream of their own, independent of the order in
+ * which other code draws from xrand().
+ */
+typedef struct
+{
+    uint64_t s[ 16 ];
+    int p;
+    uint64_t key; /* seed of the stream, used to split it */
+} xrand_state;
+
+void seed_xrand_r(xrand_state *state, uint64_t val);
+uint64_t xrand_r(xrand_state *state);
+
+/*
+ * Splittable streams: the stream of a sub-task is derived from the key of its
+ * parent and a task id by a SplitMix64 step, without drawing from the parent.
+ * Tasks that run in parallel get the same numbers whatever the thread count or
+ * the order in which they run.
+ */
+void split_xrand_r(const xrand_state *parent, uint64_t task, xrand_state *child);
+
+/*
+ * Stream of a task of the whole run: split from the seed given to seed_xrand()
+ * (the prng_seed setting) by the sampler, then by the task id, e.g. a view id.
+ */
+enum xrand_site
+{
+    XRAND_INIT = 1,   /* two-view initialization */
+    XRAND_KEYFRAME,   /* pose estimation and triangulation of a new keyframe */
+    XRAND_PLANE,      /* plane detection */
+    XRAND_VPOINT,     /* vanishing point detection of a view */
+    XRAND_MSLD,       /* random descriptor of a line segment */
+    XRAND_LOOP        /* loop verification */
+};
+
+void seed_xrand_task(xrand_state *state, uint64_t site, uint64_t task);
+
 #ifdef	__cplusplus
 }
 #endif
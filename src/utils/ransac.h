@@ -0,0 +1,432 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Madison Treat, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Generic RANSAC
+ ********************************************************************************/
+
+#ifndef RANSAC_H_
+#define RANSAC_H_
+
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "random.h"
+
+// An estimation problem is a class, derived from RansacProblem, with
+//
+//   typedef ... Model;
+//   enum { SAMPLE_SIZE = ..., MAX_MODELS = ... };
+//   int  numData() const;
+//   int  fit(const int *sample, Model *models) const;
+//        minimal solver on SAMPLE_SIZE data, writes at most MAX_MODELS models
+//        and returns their num, 0 if the sample is degenerate or the models
+//        are rejected
+//   void errors(const Model &m, int begin, int end, double *err) const;
+//        errors of data [begin, end) under m, err[0] is the one of begin
+//
+// and may hide the defaults of RansacProblem (weight, sample, refit). Models are
+// copied by value, so a model holding cv::Mat must not be modified in place.
+// All members are called from several threads if RansacOptions::parallel.
+//
+// A datum is an inlier if its error is below RansacOptions::threshold, the
+// score of a model is the sum of the weights of its inliers and a model
+// replaces the best one only if its score is larger, in the order the
+// hypotheses are drawn.
+
+struct RansacProblem
+{
+    // score of datum i if it is an inlier
+    int weight(int) const { return 1; }
+
+    // draws size distinct data of [0, n), returns false to skip the hypothesis
+    bool sample(xrand_state *rng, int n, int size, int *idx) const
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            do idx[i] = xrand_r(rng) % n;
+            while (std::find(idx, idx + i, idx[i]) != idx + i);
+        }
+
+        return true;
+    }
+
+    // non-minimal fit of m on inliers, starting from m, for the local
+    // optimization; false if not available
+    template<class Model>
+    bool refit(const std::vector<int> &, Model &) const { return false; }
+};
+
+struct RansacOptions
+{
+    int    maxIter;       // max num of hypotheses
+    double confidence;    // adapts the num of hypotheses to the inlier ratio,
+                          // 0 to always draw maxIter
+    double threshold;     // error threshold of inliers
+    int    batchSize;     // num of hypotheses drawn and scored together
+    bool   parallel;      // score the hypotheses of a batch in parallel
+    bool   earlyBound;    // stop scoring a model once it cannot win, exact
+    bool   prosac;        // PROSAC sampling, data must be sorted best first
+    bool   sprt;          // stop scoring a model once the SPRT rejects it
+    double sprtModelCost; // time of a minimal fit, in error evaluations
+    int    loIter;        // max num of local optimization steps on each new
+                          // best model, 0 for none
+
+    RansacOptions()
+        : maxIter(500), confidence(0), threshold(1), batchSize(16), parallel(false),
+          earlyBound(true), prosac(false), sprt(false), sprtModelCost(200), loIter(0) {}
+};
+
+struct RansacStats
+{
+    int iterations;  // num of hypotheses drawn
+    int models;      // num of models scored
+    int rejected;    // num of models whose scoring was cut short
+    long evaluations;// num of errors computed
+    int loRuns;      // num of local optimization steps
+    int score;       // of the best model
+
+    RansacStats()
+        : iterations(0), models(0), rejected(0), evaluations(0), loRuns(0), score(0) {}
+};
+
+// Wald's sequential probability ratio test of a model (Matas and Chum 2005):
+// a model is rejected once the likelihood ratio of the data seen so far,
+// being bad (inlier probability delta) versus good (epsilon), exceeds A.
+struct RansacSprt
+{
+    double epsilon, delta, A;
+    double inlierFactor, outlierFactor;
+
+    void update(double _epsilon, double _delta, double modelCost, double modelsPerSample)
+    {
+        epsilon = _epsilon;
+        delta = _delta;
+
+        double C = (1 - delta) * log((1 - delta) / (1 - epsilon)) + delta * log(delta / epsilon);
+        double K = modelCost * C / modelsPerSample + 1;
+        A = K;
+
+        for (int i = 0; i < 10; ++i)
+            A = K + log(A);
+
+        inlierFactor = delta / epsilon;
+        outlierFactor = (1 - delta) / (1 - epsilon);
+    }
+};
+
+template<class Problem>
+int ransacScore(const Problem &prob, const typename Problem::Model &m, double threshold,
+                int bound, const int *restWeight, const RansacSprt *sprt,
+                int &numInliers, int &numEvaluated)
+// score of m, or -1 as soon as it cannot exceed bound (if bound >= 0) or the
+// SPRT rejects it; restWeight[i] is the total weight of data [i, N)
+{
+    const int blockSize = 64;
+    double err[blockSize];
+    int N = prob.numData(), score = 0;
+    double lambda = 1;
+
+    numInliers = 0;
+    numEvaluated = 0;
+
+    for (int begin = 0; begin < N; begin += blockSize)
+    {
+        int end = std::min(N, begin + blockSize);
+        prob.errors(m, begin, end, err);
+        numEvaluated = end;
+
+        for (int i = begin; i < end; ++i)
+        {
+            if (err[i - begin] < threshold)
+            {
+                score += prob.weight(i);
+                ++numInliers;
+
+                if (sprt) lambda *= sprt->inlierFactor;
+            }
+            else if (sprt)
+                lambda *= sprt->outlierFactor;
+        }
+
+        if (bound >= 0 && score + restWeight[end] <= bound)
+            return -1;
+
+        if (sprt && lambda > sprt->A)
+            return -1;
+    }
+
+    return score;
+}
+
+template<class Problem>
+int ransacInliers(const Problem &prob, const typename Problem::Model &m, double threshold,
+                  std::vector<int> &inliers)
+// inliers of m, returns its score
+{
+    const int blockSize = 64;
+    double err[blockSize];
+    int N = prob.numData(), score = 0;
+
+    inliers.clear();
+
+    for (int begin = 0; begin < N; begin += blockSize)
+    {
+        int end = std::min(N, begin + blockSize);
+        prob.errors(m, begin, end, err);
+
+        for (int i = begin; i < end; ++i)
+        {
+            if (err[i - begin] < threshold)
+            {
+                inliers.push_back(i);
+                score += prob.weight(i);
+            }
+        }
+    }
+
+    return score;
+}
+
+template<class Problem>
+int ransacRefine(const Problem &prob, double threshold, typename Problem::Model &m,
+                 std::vector<int> &inliers, int maxSteps, RansacStats *stats = 0)
+// refits m on its inliers as long as its score grows, at most maxSteps times;
+// inliers are the ones of m on return, returns its score
+{
+    int score = ransacInliers(prob, m, threshold, inliers);
+    std::vector<int> curInliers;
+
+    for (int k = 0; k < maxSteps; ++k)
+    {
+        typename Problem::Model cur = m;
+
+        if (!prob.refit(inliers, cur)) break;
+
+        int curScore = ransacInliers(prob, cur, threshold, curInliers);
+
+        if (stats) ++stats->loRuns;
+
+        if (curScore <= score) break;
+
+        score = curScore;
+        m = cur;
+        inliers.swap(curInliers);
+    }
+
+    return score;
+}
+
+template<class Problem>
+int ransac(const Problem &prob, const RansacOptions &opts, xrand_state *rng,
+           typename Problem::Model &best, std::vector<int> &inliers, RansacStats *stats = 0)
+// Estimates the model with the largest score; returns the score, 0 if no model
+// was found, in which case best is left as it is. Hypotheses are drawn and
+// scored in batches. Hypothesis h samples from its own stream split from rng,
+// which is drawn from once, and a batch is reduced in the order of h, so the result does not depend on
+// the num of threads. The adaptive num of hypotheses, the SPRT and PROSAC are
+// updated between batches.
+{
+    typedef typename Problem::Model Model;
+    const int S = Problem::SAMPLE_SIZE;
+    const int M = Problem::MAX_MODELS;
+
+    RansacStats st;
+    int N = prob.numData();
+
+    inliers.clear();
+
+    if (N < S)
+    {
+        if (stats) *stats = st;
+        return 0;
+    }
+
+    std::vector<int> restWeight(N + 1, 0);
+
+    for (int i = N - 1; i >= 0; --i)
+        restWeight[i] = restWeight[i + 1] + prob.weight(i);
+
+    int batchSize = std::max(1, opts.batchSize);
+    std::vector<Model> models(batchSize);
+    std::vector<int> scores(batchSize), counts(batchSize), numModels(batchSize),
+        numRejected(batchSize), prosacN(batchSize);
+    std::vector<long> numEvaluated(batchSize);
+    std::vector<double> fullRatio(batchSize); // sum of the inlier ratios of the models scored in full
+
+    int maxIter = opts.maxIter, bestScore = 0, bestCount = 0;
+
+    // a draw of rng keys the streams of the hypotheses, so that successive
+    // estimations on one stream are independent
+    xrand_state base;
+    split_xrand_r(rng, xrand_r(rng), &base);
+
+    // PROSAC: hypothesis t draws from the first n data, n grows with t
+    int n = S;
+    double Tn = opts.maxIter;
+    double TnPrime = 1;
+
+    for (int i = 0; i < S; ++i)
+        Tn *= double(S - i) / (N - i);
+
+    // SPRT, initial guesses of the inlier ratios; delta is then the mean inlier
+    // ratio of the models scored in full, a model cut short gives a biased one
+    RansacSprt sprt;
+    double sumFullRatio = 0;
+    int sumFull = 0;
+    sprt.update(0.1, 0.01, opts.sprtModelCost, 1);
+
+    while (st.iterations < maxIter)
+    {
+        int num = std::min(batchSize, maxIter - st.iterations);
+        int bound = opts.earlyBound ? bestScore : -1;
+
+        for (int h = 0; h < num && opts.prosac; ++h)
+        {
+            int t = st.iterations + h + 1;
+
+            if (t > TnPrime && n < N)
+            {
+                double Tnext = Tn * (n + 1) / (n + 1 - S);
+                TnPrime += ceil(Tnext - Tn);
+                Tn = Tnext;
+                ++n;
+            }
+
+            // the n-th datum is in the sample until the schedule is behind
+            prosacN[h] = TnPrime >= t ? n : -n;
+        }
+
+        #pragma omp parallel for schedule(dynamic) if (opts.parallel)
+        for (int h = 0; h < num; ++h)
+        {
+            xrand_state hrng;
+            split_xrand_r(&base, st.iterations + h, &hrng);
+
+            scores[h] = -1;
+            numModels[h] = 0;
+            numRejected[h] = 0;
+            numEvaluated[h] = 0;
+            fullRatio[h] = 0;
+
+            int idx[S];
+            bool sampled;
+
+            if (!opts.prosac)
+                sampled = prob.sample(&hrng, N, S, idx);
+            else if (prosacN[h] > 0)
+            {
+                idx[0] = prosacN[h] - 1;
+                sampled = prob.sample(&hrng, prosacN[h] - 1, S - 1, idx + 1);
+            }
+            else
+                sampled = prob.sample(&hrng, -prosacN[h], S, idx);
+
+            if (!sampled) continue;
+
+            Model sols[M];
+            int numSols = prob.fit(idx, sols);
+
+            for (int k = 0; k < numSols; ++k)
+            {
+                int count, evaluated;
+                int b = opts.earlyBound ? std::max(bound, scores[h]) : -1;
+                int score = ransacScore(prob, sols[k], opts.threshold, b, &restWeight[0],
+                                        opts.sprt ? &sprt : 0, count, evaluated);
+
+                ++numModels[h];
+                numEvaluated[h] += evaluated;
+
+                if (score < 0)
+                {
+                    ++numRejected[h];
+                    continue;
+                }
+
+                fullRatio[h] += double(count) / N;
+
+                if (score > scores[h])
+                {
+                    scores[h] = score;
+                    counts[h] = count;
+                    models[h] = sols[k];
+                }
+            }
+        }
+
+        bool improved = false;
+
+        for (int h = 0; h < num; ++h)
+        {
+            st.models += numModels[h];
+            st.rejected += numRejected[h];
+            st.evaluations += numEvaluated[h];
+            sumFull += numModels[h] - numRejected[h];
+            sumFullRatio += fullRatio[h];
+
+            if (scores[h] > bestScore)
+            {
+                bestScore = scores[h];
+                bestCount = counts[h];
+                best = models[h];
+                improved = true;
+            }
+        }
+
+        st.iterations += num;
+
+        if (improved && opts.loIter > 0)
+        {
+            bestScore = ransacRefine(prob, opts.threshold, best, inliers, opts.loIter, &st);
+            bestCount = inliers.size();
+        }
+
+        //re-compute maximum iteration number
+        if (opts.confidence > 0 && bestCount > 0)
+        {
+            double need = fabs(log(1 - opts.confidence) / log(1 - pow(double(bestCount) / N, S)));
+            maxIter = need < opts.maxIter ? (int)need : opts.maxIter;
+        }
+
+        if (opts.sprt && st.models > 0)
+        {
+            double epsilon = std::max(sprt.epsilon, double(bestCount) / N);
+            double delta = sumFull > 0 ? sumFullRatio / sumFull : sprt.delta;
+            epsilon = std::min(epsilon, 0.999);
+            delta = std::max(1e-4, std::min(delta, 0.9 * epsilon));
+            sprt.update(epsilon, delta, opts.sprtModelCost, double(st.models) / st.iterations);
+        }
+    }
+
+    if (bestScore > 0)
+        ransacInliers(prob, best, opts.threshold, inliers);
+
+    st.score = bestScore;
+
+    if (stats) *stats = st;
+
+    return bestScore;
+}
+
+#endif
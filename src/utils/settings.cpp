@@ -92,12 +92,27 @@ void MfgSettings::printAllSettings() const
     qDebug() << "MFG Initial Frame Step       :" << frameStepInitial;
     qDebug() << "VPoint Angle Threshold       :" << vpointAngleThresh;
     qDebug() << "Depth Limit                  :" << depthLimit;
+    qDebug() << "Prefetch Frames              :" << prefetchFrames;
+    qDebug() << "Prefetch Threads             :" << prefetchThreads;
+    qDebug() << "Frame Cache Size             :" << frameCacheSize;
+    qDebug() << "Pipeline Views?              :" << pipelineViews;
+    qDebug() << "Local Mapping Thread?        :" << localMappingThread;
+    qDebug() << "Keyframe Window              :" << keyframeWindow;
+    qDebug() << "Archive Window               :" << archiveWindow;
+    qDebug() << "Archive File                 :" << archiveFile;
+    qDebug() << "Global Optimization Interval :" << globalOptInterval;
+    qDebug() << "Global window BA?            :" << globalWindowBa;
+    qDebug() << "Loop Vocabulary              :" << loopVocabulary;
+    qDebug() << "Loop Min Keyframe Gap        :" << loopMinGap;
+    qDebug() << "Loop Min Inliers             :" << loopMinInliers;
     qDebug() << "";
     qDebug() << "--- Bundle Adjustment (BA) Settings ---";
     qDebug() << "BA Weight VPoint             :" << baWeightVPoint;
     qDebug() << "BA Weight Line               :" << baWeightLine;
     qDebug() << "BA Weight Plane              :" << baWeightPlane;
     qDebug() << "BA Num Frames for VPoints    :" << baNumFramesVPoint;
+    qDebug() << "BA Linear Solver             :" << baLinearSolver;
+    qDebug() << "BA Parallel System Build?    :" << baParallelBuild;
     qDebug() << "BA Use Kernel?               :" << baUseKernel;
     qDebug() << "BA Kernel Delta for VPoints  :" << baKernelDeltaVPoint;
     qDebug() << "BA Kernel Delta for Points   :" << baKernelDeltaPoint;
@@ -241,6 +256,19 @@ void MfgSettings::loadMFGSettings()
     LOAD_DOUBLE(vpointAngleThresh, "vpoint_angle_thresh");
     LOAD_DOUBLE(depthLimit, "depth_limit");
     LOAD_INT(detectGround, "detect_ground_plane");
+    LOAD_INT(prefetchFrames, "prefetch_frames");
+    LOAD_INT(prefetchThreads, "prefetch_threads");
+    LOAD_INT(frameCacheSize, "frame_cache_size");
+    LOAD_BOOL(pipelineViews, "pipeline_views");
+    LOAD_BOOL(localMappingThread, "local_mapping_thread");
+    LOAD_INT(keyframeWindow, "keyframe_window");
+    LOAD_INT(archiveWindow, "archive_window");
+    LOAD_STR(archiveFile, "archive_file");
+    LOAD_INT(globalOptInterval, "global_opt_interval");
+    LOAD_BOOL(globalWindowBa, "global_window_ba");
+    LOAD_STR(loopVocabulary, "loop_vocabulary");
+    LOAD_INT(loopMinGap, "loop_min_gap");
+    LOAD_INT(loopMinInliers, "loop_min_inliers");
     mfgSettings->endGroup(); // "mfg"
 }
 
@@ -254,6 +282,10 @@ void MfgSettings::loadBASettings()
     LOAD_DOUBLE(baWeightPlane, "weight_plane");
     LOAD_BOOL(baUseKernel, "use_kernel");
     LOAD_INT(baNumFramesVPoint, "num_frames");
+    int baLinearSolverInt = 0;
+    LOAD_INT(baLinearSolverInt, "linear_solver");
+    baLinearSolver = (BaLinearSolver) baLinearSolverInt;
+    LOAD_BOOL(baParallelBuild, "parallel_build");
 
     if (baUseKernel)
     {
@@ -163,6 +163,58 @@ public:
     {
         return detectGround;
     }
+    int      getPrefetchFrames() const
+    {
+        return prefetchFrames;
+    }
+    int      getPrefetchThreads() const
+    {
+        return prefetchThreads;
+    }
+    int      getFrameCacheSize() const
+    {
+        return frameCacheSize;
+    }
+    bool     getPipelineViews() const
+    {
+        return pipelineViews;
+    }
+    bool     getLocalMappingThread() const
+    {
+        return localMappingThread;
+    }
+    int      getKeyframeWindow() const
+    {
+        return keyframeWindow;
+    }
+    int      getArchiveWindow() const
+    {
+        return archiveWindow;
+    }
+    QString  getArchiveFile() const
+    {
+        return archiveFile;
+    }
+    int      getGlobalOptInterval() const
+    {
+        return globalOptInterval;
+    }
+    bool     getGlobalWindowBa() const
+    {
+        return globalWindowBa;
+    }
+    QString  getLoopVocabulary() const
+    {
+        return loopVocabulary;
+    }
+    int      getLoopMinGap() const
+    {
+        return loopMinGap;
+    }
+    int      getLoopMinInliers() const
+    {
+        return loopMinInliers;
+    }
 
     // BA
     double   getBaWeightVPoint() const
@@ -201,6 +253,14 @@ public:
     {
         return baNumFramesVPoint;
     }
+    BaLinearSolver getBaLinearSolver() const
+    {
+        return baLinearSolver;
+    }
+    bool     getBaParallelBuild() const
+    {
+        return baParallelBuild;
+    }
 
 private:
     //---------------------------------------------------------------------------
@@ -267,6 +327,20 @@ private:
 
     int      detectGround;        // detect ground plane for scale estimation:0,1
 
+    int      prefetchFrames;      // num of frames loaded ahead of the tracker, 0 to disable
+    int      prefetchThreads;     // num of threads loading frames
+    int      frameCacheSize;      // num of prepared frames kept for reuse, 0 to disable
+    bool     pipelineViews;       // build next keyframe view while the map expands
+    bool     localMappingThread;  // optimize local map in background while tracking
+    int      keyframeWindow;      // num of recent keyframes keeping images and descriptors, 0 keeps all
+    int      archiveWindow;       // num of recent keyframes kept in memory, older ones are archived, 0 disables
+    QString  archiveFile;         // archive of old keyframes and landmarks, overwritten at start
+    int      globalOptInterval;   // num of keyframes between background global optimizations, 0 disables
+    bool     globalWindowBa;      // global optimization is a BA over the last keyframes instead of a pose graph
+    QString  loopVocabulary;      // vocabulary file for loop closure, empty disables
+    int      loopMinGap;          // min num of keyframes between the two ends of a loop
+    int      loopMinInliers;      // min num of PnP inliers to accept a loop
+
     //---------------------------------------------------------------------------
     // Bundle Adjustment settings
     //---------------------------------------------------------------------------
@@ -274,6 +348,8 @@ private:
     double   baWeightLine;
     double   baWeightPlane;
     int      baNumFramesVPoint; // number of frames used for vp in BA
+    BaLinearSolver baLinearSolver;
+    bool     baParallelBuild;   // build the BA system with BaParallelBlockSolver
 
     bool     baUseKernel;
     double   baKernelDeltaVPoint;
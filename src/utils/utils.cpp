@@ -28,13 +28,21 @@
 
 #include "utils.h"
 #include "settings.h"
+#include "geokernels.h"
 #include "random.h"
+#include "ransac.h"
 #include "omp.h"
 
 #include <math.h>
+#include <algorithm>
+#include <float.h>
 #include <iostream>
 #include <fstream>
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -151,6 +159,13 @@ double point2LineDist(cv::Mat l, cv::Point2d p)
     return abs((a * x + b * y + c)) / sqrt(a * a + b * b);
 }
 
+double point2LineDist(const cv::Vec3d &l, cv::Point2d p)
+// distance from point(x,y) to line ax+by+c=0;
+// l=(a, b, c), p = (x,y)
+{
+    return abs(l[0] * p.x + l[1] * p.y + l[2]) / sqrt(l[0] * l[0] + l[1] * l[1]);
+}
+
 double point2LineDist(cv::Mat l, cv::Mat p)
 // distance from point(x,y) to line ax+by+c=0;
 // l=(a, b, c), p = (x,y)
@@ -182,14 +197,12 @@ double point2LineDist(cv::Mat l, cv::Mat p)
 // Compute the sum of distances from l2's two endpoints to l1 ==> d21
 //									nomalize by l2's length: d21/len(l2)
 // Choose the smaller one as the difference.
-double normalizedLs2LstDist(IdealLine2d l1, IdealLine2d l2)
+double normalizedLs2LstDist(const IdealLine2d &l1, const IdealLine2d &l2)
 {
     //d12 = d(p1A,l2)+d(p1B,l2);
-    cv::Mat eq1 = l1.lineEq(), eq2 = l2.lineEq();
-    double a1 = eq1.at<double>(0),
-           b1 = eq1.at<double>(1), c1 = eq1.at<double>(2),
-           a2 = eq2.at<double>(0),
-           b2 = eq2.at<double>(1), c2 = eq2.at<double>(2);
+    cv::Vec3d eq1 = l1.lineVec(), eq2 = l2.lineVec();
+    double a1 = eq1[0], b1 = eq1[1], c1 = eq1[2],
+           a2 = eq2[0], b2 = eq2[1], c2 = eq2[2];
     double d12 = abs(a2 * l1.extremity1.x + b2 * l1.extremity1.y + c2) / sqrt(a2 * a2 + b2 * b2)
                  + abs(a2 * l1.extremity2.x + b2 * l1.extremity2.y + c2) / sqrt(a2 * a2 + b2 * b2);
     d12 = d12 / l1.length();
@@ -292,6 +305,18 @@ double getLineEndPtInterval(IdealLine2d a, IdealLine2d b)
                    cv::norm(a.extremity2 - b.extremity2)));
 }
 
+cv::Point2d vec2cvpt(const cv::Vec3d &v)
+// homogeneous => point, fixed size
+{
+    return cv::Point2d(v[0] / v[2], v[1] / v[2]);
+}
+
+double homoNorm(const cv::Vec3d &v)
+// norm of the homogeneous (v, 1), as cv::norm of KeyPoint3d::mat()
+{
+    return sqrt(v.dot(v) + 1);
+}
+
 cv::Point2d mat2cvpt(cv::Mat m)
 // 3x1 mat => point
 {
@@ -336,35 +361,36 @@ cv::Mat cvpt2mat(cv::Point3d p, bool homo)
         return (cv::Mat_<double>(3, 1) << p.x, p.y, p.z);
 }
 
-bool isPtOnLineSegment(cv::Point2d p, IdealLine2d l)
+bool isPtOnLineSegment(cv::Point2d p, const IdealLine2d &l)
 // NOTE: point p is collinear with l
 // if point is between two endpoints, return 1
 {
     return (p - l.extremity1).dot(p - l.extremity2) < 0;
 }
 
-double compMsldDiff(IdealLine2d a, IdealLine2d b)
+double compMsldDiff(const IdealLine2d &a, const IdealLine2d &b)
 // minimum of all possible msld comparison
 {
-    vector<double> tmp;
+    double minDiff = DBL_MAX;
 
     for (int ii = 0; ii < a.msldDescs.size(); ++ii)
     {
         for (int jj = 0; jj < b.msldDescs.size(); ++jj)
-            tmp.push_back(cv::norm(a.msldDescs[ii] - b.msldDescs[jj]));
+            minDiff = min(minDiff, cv::norm(a.msldDescs[ii], b.msldDescs[jj], cv::NORM_L2));
     }
 
-    return *std::min_element(tmp.begin(), tmp.end());
+    return minDiff;
 }
 
-double aveLine2LineDist(IdealLine2d a, IdealLine2d b)
+double aveLine2LineDist(const IdealLine2d &a, const IdealLine2d &b)
 // compute line to line distance by averaging 4 endpoint to line distances
 // a and b must be almost parallel
 {
-    return 0.25 * point2LineDist(a.lineEq(), b.extremity1)
-           + 0.25 * point2LineDist(a.lineEq(), b.extremity2)
-           + 0.25 * point2LineDist(b.lineEq(), a.extremity1)
-           + 0.25 * point2LineDist(b.lineEq(), a.extremity2);
+    cv::Vec3d la = a.lineVec(), lb = b.lineVec();
+    return 0.25 * point2LineDist(la, b.extremity1)
+           + 0.25 * point2LineDist(la, b.extremity2)
+           + 0.25 * point2LineDist(lb, a.extremity1)
+           + 0.25 * point2LineDist(lb, a.extremity2);
 }
 
 double ln2LnDist_H(IdealLine2d &l1, IdealLine2d &l2, cv::Mat &H)
@@ -406,7 +432,7 @@ void projectImgPt2Plane(cv::Mat imgPt, PrimPlane3d pi, cv::Mat K, cv::Mat &resul
 
 
 void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, cv::Mat K,
-                     cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t)
+                     cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t, xrand_state *rng)
 // compute F, E, R, t, and prune pointmatches
 {
     int nPts = pointMatches.size();
@@ -440,7 +466,7 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, cv::Mat K,
     // --- recover extrinsic parameters---
     cv::Mat inSetF2 = inSetF.clone();
 
-    while (!essn_ransac(&zPts1, &zPts2, &E, K,	&inSetF, IDEAL_IMAGE_WIDTH))
+    while (!essn_ransac(&zPts1, &zPts2, &E, K,	&inSetF, rng, IDEAL_IMAGE_WIDTH))
         ;
 
     // ---  delete outliers from pointMatches
@@ -492,7 +518,8 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, cv::Mat K,
 }
 
 void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<int>> &pairIdx,
-                     cv::Mat K,	cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t, bool useMultiE)
+                     cv::Mat K,	cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t,
+                     xrand_state *rng, bool useMultiE, bool sorted)
 // compute F, E, R, t, and prune pointmatches
 {
     int nPts = pointMatches.size();
@@ -529,7 +556,7 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<in
     if (useMultiE)
     {
         vector<cv::Mat> Es, inlierMasks;
-        essn_ransac(&zPts1, &zPts2, Es, K, inlierMasks, IDEAL_IMAGE_WIDTH);
+        essn_ransac(&zPts1, &zPts2, Es, K, inlierMasks, IDEAL_IMAGE_WIDTH, rng, false, cv::Mat(0, 0, CV_8U), sorted);
         double maxNum = 0;
 
         for (int i = 0; i < Es.size(); ++i)
@@ -544,7 +571,7 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<in
     }
     else
     {
-        while (!essn_ransac(&zPts1, &zPts2, &E, K,	&inSetF, IDEAL_IMAGE_WIDTH))
+        while (!essn_ransac(&zPts1, &zPts2, &E, K,	&inSetF, rng, IDEAL_IMAGE_WIDTH, sorted))
             ;
     }
 
@@ -604,13 +631,14 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<in
 }
 
 void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<int>> &pairIdx,
-                     cv::Mat K,	vector<cv::Mat> &Fs, vector<cv::Mat> &Es, vector<cv::Mat> &Rs, vector<cv::Mat> &ts)
+                     cv::Mat K,	vector<cv::Mat> &Fs, vector<cv::Mat> &Es, vector<cv::Mat> &Rs, vector<cv::Mat> &ts,
+                     xrand_state *rng, bool sorted)
 {
     Fs.resize(1);
     Es.resize(1);
     Rs.resize(1);
     ts.resize(1);
-    computeEpipolar(pointMatches, pairIdx, K, Fs[0], Rs[0], Es[0], ts[0], false);
+    computeEpipolar(pointMatches, pairIdx, K, Fs[0], Rs[0], Es[0], ts[0], rng, false, sorted);
 
 }
 
@@ -618,7 +646,7 @@ void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<in
 
 void computePotenEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<int>> &pairIdx,
                           cv::Mat K, vector<cv::Mat> &Fs, vector<cv::Mat> &Es, vector<cv::Mat> &Rs, vector<cv::Mat> &ts
-                          , bool usePrior, cv::Mat t_prior)
+                          , xrand_state *rng, bool usePrior, cv::Mat t_prior, bool sorted)
 // compute F, E, R, t, and prune pointmatches
 {
     int nPts = pointMatches.size();
@@ -652,7 +680,7 @@ void computePotenEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vect
     // --- recover extrinsic parameters---
     cv::Mat inSetF2 = inSetF.clone();
     vector<cv::Mat> inlierMasks;
-    essn_ransac(&zPts1, &zPts2, Es, K, inlierMasks, IDEAL_IMAGE_WIDTH, usePrior, t_prior);
+    essn_ransac(&zPts1, &zPts2, Es, K, inlierMasks, IDEAL_IMAGE_WIDTH, rng, usePrior, t_prior, sorted);
 
     // ---  delete outliers from pointMatches
     cv::Mat maxInlierMask = cv::Mat::zeros(nPts, 1, CV_8U);
@@ -776,31 +804,36 @@ vector<vector<int>>matchKeyPoints(const vector<FeatPoint2d> &kps1,
     pointMatches.clear();
     vector<vector<int>> pairIdx;
 
+    // best ratio first, for PROSAC in essn_ransac
+    vector<pair<double, int> > order;
+
     for (int i = 0; i < knnMatches.size(); ++i)
     {
         double ratio = knnMatches[i][0].distance / knnMatches[i][1].distance;
 
         if (ratio < THRESH_POINT_MATCH_RATIO)
-        {
-            //			vector<double> ptPair;
-            //			ptPair.push_back(view1.featurePoints[knnMatches[i][0].queryIdx].x);
-            //			ptPair.push_back(view1.featurePoints[knnMatches[i][0].queryIdx].y);
-            //			ptPair.push_back(view2.featurePoints[knnMatches[i][0].trainIdx].x);
-            //			ptPair.push_back(view2.featurePoints[knnMatches[i][0].trainIdx].y);
-            vector<cv::Point2d> ptPair;
-            ptPair.push_back(cv::Point2d(
-                                 kps1[knnMatches[i][0].queryIdx].x,
-                                 kps1[knnMatches[i][0].queryIdx].y));
-            ptPair.push_back(cv::Point2d(
-                                 kps2[knnMatches[i][0].trainIdx].x,
-                                 kps2[knnMatches[i][0].trainIdx].y));
-            pointMatches.push_back(ptPair);
-
-            vector<int> idpair;
-            idpair.push_back(knnMatches[i][0].queryIdx);
-            idpair.push_back(knnMatches[i][0].trainIdx);
-            pairIdx.push_back(idpair);
-        }
+            order.push_back(make_pair(ratio, i));
+    }
+
+    stable_sort(order.begin(), order.end());
+
+    for (int k = 0; k < order.size(); ++k)
+    {
+        int i = order[k].second;
+
+        vector<cv::Point2d> ptPair;
+        ptPair.push_back(cv::Point2d(
+                             kps1[knnMatches[i][0].queryIdx].x,
+                             kps1[knnMatches[i][0].queryIdx].y));
+        ptPair.push_back(cv::Point2d(
+                             kps2[knnMatches[i][0].trainIdx].x,
+                             kps2[knnMatches[i][0].trainIdx].y));
+        pointMatches.push_back(ptPair);
+
+        vector<int> idpair;
+        idpair.push_back(knnMatches[i][0].queryIdx);
+        idpair.push_back(knnMatches[i][0].trainIdx);
+        pairIdx.push_back(idpair);
     }
 
     return pairIdx;
@@ -854,6 +887,20 @@ bool isFileExist(std::string imgName)
         return false;
 }
 
+double peakRssMB()
+{
+#if defined(__linux__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss / 1024.0; // KB
+#elif defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#endif
+    return -1;
+}
+
 cv::Mat triangulatePoint(const cv::Mat &P1, const cv::Mat &P2, const cv::Mat &K,
                          cv::Point2d pt1, cv::Point2d pt2)
 {
@@ -1003,8 +1050,9 @@ IdealLine3d triangluateLine(cv::Mat R1, cv::Mat t1, cv::Mat R2, cv::Mat t2, cv::
                    (A1.at<double>(1) + A2.at<double>(1)) / 2,
                    (A1.at<double>(2) + A2.at<double>(2)) / 2);
     double len = cv::norm(A1 - A2);
-    cv::Mat drct = (A1 - A2) / len;
-    IdealLine3d line(md, drct);
+    cv::Vec3d drct(A1.at<double>(0) - A2.at<double>(0), A1.at<double>(1) - A2.at<double>(1),
+                   A1.at<double>(2) - A2.at<double>(2));
+    IdealLine3d line(md, drct * (1 / len));
     //	IdealLine3d line(cv::Point3d(A1.at<double>(0),A1.at<double>(1),A1.at<double>(2)),
     //		cv::Point3d(A2.at<double>(0),A2.at<double>(1),A2.at<double>(2)));
     line.is3D = true;
@@ -1048,7 +1096,7 @@ cv::Mat projectLine(IdealLine3d l, cv::Mat R, cv::Mat t, cv::Mat K)
 // project a 3d line to camera K[R t]
 {
     cv::Mat a = K * (R * cvpt2mat(l.midpt, 0) + t);
-    cv::Mat b = K * R * l.direct;
+    cv::Mat b = K * R * cv::Mat(l.direct);
     return a.cross(b);
 }
 
@@ -1056,10 +1104,15 @@ cv::Mat projectLine(IdealLine3d l, cv::Mat P)
 // project a 3d line to camera P
 {
     cv::Mat a = P * cvpt2mat(l.midpt) ;
-    cv::Mat b = P * (cv::Mat_<double>(4, 1) << l.direct.at<double>(0),
-                     l.direct.at<double>(1),
-                     l.direct.at<double>(2),
-                     0);
+    cv::Mat b = P * (cv::Mat_<double>(4, 1) << l.direct[0], l.direct[1], l.direct[2], 0);
+    return a.cross(b);
+}
+
+cv::Vec3d projectLine(const IdealLine3d &l, const cv::Matx34d &P)
+{
+    cv::Vec3d d = l.directVec();
+    cv::Vec3d a = P * cv::Vec4d(l.midpt.x, l.midpt.y, l.midpt.z, 1);
+    cv::Vec3d b = P * cv::Vec4d(d[0], d[1], d[2], 0);
     return a.cross(b);
 }
 
@@ -1171,45 +1224,67 @@ cv::Mat reversePanTilt(cv::Mat pt) // covert a pan-tilt angle to its opposite di
     return out;
 }
 
+// Plane through 3 points for ransac(), the model is [n' d] with n not
+// normalized and the error of a point is its distance to the plane. If
+// vertical, planes whose normal is more than 10 degrees off the y axis (the
+// ground) are rejected.
+struct PlaneProblem : public RansacProblem
+{
+    typedef cv::Vec4d Model;
+    enum { SAMPLE_SIZE = 3, MAX_MODELS = 1 };
+
+    SoaPoints3d pts;
+    bool vertical;
+
+    PlaneProblem() : vertical(false) {}
+
+    int numData() const { return pts.size(); }
+    cv::Point3d point(int i) const { return cv::Point3d(pts.x[i], pts.y[i], pts.z[i]); }
+
+    int fit(const int *sample, Model *models) const
+    {
+        cv::Point3d pt0 = point(sample[0]);
+        cv::Point3d n = (pt0 - point(sample[1])).cross(pt0 - point(sample[2]));
+        double len = cv::norm(n);
+
+        if (len == 0) return 0;
+
+        if (vertical && abs(n.y) / len < cos(10 * PI / 180)) // ensure plane normal
+            return 0;
+
+        models[0] = cv::Vec4d(n.x, n.y, n.z, -n.dot(pt0)); // plane=[n' d];
+        return 1;
+    }
+
+    void errors(const Model &m, int begin, int end, double *err) const
+    {
+        pointPlaneDists(m.val, &pts.x[begin], &pts.y[begin], &pts.z[begin], end - begin, err);
+    }
+};
+
 void find3dPlanes_pts(vector<KeyPoint3d> pts, vector<vector<int>> &groups,
-                      vector<cv::Mat> &planeVecs)
+                      vector<cv::Mat> &planeVecs, xrand_state *rng)
 // find 3d planes from a set of 3d points, using sequential ransac
 // input: pts,
 {
-    int maxIterNo = 500;
-    int minSolSetSize = 3;
-    double pt2planeDistThresh = 0.2;
     int planeSetSizeThresh = 50;
 
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = 0; // always 500 hypotheses, as the former loop
+    opts.threshold = 0.2;
+
     // ----- sequential ransac -----
     for (int seq_i = 0; seq_i < 5; ++seq_i)
     {
-        // ---- ransac ----
-        vector<int> indexes(pts.size());
+        PlaneProblem prob;
 
-        for (int i = 0; i < indexes.size(); ++i) indexes[i] = i;
+        for (int i = 0; i < pts.size(); ++i)
+            prob.pts.push_back(pts[i].x, pts[i].y, pts[i].z);
 
+        cv::Vec4d planeEq;
         vector<int> maxInlierSet;
-
-        for (int iter = 0; iter < maxIterNo; iter++)
-        {
-            vector<int> inlierSet;
-            random_unique(indexes.begin(), indexes.end(), minSolSetSize); // shuffle
-            cv::Point3d n = (pts[indexes[0]].cvpt() - pts[indexes[1]].cvpt()).cross(
-                                pts[indexes[0]].cvpt() - pts[indexes[2]].cvpt());
-            double d = -n.dot(pts[indexes[0]].cvpt()); // plane=[n' d];
-
-            for (int i = 0; i < pts.size(); ++i)
-            {
-                double dist = abs(n.dot(pts[i].cvpt()) + d) / cv::norm(n);
-
-                if (dist < pt2planeDistThresh)
-                    inlierSet.push_back(i);
-            }
-
-            if (inlierSet.size() > maxInlierSet.size())
-                maxInlierSet = inlierSet;
-        }
+        ransac(prob, opts, rng, planeEq, maxInlierSet);
 
         if (maxInlierSet.size() > planeSetSizeThresh)  // found a new plane
         {
@@ -1230,49 +1305,31 @@ void find3dPlanes_pts(vector<KeyPoint3d> pts, vector<vector<int>> &groups,
     }
 }
 
-vector<int> findGroundPlaneFromPoints(const vector<cv::Point3f> &pts, cv::Point3f &norm_vec, double &depth, double real_scale)
+vector<int> findGroundPlaneFromPoints(const vector<cv::Point3f> &pts, cv::Point3f &norm_vec, double &depth, double real_scale,
+                                      xrand_state *rng)
 {
-    int maxIterNo = 500;
-    int minSolSetSize = 3;
-    double pt2planeDistThresh = 0.075;
+    PlaneProblem prob;
+    prob.vertical = true;
 
-    if (real_scale > 1)
-        pt2planeDistThresh = 0.075 / real_scale;
+    for (int i = 0; i < pts.size(); ++i)
+        prob.pts.push_back(pts[i].x, pts[i].y, pts[i].z);
 
-    // ---- ransac ----
-    vector<int> indexes(pts.size());
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = 0.99;
+    opts.threshold = 0.075;
 
-    for (int i = 0; i < indexes.size(); ++i) indexes[i] = i;
+    if (real_scale > 1)
+        opts.threshold = 0.075 / real_scale;
 
+    // ---- ransac ----
+    cv::Vec4d plane;
     vector<int> maxInlierSet;
 
-    for (int iter = 0; iter < maxIterNo; iter++)
+    if (ransac(prob, opts, rng, plane, maxInlierSet) > 0)
     {
-        vector<int> inlierSet;
-        random_unique(indexes.begin(), indexes.end(), minSolSetSize); // shuffle
-        cv::Point3f n = (pts[indexes[0]] - pts[indexes[1]]).cross(pts[indexes[0]] - pts[indexes[2]]);
-
-        if (abs(n.y) / cv::norm(n) < cos(10 * PI / 180)) // ensure plane normal
-            continue;
-
-        double d = -n.dot(pts[indexes[0]]); // plane=[n' d];
-
-        for (int i = 0; i < pts.size(); ++i)
-        {
-            double dist = abs(n.dot(pts[i]) + d) / cv::norm(n);
-
-            if (dist < pt2planeDistThresh)
-                inlierSet.push_back(i);
-        }
-
-        if (inlierSet.size() > maxInlierSet.size())
-        {
-            maxInlierSet = inlierSet;
-            norm_vec = n;
-            depth = d;
-        }
-
-        maxIterNo = abs(log(1 - 0.99) / log(1 - pow(double(maxInlierSet.size()) / pts.size(), 3.0)));
+        norm_vec = cv::Point3f(plane[0], plane[1], plane[2]);
+        depth = plane[3];
     }
 
     if (maxInlierSet.size() > 3)
@@ -1293,16 +1350,146 @@ vector<int> findGroundPlaneFromPoints(const vector<cv::Point3f> &pts, cv::Point3
     return maxInlierSet;
 }
 
+// Plane through points and lines for ransac(). Data [0, numPts) are points and
+// the rest are lines, a line counts twice and its error is the mean distance of
+// its endpoints. A sample is 3 points, 1 point + 1 line or 2 lines of the same
+// vp; for the last two the line index is repeated to fill the 3 entries. The
+// plane must be compatible with one of normals, if any.
+struct PlaneLineProblem : public RansacProblem
+{
+    typedef cv::Vec4d Model;
+    enum { SAMPLE_SIZE = 3, MAX_MODELS = 1 };
+
+    SoaPoints3d pts, ends1, ends2;
+    vector<cv::Point3d> mids;
+    vector<int> vpGids;
+    vector<cv::Point3d> normals;
+    double normal_tolerance_deg;
+
+    static cv::Point3d point(const SoaPoints3d &p, int i) { return cv::Point3d(p.x[i], p.y[i], p.z[i]); }
+
+    int numPts() const { return pts.size(); }
+    int numLns() const { return ends1.size(); }
+    int numData() const { return pts.size() + ends1.size(); }
+    int weight(int i) const { return i < numPts() ? 1 : 2; }
+
+    bool sample(xrand_state *rng, int n, int size, int *idx) const
+    {
+        int np = numPts(), nl = numLns();
+        int solMode = xrand_r(rng) % 10;
+
+        // 0-4: 3 pts, 5-7: 1 pt + 1 line, 8-9: 2 lines
+        if (solMode < 5)  // use 3 points
+        {
+            if (np < 3) return false;
+
+            return RansacProblem::sample(rng, np, 3, idx);
+        }
+        else if (solMode < 8) // 1 pt + 1 line
+        {
+            if (np < 1 || nl < 1) return false;
+
+            idx[0] = xrand_r(rng) % np;
+            idx[1] = idx[2] = np + xrand_r(rng) % nl;
+        }
+        else     // 2 line
+        {
+            if (nl < 2) return false;
+
+            RansacProblem::sample(rng, nl, 2, idx);
+            idx[0] += np;
+            idx[1] += np;
+            idx[2] = idx[1];
+
+            if (vpGids[idx[0] - np] != vpGids[idx[1] - np]) return false;
+        }
+
+        return true;
+    }
+
+    int fit(const int *sample, Model *models) const
+    {
+        int np = numPts();
+        cv::Point3d pt0, pt1, pt2;
+
+        if (sample[0] >= np) // 2 lines
+        {
+            pt0 = point(ends1, sample[0] - np);
+            pt1 = point(ends2, sample[0] - np);
+            pt2 = mids[sample[1] - np];
+        }
+        else if (sample[1] >= np) // 1 pt + 1 line
+        {
+            pt0 = point(pts, sample[0]);
+            pt1 = point(ends1, sample[1] - np);
+            pt2 = point(ends2, sample[1] - np);
+        }
+        else
+        {
+            pt0 = point(pts, sample[0]);
+            pt1 = point(pts, sample[1]);
+            pt2 = point(pts, sample[2]);
+        }
+
+        // compute minimal solution
+        cv::Point3d n = (pt0 - pt1).cross(pt0 - pt2);
+        double len = cv::norm(n);
+
+        if (len == 0) return 0;
+
+        // --- check compatibility with vps ---
+        if (normals.size() > 0)
+        {
+            bool validNormal = false;
+
+            for (int i = 0; i < normals.size(); ++i)
+            {
+                if (abs(normals[i].dot(n) / len) > cos(normal_tolerance_deg * PI / 180))
+                {
+                    validNormal = true;
+                    break;
+                }
+            }
+
+            if (!validNormal) return 0; // discard this solution
+        }
+
+        models[0] = cv::Vec4d(n.x, n.y, n.z, -n.dot(pt0)); // plane=[n' d];
+        return 1;
+    }
+
+    void errors(const Model &m, int begin, int end, double *err) const
+    {
+        int np = numPts();
+        int mid = std::max(begin, std::min(end, np));
+        int first = std::min(begin, np); // a block of lines only holds no point
+
+        pointPlaneDists(m.val, pts.x.data() + first, pts.y.data() + first, pts.z.data() + first,
+                        mid - begin, err);
+
+        // lines, in blocks
+        const int blockSize = 64;
+        double dist[blockSize];
+
+        for (int i = mid; i < end; i += blockSize)
+        {
+            int l = i - np, num = std::min(blockSize, end - i);
+            pointPlaneDists(m.val, &ends1.x[l], &ends1.y[l], &ends1.z[l], num, err + i - begin);
+            pointPlaneDists(m.val, &ends2.x[l], &ends2.y[l], &ends2.z[l], num, dist);
+
+            for (int k = 0; k < num; ++k)
+                err[i - begin + k] = (err[i - begin + k] + dist[k]) / 2;
+        }
+    }
+};
+
 void find3dPlanes_pts_lns_VPs(vector<KeyPoint3d> pts, vector<IdealLine3d> lns, vector<VanishPnt3d> vps,
                               vector<vector<int>> &planePtIdx, vector<vector<int>> &planeLnIdx,
-                              vector<cv::Mat> &planeVecs)
+                              vector<cv::Mat> &planeVecs, xrand_state *rng)
 // find 3d planes from a set of 3d points, using sequential ransac
 // input: pts, lines
 {
-    int maxIterNo = 500;
-    double pt2planeDistThresh = mfgSettings->getMfgPointToPlaneDistance();
     int planeSetSizeThresh = mfgSettings->getMfgPointsPerPlane();
-    double normal_tolerance_deg = 2;
     // ===== find possible plane normal vectors compatible with VPs =====
     vector<cv::Point3d> normals;
 
@@ -1324,100 +1511,41 @@ void find3dPlanes_pts_lns_VPs(vector<KeyPoint3d> pts, vector<IdealLine3d> lns, v
         }
     }
 
+    RansacOptions opts;
+    opts.maxIter = 500;
+    opts.confidence = 0; // always 500 hypotheses, as the former loop
+    opts.threshold = mfgSettings->getMfgPointToPlaneDistance();
+
     // ====== sequential ransac ======
     for (int seq_i = 0; seq_i < 5; ++seq_i)
     {
         // ---- ransac ----
-        vector<int> ptIdxes(pts.size()), lnIdxes(lns.size());
+        PlaneLineProblem prob;
+        prob.normals = normals;
+        prob.normal_tolerance_deg = 2;
 
-        for (int i = 0; i < ptIdxes.size(); ++i) ptIdxes[i] = i;
-
-        for (int i = 0; i < lnIdxes.size(); ++i) lnIdxes[i] = i;
-
-        vector<int> maxInSet_pt, maxInSet_ln;
+        for (int i = 0; i < pts.size(); ++i)
+            prob.pts.push_back(pts[i].x, pts[i].y, pts[i].z);
 
-        for (int iter = 0; iter < maxIterNo; iter++)
+        for (int i = 0; i < lns.size(); ++i)
         {
-            vector<int> insetpt, insetln;
-            cv::Point3d pt0, pt1, pt2;
-            int solMode = xrand() % 10;
-
-            // 0-4: 3 pts, 5-7: 1 pt + 1 line, 8-9: 2 lines
-            if (solMode < 5)  // use 3 points
-            {
-                if (pts.size() < 3) continue;
-
-                random_unique(ptIdxes.begin(), ptIdxes.end(), 3);// shuffle
-                pt0 = pts[ptIdxes[0]].cvpt();
-                pt1 = pts[ptIdxes[1]].cvpt();
-                pt2 = pts[ptIdxes[2]].cvpt();
-            }
-            else if (solMode < 8) // 1 pt + 1 line
-            {
-                if (pts.size() < 1 || lns.size() < 1) continue;
-
-                int a = xrand() % pts.size(), b = xrand() % lns.size();
-                pt0 = pts[a].cvpt();
-                pt1 = lns[b].extremity1();
-                pt2 = lns[b].extremity2();
-            }
-            else     // 2 line
-            {
-                if (lns.size() < 2) continue;
-
-                random_unique(lnIdxes.begin(), lnIdxes.end(), 2);// shuffle
-
-                if (lns[lnIdxes[0]].vpGid != lns[lnIdxes[1]].vpGid) continue;
-
-                pt0 = lns[lnIdxes[0]].extremity1();
-                pt1 = lns[lnIdxes[0]].extremity2();
-                pt2 = lns[lnIdxes[1]].midpt;
-            }
-
-            // compute minimal solution
-            cv::Point3d n = (pt0 - pt1).cross(pt0 - pt2);
-            double d = -n.dot(pt0); // plane=[n' d];
-
-            // --- check compatibility with vps ---
-            if (normals.size() > 0)
-            {
-                bool validNormal = false;
-
-                for (int i = 0; i < normals.size(); ++i)
-                {
-                    if (abs(normals[i].dot(n) / cv::norm(n)) > cos(normal_tolerance_deg * PI / 180))
-                    {
-                        validNormal = true;
-                        break;
-                    }
-                }
-
-                if (!validNormal) continue; // discard this solution
-            }
-
-            // find inliers
-            for (int i = 0; i < pts.size(); ++i)
-            {
-                double dist = abs(n.dot(pts[i].cvpt()) + d) / cv::norm(n);
-
-                if (dist < pt2planeDistThresh)
-                    insetpt.push_back(i);
-            }
-
-            for (int i = 0; i < lns.size(); ++i)
-            {
-                double dist = (abs(n.dot(lns[i].extremity1()) + d) + abs(n.dot(lns[i].extremity2()) + d))
-                              / (2 * cv::norm(n));
+            cv::Point3d ep1 = lns[i].extremity1(), ep2 = lns[i].extremity2();
+            prob.ends1.push_back(ep1.x, ep1.y, ep1.z);
+            prob.ends2.push_back(ep2.x, ep2.y, ep2.z);
+            prob.mids.push_back(lns[i].midpt);
+            prob.vpGids.push_back(lns[i].vpGid);
+        }
 
-                if (dist < pt2planeDistThresh)
-                    insetln.push_back(i);
-            }
+        cv::Vec4d planeEq;
+        vector<int> inliers, maxInSet_pt, maxInSet_ln;
+        ransac(prob, opts, rng, planeEq, inliers);
 
-            if (insetpt.size() + insetln.size() * 2 > maxInSet_pt.size() + maxInSet_ln.size() * 2)
-            {
-                maxInSet_pt = insetpt;
-                maxInSet_ln = insetln;
-            }
+        for (int i = 0; i < inliers.size(); ++i)
+        {
+            if (inliers[i] < prob.numPts())
+                maxInSet_pt.push_back(inliers[i]);
+            else
+                maxInSet_ln.push_back(inliers[i] - prob.numPts());
         }
 
         if (maxInSet_pt.size() + maxInSet_ln.size() * 2 > planeSetSizeThresh
@@ -1537,7 +1665,8 @@ double rotateAngleDeg(cv::Mat R) // return degree
 }
 
 bool detectGroundPlane(const cv::Mat &im1, const cv::Mat &im2, const cv::Mat &R, const cv::Mat &t, const cv::Mat &K,
-                       int &n_pts, double &depth, cv::Point3f &normal, double &quality, cv::Mat &roi, double real_baseline)
+                       int &n_pts, double &depth, cv::Point3f &normal, double &quality, cv::Mat &roi, double real_baseline,
+                       xrand_state *rng)
 //// assume camera optical axis is approximately parallel to ground plane
 {
 
@@ -1707,7 +1836,7 @@ bool detectGroundPlane(const cv::Mat &im1, const cv::Mat &im2, const cv::Mat &R,
 
     cv::Point3f n;
     double d;
-    vector<int> gp_idx = findGroundPlaneFromPoints(pts3, n, d, real_baseline);
+    vector<int> gp_idx = findGroundPlaneFromPoints(pts3, n, d, real_baseline, rng);
 
     if (gp_idx.size() > 40 && abs(n.y) > 0.99)
     {
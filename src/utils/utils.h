@@ -43,6 +43,7 @@
 #include "features2d.h"
 #include "features3d.h"
 
+#include "pointgrid.h"
 #include "random.h"
 using namespace std;
 
@@ -51,6 +52,7 @@ ntuple_list callLsd(cv::Mat *); // detect line segments by LSD
 double point2LineDist(double l[3], cv::Point2d p);
 double point2LineDist(cv::Mat l, cv::Point2d p);
 double point2LineDist(cv::Mat l, cv::Mat p);
+double point2LineDist(const cv::Vec3d &l, cv::Point2d p);
 
 double symmErr_PtPair(cv::Mat p1, cv::Mat p2, cv::Mat &H);
 
@@ -89,14 +91,22 @@ std::string nextImgName(std::string name, int n, int step = 1);
 std::string prevImgName(std::string name, int n, int step = 1);
 
 void fivepoint_stewnister(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::Mat> &Es);
+void fivepoint_stewnister_ref(const cv::Mat &P1, const cv::Mat &P2, std::vector<cv::Mat> &Es); // baseline
+// fixed-size solver for a minimal sample, no heap allocation; writes up to 10
+// essential matrices to Es and returns their num
+int fivepoint_stewnister(const Eigen::Matrix<double, 3, 5> &P1, const Eigen::Matrix<double, 3, 5> &P2,
+                         Eigen::Matrix3d *Es);
+// sorted: the point pairs are ordered best first, e.g. by match distance ratio,
+// and sampled with PROSAC
 int essn_ransac(cv::Mat *pts1, cv::Mat *pts2, cv::Mat *E, cv::Mat K,
-                cv::Mat *inlierMask, int imsize = 640);
+                cv::Mat *inlierMask, xrand_state *rng, int imsize = 640, bool sorted = false);
 
 int essn_ransac_slow(cv::Mat *pts1, cv::Mat *pts2, std::vector<cv::Mat> &bestEs, cv::Mat K,
                      std::vector<cv::Mat> &inlierMasks, int imsize);
 
 void essn_ransac(cv::Mat *pts1, cv::Mat *pts2, std::vector<cv::Mat> &bestEs, cv::Mat K,
-                 std::vector<cv::Mat> &inlierMasks, int imsize,  bool usePrior = false, cv::Mat t_prior = cv::Mat(0, 0, CV_8U));
+                 std::vector<cv::Mat> &inlierMasks, int imsize, xrand_state *rng,
+                 bool usePrior = false, cv::Mat t_prior = cv::Mat(0, 0, CV_8U), bool sorted = false);
 
 void decEssential(cv::Mat *E, cv::Mat *R1, cv::Mat *R2, cv::Mat *t) ;
 cv::Mat
@@ -120,22 +130,30 @@ double mleVp2LineDist(cv::Mat vp, LineSegmt2d l);
 void optimizeVainisingPoint(std::vector<LineSegmt2d> &lines, cv::Mat &vp);
 void optimizeVainisingPoint(std::vector<LineSegmt2d> &lines, cv::Mat &vp, cv::Mat &covMat, cv::Mat &covHomo);
 
-double normalizedLs2LstDist(IdealLine2d l1, IdealLine2d l2);
+double normalizedLs2LstDist(const IdealLine2d &l1, const IdealLine2d &l2);
 double getLineEndPtInterval(IdealLine2d a, IdealLine2d b);
 
 cv::Point2d mat2cvpt(cv::Mat m);
+cv::Point2d vec2cvpt(const cv::Vec3d &v);
+double homoNorm(const cv::Vec3d &v);
 cv::Point3d mat2cvpt3d(cv::Mat m);
 cv::Mat cvpt2mat(cv::Point2d p, bool homo = true);
 cv::Mat cvpt2mat(cv::Point3d p, bool homo = true);
 
-bool isPtOnLineSegment(cv::Point2d p, IdealLine2d l);
-double compMsldDiff(IdealLine2d a, IdealLine2d b);
-double aveLine2LineDist(IdealLine2d a, IdealLine2d b);
+bool isPtOnLineSegment(cv::Point2d p, const IdealLine2d &l);
+double compMsldDiff(const IdealLine2d &a, const IdealLine2d &b);
+double aveLine2LineDist(const IdealLine2d &a, const IdealLine2d &b);
 
 void matchLinesByPointPairs(double imWidth,
                             std::vector<IdealLine2d> &lines1, std::vector<IdealLine2d> &lines2,
                             std::vector< std::vector<cv::Point2d> > &pointPairs,
                             std::vector< std::vector<int> > &linePairIdx);
+// the same, with the points of pointPairs in image 1 and 2 already indexed
+void matchLinesByPointPairs(double imWidth,
+                            std::vector<IdealLine2d> &lines1, std::vector<IdealLine2d> &lines2,
+                            std::vector< std::vector<cv::Point2d> > &pointPairs,
+                            const PointGrid &grid1, const PointGrid &grid2,
+                            std::vector< std::vector<int> > &linePairIdx);
 
 std::vector<cv::Point2d> sampleFromLine(IdealLine2d l, double stepSize);
 std::vector<cv::Point2d> sampleFromLine(IdealLine2d l, int ptNum);
@@ -145,20 +163,24 @@ double ln2LnDist_H(IdealLine2d &l1, IdealLine2d &l2, cv::Mat &H);
 void projectImgPt2Plane(cv::Mat imgPt, PrimPlane3d pi, cv::Mat K, cv::Mat &result);
 
 void computeEpipolar(std::vector< std::vector<cv::Point2d> > &pointMatches, cv::Mat K,
-                     cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t);
+                     cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t, xrand_state *rng);
 void computeEpipolar(std::vector< std::vector<cv::Point2d> > &pointMatches,
-                     std::vector< std::vector<int> > &pairIdx, cv::Mat K, cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t, bool useMultiE = false);
+                     std::vector< std::vector<int> > &pairIdx, cv::Mat K, cv::Mat &F, cv::Mat &R, cv::Mat &E, cv::Mat &t,
+                     xrand_state *rng, bool useMultiE = false, bool sorted = false);
 void computeEpipolar(vector<vector<cv::Point2d>> &pointMatches, vector<vector<int>> &pairIdx,
-                     cv::Mat K,	vector<cv::Mat> &Fs, vector<cv::Mat> &Es, vector<cv::Mat> &Rs, vector<cv::Mat> &ts) ;
+                     cv::Mat K,	vector<cv::Mat> &Fs, vector<cv::Mat> &Es, vector<cv::Mat> &Rs, vector<cv::Mat> &ts,
+                     xrand_state *rng, bool sorted = false) ;
 
 void computePotenEpipolar(std::vector< std::vector<cv::Point2d> > &pointMatches, std::vector< std::vector<int> > &pairIdx,
                           cv::Mat K, std::vector<cv::Mat> &Fs, std::vector<cv::Mat> &Es, std::vector<cv::Mat> &Rs, std::vector<cv::Mat> &ts,
-                          bool usePrior = false, cv::Mat t_prior = cv::Mat(0, 0, CV_8U));
+                          xrand_state *rng, bool usePrior = false, cv::Mat t_prior = cv::Mat(0, 0, CV_8U),
+                          bool sorted = false);
 
 
 void drawLineMatches(cv::Mat im1, cv::Mat im2, std::vector<IdealLine2d>lines1,
                      std::vector<IdealLine2d>lines2, std::vector< std::vector<int> > pairs);
 
+// matches passing the distance ratio test, best ratio first
 std::vector< std::vector<int> > matchKeyPoints(const std::vector<FeatPoint2d> &kps1,
         const std::vector<FeatPoint2d> &kps2, std::vector< std::vector<cv::Point2d> > &ptmatch);
 
@@ -171,6 +193,8 @@ int computePnP(std::vector<cv::Point3d> X, std::vector<cv::Point2d> x, cv::Mat K
 
 bool isFileExist(std::string imgName);
 
+double peakRssMB(); // peak resident set size of the process, -1 if unknown
+
 
 cv::Mat triangulatePoint(const cv::Mat &P1, const cv::Mat &P2, const cv::Mat &K,
                          cv::Point2d pt1, cv::Point2d pt2);
@@ -219,6 +243,7 @@ double ls2lnArea(cv::Mat ln, cv::Point2d a, cv::Point2d b);
 
 cv::Mat projectLine(IdealLine3d l, cv::Mat R, cv::Mat t, cv::Mat K) ;
 cv::Mat projectLine(IdealLine3d l, cv::Mat P);
+cv::Vec3d projectLine(const IdealLine3d &l, const cv::Matx34d &P); // fixed size
 
 bool checkCheirality(cv::Mat R, cv::Mat t, IdealLine3d line);
 
@@ -234,10 +259,6 @@ cv::Mat pnp_withR(std::vector<cv::Point3d> X, std::vector<cv::Point2d> x, cv::Ma
 double vecSum(std::vector<double> v);
 double vecMedian(std::vector<double> v);
 
-void est3dpt(std::vector<cv::Mat> Rs, std::vector<cv::Mat> ts, cv::Mat K,
-             std::vector<cv::Point2d> pt, cv::Mat &X, int maxIter = 200);
-void est3dpt_g2o(std::vector<cv::Mat> Rs, std::vector<cv::Mat> ts, cv::Mat K, std::vector<cv::Point2d> pts2d, cv::Mat &X);
-
 double optimizeScale(std::vector<cv::Point3d> X, std::vector<cv::Point2d> x, cv::Mat K,
                      cv::Mat Rn, cv::Mat Rtn_1, cv::Mat t, double s);
 
@@ -250,14 +271,14 @@ cv::Mat pantilt(cv::Mat vp, cv::Mat K) ;
 cv::Mat reversePanTilt(cv::Mat pt) ;
 
 template<class bidiiter> //Fisher-Yates shuffle
-bidiiter random_unique(bidiiter begin, bidiiter end, size_t num_random)
+bidiiter random_unique(bidiiter begin, bidiiter end, size_t num_random, xrand_state *rng)
 {
     size_t left = std::distance(begin, end);
 
     while (num_random--)
     {
         bidiiter r = begin;
-        std::advance(r, xrand() % left);
+        std::advance(r, xrand_r(rng) % left);
         std::swap(*begin, *r);
         ++begin;
         --left;
@@ -268,10 +289,10 @@ bidiiter random_unique(bidiiter begin, bidiiter end, size_t num_random)
 
 
 void find3dPlanes_pts(std::vector<KeyPoint3d> pts, std::vector< std::vector<int> > &groups,
-                      std::vector<cv::Mat> &planes);
+                      std::vector<cv::Mat> &planes, xrand_state *rng);
 void find3dPlanes_pts_lns_VPs(std::vector<KeyPoint3d> pts, std::vector<IdealLine3d> lns, std::vector<VanishPnt3d> vps,
                               std::vector< std::vector<int> > &planePtIdx, std::vector< std::vector<int> > &planeLnIdx,
-                              std::vector<cv::Mat> &planeVecs) ;
+                              std::vector<cv::Mat> &planeVecs, xrand_state *rng) ;
 
 cv::Mat vanishpoint_cov_xy2ab(cv::Mat vp, cv::Mat K, cv::Mat cov_xy);
 cv::Mat vanishpoint_cov_xyw2ab(cv::Mat vp, cv::Mat K, cv::Mat cov_xyw);
@@ -281,17 +302,22 @@ void detect_featpoints_buckets(cv::Mat grayImg, int n, std::vector<cv::Point2f>
 void detect_featpoints_buckets(cv::Mat grayImg, int m, int n, std::vector<cv::Point2f> &pts,
                                int maxNumPts = 1000, double qualityLevel = 0.01, double minDistance = 5);
 
+// returns the num of inliers of the pose, 0 if there are fewer points than the
+// min set of 7; a consensus of only 7 is the sample itself
 int computePnP_ransac(std::vector<cv::Point3d> X, std::vector<cv::Point2d> x, cv::Mat K,
-                      cv::Mat &R, cv::Mat &t, int maxIter = 50);
+                      cv::Mat &R, cv::Mat &t, xrand_state *rng, int maxIter = 50);
 double compParallaxDeg(cv::Point2d x1, cv::Point2d x2, cv::Mat K, cv::Mat R1, cv::Mat R2);
 double rotateAngleDeg(cv::Mat R) ;
 double rotateAngle(cv::Mat R) ;
 
-bool fund_ransac(cv::Mat pts1, cv::Mat pts2, cv::Mat F, std::vector<uchar> &mask, double distThresh, double confidence);
+bool fund_ransac(cv::Mat pts1, cv::Mat pts2, cv::Mat F, std::vector<uchar> &mask, double distThresh, double confidence,
+                 xrand_state *rng);
 
-vector<int> findGroundPlaneFromPoints(const vector<cv::Point3f> &pts, cv::Point3f &norm_vec, double &depth);
+vector<int> findGroundPlaneFromPoints(const vector<cv::Point3f> &pts, cv::Point3f &norm_vec, double &depth,
+                                      double real_scale, xrand_state *rng);
 
 bool detectGroundPlane(const cv::Mat &im1, const cv::Mat &im2, const cv::Mat &R, const cv::Mat &t, const cv::Mat &K,
-                       int &n_pts, double &depth, cv::Point3f &normal, double &quality, cv::Mat &, double);
+                       int &n_pts, double &depth, cv::Point3f &normal, double &quality, cv::Mat &, double,
+                       xrand_state *rng);
 
 #endif
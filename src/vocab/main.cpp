@@ -0,0 +1,166 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//  Multilayer Feature Graph (MFG), version 1.0
+//  Copyright (C) 2011-2015 Yan Lu, Dezhen Song
+//  Netbot Laboratory, Texas A&M University, USA
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+/********************************************************************************
+ * Builds the loop closure vocabulary offline from a folder of images
+ *
+ * usage: mfg-vocab <settings file> <image folder> <vocabulary file> [k levels]
+ *
+ * Descriptors are computed as in the keyframes of MFG with the same settings:
+ * SIFT/SURF key points, or SURF descriptors at GFTT corners.
+ ********************************************************************************/
+
+// Qt
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
+
+// Standard library
+#include <iostream>
+#include <stdlib.h>
+
+// OpenCV
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/nonfree/nonfree.hpp>
+
+// MFG
+#include "settings.h"
+#include "utils.h"
+#include "vocabulary.h"
+
+using namespace std;
+
+int IDEAL_IMAGE_WIDTH; // image width in use
+double THRESH_POINT_MATCH_RATIO = 0.50; // SIFT distance threshold
+
+// MFG settings
+MfgSettings *mfgSettings;
+
+static cv::Mat describe(const cv::Mat &gray)
+{
+    vector<cv::KeyPoint> kpts;
+    cv::Mat descs;
+
+    switch (mfgSettings->getKeypointAlgorithm())
+    {
+    case KPT_SIFT:
+    {
+        cv::SIFT sift(0, 3, 0.01, 10);
+        sift(gray, cv::Mat(), kpts, descs);
+    }
+    break;
+
+    case KPT_SURF:
+    {
+        cv::SurfFeatureDetector surfDetector(200);
+        cv::SurfDescriptorExtractor surfExtractor;
+        surfDetector.detect(gray, kpts);
+        surfExtractor.compute(gray, kpts, descs);
+    }
+    break;
+
+    case KPT_GFTT:
+    {
+        vector<cv::Point2f> pts;
+        detect_featpoints_buckets(gray, 3, 10, pts,
+                                  mfgSettings->getGfttMaxPoints(),
+                                  mfgSettings->getGfttQualityLevel(),
+                                  mfgSettings->getGfttMinimumPointDistance());
+
+        for (int i = 0; i < pts.size(); ++i)
+            kpts.push_back(cv::KeyPoint(pts[i], mfgSettings->getFeatureDescriptorRadius()));
+
+        cv::SurfDescriptorExtractor surfExtractor;
+        surfExtractor.compute(gray, kpts, descs);
+    }
+    break;
+
+    default:
+        ;
+    }
+
+    return descs;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    if (argc < 4)
+    {
+        cerr << "usage: " << argv[0] << " <settings file> <image folder> <vocabulary file> [k levels]" << endl;
+        return 1;
+    }
+
+    mfgSettings = new MfgSettings(argv[1]);
+    cv::initModule_nonfree();
+    cv::theRNG().state = 1; // k-means seeding
+
+    int k = argc > 4 ? atoi(argv[4]) : 10;
+    int levels = argc > 5 ? atoi(argv[5]) : 5;
+    IDEAL_IMAGE_WIDTH = mfgSettings->getImageWidth();
+
+    QDir dir(argv[2]);
+    QStringList filters;
+    filters << "*.png" << "*.jpg" << "*.jpeg" << "*.bmp" << "*.pgm" << "*.ppm";
+    QStringList files = dir.entryList(filters, QDir::Files, QDir::Name);
+
+    if (files.isEmpty())
+    {
+        cerr << "no images in " << argv[2] << endl;
+        return 1;
+    }
+
+    vector<cv::Mat> imageDescs;
+    int numDescs = 0;
+
+    for (int i = 0; i < files.size(); ++i)
+    {
+        cv::Mat gray = cv::imread(dir.filePath(files[i]).toStdString(), 0);
+
+        if (gray.empty()) continue;
+
+        // same resolution as the tracked frames
+        if (IDEAL_IMAGE_WIDTH > 1 && gray.cols != IDEAL_IMAGE_WIDTH)
+        {
+            double scl = IDEAL_IMAGE_WIDTH / double(gray.cols);
+            cv::resize(gray, gray, cv::Size(), scl, scl, cv::INTER_AREA);
+        }
+
+        imageDescs.push_back(describe(gray));
+        numDescs += imageDescs.back().rows;
+        cout << "\r" << i + 1 << "/" << files.size() << " images, " << numDescs << " descriptors" << flush;
+    }
+
+    cout << endl;
+
+    MyTimer tm;
+    tm.start();
+    Vocabulary voc(k, levels);
+    voc.create(imageDescs);
+    tm.end();
+
+    cout << voc.size() << " words (k = " << k << ", " << levels << " levels) in " << tm.time_s << " s" << endl;
+
+    return voc.save(argv[3]) ? 0 : 1;
+}